@@ -90,6 +90,92 @@ static JSValueRef app_watchdog_function_trigger(
 	return NULL;
 }
 
+static JSObjectRef app_watchdog_stats_to_object(JSContextRef context,
+	const struct app_watchdog_stats *stats)
+{
+	JSObjectRef object = JSObjectMake(context, NULL, NULL);
+
+	javascript_object_set_property(context, object, "running",
+		JSValueMakeBoolean(context, stats->running),
+		kJSPropertyAttributeNone, NULL);
+	javascript_object_set_property(context, object, "triggers",
+		JSValueMakeNumber(context, stats->triggers),
+		kJSPropertyAttributeNone, NULL);
+	javascript_object_set_property(context, object, "coalesced",
+		JSValueMakeNumber(context, stats->coalesced),
+		kJSPropertyAttributeNone, NULL);
+	javascript_object_set_property(context, object, "pings",
+		JSValueMakeNumber(context, stats->pings),
+		kJSPropertyAttributeNone, NULL);
+	javascript_object_set_property(context, object, "failures",
+		JSValueMakeNumber(context, stats->failures),
+		kJSPropertyAttributeNone, NULL);
+	/* microseconds internally, milliseconds for JavaScript */
+	javascript_object_set_property(context, object, "latency",
+		JSValueMakeNumber(context, stats->latency_avg / 1000.0),
+		kJSPropertyAttributeNone, NULL);
+	javascript_object_set_property(context, object, "maxLatency",
+		JSValueMakeNumber(context, stats->latency_max / 1000.0),
+		kJSPropertyAttributeNone, NULL);
+	javascript_object_set_property(context, object, "maxGap",
+		JSValueMakeNumber(context, stats->gap_max / 1000.0),
+		kJSPropertyAttributeNone, NULL);
+
+	return object;
+}
+
+/*
+ * Usage: getStats()
+ *
+ * Returns the statistics of the pings triggered from JavaScript ("script")
+ * and of those triggered by the main loop heartbeat ("mainLoop"). If the
+ * script stops triggering while the heartbeat carries on, the hang is
+ * inside JavaScript rather than in the main loop.
+ */
+static JSValueRef app_watchdog_function_get_stats(
+	JSContextRef context, JSObjectRef function, JSObjectRef object,
+	size_t argc, const JSValueRef argv[], JSValueRef *exception)
+{
+	struct app_watchdog *watchdog = JSObjectGetPrivate(object);
+	struct app_watchdog_stats stats;
+	JSObjectRef result;
+	int ret;
+
+	if (!watchdog) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	result = JSObjectMake(context, NULL, NULL);
+
+	ret = app_watchdog_get_stats(watchdog, APP_WATCHDOG_CHANNEL_SCRIPT,
+			&stats);
+	if (ret < 0) {
+		javascript_set_exception_text(context, exception,
+			"Failed to get watchdog statistics");
+		return NULL;
+	}
+
+	javascript_object_set_property(context, result, "script",
+		app_watchdog_stats_to_object(context, &stats),
+		kJSPropertyAttributeNone, NULL);
+
+	ret = app_watchdog_get_stats(watchdog, APP_WATCHDOG_CHANNEL_MAIN_LOOP,
+			&stats);
+	if (ret < 0) {
+		javascript_set_exception_text(context, exception,
+			"Failed to get watchdog statistics");
+		return NULL;
+	}
+
+	javascript_object_set_property(context, result, "mainLoop",
+		app_watchdog_stats_to_object(context, &stats),
+		kJSPropertyAttributeNone, NULL);
+
+	return result;
+}
+
 static const JSStaticFunction app_watchdog_functions[] = {
 	{
 		.name = "start",
@@ -105,6 +191,11 @@ static const JSStaticFunction app_watchdog_functions[] = {
 		.name = "trigger",
 		.callAsFunction = app_watchdog_function_trigger,
 		.attributes = kJSPropertyAttributeNone,
+	},
+	{
+		.name = "getStats",
+		.callAsFunction = app_watchdog_function_get_stats,
+		.attributes = kJSPropertyAttributeNone,
 	}, {
 	}
 };
@@ -401,9 +401,54 @@ static const JSStaticValue audio_properties[] = {
 	{}
 };
 
+static JSValueRef js_audio_prepare(JSContextRef context,
+		JSObjectRef function, JSObjectRef object, size_t argc,
+		const JSValueRef argv[], JSValueRef *exception)
+{
+	struct audio *audio = JSObjectGetPrivate(object);
+	enum audio_state state;
+	int err;
+
+	if (!audio) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	if (argc != 1) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_ARG_COUNT);
+		return NULL;
+	}
+
+	err = javascript_enum_from_string(
+		context, audio_state_enum, argv[0], (int*)&state, exception);
+	if (err)
+		return NULL;
+
+	err = audio_prepare_state(audio, state);
+	if (err && err != -ENOSYS) {
+		javascript_set_exception_text(context, exception,
+			"failed to prepare audio state");
+		return NULL;
+	}
+
+	return JSValueMakeUndefined(context);
+}
+
+static const JSStaticFunction audio_functions[] = {
+	{ /* Prepares a state, e.g. when a call comes in */
+		.name = "prepare",
+		.callAsFunction = js_audio_prepare,
+		.attributes = kJSPropertyAttributeDontDelete,
+	},
+	{}
+};
+
 static const JSClassDefinition audio_classdef = {
 	.className = "Audio",
 	.staticValues = audio_properties,
+	.staticFunctions = audio_functions,
 };
 
 static JSObjectRef javascript_audio_create(
@@ -15,14 +15,28 @@
 
 #include "javascript.h"
 
+struct js_backlight {
+	struct backlight *backlight;
+	struct backlight_fader *fader;
+};
+
+#define BACKLIGHT_CURVE(v, n) { .value = BACKLIGHT_CURVE_##v, .name = n }
+
+static const struct javascript_enum backlight_curve_enum[] = {
+	BACKLIGHT_CURVE(LINEAR,		"linear"),
+	BACKLIGHT_CURVE(PERCEPTUAL,	"perceptual"),
+	BACKLIGHT_CURVE(SMOOTH,		"smooth"),
+	{}
+};
+
 static bool js_backlight_set_brightness(JSContextRef context, JSObjectRef object,
 		JSStringRef name, JSValueRef value, JSValueRef *exception)
 {
-	struct backlight *backlight = JSObjectGetPrivate(object);
+	struct js_backlight *priv = JSObjectGetPrivate(object);
 	int brightness;
 	int err;
 
-	if (!backlight) {
+	if (!priv) {
 		javascript_set_exception_text(context, exception,
 			JS_ERR_INVALID_OBJECT_TEXT);
 		return false;
@@ -34,7 +48,10 @@ static bool js_backlight_set_brightness(JSContextRef context, JSObjectRef object
 	if (err)
 		return false;
 
-	err = backlight_set(backlight, brightness);
+	/* setting the brightness directly ends any running fade */
+	backlight_fade_cancel(priv->fader);
+
+	err = backlight_set(priv->backlight, brightness);
 	if (err)
 		javascript_set_exception_text(context, exception,
 			"failed to set brightness");
@@ -45,16 +62,20 @@ static bool js_backlight_set_brightness(JSContextRef context, JSObjectRef object
 static JSValueRef js_backlight_get_brightness(JSContextRef context, JSObjectRef object,
 		JSStringRef name, JSValueRef *exception)
 {
-	struct backlight *backlight = JSObjectGetPrivate(object);
+	struct js_backlight *priv = JSObjectGetPrivate(object);
 	int brightness;
 
-	if (!backlight) {
+	if (!priv) {
 		javascript_set_exception_text(context, exception,
 			JS_ERR_INVALID_OBJECT_TEXT);
 		return NULL;
 	}
 
-	brightness = backlight_get(backlight);
+	/* don't compete with the fader for the device */
+	brightness = backlight_fade_get_brightness(priv->fader);
+	if (brightness < 0)
+		brightness = backlight_get(priv->backlight);
+
 	if (brightness < 0) {
 		javascript_set_exception_text(context, exception,
 			"failed to get brightness");
@@ -69,16 +90,19 @@ static bool js_backlight_set_enable(JSContextRef context,
 		JSObjectRef object, JSStringRef name, JSValueRef value,
 		JSValueRef *exception)
 {
-	struct backlight *backlight = JSObjectGetPrivate(object);
+	struct js_backlight *priv = JSObjectGetPrivate(object);
 	int err;
 
-	if (!backlight) {
+	if (!priv) {
 		javascript_set_exception_text(context, exception,
 			JS_ERR_INVALID_OBJECT_TEXT);
 		return false;
 	}
 
-	err = backlight_enable(backlight, JSValueToBoolean(context, value));
+	backlight_fade_cancel(priv->fader);
+
+	err = backlight_enable(priv->backlight,
+			JSValueToBoolean(context, value));
 	if (err)
 		javascript_set_exception_text(context, exception,
 			"failed to set backlight enable");
@@ -90,16 +114,16 @@ static bool js_backlight_set_enable(JSContextRef context,
 static JSValueRef js_backlight_get_enable(JSContextRef context,
 		JSObjectRef object, JSStringRef name, JSValueRef *exception)
 {
-	struct backlight *backlight = JSObjectGetPrivate(object);
+	struct js_backlight *priv = JSObjectGetPrivate(object);
 	int state;
 
-	if (!backlight) {
+	if (!priv) {
 		javascript_set_exception_text(context, exception,
 			JS_ERR_INVALID_OBJECT_TEXT);
 		return NULL;
 	}
 
-	state = backlight_is_enabled(backlight);
+	state = backlight_is_enabled(priv->backlight);
 	if (state < 0) {
 		javascript_set_exception_text(context, exception,
 			"failed to query backlight state");
@@ -125,9 +149,100 @@ static const JSStaticValue backlight_properties[] = {
 	{}
 };
 
+static JSValueRef js_backlight_fade(JSContextRef context,
+		JSObjectRef function, JSObjectRef object, size_t argc,
+		const JSValueRef argv[], JSValueRef *exception)
+{
+	struct js_backlight *priv = JSObjectGetPrivate(object);
+	int curve = BACKLIGHT_CURVE_PERCEPTUAL;
+	int brightness, duration;
+	int err;
+
+	if (!priv) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	if (argc < 2 || argc > 3) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_ARG_COUNT);
+		return NULL;
+	}
+
+	err = javascript_int_from_unit(context, argv[0], BACKLIGHT_MIN,
+			BACKLIGHT_MAX, &brightness, exception);
+	if (err)
+		return NULL;
+
+	err = javascript_int_from_number(context, argv[1], 0, G_MAXINT,
+			&duration, exception);
+	if (err)
+		return NULL;
+
+	if (argc > 2 && javascript_enum_from_string(context,
+			backlight_curve_enum, argv[2], &curve, exception))
+		return NULL;
+
+	err = backlight_fade(priv->fader, brightness, duration, curve);
+	if (err < 0) {
+		javascript_set_exception_text(context, exception,
+			"failed to start fade");
+		return NULL;
+	}
+
+	return JSValueMakeUndefined(context);
+}
+
+static JSValueRef js_backlight_cancel_fade(JSContextRef context,
+		JSObjectRef function, JSObjectRef object, size_t argc,
+		const JSValueRef argv[], JSValueRef *exception)
+{
+	struct js_backlight *priv = JSObjectGetPrivate(object);
+	int ret;
+
+	if (!priv) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	ret = backlight_fade_cancel(priv->fader);
+	if (ret < 0) {
+		javascript_set_exception_text(context, exception,
+			"failed to cancel fade");
+		return NULL;
+	}
+
+	return JSValueMakeBoolean(context, ret > 0);
+}
+
+static const JSStaticFunction backlight_functions[] = {
+	{ /* Fades to a brightness (0-1) over a duration in milliseconds */
+		.name = "fade",
+		.callAsFunction = js_backlight_fade,
+		.attributes = kJSPropertyAttributeDontDelete,
+	},
+	{ /* Stops a running fade at its current level */
+		.name = "cancelFade",
+		.callAsFunction = js_backlight_cancel_fade,
+		.attributes = kJSPropertyAttributeDontDelete,
+	},
+	{}
+};
+
+static void js_backlight_finalize(JSObjectRef object)
+{
+	struct js_backlight *priv = JSObjectGetPrivate(object);
+
+	g_free(priv);
+}
+
 static const JSClassDefinition backlight_classdef = {
 	.className = "Backlight",
 	.staticValues = backlight_properties,
+	.staticFunctions = backlight_functions,
+	.finalize = js_backlight_finalize,
 };
 
 static JSObjectRef javascript_backlight_create(
@@ -135,12 +250,20 @@ static JSObjectRef javascript_backlight_create(
 	struct javascript_userdata *user_data)
 {
 	struct backlight *backlight;
+	struct js_backlight *priv;
 
 	backlight = remote_control_get_backlight(user_data->rcd->rc);
 	if (!backlight)
 		return NULL;
 
-	return JSObjectMake(js, class, backlight);
+	priv = g_new0(struct js_backlight, 1);
+	if (!priv)
+		return NULL;
+
+	priv->backlight = backlight;
+	priv->fader = remote_control_get_backlight_fader(user_data->rcd->rc);
+
+	return JSObjectMake(js, class, priv);
 }
 
 struct javascript_module javascript_backlight = {
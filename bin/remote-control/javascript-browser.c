@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2017 Avionic Design GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <math.h>
+
+#include "javascript.h"
+
+/* milestones in milliseconds since the start of the navigation */
+static JSValueRef js_browser_make_milestone(JSContextRef context,
+		gint64 value)
+{
+	if (value < 0)
+		return JSValueMakeNull(context);
+
+	return JSValueMakeNumber(context, value / 1000.0);
+}
+
+static JSObjectRef js_browser_make_timeline(JSContextRef context,
+		const struct webkit_timeline *timeline, JSValueRef *exception)
+{
+	JSObjectRef object;
+	JSValueRef uri;
+
+	object = JSObjectMake(context, NULL, NULL);
+	if (!object)
+		return NULL;
+
+	if (timeline->uri) {
+		uri = javascript_make_string(context, timeline->uri,
+				exception);
+		if (!uri)
+			return NULL;
+	} else {
+		uri = JSValueMakeNull(context);
+	}
+
+	/* start in milliseconds, suitable for new Date() */
+	javascript_object_set_property(context, object, "sequence",
+		JSValueMakeNumber(context, timeline->sequence),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "uri", uri,
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "start",
+		JSValueMakeNumber(context, timeline->start / 1000.0),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "firstByte",
+		js_browser_make_milestone(context, timeline->first_byte),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "domContentLoaded",
+		js_browser_make_milestone(context, timeline->dom_loaded),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "loadFinished",
+		js_browser_make_milestone(context, timeline->finished),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "javascript",
+		js_browser_make_milestone(context, timeline->javascript),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "failed",
+		JSValueMakeBoolean(context, timeline->failed),
+		kJSPropertyAttributeReadOnly, NULL);
+
+	return object;
+}
+
+/*
+ * Returns the recorded page loads newer than the given sequence number,
+ * oldest first. The current page load is included while it is still in
+ * progress, with the milestones not reached yet set to null.
+ */
+static JSValueRef js_browser_get_timeline(JSContextRef context,
+		JSObjectRef function, JSObjectRef object, size_t argc,
+		const JSValueRef argv[], JSValueRef *exception)
+{
+	RemoteControlWebkitWindow *window = JSObjectGetPrivate(object);
+	struct webkit_timeline timeline[WEBKIT_TIMELINE_SIZE];
+	JSValueRef elements[WEBKIT_TIMELINE_SIZE];
+	guint64 since = 0;
+	double value;
+	guint count, i;
+
+	if (!window) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	if (argc > 1) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_ARG_COUNT);
+		return NULL;
+	}
+
+	if (argc == 1 && !JSValueIsUndefined(context, argv[0])) {
+		value = JSValueToNumber(context, argv[0], exception);
+		if (isnan(value) || value < 0) {
+			javascript_set_exception_text(context, exception,
+				"invalid sequence number");
+			return NULL;
+		}
+
+		since = value;
+	}
+
+	count = remote_control_webkit_window_get_timeline(window, since,
+			timeline, G_N_ELEMENTS(timeline));
+
+	for (i = 0; i < count; i++) {
+		elements[i] = js_browser_make_timeline(context, &timeline[i],
+				exception);
+		if (!elements[i])
+			return NULL;
+	}
+
+	return JSObjectMakeArray(context, count, elements, exception);
+}
+
+static const JSStaticFunction browser_functions[] = {
+	{
+		.name = "getTimeline",
+		.callAsFunction = js_browser_get_timeline,
+		.attributes = kJSPropertyAttributeDontDelete,
+	},
+	{}
+};
+
+static const JSClassDefinition browser_classdef = {
+	.className = "Browser",
+	.staticFunctions = browser_functions,
+};
+
+static JSObjectRef javascript_browser_create(JSContextRef js,
+		JSClassRef class, struct javascript_userdata *user_data)
+{
+	return JSObjectMake(js, class, user_data->window);
+}
+
+struct javascript_module javascript_browser = {
+	.classdef = &browser_classdef,
+	.create = javascript_browser_create,
+};
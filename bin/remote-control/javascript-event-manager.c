@@ -11,16 +11,19 @@
 #endif
 
 #include <errno.h>
+#include <math.h>
 
 #include "javascript.h"
 
+#define JS_EVENT_QUEUE_SIZE 32
+#define JS_EVENT_HISTORY_MAX 256
+
 struct js_event_manager {
-	GSource source;
 	struct event_manager *manager;
+	struct event_subscription *subscription;
 	JSContextRef context;
 	JSObjectRef callback;
 	JSObjectRef this;
-	GList *events;
 };
 
 #define SOURCE_ENUM(v, n) { .value = EVENT_SOURCE_##v, .name = n }
@@ -28,11 +31,13 @@ struct js_event_manager {
 static const struct javascript_enum event_manager_source_enum[] = {
 	SOURCE_ENUM(SMARTCARD, "smartcard"),
 	SOURCE_ENUM(HOOK, "hook"),
+	SOURCE_ENUM(USB_HANDSET, "usb-handset"),
+	SOURCE_ENUM(BACKLIGHT, "backlight"),
 	{}
 };
 
 static JSValueRef js_event_manager_get_event_state(JSContextRef context,
-		struct event *event)
+		const struct event *event)
 {
 	switch (event->source) {
 	case EVENT_SOURCE_SMARTCARD:
@@ -44,6 +49,7 @@ static JSValueRef js_event_manager_get_event_state(JSContextRef context,
 		default:
 			break;
 		}
+		break;
 	case EVENT_SOURCE_HOOK:
 		switch (event->hook.state) {
 		case EVENT_HOOK_STATE_OFF:
@@ -53,64 +59,47 @@ static JSValueRef js_event_manager_get_event_state(JSContextRef context,
 		default:
 			break;
 		}
-	default:
 		break;
-	}
-
-	return JSValueMakeUndefined(context);
-}
-
-int js_event_manager_event_cb(void *data, struct event *event)
-{
-	struct js_event_manager *priv = (struct js_event_manager *)data;
-	struct event *append;
-
-	if (!priv || !event)
-		return -EINVAL;
-
-	switch (event->source) {
-	case EVENT_SOURCE_SMARTCARD:
-	case EVENT_SOURCE_HOOK:
+	case EVENT_SOURCE_USB_HANDSET:
+		switch (event->usb_handset.state) {
+		case EVENT_USB_HANDSET_STATE_DISCONNECTED:
+			return JSValueMakeBoolean(context, false);
+		case EVENT_USB_HANDSET_STATE_CONNECTED:
+			return JSValueMakeBoolean(context, true);
+		default:
+			break;
+		}
+		break;
+	case EVENT_SOURCE_BACKLIGHT:
+		/* true if the fade reached its target */
+		switch (event->backlight.state) {
+		case EVENT_BACKLIGHT_STATE_FADE_CANCELLED:
+			return JSValueMakeBoolean(context, false);
+		case EVENT_BACKLIGHT_STATE_FADE_DONE:
+			return JSValueMakeBoolean(context, true);
+		default:
+			break;
+		}
 		break;
 	default:
-		return -ENXIO;
+		break;
 	}
 
-	append = (struct event *)g_memdup(event, sizeof(*event));
-	if (!append)
-		return -ENOMEM;
-
-	priv->events = g_list_append(priv->events, append);
-
-	return 0;
-}
-
-static gboolean js_event_manager_source_prepare(GSource *source, gint *timeout)
-{
-	if (timeout)
-		*timeout = 100;
-
-	return FALSE;
-}
-
-static gboolean js_event_manager_source_check(GSource *source)
-{
-	struct js_event_manager *priv = (struct js_event_manager *)source;
-	if (priv && g_list_first(priv->events))
-		return TRUE;
-
-	return FALSE;
+	return JSValueMakeUndefined(context);
 }
 
 static void js_event_manager_send_event(struct js_event_manager *priv,
-		struct event *event)
+		const struct event_record *record)
 {
 	JSValueRef exception = NULL;
-	JSValueRef args[2];
+	JSValueRef args[3];
 
 	args[0] = javascript_enum_to_string(priv->context,
-			event_manager_source_enum, event->source, &exception);
-	args[1] = js_event_manager_get_event_state(priv->context, event);
+			event_manager_source_enum, record->event.source,
+			&exception);
+	args[1] = js_event_manager_get_event_state(priv->context,
+			&record->event);
+	args[2] = JSValueMakeNumber(priv->context, record->sequence);
 
 	(void)JSObjectCallAsFunction(priv->context, priv->callback, priv->this,
 			G_N_ELEMENTS(args), args, &exception);
@@ -118,42 +107,16 @@ static void js_event_manager_send_event(struct js_event_manager *priv,
 		g_warning(JS_LOG_CALLBACK_EXCEPTION, __func__);
 }
 
-static gboolean js_event_manager_source_dispatch(GSource *source,
-		GSourceFunc callback, gpointer user_data)
-{
-	struct js_event_manager *priv = (struct js_event_manager *)source;
-	GList *node = priv ? g_list_first(priv->events) : NULL;
-	struct event *event = node ? node->data : NULL;
-
-	while (event) {
-		if (priv->context && priv->callback)
-			js_event_manager_send_event(priv, event);
-		priv->events = g_list_remove(priv->events, event);
-		g_free(event);
-		node = g_list_first(priv->events);
-		event = node ? node->data : NULL;
-	}
-
-	if (callback)
-		return callback(user_data);
-
-	return TRUE;
-}
-
-static void js_event_manager_source_finalize(GSource *source)
+/* delivered by the event manager into the main context of the page */
+static void js_event_manager_deliver(void *data,
+		const struct event_record *record)
 {
-	struct js_event_manager *priv = (struct js_event_manager *)source;
+	struct js_event_manager *priv = data;
 
-	g_list_free_full(priv->events, g_free);
+	if (priv->context && priv->callback)
+		js_event_manager_send_event(priv, record);
 }
 
-static GSourceFuncs js_event_manager_source_funcs = {
-	.prepare = js_event_manager_source_prepare,
-	.check = js_event_manager_source_check,
-	.dispatch = js_event_manager_source_dispatch,
-	.finalize = js_event_manager_source_finalize,
-};
-
 static JSValueRef js_event_manager_get_on_state_changed(JSContextRef context,
 		JSObjectRef object, JSStringRef name, JSValueRef *exception)
 {
@@ -184,12 +147,6 @@ static bool js_event_manager_set_on_state_changed(JSContextRef context,
 		JSValueUnprotect(context, priv->callback);
 
 	if (JSValueIsNull(context, value)) {
-		void *owner = event_manager_get_event_cb_owner(priv->manager,
-			js_event_manager_event_cb);
-
-		if ((void *)priv->context == owner) /* Only if we have set the callback */
-			event_manager_set_event_cb(priv->manager,
-					NULL, NULL, (void *)priv->context);
 		priv->callback = NULL;
 		return true;
 	}
@@ -202,14 +159,22 @@ static bool js_event_manager_set_on_state_changed(JSContextRef context,
 	}
 	JSValueProtect(context, priv->callback);
 
-	if (event_manager_set_event_cb(priv->manager, js_event_manager_event_cb,
-			priv, (void *)priv->context)) {
+	return true;
+}
+
+static JSValueRef js_event_manager_get_sequence(JSContextRef context,
+		JSObjectRef object, JSStringRef name, JSValueRef *exception)
+{
+	struct js_event_manager *priv = JSObjectGetPrivate(object);
+
+	if (!priv) {
 		javascript_set_exception_text(context, exception,
-			"failed to set state changed callback");
-		return false;
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
 	}
 
-	return true;
+	return JSValueMakeNumber(context,
+			event_manager_get_sequence(priv->manager));
 }
 
 static const JSStaticValue event_manager_properties[] = {
@@ -218,6 +183,11 @@ static const JSStaticValue event_manager_properties[] = {
 		.getProperty = js_event_manager_get_on_state_changed,
 		.setProperty = js_event_manager_set_on_state_changed,
 		.attributes = kJSPropertyAttributeNone,
+	}, {
+		.name = "sequence",
+		.getProperty = js_event_manager_get_sequence,
+		.attributes = kJSPropertyAttributeDontDelete |
+			kJSPropertyAttributeReadOnly,
 	}, {
 	}
 };
@@ -253,11 +223,125 @@ static JSValueRef event_manager_function_state(JSContextRef context,
 	return js_event_manager_get_event_state(context, &event);
 }
 
+static JSObjectRef js_event_manager_make_record(JSContextRef context,
+		const struct event_record *record, JSValueRef *exception)
+{
+	JSObjectRef object;
+	JSValueRef source;
+
+	source = javascript_enum_to_string(context, event_manager_source_enum,
+			record->event.source, exception);
+	if (!source)
+		return NULL;
+
+	object = JSObjectMake(context, NULL, NULL);
+	if (!object)
+		return NULL;
+
+	/* timestamp in milliseconds, suitable for new Date() */
+	javascript_object_set_property(context, object, "sequence",
+		JSValueMakeNumber(context, record->sequence),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "timestamp",
+		JSValueMakeNumber(context, record->timestamp / 1000.0),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "source", source,
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "state",
+		js_event_manager_get_event_state(context, &record->event),
+		kJSPropertyAttributeReadOnly, NULL);
+
+	return object;
+}
+
+/*
+ * Returns all recorded events newer than the given sequence number, so that
+ * a page can catch up on what happened while it was being (re)loaded. Events
+ * that have already dropped out of the history are lost, which shows as a
+ * gap in the sequence numbers.
+ */
+static JSValueRef event_manager_function_get_events(JSContextRef context,
+		JSObjectRef function, JSObjectRef object,
+		size_t argc, const JSValueRef argv[], JSValueRef *exception)
+{
+	struct js_event_manager *priv = JSObjectGetPrivate(object);
+	struct event_record *records;
+	JSValueRef *elements;
+	JSValueRef ret = NULL;
+	uint64_t since = 0;
+	unsigned int count = 0;
+	double value;
+	int err, i;
+
+	if (!priv) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	if (argc > 1) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_ARG_COUNT);
+		return NULL;
+	}
+
+	if (argc == 1 && !JSValueIsUndefined(context, argv[0])) {
+		value = JSValueToNumber(context, argv[0], exception);
+		if (isnan(value) || value < 0) {
+			javascript_set_exception_text(context, exception,
+				"invalid sequence number");
+			return NULL;
+		}
+
+		since = value;
+	}
+
+	records = g_new(struct event_record, JS_EVENT_HISTORY_MAX);
+	elements = g_new(JSValueRef, JS_EVENT_HISTORY_MAX);
+
+	err = event_manager_get_history(priv->manager, since, records,
+			JS_EVENT_HISTORY_MAX);
+	if (err < 0) {
+		javascript_set_exception_text(context, exception,
+			"failed to get event history");
+		goto out;
+	}
+
+	for (i = 0; i < err; i++) {
+		JSObjectRef record;
+
+		/* only the sources known to JavaScript are reported */
+		if (records[i].event.source != EVENT_SOURCE_SMARTCARD &&
+		    records[i].event.source != EVENT_SOURCE_HOOK &&
+		    records[i].event.source != EVENT_SOURCE_USB_HANDSET &&
+		    records[i].event.source != EVENT_SOURCE_BACKLIGHT)
+			continue;
+
+		record = js_event_manager_make_record(context, &records[i],
+				exception);
+		if (!record)
+			goto out;
+
+		elements[count++] = record;
+	}
+
+	ret = JSObjectMakeArray(context, count, elements, exception);
+
+out:
+	g_free(elements);
+	g_free(records);
+	return ret;
+}
+
 static const JSStaticFunction event_manager_functions[] = {
 	{
 		.name = "getState",
 		.callAsFunction = event_manager_function_state,
 		.attributes = kJSPropertyAttributeNone,
+	}, {
+		.name = "getEvents",
+		.callAsFunction = event_manager_function_get_events,
+		.attributes = kJSPropertyAttributeNone,
 	}, {
 	}
 };
@@ -272,16 +356,13 @@ static void event_manager_initialize(JSContextRef context, JSObjectRef object)
 static void event_manager_finalize(JSObjectRef object)
 {
 	struct js_event_manager *priv = JSObjectGetPrivate(object);
-	void *owner = event_manager_get_event_cb_owner(priv->manager,
-		js_event_manager_event_cb);
 
-	if (priv->callback) {
-		if ((void *)priv->context == owner) /* Only if we have set the callback */
-			event_manager_set_event_cb(priv->manager,
-					NULL, NULL, (void *)priv->context);
+	event_manager_unsubscribe(priv->manager, priv->subscription);
+
+	if (priv->callback)
 		JSValueUnprotect(priv->context, priv->callback);
-	}
-	g_source_destroy(&priv->source);
+
+	g_free(priv);
 }
 
 static const JSClassDefinition event_manager_classdef = {
@@ -296,18 +377,31 @@ static JSObjectRef javascript_event_manager_create( JSContextRef context,
 		JSClassRef class, struct javascript_userdata *user_data)
 {
 	struct js_event_manager *priv;
-	GSource *source;
+	int err;
 
-	source = g_source_new(&js_event_manager_source_funcs, sizeof(*priv));
-	priv = (struct js_event_manager *)source;
+	priv = g_new0(struct js_event_manager, 1);
 	if (!priv)
 		return NULL;
 
 	priv->context = context;
 	priv->manager = remote_control_get_event_manager(user_data->rcd->rc);
 
-	g_source_attach(source, g_main_loop_get_context(user_data->loop));
-	return JSObjectMake(context, class, source);
+	err = event_manager_subscribe(priv->manager,
+			EVENT_SOURCE_MASK(EVENT_SOURCE_SMARTCARD) |
+			EVENT_SOURCE_MASK(EVENT_SOURCE_HOOK) |
+			EVENT_SOURCE_MASK(EVENT_SOURCE_USB_HANDSET) |
+			EVENT_SOURCE_MASK(EVENT_SOURCE_BACKLIGHT),
+			JS_EVENT_QUEUE_SIZE,
+			g_main_loop_get_context(user_data->loop),
+			js_event_manager_deliver, priv, &priv->subscription);
+	if (err < 0) {
+		g_warning("%s: failed to subscribe to events: %s", __func__,
+			g_strerror(-err));
+		g_free(priv);
+		return NULL;
+	}
+
+	return JSObjectMake(context, class, priv);
 }
 
 struct javascript_module javascript_event_manager = {
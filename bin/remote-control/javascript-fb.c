@@ -19,6 +19,11 @@
 #include <fcntl.h>
 #include <errno.h>
 
+/*
+ * Text is drawn into a back buffer and only the bytes that differ from the
+ * shadow copy of the device contents get written out. Writes can be
+ * batched into a single frame with beginUpdate() and endUpdate().
+ */
 struct js_fb_data {
 	struct udev_match *match;
 	char *name;
@@ -27,12 +32,20 @@ struct js_fb_data {
 	int width;
 	int height;
 	int stride;
+
+	char *back;
+	char *shadow;
+	size_t size;
+	bool shadow_valid;
+	unsigned int batch;
 };
 
 #define JS_FB_MAX                       16
 #define JS_FB_CONFIG_GROUP              "framebuffer "
 #define JS_FB_CLEAR_CHAR                ' '
 #define JS_FB_WRITE_AGAIN_DELAY         100
+/* unchanged bytes rewritten rather than starting another write */
+#define JS_FB_SPAN_GAP                  16
 
 #define JS_FB_ERR_INVALID_FRAMEBUFFER   "framebuffer device not functional"
 #define JS_FB_ERR_FAILED_TO_SEEK        "failed to seek to position"
@@ -51,6 +64,44 @@ static void js_fb_reset_fb(struct js_fb_data *data)
 	data->width = 0;
 	data->height = 0;
 	data->stride = 0;
+	/* keep the back buffer, a frame is rewritten as a whole on reopen */
+	data->shadow_valid = false;
+}
+
+static int js_fb_alloc_buffers(struct js_fb_data *data)
+{
+	size_t size = data->stride * data->height;
+	ssize_t num;
+
+	if (data->back && data->size == size)
+		return 0;
+
+	g_free(data->back);
+	g_free(data->shadow);
+	data->size = 0;
+
+	data->back = g_try_malloc(size);
+	data->shadow = g_try_malloc(size);
+	if (!data->back || !data->shadow) {
+		g_free(data->back);
+		g_free(data->shadow);
+		data->back = data->shadow = NULL;
+		return -ENOMEM;
+	}
+
+	data->size = size;
+
+	/* start out with what is on the display */
+	num = pread(data->fd, data->back, size, 0);
+	if (num == size) {
+		memcpy(data->shadow, data->back, size);
+		data->shadow_valid = true;
+	} else {
+		memset(data->back, JS_FB_CLEAR_CHAR, size);
+		data->shadow_valid = false;
+	}
+
+	return 0;
 }
 
 static int js_fb_on_udev_found(gpointer user, GUdevDevice *dev)
@@ -114,34 +165,111 @@ static int js_fb_prepare_fb(struct js_fb_data *data)
 	data->height = vinfo.yres;
 	data->stride = finfo.line_length;
 
+	ret = js_fb_alloc_buffers(data);
+	if (ret < 0) {
+		g_warning("%s: Failed to allocate buffers for framebuffer %s",
+				__func__, data->name);
+		js_fb_reset_fb(data);
+		return ret;
+	}
+
 	return 0;
 }
 
-static int js_fb_write_text(struct js_fb_data *fb, int x, int y,
-		const char *text, JSContextRef context, JSValueRef *exception)
+static int js_fb_write_span(struct js_fb_data *fb, size_t start, size_t end)
 {
-	int ret, len = strlen(text);
+	ssize_t num;
 
-	ret = lseek(fb->fd, y * fb->stride + x, SEEK_SET);
-	if (-1 == ret) {
-		ret = -errno;
-		javascript_set_exception_text(context, exception,
-				JS_FB_ERR_FAILED_TO_SEEK);
-		js_fb_reset_fb(fb);
-		return ret;
+	while (start < end) {
+		num = pwrite(fb->fd, fb->back + start, end - start, start);
+		if (num <= 0)
+			return num < 0 ? -errno : -EIO;
+
+		memcpy(fb->shadow + start, fb->back + start, num);
+		start += num;
 	}
-	ret = write(fb->fd, text, len);
-	if (-1 == ret) {
-		ret = -errno;
+
+	return 0;
+}
+
+/*
+ * Write out everything that changed since the last flush. Changes close
+ * to each other are merged into a single write.
+ */
+static int js_fb_flush(struct js_fb_data *fb)
+{
+	size_t pos = 0, start, end;
+	int err;
+
+	if (!fb->shadow_valid) {
+		err = js_fb_write_span(fb, 0, fb->size);
+		if (err < 0)
+			return err;
+
+		fb->shadow_valid = true;
+		return 0;
+	}
+
+	while (pos < fb->size) {
+		while (pos < fb->size && fb->back[pos] == fb->shadow[pos])
+			pos++;
+
+		if (pos == fb->size)
+			break;
+
+		start = pos;
+		end = pos + 1;
+
+		for (pos = end; pos < fb->size && pos - end < JS_FB_SPAN_GAP;
+				pos++)
+			if (fb->back[pos] != fb->shadow[pos])
+				end = pos + 1;
+
+		err = js_fb_write_span(fb, start, end);
+		if (err < 0)
+			return err;
+
+		pos = end;
+	}
+
+	return 0;
+}
+
+static int js_fb_update(struct js_fb_data *fb, JSContextRef context,
+		JSValueRef *exception)
+{
+	int ret;
+
+	if (fb->batch)
+		return 0;
+
+	ret = js_fb_flush(fb);
+	if (ret < 0) {
 		javascript_set_exception_text(context, exception,
 				JS_FB_ERR_FAILED_TO_WRITE);
 		js_fb_reset_fb(fb);
-		return ret;
 	}
 
 	return ret;
 }
 
+static int js_fb_write_text(struct js_fb_data *fb, int x, int y,
+		const char *text, JSContextRef context, JSValueRef *exception)
+{
+	size_t offset = (size_t)y * fb->stride + x;
+	size_t len = strlen(text);
+
+	if (offset > fb->size || len > fb->size - offset) {
+		javascript_set_exception_text(context, exception,
+				JS_FB_ERR_FAILED_TO_SEEK);
+		return -EINVAL;
+	}
+
+	memcpy(fb->back + offset, text, len);
+
+	return len;
+}
+
 static int js_fb_check_object(JSContextRef context, struct js_fb_data *fb,
 		JSValueRef *exception)
 {
@@ -254,6 +382,9 @@ static JSValueRef js_fb_set_text(JSContextRef context, JSObjectRef function,
 		goto cleanup;
 	}
 
+	if (js_fb_update(fb, context, exception))
+		goto cleanup;
+
 	ret = JSValueMakeBoolean(context, TRUE);
 
 cleanup:
@@ -268,9 +399,7 @@ static JSValueRef js_fb_clear_text(JSContextRef context, JSObjectRef function,
 {
 	struct js_fb_data *fb = JSObjectGetPrivate(object);
 	JSValueRef ret = NULL;
-	bool failed = FALSE;
-	char *fill = NULL;
-	int count, i = 0;
+	int i;
 
 	if (js_fb_check_object(context, fb, exception))
 		goto cleanup;
@@ -282,33 +411,65 @@ static JSValueRef js_fb_clear_text(JSContextRef context, JSObjectRef function,
 		goto cleanup;
 	}
 
-	fill = g_strnfill(fb->width, JS_FB_CLEAR_CHAR);
-	if (!fill) {
-		javascript_set_exception_text(context, exception,
-				JS_FB_ERR_FAILED_TO_ALLOC);
-		goto cleanup;
-	}
+	for (i = 0; i < fb->height; i++)
+		memset(fb->back + i * fb->stride, JS_FB_CLEAR_CHAR,
+				MIN(fb->width, fb->stride));
 
-	while (i < fb->height) {
-		count = js_fb_write_text(fb, 0, i++, fill, context, exception);
-		if (count != fb->width)
-			failed = TRUE;
-		 /* If failed, keep on trying to clear remaining lines */
-	}
-	if (failed) {
-		javascript_set_exception_text(context, exception,
-				JS_FB_ERR_FAILED_TO_WRITE);
+	if (js_fb_update(fb, context, exception))
 		goto cleanup;
-	}
 
 	ret = JSValueMakeBoolean(context, TRUE);
 
 cleanup:
-	if (fill)
-		g_free(fill);
 	return ret;
 }
 
+static JSValueRef js_fb_begin_update(JSContextRef context,
+		JSObjectRef function, JSObjectRef object, size_t argc,
+		const JSValueRef argv[], JSValueRef *exception)
+{
+	struct js_fb_data *fb = JSObjectGetPrivate(object);
+
+	if (js_fb_check_object(context, fb, exception))
+		return NULL;
+
+	/* Usage beginUpdate(), defers writes until the matching endUpdate() */
+	if (argc != 0) {
+		javascript_set_exception_text(context, exception,
+				JS_ERR_INVALID_ARG_COUNT);
+		return NULL;
+	}
+
+	fb->batch++;
+
+	return JSValueMakeBoolean(context, TRUE);
+}
+
+static JSValueRef js_fb_end_update(JSContextRef context,
+		JSObjectRef function, JSObjectRef object, size_t argc,
+		const JSValueRef argv[], JSValueRef *exception)
+{
+	struct js_fb_data *fb = JSObjectGetPrivate(object);
+
+	if (js_fb_check_object(context, fb, exception))
+		return NULL;
+
+	/* Usage endUpdate() */
+	if (argc != 0) {
+		javascript_set_exception_text(context, exception,
+				JS_ERR_INVALID_ARG_COUNT);
+		return NULL;
+	}
+
+	if (fb->batch > 0)
+		fb->batch--;
+
+	if (js_fb_update(fb, context, exception))
+		return NULL;
+
+	return JSValueMakeBoolean(context, TRUE);
+}
+
 #define FB_BLANK(v, n) { .value = FB_BLANK_##v, .name = n }
 static const struct javascript_enum js_fb_blank_enum[] = {
 	FB_BLANK(UNBLANK, "unblank"),
@@ -372,6 +533,16 @@ static const JSStaticFunction js_fb_functions[] = {
 		.callAsFunction = js_fb_set_blank,
 		.attributes = kJSPropertyAttributeDontDelete,
 	},
+	{
+		.name = "beginUpdate",
+		.callAsFunction = js_fb_begin_update,
+		.attributes = kJSPropertyAttributeDontDelete,
+	},
+	{
+		.name = "endUpdate",
+		.callAsFunction = js_fb_end_update,
+		.attributes = kJSPropertyAttributeDontDelete,
+	},
 	{}
 };
 
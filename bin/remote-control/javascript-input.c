@@ -11,54 +11,45 @@
 #endif
 
 #include <errno.h>
-#include <fcntl.h>
-#include <unistd.h>
 #include <string.h>
 
 #include <linux/input.h>
 
-#include <gudev/gudev.h>
-
 #include "javascript.h"
-#include "find-device.h"
 
 #define MAX_INPUT_DEVICES 10
 #define INPUT_DEVICE_PREFIX  "device-"
 
-#define BITS_PER_LONG (sizeof(long) * 8)
-#define OFF(x) ((x) % BITS_PER_LONG)
-#define LONG(x) ((x) / BITS_PER_LONG)
-#define IS_BIT_SET(bit, array) ((array[LONG(bit)] >> OFF(bit)) & 1)
-
-struct device {
-	int vendorId;
-	int productId;
+struct alias {
 	gchar *name;
 	gchar *alias;
+};
+
+struct input;
 
-	GPollFD *poll;
+/* one per configured device name, the alias is reported with each event */
+struct input_watch {
+	struct input *input;
+	const struct alias *alias;
+	struct evdev_subscription *sub;
 };
 
 struct input {
-	GSource source;
+	struct input_watch *watches;
+	unsigned int num_watches;
+	/* present devices, as struct evdev_device */
 	GList *devices;
-	GUdevClient* udev_client;
 
 	JSContextRef context;
 	JSObjectRef callback;
 	JSObjectRef this;
 };
 
-struct alias {
-	gchar *name;
-	gchar *alias;
-};
-
 static struct alias *supported_devices = NULL;
 static int supported_devices_count = 0;
 
-static int input_report(struct input *input, struct device *device,
-		struct input_event *event)
+static int input_report(struct input *input, const struct alias *alias,
+		const struct input_event *event)
 {
 	JSValueRef exception = NULL;
 	JSValueRef args[5];
@@ -78,7 +69,7 @@ static int input_report(struct input *input, struct device *device,
 	args[2] = JSValueMakeNumber(input->context, event->code);
 	args[3] = JSValueMakeNumber(input->context, event->value);
 	args[4] = javascript_make_string(input->context,
-			device->alias ? device->alias : device->name, NULL);
+			alias->alias ? alias->alias : alias->name, NULL);
 
 	(void)JSObjectCallAsFunction(input->context, input->callback,
 			input->this, G_N_ELEMENTS(args), args, &exception);
@@ -89,235 +80,74 @@ static int input_report(struct input *input, struct device *device,
 	return 0;
 }
 
-static gboolean input_source_prepare(GSource *source, gint *timeout)
-{
-	if (timeout)
-		*timeout = -1;
-
-	return FALSE;
-}
-
-static gboolean input_source_check(GSource *source)
-{
-	struct input *input = (struct input *)source;
-	GList *node;
-
-	for (node = g_list_first(input->devices); node; node = node->next) {
-		struct device *device = node->data;
-		GPollFD *poll = device->poll;
-
-		if (poll->revents & (G_IO_IN | G_IO_ERR | G_IO_HUP))
-			return TRUE;
-	}
-
-	return FALSE;
-}
-
-static void free_poll(gpointer data)
-{
-	GPollFD *poll = data;
-	close(poll->fd);
-	g_free(poll);
-}
-
-static void free_device(gpointer data)
-{
-	struct device *device = data;
-	free_poll(device->poll);
-	g_free(device->name);
-	g_free(device->alias);
-	g_free(device);
-}
-
-static int input_remove_device(gpointer user, struct device *device)
-{
-	struct input *input = user;
-	GPollFD *poll;
-
-	g_return_val_if_fail(device != NULL, -EINVAL);
-	g_return_val_if_fail(input != NULL, -EINVAL);
-
-	poll = device->poll;
-	g_source_remove_poll((GSource*)input, poll);
-	input->devices = g_list_remove(input->devices, device);
-	free_device(device);
-
-	return 0;
-}
-
-static gboolean input_source_dispatch(GSource *source, GSourceFunc callback,
-		gpointer user_data)
-{
-	struct input *input = (struct input *)source;
-	GList *node, *next;
-
-	for (node = g_list_first(input->devices); node; node = next) {
-		struct device *device = node->data;
-		GPollFD *poll = device->poll;
-		struct input_event event;
-		ssize_t err;
-
-		next = node->next;
-		if (poll->revents & (G_IO_ERR | G_IO_HUP)) {
-			g_debug("js-input: input device error, closing device.");
-			input_remove_device(input, device);
-		} else if (poll->revents & G_IO_IN) {
-			err = read(poll->fd, &event, sizeof(event));
-			if (err < 0) {
-				g_debug("js-input: read(): %s", g_strerror(errno));
-				continue;
-			}
-
-			err = input_report(input, device, &event);
-			if (err < 0) {
-				if (err != -EFAULT)
-					g_warning("%s: %s", __func__, g_strerror(-err));
-				continue;
-			}
-		}
-	}
-
-	if (callback)
-		return callback(user_data);
-
-	return TRUE;
-}
-
-static void input_source_finalize(GSource *source)
-{
-	struct input *input = (struct input *)source;
-
-	if (input->udev_client)
-		g_object_unref(input->udev_client);
-
-	g_list_free_full(input->devices, free_device);
-}
-
-static GSourceFuncs input_source_funcs = {
-	.prepare = input_source_prepare,
-	.check = input_source_check,
-	.dispatch = input_source_dispatch,
-	.finalize = input_source_finalize,
-};
-
-static int input_add_device(gpointer user, const gchar *filename,
-		const gchar *name, int vendorId, int productId)
+static void input_event(void *data, struct evdev_device *device,
+		const struct input_event *event)
 {
-	const struct alias *supported_device;
-	struct input *input = user;
-	struct device *device;
-	GPollFD *poll;
-	int fd;
-
-	g_return_val_if_fail(input != NULL, -EINVAL);
-	g_return_val_if_fail(filename != NULL, -EINVAL);
-
-	fd = open(filename, O_RDONLY);
-	if (fd < 0)
-		return -errno;
-
-	device = g_new0(struct device, 1);
-	if (!device) {
-		close(fd);
-		return -ENOMEM;
-
-	}
-	poll = g_new0(GPollFD, 1);
-	if (!poll) {
-		close(fd);
-		g_free(device);
-		return -ENOMEM;
-	}
+	struct input_watch *watch = data;
+	int err;
 
-	poll->events = G_IO_IN | G_IO_HUP | G_IO_ERR;
-	poll->fd = fd;
-
-	device->poll = poll;
-	device->name = g_strdup(name);
-	device->vendorId = vendorId;
-	device->productId = productId;
-
-	for (supported_device = supported_devices;
-			supported_device->name != NULL; supported_device++) {
-		if (!g_strcmp0(name, supported_device->name)) {
-			device->alias = g_strdup(supported_device->alias);
-			break;
-		}
-	}
-
-	input->devices = g_list_append(input->devices, device);
-	g_source_add_poll((GSource *)input, poll);
-
-	return 0;
+	err = input_report(watch->input, watch->alias, event);
+	if (err < 0 && err != -EFAULT)
+		g_warning("%s: %s", __func__, g_strerror(-err));
 }
 
-static void input_on_udev_event(GUdevClient *client, gchar *action,
-			  GUdevDevice *udevice, gpointer user_data)
+static void input_presence(void *data, struct evdev_device *device,
+		bool present)
 {
-	struct input *input = user_data;
-	const struct alias *supported_device;
-	const char *filename;
-	GUdevDevice *parent;
-	const char *pname;
-	const char *name;
+	struct input_watch *watch = data;
+	struct input *input = watch->input;
 
-	if (g_strcmp0(action, "add"))
-		return;
-
-	name = g_udev_device_get_name(udevice);
-	if (!g_str_has_prefix(name, "event"))
-		return;
-
-	parent = g_udev_device_get_parent(udevice);
-	if (!parent)
-		return;
-
-	pname = g_udev_device_get_sysfs_attr(parent, "name");
-	for (supported_device = supported_devices; supported_device->name != NULL; supported_device++) {
-		g_debug("js-input: Check for device %s\n", supported_device->name);
-		if (!g_strcmp0(pname, supported_device->name)) {
-			filename = g_udev_device_get_device_file(udevice);
-			input_add_device(input, filename, pname,
-				g_udev_device_get_sysfs_attr_as_int(parent, "vendorId"),
-				g_udev_device_get_sysfs_attr_as_int(parent, "productId"));
-		}
-	}
+	g_debug("js-input: %s %s", watch->alias->name,
+		present ? "added" : "removed");
 
-	g_object_unref(parent);
-	g_debug("js-input: Device added %s (parent %s)\n", name, pname);
+	if (present)
+		input->devices = g_list_append(input->devices, device);
+	else
+		input->devices = g_list_remove(input->devices, device);
 }
 
-static GSource *input_source_new(JSContextRef context)
+static struct input *input_new(JSContextRef context)
 {
-	const gchar *const subsystems[] = { "input", NULL };
-	const struct alias *supported_device;
 	struct input *input;
-	GSource *source;
+	unsigned int i;
+	int err;
 
-	source = g_source_new(&input_source_funcs, sizeof(*input));
-	if (!source) {
+	input = g_new0(struct input, 1);
+	if (!input) {
 		g_debug("js-input: failed to allocate memory");
 		return NULL;
 	}
 
-	input = (struct input *)source;
 	input->context = context;
 	input->callback = NULL;
 	input->devices = NULL;
 
-	input->udev_client = g_udev_client_new(subsystems);
-	if (input->udev_client)
-		g_signal_connect(input->udev_client, "uevent",
-				 G_CALLBACK(input_on_udev_event), input);
-	else
-		g_warning("js-input: failed to create udev client");
-
-	for (supported_device = supported_devices; supported_device->name != NULL; supported_device++) {
-		if (find_input_devices(supported_device->name, input_add_device, input) < 1)
-			g_debug("js-input: no %s device found", supported_device->name);
+	input->watches = g_new0(struct input_watch, supported_devices_count);
+	input->num_watches = supported_devices_count;
+
+	for (i = 0; i < input->num_watches; i++) {
+		struct input_watch *watch = &input->watches[i];
+		guint found = g_list_length(input->devices);
+		struct evdev_filter filter = {
+			.device = supported_devices[i].name,
+			.event = input_event,
+			.presence = input_presence,
+			.data = watch,
+		};
+
+		watch->input = input;
+		watch->alias = &supported_devices[i];
+
+		err = evdev_subscribe(&filter, &watch->sub);
+		if (err < 0)
+			g_warning("js-input: failed to watch %s: %s",
+				  watch->alias->name, g_strerror(-err));
+		else if (g_list_length(input->devices) == found)
+			g_debug("js-input: no %s device found",
+				watch->alias->name);
 	}
 
-	return source;
+	return input;
 }
 
 static void input_initialize(JSContextRef context, JSObjectRef object)
@@ -331,10 +161,17 @@ static void input_finalize(JSObjectRef object)
 {
 	struct input *input = JSObjectGetPrivate(object);
 
+	unsigned int i;
+
 	if (input->callback)
 		JSValueUnprotect(input->context, input->callback);
 
-	g_source_destroy(&input->source);
+	for (i = 0; i < input->num_watches; i++)
+		evdev_unsubscribe(input->watches[i].sub);
+
+	g_list_free(input->devices);
+	g_free(input->watches);
+	g_free(input);
 }
 
 static JSValueRef input_get_onevent(JSContextRef context, JSObjectRef object,
@@ -437,9 +274,11 @@ static JSValueRef input_get_devices(JSContextRef context,
 
 	for (node = g_list_first(input->devices); node && i < MAX_INPUT_DEVICES;
 			node = node->next, i++) {
-		struct device *device = node->data;
+		struct evdev_device *device = node->data;
+		JSStringRef text;
 
-		JSStringRef text = JSStringCreateWithUTF8CString(device->name);
+		text = JSStringCreateWithUTF8CString(
+			evdev_device_get_name(device));
 		array_elements[i] = JSValueMakeString(context, text);
 		JSStringRelease(text);
 	}
@@ -533,13 +372,14 @@ static JSValueRef input_get_switch_state(
 {
 	struct input *input = JSObjectGetPrivate(object);
 
-	unsigned long bits[1];
+	struct evdev_device *found = NULL;
 	JSValueRef ret = NULL;
 	char *dev = NULL;
 	char *key = NULL;
-	int i, fd = -1;
 	int code;
+	int err;
 	GList *node;
+	int i;
 
 	if (argc != 2) { /* [Device alias|name], [Key name|code] */
 		javascript_set_exception_text(context, exception,
@@ -550,15 +390,33 @@ static JSValueRef input_get_switch_state(
 	dev = javascript_get_string(context, argv[0], exception);
 	key = javascript_get_string(context, argv[1], exception);
 
-	for (node = g_list_first(input->devices); node; node = node->next) {
-		struct device *device = node->data;
-		if (!g_strcmp0(dev, device->alias) ||
-		    !g_strcmp0(dev, device->name)) {
-			fd = device->poll->fd;
-			break;
+	for (i = 0; i < input->num_watches && !found; i++) {
+		struct input_watch *watch = &input->watches[i];
+
+		if (g_strcmp0(dev, watch->alias->alias) &&
+		    g_strcmp0(dev, watch->alias->name))
+			continue;
+
+		for (node = input->devices; node; node = node->next) {
+			const char *name = evdev_device_get_name(node->data);
+
+			if (!g_strcmp0(name, watch->alias->name)) {
+				found = node->data;
+				break;
+			}
 		}
 	}
-	if (-1 == fd) {
+
+	if (!found) {
+		for (node = input->devices; node; node = node->next) {
+			if (!g_strcmp0(dev, evdev_device_get_name(node->data))) {
+				found = node->data;
+				break;
+			}
+		}
+	}
+
+	if (!found) {
 		javascript_set_exception_text(context, exception,
 			"No valid device found");
 		goto cleanup;
@@ -568,21 +426,17 @@ static JSValueRef input_get_switch_state(
 		if (!g_strcmp0(key, input_event_codes[i].name))
 			break;
 	if (!input_event_codes[i].name) {
-		int err = javascript_int_from_number(
+		err = javascript_int_from_number(
 			context, argv[1], 0, UINT16_MAX, &code, exception);
 		if (err)
 			goto cleanup;
 	} else
 		code = (int)input_event_codes[i].code;
 
-
-	if (ioctl(fd, EVIOCGBIT(EV_SW, code + 1), bits) >= 0) {
-		if (IS_BIT_SET(code, bits)) {
-			ioctl(fd, EVIOCGSW(sizeof(bits)), bits);
-			ret = JSValueMakeNumber(context,
-					IS_BIT_SET(code, bits) ? 1 : 0);
-		}
-	}
+	/* the capabilities are cached, only the state needs an ioctl() */
+	err = evdev_device_get_switch(found, code);
+	if (err >= 0)
+		ret = JSValueMakeNumber(context, err);
 cleanup:
 	if (dev)
 		g_free(dev);
@@ -621,16 +475,13 @@ static const JSClassDefinition input_classdef = {
 static JSObjectRef javascript_input_create(
 	JSContextRef js, JSClassRef class, struct javascript_userdata *data)
 {
-	GSource *source;
+	struct input *input;
 
-	source = input_source_new(js);
-	if (!source)
+	input = input_new(js);
+	if (!input)
 		return NULL;
 
-	g_source_attach(source, g_main_loop_get_context(data->loop));
-	g_source_unref(source);
-
-	return JSObjectMake(js, class, source);
+	return JSObjectMake(js, class, input);
 }
 
 static int javascript_input_init(GKeyFile *config)
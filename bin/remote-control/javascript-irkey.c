@@ -22,6 +22,7 @@
 #include <unistd.h>
 
 #include "javascript.h"
+#include "javascript-serial.h"
 
 /*
  * TODO: Make this a configuration setting.
@@ -37,6 +38,9 @@
 #define HEADER_PROTOCOL_RC6     0x2
 #define HEADER_PROTOCOL_LG      0x3
 
+/* incomplete messages are dropped after this many milliseconds */
+#define IR_FRAME_GAP            100
+
 struct ir_message {
 	uint8_t header;
 	uint8_t reserved;
@@ -54,59 +58,14 @@ struct ir_message {
 };
 
 struct ir {
-	GSource source;
-	GPollFD *tty;
+	struct js_serial *serial;
 
 	JSContextRef context;
 	JSObjectRef callback;
 	JSObjectRef thisptr;
 };
 
-static ssize_t read_all(int fd, uint8_t *buffer, size_t count, ulong timeout)
-{
-	struct timeval to;
-	ssize_t pos = 0;
-	ssize_t num;
-
-	memset(&to, 0, sizeof(to));
-	to.tv_sec = timeout / 1000;
-	to.tv_usec = (timeout % 1000) * 1000;
-
-	while (pos < count) {
-		fd_set rfds;
-		int err;
-
-		FD_ZERO(&rfds);
-		FD_SET(fd, &rfds);
-
-		err = select(fd + 1, &rfds, NULL, NULL, &to);
-		if (err < 0) {
-			if (errno == EINTR)
-				continue;
-
-			return -errno;
-		}
-
-		if (err == 0)
-			return -ETIMEDOUT;
-
-		if (FD_ISSET(fd, &rfds)) {
-			num = read(fd, buffer + pos, count - pos);
-			if (num < 0) {
-				if (errno == EINTR)
-					continue;
-
-				return -errno;
-			}
-
-			pos += num;
-		}
-	}
-
-	return pos;
-}
-
-static int ir_report(struct ir *ir, struct ir_message *message)
+static int ir_report(struct ir *ir, const struct ir_message *message)
 {
 	JSValueRef exception = NULL;
 	JSValueRef arguments[1];
@@ -145,59 +104,22 @@ static int ir_report(struct ir *ir, struct ir_message *message)
 	return 0;
 }
 
-static gboolean ir_source_prepare(GSource *source, gint *timeout)
-{
-	if (timeout)
-		*timeout = -1;
-
-	return FALSE;
-}
-
-static gboolean ir_source_check(GSource *source)
-{
-	struct ir *ir = (struct ir *)source;
-	GPollFD *poll = ir->tty;
-
-	if (poll->revents & G_IO_IN)
-		return TRUE;
-
-	return FALSE;
-}
-
-static gboolean ir_source_dispatch(GSource *source, GSourceFunc callback,
-		gpointer user_data)
+/* the serial layer only hands out complete messages */
+static void ir_receive(void *data, const guint8 *frame, size_t length)
 {
-	struct ir *ir = (struct ir *)source;
-	struct ir_message *msg = NULL;
-	GPollFD *poll = ir->tty;
-	uint8_t buf[8]; /* messages are normaly 64bits */
+	const struct ir_message *msg = (const struct ir_message *)frame;
+	struct ir *ir = data;
 	uint8_t proto;
-	ssize_t got;
 	int err;
 
-	got = read_all(poll->fd, buf, sizeof(buf), 100);
-	if (got < 0) {
-		g_warning("js-irkey: read failed: %zd", got);
-		goto fail;
-	}
-
-	if (got != sizeof(struct ir_message)) {
-		g_warning("js-irkey: invalid length");
-		goto fail;
-	}
-
-	msg = (struct ir_message*)buf;
 	proto = (msg->header & HEADER_PROTOCOL_MASK) >> HEADER_PROTOCOL_SHIFT;
 
 	switch (proto) {
 	case HEADER_PROTOCOL_RC5:
 	case HEADER_PROTOCOL_LG:
 		err = ir_report(ir, msg);
-		if (err < 0) {
-			if (err != -EFAULT)
-				g_warning("%s: %s", __func__, g_strerror(-err));
-			goto fail;
-		}
+		if (err < 0 && err != -EFAULT)
+			g_warning("%s: %s", __func__, g_strerror(-err));
 		break;
 
 	default:
@@ -205,33 +127,8 @@ static gboolean ir_source_dispatch(GSource *source, GSourceFunc callback,
 			  msg->header);
 		break;
 	}
-
-fail:
-	if (callback)
-		return callback(user_data);
-
-	return TRUE;
-}
-
-static void ir_source_finalize(GSource *source)
-{
-	struct ir *ir = (struct ir *)source;
-
-	if (ir->tty) {
-		close(ir->tty->fd);
-		ir->tty->fd = 0;
-		g_free(ir->tty);
-		ir->tty = NULL;
-	}
 }
 
-static GSourceFuncs ir_source_funcs = {
-	.prepare = ir_source_prepare,
-	.check = ir_source_check,
-	.dispatch = ir_source_dispatch,
-	.finalize = ir_source_finalize,
-};
-
 static int open_tty(const char *tty, int *fd)
 {
 	struct termios attr;
@@ -273,44 +170,30 @@ static int open_tty(const char *tty, int *fd)
 	return 0;
 }
 
-static int ir_setup_poll(struct ir *ir, int fd)
-{
-	g_return_val_if_fail(ir != NULL, -EINVAL);
-	g_return_val_if_fail(fd != 0, -EINVAL);
-
-	ir->tty = g_new0(GPollFD, 1);
-	if (!ir->tty) {
-		close(fd);
-		return -ENOMEM;
-	}
-
-	ir->tty->events = G_IO_IN | G_IO_HUP | G_IO_ERR;
-	ir->tty->fd = fd;
-
-	g_source_add_poll((GSource *)ir, ir->tty);
-	return 0;
-}
-
-static GSource *ir_source_new(JSContextRef context)
+static struct ir *ir_new(JSContextRef context, GMainContext *main)
 {
 	static const char* ttys[] = {
 		DEFAULT_IR_PORT_VIBRANTE,
 		DEFAULT_IR_PORT_CHROMIUM
 	};
+	static const struct js_serial_config config = {
+		.delimiter = -1,
+		.frame_length = sizeof(struct ir_message),
+		.gap = IR_FRAME_GAP,
+		.trace = TRACE_SOURCE_IRKEY,
+	};
 
-	GSource *source;
 	struct ir *ir;
-	int fd = 0;
+	int fd = -1;
 	int ret;
 	int i;
 
-	source = g_source_new(&ir_source_funcs, sizeof(*ir));
-	if (!source) {
+	ir = g_new0(struct ir, 1);
+	if (!ir) {
 		g_warning("js-irkey: failed to allocate memory");
 		return NULL;
 	}
 
-	ir = (struct ir *)source;
 	ir->context = context;
 	ir->callback = NULL;
 
@@ -327,17 +210,23 @@ static GSource *ir_source_new(JSContextRef context)
 		break;
 	}
 
-	ret = ir_setup_poll(ir, fd);
+	if (fd < 0)
+		goto cleanup;
+
+	ret = js_serial_create(&ir->serial, fd, &config, main);
 	if (ret < 0) {
-		g_warning("js-irkey: failed to create polling fd: %s",
+		g_warning("js-irkey: failed to set up port: %s",
 			  g_strerror(-ret));
+		close(fd);
 		goto cleanup;
 	}
 
-	return source;
+	js_serial_set_receive_cb(ir->serial, ir_receive, ir);
+
+	return ir;
 
 cleanup:
-	g_source_unref(source);
+	g_free(ir);
 	return NULL;
 }
 
@@ -350,11 +239,45 @@ static void ir_initialize(JSContextRef context, JSObjectRef object)
 
 static void ir_finalize(JSObjectRef object)
 {
-	GSource *source = JSObjectGetPrivate(object);
+	struct ir *ir = JSObjectGetPrivate(object);
+
+	js_serial_free(ir->serial);
+	g_free(ir);
+}
+
+/*
+ * AvionicDesign.IR.getStats()
+ */
+static JSValueRef ir_function_get_stats(JSContextRef context,
+		JSObjectRef function, JSObjectRef object, size_t argc,
+		const JSValueRef argv[], JSValueRef *exception)
+{
+	struct ir *ir = JSObjectGetPrivate(object);
+
+	if (!ir) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	if (argc != 0) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_ARG_COUNT);
+		return NULL;
+	}
 
-	g_source_destroy(source);
+	return js_serial_stats_to_object(context, ir->serial);
 }
 
+static const JSStaticFunction ir_functions[] = {
+	{
+		.name = "getStats",
+		.callAsFunction = ir_function_get_stats,
+		.attributes = kJSPropertyAttributeNone,
+	}, {
+	}
+};
+
 static JSValueRef ir_get_onevent(JSContextRef context, JSObjectRef object,
 		JSStringRef name, JSValueRef *exception)
 {
@@ -401,21 +324,19 @@ static const JSClassDefinition ir_classdef = {
 	.initialize = ir_initialize,
 	.finalize = ir_finalize,
 	.staticValues = ir_properties,
+	.staticFunctions = ir_functions,
 };
 
 static JSObjectRef javascript_ir_create(
 	JSContextRef js, JSClassRef class, struct javascript_userdata *data)
 {
-	GSource *source;
+	struct ir *ir;
 
-	source = ir_source_new(js);
-	if (!source)
+	ir = ir_new(js, g_main_loop_get_context(data->loop));
+	if (!ir)
 		return NULL;
 
-	g_source_attach(source, g_main_loop_get_context(data->loop));
-	g_source_unref(source);
-
-	return JSObjectMake(js, class, source);
+	return JSObjectMake(js, class, ir);
 }
 
 struct javascript_module javascript_ir = {
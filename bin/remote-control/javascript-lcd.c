@@ -14,7 +14,6 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <sys/types.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -23,10 +22,11 @@
 #include <unistd.h>
 
 #include "javascript.h"
+#include "javascript-serial.h"
 
-#define DEFAULT_TIMEOUT        100
-#define DEFAULT_READ_TIMEOUT   DEFAULT_TIMEOUT
-#define DEFAULT_WRITE_TIMEOUT  DEFAULT_TIMEOUT
+/* responses have no common format, so a pause ends them */
+#define LCD_FRAME_GAP          20
+#define LCD_RESPONSE_TIMEOUT   500
 
 #define DEFAULT_LCD_PORT_CHROMIUM "/dev/ttyS1"
 
@@ -44,8 +44,7 @@ struct lcd_command {
 };
 
 struct lcd {
-	GSource source;
-	GPollFD *tty;
+	struct js_serial *serial;
 
 	JSContextRef context;
 	JSObjectRef receive_cb;
@@ -60,92 +59,6 @@ static const struct lcd_command lg_tv_commands[] = {
 	{ COMMAND_VOLUME_SET,    5, "kf 1 %02x\r" },
 };
 
-#ifdef DEBUG
-static void hexdump(uint8_t *buf, size_t len)
-{
-	const size_t rowsize = 16;
-	const uint8_t *ptr = buf;
-	FILE *fp = stdout;
-	size_t i, j;
-
-	for (j = 0; j < len; j += rowsize) {
-
-		for (i = 0; i < rowsize; i++) {
-			if ((j + i) < len)
-				fprintf(fp, "%s%02x", i ? " " : "", ptr[j + i]);
-			else
-				fprintf(fp, "%s  ", i ? " " : "");
-		}
-
-		fprintf(fp, " | ");
-
-		for (i = 0; i < rowsize; i++) {
-			if ((j + i) < len) {
-				if (isprint(ptr[j + i]))
-					fprintf(fp, "%c", ptr[j + i]);
-				else
-					fprintf(fp, ".");
-			} else {
-				fprintf(fp, " ");
-			}
-		}
-
-		fprintf(fp, " |\n");
-	}
-}
-#else
-#define hexdump(b,l)
-#endif
-
-static ssize_t read_all(int fd, uint8_t *buffer, size_t count, ulong timeout)
-{
-	struct timeval to;
-	ssize_t pos = 0;
-	ssize_t num;
-
-	memset(&to, 0, sizeof(to));
-	to.tv_sec = timeout / 1000;
-	to.tv_usec = (timeout % 1000) * 1000;
-
-	while (pos < count) {
-		fd_set rfds;
-		int err;
-
-		FD_ZERO(&rfds);
-		FD_SET(fd, &rfds);
-
-		err = select(fd + 1, &rfds, NULL, NULL, &to);
-		if (err < 0) {
-			if (errno == EINTR)
-				continue;
-
-			g_debug("   select failed: %d (%s)", errno, g_strerror(errno));
-			return -errno;
-		}
-
-		if (err == 0) {
-			g_debug("   timeout, read=%zu, count=%zu", pos, count);
-			if (pos > 0)
-				return pos;
-			return -ETIMEDOUT;
-		}
-
-		if (FD_ISSET(fd, &rfds)) {
-			num = read(fd, buffer + pos, count - pos);
-			if (num < 0) {
-				if (errno == EINTR)
-					continue;
-				g_debug("   read failed: %d (%s)", errno, g_strerror(errno));
-				return -errno;
-			}
-
-			pos += num;
-		}
-	}
-
-	return pos;
-}
-
 #ifdef CHECK_DATA
 static int parse_response(guint8 *buffer, guint length)
 {
@@ -161,7 +74,7 @@ static int parse_response(guint8 *buffer, guint length)
 }
 #endif
 
-static int lcd_report(struct lcd *lcd, uint8_t *data, int length)
+static int lcd_report(struct lcd *lcd, const uint8_t *data, int length)
 {
 	JSValueRef exception = NULL;
 	JSValueRef arguments[1];
@@ -172,8 +85,6 @@ static int lcd_report(struct lcd *lcd, uint8_t *data, int length)
 	g_return_val_if_fail(data != NULL, -EINVAL);
 	g_return_val_if_fail(length > 0, -EINVAL);
 
-	hexdump(data, length);
-
 	/* serial object has been used but callback has not been set */
 	if (lcd->receive_cb == NULL)
 		return 0;
@@ -196,74 +107,16 @@ static int lcd_report(struct lcd *lcd, uint8_t *data, int length)
 	return 0;
 }
 
-static gboolean lcd_source_prepare(GSource *source, gint *timeout)
+static void lcd_receive(void *data, const guint8 *frame, size_t length)
 {
-	if (timeout)
-		*timeout = -1;
-
-	return FALSE;
-}
-
-static gboolean lcd_source_check(GSource *source)
-{
-	struct lcd *lcd = (struct lcd *)source;
-	GPollFD *poll = lcd->tty;
-
-	if (poll->revents & G_IO_IN)
-		return TRUE;
-
-	return FALSE;
-}
-
-static gboolean lcd_source_dispatch(GSource *source, GSourceFunc callback,
-                                    gpointer user_data)
-{
-	struct lcd *lcd = (struct lcd *)source;
-	GPollFD *poll = lcd->tty;
-	guint8 buf[1024];
-	ssize_t got;
+	struct lcd *lcd = data;
 	int err;
 
-	got = read_all(poll->fd, buf, sizeof(buf), DEFAULT_READ_TIMEOUT);
-	if (got < 0) {
-		g_warning("%s: read failed: %zd", __func__, got);
-		goto fail;
-	}
-
-	err = lcd_report(lcd, buf, got);
-	if (err < 0) {
-		if (err != -EFAULT)
-			g_warning("%s: %s", __func__, g_strerror(-err));
-		goto fail;
-	}
-
-fail:
-	if (callback)
-		return callback(user_data);
-
-	return TRUE;
+	err = lcd_report(lcd, frame, length);
+	if (err < 0 && err != -EFAULT)
+		g_warning("%s: %s", __func__, g_strerror(-err));
 }
 
-static void lcd_source_finalize(GSource *source)
-{
-	struct lcd *lcd = (struct lcd *)source;
-
-	if (lcd->tty) {
-		g_warning("%s: closing device", __func__);
-		close(lcd->tty->fd);
-		lcd->tty->fd = 0;
-		g_free(lcd->tty);
-		lcd->tty = NULL;
-	}
-}
-
-static GSourceFuncs lcd_source_funcs = {
-	.prepare = lcd_source_prepare,
-	.check = lcd_source_check,
-	.dispatch = lcd_source_dispatch,
-	.finalize = lcd_source_finalize,
-};
-
 static int open_tty(const char *tty, int *fd)
 {
 	struct termios attr;
@@ -306,43 +159,29 @@ static int open_tty(const char *tty, int *fd)
 	return 0;
 }
 
-static int lcd_setup_poll(struct lcd *lcd, int fd)
-{
-	g_return_val_if_fail(lcd != NULL, -EINVAL);
-	g_return_val_if_fail(fd != 0, -EINVAL);
-
-	lcd->tty = g_new0(GPollFD, 1);
-	if (!lcd->tty) {
-		close(fd);
-		return -ENOMEM;
-	}
-
-	lcd->tty->events = G_IO_IN | G_IO_HUP | G_IO_ERR;
-	lcd->tty->fd = fd;
-
-	g_source_add_poll((GSource *)lcd, lcd->tty);
-	return 0;
-}
-
-static GSource *lcd_source_new(JSContextRef context)
+static struct lcd *lcd_new(JSContextRef context, GMainContext *main)
 {
 	static const char* ttys[] = {
 		DEFAULT_LCD_PORT_CHROMIUM
 	};
+	static const struct js_serial_config config = {
+		.delimiter = -1,
+		.gap = LCD_FRAME_GAP,
+		.timeout = LCD_RESPONSE_TIMEOUT,
+		.trace = TRACE_SOURCE_LCD,
+	};
 
-	GSource *source;
 	struct lcd *lcd;
-	int fd = 0;
+	int fd = -1;
 	int ret;
 	int i;
 
-	source = g_source_new(&lcd_source_funcs, sizeof(*lcd));
-	if (!source) {
+	lcd = g_new0(struct lcd, 1);
+	if (!lcd) {
 		g_warning("%s: failed to allocate memory", __func__);
 		return NULL;
 	}
 
-	lcd = (struct lcd *)source;
 	lcd->context = context;
 	lcd->receive_cb = NULL;
 
@@ -359,17 +198,23 @@ static GSource *lcd_source_new(JSContextRef context)
 		break;
 	}
 
-	ret = lcd_setup_poll(lcd, fd);
+	if (fd < 0)
+		goto cleanup;
+
+	ret = js_serial_create(&lcd->serial, fd, &config, main);
 	if (ret < 0) {
-		g_warning("%s: failed to create polling fd: %s",
+		g_warning("%s: failed to set up port: %s",
 			__func__, g_strerror(-ret));
+		close(fd);
 		goto cleanup;
 	}
 
-	return source;
+	js_serial_set_receive_cb(lcd->serial, lcd_receive, lcd);
+
+	return lcd;
 
 cleanup:
-	g_source_unref(source);
+	g_free(lcd);
 	return NULL;
 }
 
@@ -386,7 +231,8 @@ static void lcd_finalize(JSObjectRef object)
 	if (lcd->receive_cb)
 		JSValueUnprotect(lcd->context, lcd->receive_cb);
 
-	g_source_destroy(&lcd->source);
+	js_serial_free(lcd->serial);
+	g_free(lcd);
 }
 
 
@@ -405,10 +251,31 @@ static const struct lcd_command* lcd_find_command(struct lcd *lcd, int command)
 	return cmd;
 }
 
+/*
+ * Responses are matched to their commands by the serial layer, they are
+ * passed on to the page like everything else the display sends.
+ */
+static void lcd_command_done(void *data, int status, const guint8 *frame,
+			     size_t length)
+{
+	struct lcd *lcd = data;
+
+	if (status < 0) {
+		g_debug("%s(): %s", __func__, g_strerror(-status));
+		return;
+	}
+
+#ifdef CHECK_DATA
+	if (parse_response((guint8 *)frame, length) < 0)
+		g_debug("%s(): parse_response: EINVAL", __func__);
+#endif
+
+	lcd_receive(lcd, frame, length);
+}
+
 static int lcd_send_command(struct lcd *lcd, int command, int value)
 {
 	const struct lcd_command *cmd;
-	GPollFD *poll = lcd->tty;
 	guint8 *buf;
 	int len;
 	int ret;
@@ -426,26 +293,13 @@ static int lcd_send_command(struct lcd *lcd, int command, int value)
 	buf = g_alloca(len);
 	len = g_snprintf((char*)buf, len, cmd->cmd, value);
 
-	hexdump(buf, len);
-
-	ret = write(poll->fd, buf, len);
+	ret = js_serial_request(lcd->serial, buf, len, lcd_command_done, lcd);
 	if (ret < 0) {
-		g_debug("< %s(): write: EIO", __func__);
-		return -EIO;
+		g_debug("< %s(): js_serial_request: %s", __func__,
+			g_strerror(-ret));
+		return ret;
 	}
 
-#ifdef CHECK_DATA
-	ret = read_all(poll->fd, buf, cmd->length * 2, DEFAULT_READ_TIMEOUT);
-	if (ret < 0) {
-		g_debug("< %s(): read_all: EIO", __func__);
-		return -EIO;
-	}
-	ret = parse_response(buf, ret);
-	if (ret < 0) {
-		g_debug("< %s(): parse_response: EINVAL", __func__);
-		return -EINVAL;
-	}
-#endif
 	g_debug("< %s(): OK", __func__);
 	return 0;
 }
@@ -493,9 +347,8 @@ static JSValueRef lcd_function_send(JSContextRef context,
 	length = JSStringGetUTF8CString(string, command, length);
 	JSStringRelease(string);
 
-	hexdump(command, length);
-
-	ret = write(priv->tty->fd, command, length);
+	/* the length includes the terminating NUL */
+	ret = js_serial_send(priv->serial, command, length);
 	if (ret < 0) {
 		javascript_set_exception_text(context, exception,
 			"write failed");
@@ -595,6 +448,32 @@ static JSValueRef lcd_function_mute(JSContextRef context,
 	return JSValueMakeBoolean(context, TRUE);
 }
 
+/*
+ * AvionicDesign.LCD.getStats()
+ */
+static JSValueRef lcd_function_get_stats(JSContextRef context,
+                                         JSObjectRef function,
+                                         JSObjectRef object,
+                                         size_t argc, const JSValueRef argv[],
+                                         JSValueRef *exception)
+{
+	struct lcd *lcd = JSObjectGetPrivate(object);
+
+	if (!lcd) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	if (argc != 0) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_ARG_COUNT);
+		return NULL;
+	}
+
+	return js_serial_stats_to_object(context, lcd->serial);
+}
+
 static const JSStaticFunction lcd_functions[] = {
 	{
 		.name = "send",
@@ -608,6 +487,10 @@ static const JSStaticFunction lcd_functions[] = {
 		.name = "mute",
 		.callAsFunction = lcd_function_mute,
 		.attributes = kJSPropertyAttributeNone,
+	}, {
+		.name = "getStats",
+		.callAsFunction = lcd_function_get_stats,
+		.attributes = kJSPropertyAttributeNone,
 	}, {
 	}
 
@@ -675,16 +558,13 @@ static const JSClassDefinition lcd_classdef = {
 static JSObjectRef javascript_lcd_create(
 	JSContextRef js, JSClassRef class, struct javascript_userdata *data)
 {
-	GSource *source;
+	struct lcd *lcd;
 
-	source = lcd_source_new(js);
-	if (!source)
+	lcd = lcd_new(js, g_main_loop_get_context(data->loop));
+	if (!lcd)
 		return NULL;
 
-	g_source_attach(source, g_main_loop_get_context(data->loop));
-	g_source_unref(source);
-
-	return JSObjectMake(js, class, source);
+	return JSObjectMake(js, class, lcd);
 }
 
 struct javascript_module javascript_lcd = {
@@ -16,10 +16,16 @@
 
 #include "javascript.h"
 
-static JSValueRef js_lldp_get_info(JSContextRef js, JSObjectRef object,
-		JSStringRef name, JSValueRef *exception)
+struct js_lldp {
+	struct lldp_monitor *lldp;
+	JSContextRef context;
+	JSObjectRef callback;
+	JSObjectRef this;
+};
+
+static JSValueRef js_lldp_make_info(JSContextRef js,
+		struct lldp_monitor *lldp, JSValueRef *exception)
 {
-	struct lldp_monitor *lldp = JSObjectGetPrivate(object);
 	GHashTableIter iter;
 	GHashTable *info;
 	JSObjectRef ret;
@@ -27,7 +33,8 @@ static JSValueRef js_lldp_get_info(JSContextRef js, JSObjectRef object,
 	int err;
 
 	if ((err = lldp_monitor_read_info(lldp, &info)) < 0) {
-		*exception = JSValueMakeNumber(js, err);
+		if (exception)
+			*exception = JSValueMakeNumber(js, err);
 		return NULL;
 	}
 
@@ -47,12 +54,99 @@ static JSValueRef js_lldp_get_info(JSContextRef js, JSObjectRef object,
 	return ret;
 }
 
+static JSValueRef js_lldp_get_info(JSContextRef js, JSObjectRef object,
+		JSStringRef name, JSValueRef *exception)
+{
+	struct js_lldp *priv = JSObjectGetPrivate(object);
+
+	if (!priv) {
+		javascript_set_exception_text(js, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	return js_lldp_make_info(js, priv->lldp, exception);
+}
+
+/* pushed by the monitor, so that pages don't need to poll the info */
+static void js_lldp_changed(void *data)
+{
+	struct js_lldp *priv = data;
+	JSValueRef exception = NULL;
+	JSValueRef args[1];
+
+	if (!priv->callback)
+		return;
+
+	args[0] = js_lldp_make_info(priv->context, priv->lldp, NULL);
+	if (!args[0])
+		args[0] = JSValueMakeNull(priv->context);
+
+	(void)JSObjectCallAsFunction(priv->context, priv->callback,
+			priv->this, G_N_ELEMENTS(args), args, &exception);
+	if (exception)
+		g_warning(JS_LOG_CALLBACK_EXCEPTION, __func__);
+}
+
+static JSValueRef js_lldp_get_on_neighbors_changed(JSContextRef js,
+		JSObjectRef object, JSStringRef name, JSValueRef *exception)
+{
+	struct js_lldp *priv = JSObjectGetPrivate(object);
+
+	if (!priv) {
+		javascript_set_exception_text(js, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	return priv->callback ? priv->callback : JSValueMakeNull(js);
+}
+
+static bool js_lldp_set_on_neighbors_changed(JSContextRef js,
+		JSObjectRef object, JSStringRef name, JSValueRef value,
+		JSValueRef *exception)
+{
+	struct js_lldp *priv = JSObjectGetPrivate(object);
+
+	if (!priv) {
+		javascript_set_exception_text(js, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return false;
+	}
+
+	if (priv->callback)
+		JSValueUnprotect(js, priv->callback);
+
+	if (JSValueIsNull(js, value)) {
+		priv->callback = NULL;
+		return true;
+	}
+
+	priv->callback = JSValueToObject(js, value, exception);
+	if (!priv->callback) {
+		javascript_set_exception_text(js, exception,
+			"failed to set on neighbors changed");
+		return false;
+	}
+	JSValueProtect(js, priv->callback);
+
+	/* the most recently loaded page gets the notifications */
+	lldp_monitor_set_changed_cb(priv->lldp, js_lldp_changed, priv);
+
+	return true;
+}
+
 static const JSStaticValue lldp_properties[] = {
 	{
 		.name = "info",
 		.getProperty = js_lldp_get_info,
 		.attributes = kJSPropertyAttributeDontDelete |
 			kJSPropertyAttributeReadOnly,
+	}, {
+		.name = "onNeighborsChanged",
+		.getProperty = js_lldp_get_on_neighbors_changed,
+		.setProperty = js_lldp_set_on_neighbors_changed,
+		.attributes = kJSPropertyAttributeNone,
 	},
 	{}
 };
@@ -61,13 +155,13 @@ static JSValueRef js_lldp_read(JSContextRef js, JSObjectRef function,
 		JSObjectRef object, size_t argc, const JSValueRef argv[],
 		JSValueRef *exception)
 {
-	struct lldp_monitor *lldp = JSObjectGetPrivate(object);
+	struct js_lldp *priv = JSObjectGetPrivate(object);
 	int size = LLDP_MAX_SIZE;
 	JSValueRef array;
 	char *data;
 	int err;
 
-	if (!lldp) {
+	if (!priv) {
 		javascript_set_exception_text(js, exception,
 			JS_ERR_INVALID_OBJECT_TEXT);
 		return JSValueMakeNull(js);
@@ -94,8 +188,8 @@ static JSValueRef js_lldp_read(JSContextRef js, JSObjectRef function,
 		return JSValueMakeNull(js);
 	}
 
-	g_debug("lldp_monitor_read(%p, %p, %d)", lldp, data, size);
-	err = lldp_monitor_read(lldp, data, size);
+	g_debug("lldp_monitor_read(%p, %p, %d)", priv->lldp, data, size);
+	err = lldp_monitor_read(priv->lldp, data, size);
 	if (err < 0) {
 		g_free(data);
 		javascript_set_exception_text(js, exception,
@@ -118,8 +212,30 @@ static const JSStaticFunction lldp_functions[] = {
 	}
 };
 
+static void lldp_initialize(JSContextRef js, JSObjectRef object)
+{
+	struct js_lldp *priv = JSObjectGetPrivate(object);
+
+	priv->this = object;
+}
+
+static void lldp_finalize(JSObjectRef object)
+{
+	struct js_lldp *priv = JSObjectGetPrivate(object);
+
+	if (lldp_monitor_get_changed_cb_data(priv->lldp) == priv)
+		lldp_monitor_set_changed_cb(priv->lldp, NULL, NULL);
+
+	if (priv->callback)
+		JSValueUnprotect(priv->context, priv->callback);
+
+	g_free(priv);
+}
+
 static const JSClassDefinition lldp_classdef = {
 	.className = "LLDP",
+	.initialize = lldp_initialize,
+	.finalize = lldp_finalize,
 	.staticValues = lldp_properties,
 	.staticFunctions = lldp_functions,
 };
@@ -128,6 +244,7 @@ static JSObjectRef javascript_lldp_create(JSContextRef js, JSClassRef class,
 		struct javascript_userdata *user_data)
 {
 	struct lldp_monitor *lldp;
+	struct js_lldp *priv;
 
 	if (!user_data->rcd || !user_data->rcd->rc)
 		return NULL;
@@ -136,7 +253,14 @@ static JSObjectRef javascript_lldp_create(JSContextRef js, JSClassRef class,
 	if (!lldp)
 		return NULL;
 
-	return JSObjectMake(js, class, lldp);
+	priv = g_new0(struct js_lldp, 1);
+	if (!priv)
+		return NULL;
+
+	priv->lldp = lldp;
+	priv->context = js;
+
+	return JSObjectMake(js, class, priv);
 }
 
 struct javascript_module javascript_lldp = {
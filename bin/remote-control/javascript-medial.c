@@ -302,6 +302,14 @@ static int mmsg_get_type(uint8_t *data, size_t len)
 	return (data[23] - 0x30) << 4 | (data[24] - 0x30);
 }
 
+static ssize_t medial_send(struct net_udp_channel *channel, const void *data,
+		size_t size)
+{
+	trace_record(TRACE_SOURCE_MEDIAL, TRACE_DIRECTION_OUT, data, size);
+
+	return net_udp_send(channel, data, size);
+}
+
 static JSValueRef jsstring_from_response(JSContextRef js, uint8_t byte,
 		JSValueRef *exception)
 {
@@ -350,6 +358,8 @@ static void js_medial_digest_packet(struct js_medial *jsdg,
 		return;
 	}
 
+	trace_record(TRACE_SOURCE_MEDIAL, TRACE_DIRECTION_IN, data, size);
+
 	if (size < MIN_MSG_LEN) {
 		g_warning("%s: impossible message length: %d", __func__, size);
 		g_free(data);
@@ -738,7 +748,7 @@ static JSValueRef medial_function_register(JSContextRef js,
 	mmsg_init_powerup_message(jsdg->medial, &data);
 	mmsg_send_header_preproc(&data.header);
 
-	ret = net_udp_send(channel, (uint8_t *)&data, sizeof(data));
+	ret = medial_send(channel, &data, sizeof(data));
 	if (ret < 0) {
 		javascript_set_exception_text(js, exception,
 			"failed to send 'powerup' message: %d", ret);
@@ -793,7 +803,7 @@ static JSValueRef medial_function_login(JSContextRef js,
 	mmsg_init_card_message(jsdg->medial, &data);
 	mmsg_send_header_preproc(&data.header);
 
-	ret = net_udp_send(channel, (uint8_t *)&data, sizeof(data));
+	ret = medial_send(channel, &data, sizeof(data));
 	if (ret < 0) {
 		javascript_set_exception_text(js, exception,
 			"failed to send 'card' message: %d", ret);
@@ -850,7 +860,7 @@ static JSValueRef medial_function_logout(JSContextRef js,
 	mmsg_init_card_message(jsdg->medial, &data);
 	mmsg_send_header_preproc(&data.header);
 
-	ret = net_udp_send(channel, (uint8_t *)&data, sizeof(data));
+	ret = medial_send(channel, &data, sizeof(data));
 	if (ret < 0) {
 		javascript_set_exception_text(js, exception,
 			"failed to send 'card' message: %d", ret);
@@ -13,13 +13,9 @@
 #include <errno.h>
 #include <math.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 
 #include <linux/input.h>
 
-#include "find-device.h"
 #include "javascript.h"
 #include "javascript-output.h"
 
@@ -27,6 +23,9 @@ struct js_output {
 	char *path;
 	char *name;
 	int code;
+
+	/* keeps the device open in the shared evdev layer */
+	struct evdev_subscription *sub;
 };
 
 static const struct {
@@ -52,81 +51,47 @@ static int get_led_code(const char *name)
 	return -ENOENT;
 }
 
-static int js_output_hid_led_set(struct js_output *out, double value)
+/* the device name takes precedence over the path, as it did before */
+static const char *js_output_hid_led_device(struct js_output *out)
 {
-	struct input_event ev = {};
-	int err;
-	int fd;
-
-	if (!out->path)
-		return -ENODEV;
-
-	fd = open(out->path, O_WRONLY);
-	if (fd < 0)
-		return -errno;
-
-	ev.type = EV_LED;
-	ev.code = out->code;
-	ev.value = value > 0;
-
-	err = write(fd, &ev, sizeof(ev));
-	close(fd);
-
-	return err < 0 ? -errno : 0;
+	return out->name ? out->name : out->path;
 }
 
-static int js_output_hid_led_get(struct js_output *out, double *valuep)
+static int js_output_hid_led_set(struct js_output *out, double value)
 {
-	uint8_t leds[16] = {};
-	int err;
-	int fd;
-
-	if (!out->path)
-		return -ENODEV;
-
-	if (out->code / 8 >= sizeof(leds)) {
-		g_critical("%s: Output %s has a too large LED code",
-			__func__, out->name ? out->name : out->path);
-		return -EINVAL;
-	}
-
-	fd = open(out->path, O_RDONLY);
-	if (fd < 0)
-		return -errno;
-
-	err = ioctl(fd, EVIOCGLED(sizeof(leds)), leds);
-	if (err > 0)
-		*valuep = (leds[out->code >> 3] >> (out->code & 7)) & 1;
-	close(fd);
-	return err < 0 ? -errno : 0;
+	return evdev_set_led(js_output_hid_led_device(out), out->code,
+		value > 0);
 }
 
-static int on_input_device_found(gpointer user, const gchar *filename,
-				const gchar *name, const int vendorId,
-				const int productId)
+static int js_output_hid_led_get(struct js_output *out, double *valuep)
 {
-	struct js_output *out = user;
+	int ret;
 
-	/* Skip other devices once we got one */
-	if (!out->path)
-		out->path = g_strdup(filename);
+	ret = evdev_get_led(js_output_hid_led_device(out), out->code);
+	if (ret < 0)
+		return ret;
+
+	*valuep = ret;
 	return 0;
 }
 
 static int js_output_hid_led_prepare(struct js_output *out)
 {
+	struct evdev_filter filter = {
+		.device = js_output_hid_led_device(out),
+		.types = 1UL << EV_LED,
+	};
 	int err;
 
-	if (!out->name)
+	if (out->sub)
 		return 0;
 
-	if (out->path) {
-		g_free(out->path);
-		out->path = NULL;
-	}
+	err = evdev_subscribe(&filter, &out->sub);
+	if (err < 0)
+		return err;
 
-	err = find_input_devices(out->name, on_input_device_found, out);
-	return err == 0 ? -ENOENT : err;
+	/* check that the device is there, devices added later show up */
+	return evdev_get_led(filter.device, out->code) < 0 ? -ENOENT : 0;
 }
 
 static int js_output_hid_led_create(
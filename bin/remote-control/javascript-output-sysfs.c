@@ -14,6 +14,7 @@
 #include <math.h>
 
 #include "find-device.h"
+#include "gsysfs.h"
 #include "javascript.h"
 #include "javascript-output.h"
 
@@ -22,20 +23,31 @@ struct js_output {
 	struct udev_match *udev_match;
 	char *attr;
 	double min, max;
+	/*
+	 * Outputs are usually driven at a high rate from JavaScript, so the
+	 * attribute is kept open between accesses.
+	 */
+	GSysfsAttribute *attribute;
 };
 
+static GSysfsAttribute *js_output_sysfs_get_attribute(struct js_output *out)
+{
+	if (!out->attribute && out->path)
+		out->attribute = g_sysfs_attribute_new_for_path(out->path);
+
+	return out->attribute;
+}
+
 static int js_output_sysfs_set(struct js_output *out, double value)
 {
-	int ival, err;
-	FILE *fd;
+	GSysfsAttribute *attribute;
+	GError *error = NULL;
+	int ival;
 
-	if (!out->path)
+	attribute = js_output_sysfs_get_attribute(out);
+	if (!attribute)
 		return -ENODEV;
 
-	fd = fopen(out->path, "w");
-	if (fd == NULL)
-		return -errno;
-
 	if (value < out->min)
 		ival = out->min;
 	else if (value > out->max)
@@ -43,32 +55,33 @@ static int js_output_sysfs_set(struct js_output *out, double value)
 	else
 		ival = value;
 
-	err = fprintf(fd, "%d", ival);
-	fclose(fd);
+	if (!g_sysfs_attribute_write_int(attribute, ival, &error)) {
+		g_debug("%s: %s", __func__, error->message);
+		g_error_free(error);
+		return -EIO;
+	}
 
-	return err < 0 ? -errno : 0;
+	return 0;
 }
 
 static int js_output_sysfs_get(struct js_output *out, double *valuep)
 {
-	int ival, err;
-	FILE *fd;
+	GSysfsAttribute *attribute;
+	GError *error = NULL;
+	gint value;
 
-	if (!out->path)
+	attribute = js_output_sysfs_get_attribute(out);
+	if (!attribute)
 		return -ENODEV;
 
-	fd = fopen(out->path, "r");
-	if (fd == NULL)
-		return -errno;
-
-	err = fscanf(fd, "%d", &ival);
-	fclose(fd);
-
-	if (err > 0) {
-		*valuep = ival;
-		return 0;
+	if (!g_sysfs_attribute_read_int(attribute, &value, &error)) {
+		g_debug("%s: %s", __func__, error->message);
+		g_error_free(error);
+		return -EIO;
 	}
-	return err < 0 ? -errno : -EIO;
+
+	*valuep = value;
+	return 0;
 }
 
 static int on_output_device_found(gpointer user, GUdevDevice *dev)
@@ -92,6 +105,8 @@ static int js_output_sysfs_prepare(struct js_output *out)
 		return 0;
 
 	if (out->path) {
+		g_sysfs_attribute_free(out->attribute);
+		out->attribute = NULL;
 		g_free(out->path);
 		out->path = NULL;
 	}
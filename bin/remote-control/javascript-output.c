@@ -12,7 +12,11 @@
 
 #include <errno.h>
 #include <math.h>
+#include <poll.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #include "find-device.h"
 #include "javascript.h"
@@ -20,19 +24,59 @@
 
 #define MAX_OUTPUT_CHANNELS 16
 
-struct js_output_channel_set {
+/* steps executed later than this are counted as missed deadlines */
+#define OUTPUT_DEADLINE_SLACK 2000 /* us */
+
+struct js_output_step {
 	double value;
-	unsigned duration;
+	unsigned duration; /* ms */
+};
+
+/*
+ * A pattern steps through its values on absolute deadlines, so a late
+ * step doesn't shift the ones following it. Several patterns can be
+ * active on a channel, the one with the highest priority drives it.
+ */
+struct js_output_pattern {
+	struct js_output_step *steps;
+	unsigned count;
+	unsigned total; /* ms, sum of all step durations */
+	int pos; /* -1 until the first step has been executed */
+	int repeat; /* remaining repetitions, -1 for endless */
+	int priority;
+	gint64 deadline; /* us, end of the current step */
+	bool stepped;
+};
+
+struct js_output_stats {
+	guint64 steps;
+	guint64 missed;
+	gint64 max_lateness; /* us */
 };
 
 struct js_output_channel {
 	const struct js_output_type *type;
 	char *name;
 	struct js_output *output;
-	struct js_output_channel_set *set;
-	unsigned set_count;
-	unsigned set_pos;
-	guint timeout_id;
+
+	/* serializes output access between JS and the sequencer */
+	GMutex lock;
+
+	/* protected by the sequencer lock */
+	GList *patterns;
+	struct js_output_pattern *current;
+	struct js_output_stats stats;
+	/* value to restore once no pattern is playing anymore */
+	bool queued;
+	double queued_value;
+};
+
+struct js_output_sequencer {
+	GThread *thread;
+	GMutex lock;
+	bool done;
+	int timer_fd;
+	int wakeup_fd;
 };
 
 extern const struct js_output_type js_output_sysfs;
@@ -47,12 +91,497 @@ static const struct js_output_type * const output_types[] = {
 static struct js_output_channel channels[MAX_OUTPUT_CHANNELS];
 static unsigned channels_count = 0;
 
+static struct js_output_sequencer sequencer = {
+	.timer_fd = -1,
+	.wakeup_fd = -1,
+};
+
+static int js_output_channel_write(struct js_output_channel *channel,
+		double value)
+{
+	int err;
+
+	g_mutex_lock(&channel->lock);
+
+	err = channel->type->set(channel->output, value);
+	if (err && channel->type->prepare) {
+		if (channel->type->prepare(channel->output) >= 0) {
+			g_warning("Retry to set output due to error %d", err);
+			err = channel->type->set(channel->output, value);
+		}
+	}
+
+	g_mutex_unlock(&channel->lock);
+
+	return err;
+}
+
+static void js_output_pattern_free(gpointer data)
+{
+	struct js_output_pattern *pattern = data;
+
+	g_free(pattern->steps);
+	g_free(pattern);
+}
+
+/* highest priority first */
+static gint js_output_pattern_compare(gconstpointer a, gconstpointer b)
+{
+	const struct js_output_pattern *pa = a, *pb = b;
+
+	if (pa->priority > pb->priority)
+		return -1;
+
+	return pa->priority < pb->priority ? 1 : 0;
+}
+
+/*
+ * Advance a pattern up to the given time. Returns false once the pattern
+ * has played its last step.
+ */
+static bool js_output_pattern_advance(struct js_output_pattern *pattern,
+		struct js_output_stats *stats, gint64 now, bool *changed)
+{
+	while (pattern->deadline <= now) {
+		gint64 lateness = now - pattern->deadline;
+
+		if (++pattern->pos >= pattern->count) {
+			if (pattern->repeat == 0)
+				return false;
+
+			if (pattern->repeat > 0)
+				pattern->repeat--;
+
+			pattern->pos = 0;
+		}
+
+		pattern->deadline += pattern->steps[pattern->pos].duration *
+			(gint64)1000;
+		*changed = true;
+
+		stats->steps++;
+		if (lateness > OUTPUT_DEADLINE_SLACK)
+			stats->missed++;
+		if (lateness > stats->max_lateness)
+			stats->max_lateness = lateness;
+
+		/* the last step of a pattern that doesn't repeat is final */
+		if (pattern->pos == pattern->count - 1 &&
+		    pattern->repeat == 0 &&
+		    pattern->steps[pattern->pos].duration == 0)
+			return false;
+	}
+
+	return true;
+}
+
+static void js_output_channel_remove(struct js_output_channel *channel,
+		GList *node)
+{
+	struct js_output_pattern *pattern = node->data;
+
+	if (channel->current == pattern)
+		channel->current = NULL;
+
+	channel->patterns = g_list_delete_link(channel->patterns, node);
+	js_output_pattern_free(pattern);
+}
+
+/*
+ * Run all patterns up to now, collect the values to write and return the
+ * next deadline, or -1 if there is none. Called with the sequencer lock
+ * held.
+ */
+static gint64 js_output_sequencer_step(gint64 now, double *values,
+		bool *write)
+{
+	gint64 next = -1;
+	unsigned i;
+
+	for (i = 0; i < channels_count; i++) {
+		struct js_output_channel *channel = &channels[i];
+		struct js_output_pattern *top, *pattern;
+		GList *node, *next_node;
+
+		write[i] = false;
+		top = channel->patterns ? channel->patterns->data : NULL;
+
+		for (node = channel->patterns; node; node = next_node) {
+			next_node = node->next;
+			pattern = node->data;
+			pattern->stepped = false;
+
+			if (js_output_pattern_advance(pattern, &channel->stats,
+					now, &pattern->stepped)) {
+				if (next < 0 || pattern->deadline < next)
+					next = pattern->deadline;
+				continue;
+			}
+
+			/*
+			 * The final value of the top pattern stays, the one
+			 * of a shadowed pattern is applied once the patterns
+			 * above it are done.
+			 */
+			if (pattern == top && pattern->stepped) {
+				values[i] = pattern->steps[
+					pattern->count - 1].value;
+				write[i] = true;
+			} else if (pattern->stepped) {
+				channel->queued_value = pattern->steps[
+					pattern->count - 1].value;
+				channel->queued = true;
+			}
+
+			js_output_channel_remove(channel, node);
+		}
+
+		/* a pattern that was shadowed takes over from a finished one */
+		pattern = channel->patterns ? channel->patterns->data : NULL;
+		if (pattern && pattern->pos >= 0 &&
+		    (pattern != channel->current || pattern->stepped)) {
+			values[i] = pattern->steps[pattern->pos].value;
+			write[i] = true;
+		} else if (!pattern && channel->queued) {
+			values[i] = channel->queued_value;
+			write[i] = true;
+		}
+
+		if (!pattern)
+			channel->queued = false;
+
+		channel->current = pattern;
+	}
+
+	return next;
+}
+
+static void js_output_sequencer_arm(gint64 deadline)
+{
+	struct itimerspec spec;
+
+	memset(&spec, 0, sizeof(spec));
+
+	/* a zero value disarms the timer */
+	if (deadline >= 0) {
+		spec.it_value.tv_sec = deadline / G_USEC_PER_SEC;
+		spec.it_value.tv_nsec = (deadline % G_USEC_PER_SEC) * 1000;
+		if (!spec.it_value.tv_sec && !spec.it_value.tv_nsec)
+			spec.it_value.tv_nsec = 1;
+	}
+
+	if (timerfd_settime(sequencer.timer_fd, TFD_TIMER_ABSTIME, &spec,
+			NULL) < 0)
+		g_warning("%s: timerfd_settime(): %s", __func__,
+			g_strerror(errno));
+}
+
+/*
+ * The sequencer runs in its own thread so that pattern timing doesn't
+ * depend on how busy the UI main loop is. g_get_monotonic_time() and the
+ * timer both use CLOCK_MONOTONIC.
+ */
+static gpointer js_output_sequencer_thread(gpointer data)
+{
+	double values[MAX_OUTPUT_CHANNELS];
+	bool write[MAX_OUTPUT_CHANNELS];
+	struct pollfd fds[2];
+	uint64_t count;
+	gint64 next;
+	unsigned i;
+
+	fds[0].fd = sequencer.timer_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = sequencer.wakeup_fd;
+	fds[1].events = POLLIN;
+
+	while (true) {
+		g_mutex_lock(&sequencer.lock);
+		if (sequencer.done) {
+			g_mutex_unlock(&sequencer.lock);
+			break;
+		}
+		next = js_output_sequencer_step(g_get_monotonic_time(), values,
+				write);
+		g_mutex_unlock(&sequencer.lock);
+
+		for (i = 0; i < channels_count; i++) {
+			if (write[i] && js_output_channel_write(&channels[i],
+					values[i]))
+				g_warning("%s: Failed to set output %s to %g",
+					__func__, channels[i].name, values[i]);
+		}
+
+		js_output_sequencer_arm(next);
+
+		if (poll(fds, G_N_ELEMENTS(fds), -1) < 0) {
+			if (errno != EINTR)
+				g_warning("%s: poll(): %s", __func__,
+					g_strerror(errno));
+			continue;
+		}
+
+		if (fds[0].revents & POLLIN)
+			(void)read(sequencer.timer_fd, &count, sizeof(count));
+		if (fds[1].revents & POLLIN)
+			(void)read(sequencer.wakeup_fd, &count, sizeof(count));
+	}
+
+	return NULL;
+}
+
+static int js_output_sequencer_start(void)
+{
+	sequencer.timer_fd = timerfd_create(CLOCK_MONOTONIC,
+			TFD_NONBLOCK | TFD_CLOEXEC);
+	if (sequencer.timer_fd < 0)
+		return -errno;
+
+	sequencer.wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (sequencer.wakeup_fd < 0) {
+		close(sequencer.timer_fd);
+		sequencer.timer_fd = -1;
+		return -errno;
+	}
+
+	g_mutex_init(&sequencer.lock);
+
+	sequencer.thread = g_thread_new("output", js_output_sequencer_thread,
+			NULL);
+	return 0;
+}
+
+static void js_output_sequencer_wakeup(void)
+{
+	uint64_t one = 1;
+
+	(void)write(sequencer.wakeup_fd, &one, sizeof(one));
+}
+
+static void js_output_sequencer_stop(void)
+{
+	unsigned i;
+
+	if (!sequencer.thread)
+		return;
+
+	g_mutex_lock(&sequencer.lock);
+	sequencer.done = true;
+	g_mutex_unlock(&sequencer.lock);
+
+	js_output_sequencer_wakeup();
+	g_thread_join(sequencer.thread);
+	sequencer.thread = NULL;
+
+	for (i = 0; i < channels_count; i++) {
+		g_list_free_full(channels[i].patterns, js_output_pattern_free);
+		channels[i].patterns = NULL;
+		channels[i].current = NULL;
+	}
+
+	close(sequencer.wakeup_fd);
+	sequencer.wakeup_fd = -1;
+	close(sequencer.timer_fd);
+	sequencer.timer_fd = -1;
+	g_mutex_clear(&sequencer.lock);
+}
+
+/*
+ * Add a pattern to a channel, replacing any pattern of the same priority.
+ * Called with the sequencer lock held.
+ */
+static void js_output_channel_play(struct js_output_channel *channel,
+		struct js_output_pattern *pattern)
+{
+	GList *node;
+
+	for (node = channel->patterns; node; node = node->next) {
+		struct js_output_pattern *other = node->data;
+
+		if (other->priority == pattern->priority) {
+			js_output_channel_remove(channel, node);
+			break;
+		}
+	}
+
+	channel->patterns = g_list_insert_sorted(channel->patterns, pattern,
+			js_output_pattern_compare);
+}
+
+/*
+ * Parse value,duration,...,value lists as used by set() and play(), the
+ * list has to contain an odd number of entries.
+ */
+static struct js_output_pattern *js_output_pattern_parse(
+	JSContextRef context, size_t argc, const JSValueRef argv[],
+	JSValueRef *exception)
+{
+	struct js_output_pattern *pattern;
+	unsigned total = 0;
+	size_t i;
+
+	/* We need an odd number of arguments: values with intervals */
+	if ((argc & 1) == 0) {
+		javascript_set_exception_text(context, exception,
+			"invalid argument count");
+		return NULL;
+	}
+
+	pattern = g_new0(struct js_output_pattern, 1);
+	pattern->steps = g_new0(struct js_output_step, (argc + 1) / 2);
+	pattern->pos = -1;
+
+	for (i = 0; i < argc; i += 2) {
+		struct js_output_step *step = &pattern->steps[pattern->count];
+
+		step->value = JSValueToNumber(context, argv[i], exception);
+		if (isnan(step->value)) {
+			javascript_set_exception_text(context, exception,
+				"value must be a number");
+			goto free;
+		}
+		if (i + 1 < argc) {
+			double duration = JSValueToNumber(
+				context, argv[i + 1], exception);
+			if (isnan(duration) || duration < 0.0) {
+				javascript_set_exception_text(
+					context, exception,
+					"duration must be a positive number");
+				goto free;
+			}
+			step->duration = duration;
+		} else {
+			step->duration = 0;
+		}
+		total += step->duration;
+		pattern->count += 1;
+	}
+
+	pattern->total = total;
+	return pattern;
+
+free:
+	js_output_pattern_free(pattern);
+	return NULL;
+}
+
+static struct js_output_pattern *js_output_pattern_from_array(
+	JSContextRef context, JSValueRef value, JSValueRef *exception)
+{
+	struct js_output_pattern *pattern;
+	JSValueRef *argv, length;
+	JSObjectRef array;
+	unsigned i, argc;
+	double dval;
+
+	array = JSValueToObject(context, value, exception);
+	if (!array)
+		return NULL;
+
+	length = javascript_object_get_property(context, array, "length",
+			exception);
+	dval = length ? JSValueToNumber(context, length, exception) : NAN;
+	if (isnan(dval) || dval < 1) {
+		javascript_set_exception_text(context, exception,
+			"pattern must be a non-empty array");
+		return NULL;
+	}
+
+	argc = dval;
+	argv = g_new(JSValueRef, argc);
+
+	for (i = 0; i < argc; i++)
+		argv[i] = JSObjectGetPropertyAtIndex(context, array, i,
+				exception);
+
+	pattern = js_output_pattern_parse(context, argc, argv, exception);
+	g_free(argv);
+
+	return pattern;
+}
+
+/* options are { repeat: <count, -1 for endless>, priority: <number> } */
+static bool js_output_pattern_set_options(JSContextRef context,
+	struct js_output_pattern *pattern, JSValueRef value,
+	JSValueRef *exception)
+{
+	JSObjectRef options;
+	JSValueRef prop;
+	int ival;
+
+	if (!value || JSValueIsUndefined(context, value) ||
+	    JSValueIsNull(context, value))
+		return true;
+
+	options = JSValueToObject(context, value, exception);
+	if (!options)
+		return false;
+
+	prop = javascript_object_get_property(context, options, "repeat",
+			NULL);
+	if (prop && !JSValueIsUndefined(context, prop)) {
+		if (javascript_int_from_number(context, prop, -1, G_MAXINT,
+				&ival, exception)) {
+			javascript_set_exception_text(context, exception,
+				"repeat must be a number");
+			return false;
+		}
+
+		if (ival != 0 && pattern->total == 0) {
+			javascript_set_exception_text(context, exception,
+				"repeated pattern needs a duration");
+			return false;
+		}
+
+		pattern->repeat = ival;
+	}
+
+	prop = javascript_object_get_property(context, options, "priority",
+			NULL);
+	if (prop && !JSValueIsUndefined(context, prop)) {
+		if (javascript_int_from_number(context, prop, G_MININT,
+				G_MAXINT, &ival, exception)) {
+			javascript_set_exception_text(context, exception,
+				"priority must be a number");
+			return false;
+		}
+
+		pattern->priority = ival;
+	}
+
+	return true;
+}
+
+static JSValueRef js_output_stats_to_object(JSContextRef context,
+	const struct js_output_stats *stats)
+{
+	JSObjectRef object;
+
+	object = JSObjectMake(context, NULL, NULL);
+	if (!object)
+		return JSValueMakeNull(context);
+
+	javascript_object_set_property(context, object, "steps",
+		JSValueMakeNumber(context, stats->steps),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "missed",
+		JSValueMakeNumber(context, stats->missed),
+		kJSPropertyAttributeReadOnly, NULL);
+	/* in milliseconds, like the step durations */
+	javascript_object_set_property(context, object, "maxLateness",
+		JSValueMakeNumber(context, stats->max_lateness / 1000.0),
+		kJSPropertyAttributeReadOnly, NULL);
+
+	return object;
+}
+
 static bool js_output_set_value(
 	JSContextRef context, JSObjectRef object,
 	JSStringRef name, JSValueRef value,
 	JSValueRef *exception)
 {
 	struct js_output_channel *channel = JSObjectGetPrivate(object);
+	bool queued;
 	double dval;
 	int err;
 
@@ -66,13 +595,22 @@ static bool js_output_set_value(
 	if (isnan(dval))
 		return true;
 
-	err = channel->type->set(channel->output, dval);
-	if (err && channel->type->prepare) {
-		if (channel->type->prepare(channel->output) >= 0) {
-			g_warning("Retry to set output due to error %d", err);
-			err = channel->type->set(channel->output, dval);
-		}
+	/*
+	 * While patterns are playing the value would be overwritten by their
+	 * next step, so it is kept until they are done instead.
+	 */
+	if (sequencer.thread) {
+		g_mutex_lock(&sequencer.lock);
+		queued = channel->patterns != NULL;
+		channel->queued = queued;
+		channel->queued_value = dval;
+		g_mutex_unlock(&sequencer.lock);
+
+		if (queued)
+			return true;
 	}
+
+	err = js_output_channel_write(channel, dval);
 	if (err)
 		javascript_set_exception_text(context, exception,
 			"failed to set output value");
@@ -93,6 +631,8 @@ static JSValueRef js_output_get_value(
 		return NULL;
 	}
 
+	g_mutex_lock(&channel->lock);
+
 	err = channel->type->get(channel->output, &dval);
 	if (err && channel->type->prepare) {
 		if (channel->type->prepare(channel->output) >= 0) {
@@ -100,6 +640,9 @@ static JSValueRef js_output_get_value(
 			err = channel->type->get(channel->output, &dval);
 		}
 	}
+
+	g_mutex_unlock(&channel->lock);
+
 	if (err)
 		javascript_set_exception_text(context, exception,
 			"failed to get output value");
@@ -107,39 +650,24 @@ static JSValueRef js_output_get_value(
 	return JSValueMakeNumber(context, dval);
 }
 
-static gboolean js_output_on_set_done(gpointer user_data)
+static JSValueRef js_output_get_stats(
+	JSContextRef context, JSObjectRef object,
+	JSStringRef name, JSValueRef *exception)
 {
-	struct js_output_channel *channel = user_data;
-	struct js_output_channel_set *set;
-	int err;
-
-	channel->timeout_id = 0;
-
-	if (!channel->set || channel->set_pos >= channel->set_count)
-		return G_SOURCE_REMOVE;
-
-	set = &channel->set[channel->set_pos];
+	struct js_output_channel *channel = JSObjectGetPrivate(object);
+	struct js_output_stats stats;
 
-	err = channel->type->set(channel->output, set->value);
-	if (err && channel->type->prepare) {
-		if (channel->type->prepare(channel->output) >= 0) {
-			g_warning("Retry to set output due to error %d", err);
-			err = channel->type->set(channel->output, set->value);
-		}
-	}
-	if (err) {
-		g_warning("%s: Failed to set output %s to %g",
-			__func__, channel->name, set->value);
-		return G_SOURCE_REMOVE;
+	if (!channel) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
 	}
 
-	channel->set_pos += 1;
-
-	if (channel->set_pos <= channel->set_count)
-		channel->timeout_id = g_timeout_add(
-			set->duration, js_output_on_set_done, channel);
+	g_mutex_lock(&sequencer.lock);
+	stats = channel->stats;
+	g_mutex_unlock(&sequencer.lock);
 
-	return G_SOURCE_REMOVE;
+	return js_output_stats_to_object(context, &stats);
 }
 
 static const JSStaticValue js_output_properties[] = {
@@ -149,16 +677,45 @@ static const JSStaticValue js_output_properties[] = {
 		.setProperty = js_output_set_value,
 		.attributes = kJSPropertyAttributeDontDelete,
 	},
+	{
+		.name = "stats",
+		.getProperty = js_output_get_stats,
+		.attributes = kJSPropertyAttributeDontDelete |
+			kJSPropertyAttributeReadOnly,
+	},
 	{}
 };
 
+static JSValueRef js_output_start(JSContextRef context,
+	struct js_output_channel *channel, struct js_output_pattern *pattern)
+{
+	/* without the sequencer only the first value can be set */
+	if (!sequencer.thread) {
+		if (js_output_channel_write(channel, pattern->steps[0].value))
+			g_warning("%s: Failed to set output %s", __func__,
+				channel->name);
+		js_output_pattern_free(pattern);
+		return JSValueMakeNull(context);
+	}
+
+	pattern->deadline = g_get_monotonic_time();
+
+	g_mutex_lock(&sequencer.lock);
+	js_output_channel_play(channel, pattern);
+	g_mutex_unlock(&sequencer.lock);
+
+	js_output_sequencer_wakeup();
+
+	return JSValueMakeNull(context);
+}
+
 static JSValueRef js_output_set(
 	JSContextRef context, JSObjectRef function,
 	JSObjectRef object, size_t argc, const JSValueRef argv[],
 	JSValueRef *exception)
 {
 	struct js_output_channel *channel = JSObjectGetPrivate(object);
-	int i;
+	struct js_output_pattern *pattern;
 
 	if (!channel) {
 		javascript_set_exception_text(context, exception,
@@ -166,53 +723,188 @@ static JSValueRef js_output_set(
 		return NULL;
 	}
 
-	/* We need an odd number of arguments: values with intervals */
-	if ((argc & 1) == 0) {
+	pattern = js_output_pattern_parse(context, argc, argv, exception);
+	if (!pattern)
+		return NULL;
+
+	return js_output_start(context, channel, pattern);
+}
+
+static JSValueRef js_output_play(
+	JSContextRef context, JSObjectRef function,
+	JSObjectRef object, size_t argc, const JSValueRef argv[],
+	JSValueRef *exception)
+{
+	struct js_output_channel *channel = JSObjectGetPrivate(object);
+	struct js_output_pattern *pattern;
+
+	if (!channel) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	if (argc < 1 || argc > 2) {
 		javascript_set_exception_text(context, exception,
 			"invalid argument count");
 		return NULL;
 	}
 
-	/* Parse the value,duration pairs */
-	channel->set_count = channel->set_pos = 0;
-	channel->set = g_realloc_n(
-		channel->set, (argc + 1) / 2, sizeof(*channel->set));
+	pattern = js_output_pattern_from_array(context, argv[0], exception);
+	if (!pattern)
+		return NULL;
 
-	for (i = 0; i < argc; i += 2) {
-		struct js_output_channel_set *set =
-			&channel->set[channel->set_count];
-		set->value = JSValueToNumber(context, argv[i], exception);
-		if (isnan(set->value)) {
+	if (!js_output_pattern_set_options(context, pattern,
+			argc > 1 ? argv[1] : NULL, exception)) {
+		js_output_pattern_free(pattern);
+		return NULL;
+	}
+
+	return js_output_start(context, channel, pattern);
+}
+
+static JSValueRef js_output_stop(
+	JSContextRef context, JSObjectRef function,
+	JSObjectRef object, size_t argc, const JSValueRef argv[],
+	JSValueRef *exception)
+{
+	struct js_output_channel *channel = JSObjectGetPrivate(object);
+	int priority = 0;
+	GList *node, *next;
+
+	if (!channel) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	if (argc > 0 && javascript_int_from_number(context, argv[0],
+			G_MININT, G_MAXINT, &priority, exception)) {
+		javascript_set_exception_text(context, exception,
+			JS_ERR_INVALID_NUMBER);
+		return NULL;
+	}
+
+	/* without a priority all patterns of the channel are stopped */
+	g_mutex_lock(&sequencer.lock);
+
+	for (node = channel->patterns; node; node = next) {
+		struct js_output_pattern *pattern = node->data;
+
+		next = node->next;
+
+		if (argc > 0 && pattern->priority != priority)
+			continue;
+
+		js_output_channel_remove(channel, node);
+	}
+
+	g_mutex_unlock(&sequencer.lock);
+
+	js_output_sequencer_wakeup();
+
+	return JSValueMakeNull(context);
+}
+
+static struct js_output_channel *js_output_channel_find(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < channels_count; i++)
+		if (!strcmp(channels[i].name, name))
+			return &channels[i];
+
+	return NULL;
+}
+
+/*
+ * output.play({ <channel>: [ value, duration, ... ], ... }, options)
+ * starts patterns on several channels at the very same deadline, so that
+ * they step in sync.
+ */
+static JSValueRef js_output_play_sync(
+	JSContextRef context, JSObjectRef function,
+	JSObjectRef object, size_t argc, const JSValueRef argv[],
+	JSValueRef *exception)
+{
+	struct js_output_pattern *patterns[MAX_OUTPUT_CHANNELS];
+	struct js_output_channel *targets[MAX_OUTPUT_CHANNELS];
+	JSPropertyNameArrayRef props;
+	JSObjectRef map;
+	size_t i, count;
+	gint64 start;
+
+	if (argc < 1 || argc > 2) {
+		javascript_set_exception_text(context, exception,
+			"invalid argument count");
+		return NULL;
+	}
+
+	map = JSValueToObject(context, argv[0], exception);
+	if (!map)
+		return NULL;
+
+	props = JSObjectCopyPropertyNames(context, map);
+	count = MIN(JSPropertyNameArrayGetCount(props), MAX_OUTPUT_CHANNELS);
+
+	for (i = 0; i < count; i++) {
+		JSStringRef name = JSPropertyNameArrayGetNameAtIndex(props, i);
+		char *cname;
+
+		cname = javascript_get_string(context,
+				JSValueMakeString(context, name), exception);
+		targets[i] = cname ? js_output_channel_find(cname) : NULL;
+		if (!targets[i]) {
 			javascript_set_exception_text(context, exception,
-				"value must be a number");
-			return NULL;
+				"unknown output %s", cname ? cname : "");
+			g_free(cname);
+			goto free;
 		}
-		if (i + 1 < argc) {
-			double duration = JSValueToNumber(
-				context, argv[i + 1], exception);
-			if (isnan(duration) || duration < 0.0) {
-				javascript_set_exception_text(
-					context, exception,
-					"duration must be a positive number");
-				return NULL;
-			}
-			set->duration = duration;
-		} else {
-			set->duration = 0;
+		g_free(cname);
+
+		patterns[i] = js_output_pattern_from_array(context,
+				JSObjectGetProperty(context, map, name, NULL),
+				exception);
+		if (!patterns[i])
+			goto free;
+
+		if (!js_output_pattern_set_options(context, patterns[i],
+				argc > 1 ? argv[1] : NULL, exception)) {
+			i++;
+			goto free;
 		}
-		channel->set_count += 1;
 	}
 
-	/* Clear any pending timeout */
-	if (channel->timeout_id) {
-		g_source_remove(channel->timeout_id);
-		channel->timeout_id = 0;
+	JSPropertyNameArrayRelease(props);
+
+	if (!sequencer.thread) {
+		for (i = 0; i < count; i++)
+			js_output_start(context, targets[i], patterns[i]);
+
+		return JSValueMakeNull(context);
+	}
+
+	start = g_get_monotonic_time();
+
+	g_mutex_lock(&sequencer.lock);
+
+	for (i = 0; i < count; i++) {
+		patterns[i]->deadline = start;
+		js_output_channel_play(targets[i], patterns[i]);
 	}
 
-	/* (re)start the process */
-	js_output_on_set_done(channel);
+	g_mutex_unlock(&sequencer.lock);
+
+	js_output_sequencer_wakeup();
 
 	return JSValueMakeNull(context);
+
+free:
+	while (i-- > 0)
+		if (targets[i] && patterns[i])
+			js_output_pattern_free(patterns[i]);
+	JSPropertyNameArrayRelease(props);
+	return NULL;
 }
 
 static const JSStaticFunction js_output_functions[] = {
@@ -221,6 +913,16 @@ static const JSStaticFunction js_output_functions[] = {
 		.callAsFunction = js_output_set,
 		.attributes = kJSPropertyAttributeDontDelete,
 	},
+	{
+		.name = "play",
+		.callAsFunction = js_output_play,
+		.attributes = kJSPropertyAttributeDontDelete,
+	},
+	{
+		.name = "stop",
+		.callAsFunction = js_output_stop,
+		.attributes = kJSPropertyAttributeDontDelete,
+	},
 	{}
 };
 
@@ -241,10 +943,20 @@ static JSObjectRef js_output_create(
 	if (!root)
 		return NULL;
 
+	javascript_object_set_property(js, root, "play",
+		JSObjectMakeFunctionWithCallback(js, NULL, js_output_play_sync),
+		kJSPropertyAttributeDontDelete | kJSPropertyAttributeReadOnly,
+		NULL);
+
 	for (i = 0; i < channels_count; i++) {
 		JSObjectRef channel;
 		if (channels[i].type->prepare) {
-			int err = channels[i].type->prepare(channels[i].output);
+			int err;
+
+			g_mutex_lock(&channels[i].lock);
+			err = channels[i].type->prepare(channels[i].output);
+			g_mutex_unlock(&channels[i].lock);
+
 			if (err < 0 && err != -ENOENT)
 				g_warning("%s: Failed to prepare output %s",
 						__func__, channels[i].name);
@@ -312,6 +1024,7 @@ int js_output_init_channel(GKeyFile *config, const char *name)
 	channels[channels_count].type = type;
 	channels[channels_count].name = strdup(name);
 	channels[channels_count].output = output;
+	g_mutex_init(&channels[channels_count].lock);
 	channels_count += 1;
 
 	return 0;
@@ -334,11 +1047,26 @@ int js_output_init(GKeyFile *config)
 	}
 
 	g_strfreev(names);
+
+	if (channels_count == 0)
+		return 0;
+
+	err = js_output_sequencer_start();
+	if (err < 0)
+		g_warning("%s: Failed to start output sequencer: %s",
+			__func__, g_strerror(-err));
+
 	return 0;
 }
 
+static void js_output_exit(void)
+{
+	js_output_sequencer_stop();
+}
+
 struct javascript_module javascript_output = {
 	.classdef = &js_output_classdef,
 	.init = js_output_init,
+	.exit = js_output_exit,
 	.create = js_output_create,
 };
@@ -0,0 +1,539 @@
+/*
+ * Copyright (C) 2017 Avionic Design GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "javascript.h"
+#include "javascript-serial.h"
+
+#define SERIAL_RX_SIZE 1024
+
+struct js_serial_request {
+	js_serial_response_cb callback;
+	void *data;
+	gint64 sent;
+	gint64 deadline;
+};
+
+struct js_serial_tx {
+	guint8 *data;
+	size_t length;
+	size_t offset;
+	struct js_serial_request *request;
+};
+
+/*
+ * Nothing here ever blocks: data is written as far as the TTY takes it and
+ * the rest once it becomes writable, received data is collected until a
+ * frame is complete, and both request timeouts and inter-byte gaps are
+ * turned into the timeout of the source.
+ */
+struct js_serial {
+	GSource source;
+	GPollFD poll;
+	struct js_serial_config config;
+
+	/* received data, frames are taken from the start */
+	guint8 rx[SERIAL_RX_SIZE];
+	size_t rx_start;
+	size_t rx_end;
+	gint64 rx_last;
+
+	/* data waiting to be written, and requests waiting for a response */
+	GQueue tx;
+	GQueue pending;
+
+	js_serial_receive_cb receive;
+	void *receive_data;
+
+	struct js_serial_stats stats;
+	guint64 latency_total;
+	bool failed;
+};
+
+static void js_serial_tx_free(struct js_serial_tx *tx)
+{
+	g_free(tx->request);
+	g_free(tx->data);
+	g_free(tx);
+}
+
+static void js_serial_complete(struct js_serial *serial, gint64 now,
+	const guint8 *frame, size_t length)
+{
+	struct js_serial_request *request;
+	guint64 latency;
+
+	request = g_queue_pop_head(&serial->pending);
+	if (!request) {
+		if (serial->receive)
+			serial->receive(serial->receive_data, frame, length);
+		return;
+	}
+
+	latency = now - request->sent;
+	serial->latency_total += latency;
+	serial->stats.responses++;
+	serial->stats.latency_avg = serial->latency_total /
+		serial->stats.responses;
+	serial->stats.latency_max = MAX(serial->stats.latency_max, latency);
+
+	if (request->callback)
+		request->callback(request->data, 0, frame, length);
+
+	g_free(request);
+}
+
+static ssize_t js_serial_frame_length(struct js_serial *serial,
+	const guint8 *data, size_t length)
+{
+	const guint8 *end;
+
+	if (serial->config.parse)
+		return serial->config.parse(data, length);
+
+	if (serial->config.delimiter >= 0) {
+		end = memchr(data, serial->config.delimiter, length);
+		return end ? end - data + 1 : 0;
+	}
+
+	if (serial->config.frame_length)
+		return length >= serial->config.frame_length ?
+			serial->config.frame_length : 0;
+
+	/* only the gap ends a frame */
+	return 0;
+}
+
+static void js_serial_deliver(struct js_serial *serial, gint64 now,
+	size_t length)
+{
+	const guint8 *frame = serial->rx + serial->rx_start;
+
+	serial->rx_start += length;
+	if (serial->rx_start == serial->rx_end)
+		serial->rx_start = serial->rx_end = 0;
+
+	serial->stats.rx_frames++;
+	trace_record(serial->config.trace, TRACE_DIRECTION_IN, frame, length);
+
+	/* the buffer is only compacted before reading, so frame stays valid */
+	js_serial_complete(serial, now, frame, length);
+}
+
+static void js_serial_parse(struct js_serial *serial, gint64 now)
+{
+	ssize_t length;
+
+	while (serial->rx_end > serial->rx_start) {
+		length = js_serial_frame_length(serial,
+				serial->rx + serial->rx_start,
+				serial->rx_end - serial->rx_start);
+		if (length == 0)
+			break;
+
+		if (length < 0 ||
+		    (size_t)length > serial->rx_end - serial->rx_start) {
+			g_debug("js-serial: dropping %zu bytes of invalid data",
+				serial->rx_end - serial->rx_start);
+			serial->stats.errors++;
+			serial->rx_start = serial->rx_end = 0;
+			break;
+		}
+
+		js_serial_deliver(serial, now, length);
+	}
+}
+
+static void js_serial_read(struct js_serial *serial, gint64 now)
+{
+	ssize_t num;
+
+	while (true) {
+		if (serial->rx_start > 0) {
+			memmove(serial->rx, serial->rx + serial->rx_start,
+				serial->rx_end - serial->rx_start);
+			serial->rx_end -= serial->rx_start;
+			serial->rx_start = 0;
+		}
+
+		if (serial->rx_end == sizeof(serial->rx)) {
+			g_debug("js-serial: receive buffer full, dropping data");
+			serial->stats.overruns++;
+			serial->rx_end = 0;
+		}
+
+		num = read(serial->poll.fd, serial->rx + serial->rx_end,
+			sizeof(serial->rx) - serial->rx_end);
+		if (num < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN) {
+				g_debug("js-serial: read failed: %s",
+					g_strerror(errno));
+				serial->stats.errors++;
+			}
+			break;
+		}
+
+		if (num == 0)
+			break;
+
+		serial->rx_end += num;
+		serial->rx_last = now;
+		serial->stats.rx_bytes += num;
+
+		js_serial_parse(serial, now);
+	}
+}
+
+static void js_serial_fail_tx(struct js_serial *serial, int err)
+{
+	struct js_serial_tx *tx;
+
+	while ((tx = g_queue_pop_head(&serial->tx)) != NULL) {
+		if (tx->request && tx->request->callback)
+			tx->request->callback(tx->request->data, err, NULL, 0);
+		js_serial_tx_free(tx);
+	}
+}
+
+static void js_serial_flush(struct js_serial *serial)
+{
+	struct js_serial_tx *tx;
+	ssize_t num;
+	gint64 now;
+	int err;
+
+	while ((tx = g_queue_peek_head(&serial->tx)) != NULL) {
+		num = write(serial->poll.fd, tx->data + tx->offset,
+			tx->length - tx->offset);
+		if (num < 0) {
+			err = errno;
+
+			if (err == EINTR)
+				continue;
+			if (err == EAGAIN)
+				break;
+
+			g_debug("js-serial: write failed: %s",
+				g_strerror(err));
+			serial->stats.errors++;
+			js_serial_fail_tx(serial, -err);
+			break;
+		}
+
+		tx->offset += num;
+		serial->stats.tx_bytes += num;
+		if (tx->offset < tx->length)
+			break;
+
+		g_queue_pop_head(&serial->tx);
+		serial->stats.tx_frames++;
+		trace_record(serial->config.trace, TRACE_DIRECTION_OUT,
+			tx->data, tx->length);
+
+		/* the response can't be there before the request is out */
+		if (tx->request) {
+			now = g_get_monotonic_time();
+			tx->request->sent = now;
+			tx->request->deadline = now +
+				serial->config.timeout * 1000;
+			g_queue_push_tail(&serial->pending, tx->request);
+			tx->request = NULL;
+		}
+
+		js_serial_tx_free(tx);
+	}
+
+	if (g_queue_is_empty(&serial->tx))
+		serial->poll.events &= ~G_IO_OUT;
+	else
+		serial->poll.events |= G_IO_OUT;
+}
+
+static void js_serial_expire(struct js_serial *serial, gint64 now)
+{
+	struct js_serial_request *request;
+
+	/* requests are sent in order and share a timeout */
+	while ((request = g_queue_peek_head(&serial->pending)) != NULL) {
+		if (request->deadline > now)
+			break;
+
+		g_queue_pop_head(&serial->pending);
+		serial->stats.timeouts++;
+
+		if (request->callback)
+			request->callback(request->data, -ETIMEDOUT, NULL, 0);
+
+		g_free(request);
+	}
+
+	if (!serial->config.gap || serial->rx_end == serial->rx_start)
+		return;
+
+	if (serial->rx_last + serial->config.gap * 1000 > now)
+		return;
+
+	if (serial->config.parse || serial->config.delimiter >= 0 ||
+	    serial->config.frame_length) {
+		g_debug("js-serial: dropping incomplete frame of %zu bytes",
+			serial->rx_end - serial->rx_start);
+		serial->stats.errors++;
+		serial->rx_start = serial->rx_end = 0;
+	} else {
+		js_serial_deliver(serial, now,
+			serial->rx_end - serial->rx_start);
+	}
+}
+
+static gint64 js_serial_next_deadline(struct js_serial *serial)
+{
+	struct js_serial_request *request;
+	gint64 deadline = G_MAXINT64;
+
+	request = g_queue_peek_head(&serial->pending);
+	if (request)
+		deadline = request->deadline;
+
+	if (serial->config.gap && serial->rx_end > serial->rx_start)
+		deadline = MIN(deadline,
+			serial->rx_last + serial->config.gap * 1000);
+
+	return deadline;
+}
+
+static gboolean js_serial_source_prepare(GSource *source, gint *timeout)
+{
+	struct js_serial *serial = (struct js_serial *)source;
+	gint64 deadline, now;
+
+	if (timeout)
+		*timeout = -1;
+
+	deadline = js_serial_next_deadline(serial);
+	if (deadline == G_MAXINT64)
+		return FALSE;
+
+	now = g_get_monotonic_time();
+	if (deadline <= now)
+		return TRUE;
+
+	if (timeout)
+		*timeout = (deadline - now + 999) / 1000;
+
+	return FALSE;
+}
+
+static gboolean js_serial_source_check(GSource *source)
+{
+	struct js_serial *serial = (struct js_serial *)source;
+
+	if (serial->poll.revents)
+		return TRUE;
+
+	return js_serial_next_deadline(serial) <= g_get_monotonic_time();
+}
+
+static gboolean js_serial_source_dispatch(GSource *source,
+	GSourceFunc callback, gpointer user_data)
+{
+	struct js_serial *serial = (struct js_serial *)source;
+	gushort revents = serial->poll.revents;
+	gint64 now = g_get_monotonic_time();
+
+	if (revents & (G_IO_ERR | G_IO_HUP)) {
+		g_warning("js-serial: port failed, closing it");
+		g_source_remove_poll(source, &serial->poll);
+		serial->poll.revents = 0;
+		serial->failed = true;
+		serial->stats.errors++;
+		js_serial_fail_tx(serial, -EIO);
+	} else {
+		if (revents & G_IO_IN)
+			js_serial_read(serial, now);
+
+		if (revents & G_IO_OUT)
+			js_serial_flush(serial);
+	}
+
+	js_serial_expire(serial, now);
+
+	return TRUE;
+}
+
+static void js_serial_source_finalize(GSource *source)
+{
+	struct js_serial *serial = (struct js_serial *)source;
+	struct js_serial_tx *tx;
+
+	while ((tx = g_queue_pop_head(&serial->tx)) != NULL)
+		js_serial_tx_free(tx);
+
+	while (!g_queue_is_empty(&serial->pending))
+		g_free(g_queue_pop_head(&serial->pending));
+
+	close(serial->poll.fd);
+}
+
+static GSourceFuncs js_serial_source_funcs = {
+	.prepare = js_serial_source_prepare,
+	.check = js_serial_source_check,
+	.dispatch = js_serial_source_dispatch,
+	.finalize = js_serial_source_finalize,
+};
+
+int js_serial_create(struct js_serial **serialp, int fd,
+	const struct js_serial_config *config, GMainContext *context)
+{
+	struct js_serial *serial;
+	GSource *source;
+	int flags;
+
+	if (!serialp || fd < 0 || !config)
+		return -EINVAL;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		return -errno;
+
+	source = g_source_new(&js_serial_source_funcs, sizeof(*serial));
+	if (!source)
+		return -ENOMEM;
+
+	serial = (struct js_serial *)source;
+	serial->config = *config;
+	g_queue_init(&serial->tx);
+	g_queue_init(&serial->pending);
+
+	serial->poll.fd = fd;
+	serial->poll.events = G_IO_IN | G_IO_HUP | G_IO_ERR;
+	g_source_add_poll(source, &serial->poll);
+
+	g_source_attach(source, context);
+
+	*serialp = serial;
+	return 0;
+}
+
+void js_serial_free(struct js_serial *serial)
+{
+	if (!serial)
+		return;
+
+	g_source_destroy(&serial->source);
+	g_source_unref(&serial->source);
+}
+
+void js_serial_set_receive_cb(struct js_serial *serial,
+	js_serial_receive_cb callback, void *data)
+{
+	if (!serial)
+		return;
+
+	serial->receive = callback;
+	serial->receive_data = data;
+}
+
+static int js_serial_queue(struct js_serial *serial, const void *data,
+	size_t length, struct js_serial_request *request)
+{
+	struct js_serial_tx *tx;
+
+	if (serial->failed) {
+		g_free(request);
+		return -EIO;
+	}
+
+	tx = g_new0(struct js_serial_tx, 1);
+	tx->data = g_memdup(data, length);
+	tx->length = length;
+	tx->request = request;
+
+	g_queue_push_tail(&serial->tx, tx);
+
+	/* most of the time the TTY takes it right away */
+	if (g_queue_get_length(&serial->tx) == 1)
+		js_serial_flush(serial);
+
+	return 0;
+}
+
+int js_serial_send(struct js_serial *serial, const void *data, size_t length)
+{
+	if (!serial || !data || !length)
+		return -EINVAL;
+
+	return js_serial_queue(serial, data, length, NULL);
+}
+
+int js_serial_request(struct js_serial *serial, const void *data,
+	size_t length, js_serial_response_cb callback, void *user)
+{
+	struct js_serial_request *request;
+
+	if (!serial || !data || !length)
+		return -EINVAL;
+
+	request = g_new0(struct js_serial_request, 1);
+	request->callback = callback;
+	request->data = user;
+
+	return js_serial_queue(serial, data, length, request);
+}
+
+int js_serial_get_stats(struct js_serial *serial, struct js_serial_stats *stats)
+{
+	if (!serial || !stats)
+		return -EINVAL;
+
+	*stats = serial->stats;
+	return 0;
+}
+
+JSObjectRef js_serial_stats_to_object(JSContextRef context,
+	struct js_serial *serial)
+{
+	const struct {
+		const char *name;
+		double value;
+	} values[] = {
+		{ "rxFrames", serial->stats.rx_frames },
+		{ "rxBytes", serial->stats.rx_bytes },
+		{ "txFrames", serial->stats.tx_frames },
+		{ "txBytes", serial->stats.tx_bytes },
+		{ "timeouts", serial->stats.timeouts },
+		{ "errors", serial->stats.errors },
+		{ "overruns", serial->stats.overruns },
+		{ "responses", serial->stats.responses },
+		/* in milliseconds, like every other time in the API */
+		{ "latency", serial->stats.latency_avg / 1000.0 },
+		{ "maxLatency", serial->stats.latency_max / 1000.0 },
+	};
+	JSObjectRef object;
+	guint i;
+
+	object = JSObjectMake(context, NULL, NULL);
+	if (!object)
+		return NULL;
+
+	for (i = 0; i < G_N_ELEMENTS(values); i++)
+		javascript_object_set_property(context, object, values[i].name,
+			JSValueMakeNumber(context, values[i].value),
+			kJSPropertyAttributeReadOnly, NULL);
+
+	return object;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2017 Avionic Design GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef JAVASCRIPT_SERIAL_H
+#define JAVASCRIPT_SERIAL_H 1
+
+#include <glib.h>
+#include <JavaScriptCore/JavaScript.h>
+
+#include "remote-control.h"
+
+/** A non-blocking, framed serial port running in a GLib main context */
+struct js_serial;
+
+/**
+ * Callback to find the end of a frame in the received data
+ *
+ * @param data   The buffered data, starting with the next frame
+ * @param length The number of buffered bytes
+ * @return The length of the first frame, 0 if the frame is not yet
+ *         complete or a negative error code to drop the buffered data
+ */
+typedef ssize_t (*js_serial_frame_cb)(const guint8 *data, size_t length);
+
+/**
+ * Callback run for frames that are not the response to a request
+ *
+ * @param data   The user data passed to js_serial_set_receive_cb()
+ * @param frame  The frame, only valid during the callback
+ * @param length The frame length
+ */
+typedef void (*js_serial_receive_cb)(void *data, const guint8 *frame,
+	size_t length);
+
+/**
+ * Callback run when a request has been answered or has timed out
+ *
+ * @param data   The user data passed to js_serial_request()
+ * @param status 0 on success, -ETIMEDOUT or another negative error code
+ * @param frame  The response, NULL if there is none
+ * @param length The response length
+ */
+typedef void (*js_serial_response_cb)(void *data, int status,
+	const guint8 *frame, size_t length);
+
+/**
+ * How the byte stream of a port is split into frames. Frames end with the
+ * delimiter, after a fixed number of bytes or where the parse callback says
+ * so. The inter-byte gap ends frames for ports without any of these and
+ * discards incomplete frames for all others.
+ */
+struct js_serial_config {
+	/** Frame delimiter, included in the frame, -1 if unused */
+	int delimiter;
+	/** Fixed frame length, 0 if unused */
+	size_t frame_length;
+	/** Frame parser, NULL if unused */
+	js_serial_frame_cb parse;
+	/** Maximum silence within a frame in milliseconds, 0 to disable */
+	unsigned int gap;
+	/** Time a request waits for its response in milliseconds */
+	unsigned int timeout;
+	/** Where received and sent frames are traced */
+	enum trace_source trace;
+};
+
+struct js_serial_stats {
+	unsigned long rx_frames;
+	unsigned long rx_bytes;
+	unsigned long tx_frames;
+	unsigned long tx_bytes;
+	/** Requests that didn't get a response in time */
+	unsigned long timeouts;
+	/** Incomplete or invalid frames and failed reads or writes */
+	unsigned long errors;
+	/** Data dropped because the receive buffer was full */
+	unsigned long overruns;
+	/** Responses received, the latency is averaged over these */
+	unsigned long responses;
+	/** Time from sending a request to its response in microseconds */
+	guint64 latency_avg;
+	guint64 latency_max;
+};
+
+/**
+ * Wrap an opened and configured TTY
+ *
+ * @param serialp The newly allocated port
+ * @param fd      The TTY, owned by the port from now on
+ * @param config  The framing of the port
+ * @param context The main context to run in, NULL for the default
+ * @return A negative error code in case of error, 0 otherwise
+ */
+int js_serial_create(struct js_serial **serialp, int fd,
+	const struct js_serial_config *config, GMainContext *context);
+
+/**
+ * Close the port, outstanding requests are dropped without calling back
+ *
+ * @param serial The port to close
+ */
+void js_serial_free(struct js_serial *serial);
+
+void js_serial_set_receive_cb(struct js_serial *serial,
+	js_serial_receive_cb callback, void *data);
+
+/**
+ * Queue data for sending, without expecting a response
+ *
+ * @return A negative error code in case of error, 0 otherwise
+ */
+int js_serial_send(struct js_serial *serial, const void *data, size_t length);
+
+/**
+ * Queue a request, the next frame received after the request and all
+ * requests before it have been answered is taken as its response
+ *
+ * @return A negative error code in case of error, 0 otherwise
+ */
+int js_serial_request(struct js_serial *serial, const void *data,
+	size_t length, js_serial_response_cb callback, void *user);
+
+int js_serial_get_stats(struct js_serial *serial, struct js_serial_stats *stats);
+
+/**
+ * Helper to report the statistics of a port to JavaScript
+ *
+ * @return A new object or NULL in case of error
+ */
+JSObjectRef js_serial_stats_to_object(JSContextRef context,
+	struct js_serial *serial);
+
+#endif /* JAVASCRIPT_SERIAL_H */
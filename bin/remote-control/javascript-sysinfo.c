@@ -11,7 +11,10 @@
 #endif
 
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
+#include <dirent.h>
+#include <malloc.h>
 #include <ifaddrs.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
@@ -20,6 +23,10 @@
 #include <sys/utsname.h>
 #include <sys/ioctl.h>
 
+#ifdef USE_WEBKIT2
+#include <webkit2/webkit2.h>
+#endif
+
 #include "javascript.h"
 
 #define SYSINFO_RELEASE_FILE "/etc/os-release"
@@ -27,8 +34,25 @@
 #define SYSINFO_RELEASE_GROUP "INFO"
 #define SYSINFO_RELEASE_GROUP_DATA "["SYSINFO_RELEASE_GROUP"]\n"
 
+#define SYSINFO_MAX_TASKS 64
+
+/* all sizes in kB, like the kernel reports them */
+struct sysinfo_memory {
+	unsigned long rss;
+	unsigned long pss;
+	unsigned long swap;
+	unsigned int processes;
+};
+
+struct sysinfo_process {
+	pid_t pid;
+	pid_t ppid;
+	char comm[16];
+};
+
 struct sysinfo {
 	struct remote_control_data *rcd;
+	RemoteControlWebkitWindow *window;
 };
 
 static struct ifaddrs *sysinfo_get_if(struct ifaddrs *ifaddr, char *interface)
@@ -415,9 +439,8 @@ static JSValueRef sysinfo_function_get_free_memory(
 		return NULL;
 	}
 
-	/* TODO: mayby we should and query the memory usage of
-	 *       remote-control and its children to calculate
-	 *       the free memory? */
+	/* see getMemoryStats() for the usage of remote-control and its
+	 * children */
 	avail_pages = sysconf(_SC_AVPHYS_PAGES);
 	page_size = sysconf(_SC_PAGE_SIZE);
 
@@ -430,6 +453,549 @@ static JSValueRef sysinfo_function_get_free_memory(
 	return JSValueMakeNumber(context, (avail_pages * page_size) / 1024);
 }
 
+static int sysinfo_read_meminfo(unsigned long *total,
+	unsigned long *available)
+{
+	unsigned long value, free = 0, buffers = 0, cached = 0;
+	bool have_available = false;
+	char line[128];
+	FILE *fp;
+
+	fp = fopen("/proc/meminfo", "r");
+	if (!fp)
+		return -errno;
+
+	*total = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "MemTotal: %lu kB", &value) == 1)
+			*total = value;
+		else if (sscanf(line, "MemFree: %lu kB", &value) == 1)
+			free = value;
+		else if (sscanf(line, "Buffers: %lu kB", &value) == 1)
+			buffers = value;
+		else if (sscanf(line, "Cached: %lu kB", &value) == 1)
+			cached = value;
+		else if (sscanf(line, "MemAvailable: %lu kB", &value) == 1) {
+			*available = value;
+			have_available = true;
+		}
+	}
+
+	fclose(fp);
+
+	/* kernels before 3.14 don't provide an estimate of their own */
+	if (!have_available)
+		*available = free + buffers + cached;
+
+	return 0;
+}
+
+/* cheap, but counts shared pages in full and doesn't know about swap */
+static int sysinfo_read_statm(pid_t pid, struct sysinfo_memory *memory)
+{
+	unsigned long size, resident;
+	char path[32];
+	int ret = 0;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/%d/statm", pid);
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -errno;
+
+	if (fscanf(fp, "%lu %lu", &size, &resident) == 2) {
+		resident *= sysconf(_SC_PAGE_SIZE) / 1024;
+		memory->rss += resident;
+		memory->pss += resident;
+		memory->processes++;
+	} else {
+		ret = -EIO;
+	}
+
+	fclose(fp);
+	return ret;
+}
+
+/*
+ * smaps_rollup (Linux 4.14) sums up smaps in the kernel, which is orders of
+ * magnitude cheaper than parsing smaps for a WebKit process with thousands
+ * of mappings. Older kernels get the statm numbers instead.
+ */
+static int sysinfo_read_rollup(pid_t pid, struct sysinfo_memory *memory)
+{
+	unsigned long value;
+	char path[40];
+	char line[128];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", pid);
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return sysinfo_read_statm(pid, memory);
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "Rss: %lu kB", &value) == 1)
+			memory->rss += value;
+		else if (sscanf(line, "Pss: %lu kB", &value) == 1)
+			memory->pss += value;
+		else if (sscanf(line, "Swap: %lu kB", &value) == 1)
+			memory->swap += value;
+	}
+
+	memory->processes++;
+	fclose(fp);
+	return 0;
+}
+
+/* snapshot of all processes with their parents, taken in a single pass */
+static GArray *sysinfo_scan_processes(void)
+{
+	struct sysinfo_process process;
+	struct dirent *entry;
+	char path[32];
+	char line[256];
+	GArray *list;
+	char *comm;
+	DIR *dir;
+	FILE *fp;
+
+	dir = opendir("/proc");
+	if (!dir)
+		return NULL;
+
+	list = g_array_new(FALSE, FALSE, sizeof(process));
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] < '1' || entry->d_name[0] > '9')
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+		fp = fopen(path, "r");
+		if (!fp)
+			continue;
+
+		if (!fgets(line, sizeof(line), fp)) {
+			fclose(fp);
+			continue;
+		}
+		fclose(fp);
+
+		/* the command name may contain spaces and parentheses */
+		comm = strrchr(line, ')');
+		if (!comm || sscanf(comm, ") %*c %d", &process.ppid) != 1)
+			continue;
+		*comm = '\0';
+
+		comm = strchr(line, '(');
+		if (!comm)
+			continue;
+
+		process.pid = atoi(entry->d_name);
+		g_strlcpy(process.comm, comm + 1, sizeof(process.comm));
+		g_array_append_val(list, process);
+	}
+
+	closedir(dir);
+	return list;
+}
+
+static void sysinfo_add_tree(GArray *processes, pid_t pid,
+	struct sysinfo_memory *memory)
+{
+	guint i;
+
+	sysinfo_read_rollup(pid, memory);
+
+	for (i = 0; i < processes->len; i++) {
+		struct sysinfo_process *process =
+			&g_array_index(processes, struct sysinfo_process, i);
+
+		if (process->ppid == pid)
+			sysinfo_add_tree(processes, process->pid, memory);
+	}
+}
+
+static bool sysinfo_is_task(const int32_t *tasks, int num_tasks, pid_t pid)
+{
+	int i;
+
+	for (i = 0; i < num_tasks; i++)
+		if (tasks[i] == pid)
+			return true;
+
+	return false;
+}
+
+/*
+ * Splits the children of remote-control into the auxiliary processes of
+ * WebKit, which hold the page contents and the memory cache, and the
+ * processes started through the task manager, including their children.
+ * remote-control-browser is a separate program, so its ad blocker URL
+ * cache and open PDF documents are part of its own PSS, which shows up in
+ * the tasks if it was started through the task manager.
+ */
+static void sysinfo_get_children_memory(struct sysinfo *inf,
+	struct sysinfo_memory *browser, struct sysinfo_memory *tasks)
+{
+	int32_t task_pids[SYSINFO_MAX_TASKS];
+	pid_t self = getpid();
+	int num_tasks = 0;
+	GArray *processes;
+	guint i;
+
+	processes = sysinfo_scan_processes();
+	if (!processes)
+		return;
+
+	if (inf->rcd && inf->rcd->rc)
+		num_tasks = task_manager_get_real_pids(inf->rcd->rc, task_pids,
+				G_N_ELEMENTS(task_pids));
+
+	for (i = 0; i < processes->len; i++) {
+		struct sysinfo_process *process =
+			&g_array_index(processes, struct sysinfo_process, i);
+
+		if (process->ppid != self)
+			continue;
+
+		if (sysinfo_is_task(task_pids, num_tasks, process->pid))
+			sysinfo_add_tree(processes, process->pid, tasks);
+		else if (g_str_has_prefix(process->comm, "WebKit"))
+			sysinfo_add_tree(processes, process->pid, browser);
+	}
+
+	g_array_free(processes, TRUE);
+}
+
+static JSObjectRef sysinfo_make_memory(JSContextRef context,
+	const struct sysinfo_memory *memory, bool detailed)
+{
+	JSObjectRef object = JSObjectMake(context, NULL, NULL);
+
+	javascript_object_set_property(context, object, "rss",
+		JSValueMakeNumber(context, memory->rss),
+		kJSPropertyAttributeReadOnly, NULL);
+	if (!detailed)
+		return object;
+
+	javascript_object_set_property(context, object, "pss",
+		JSValueMakeNumber(context, memory->pss),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "swap",
+		JSValueMakeNumber(context, memory->swap),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "processes",
+		JSValueMakeNumber(context, memory->processes),
+		kJSPropertyAttributeReadOnly, NULL);
+
+	return object;
+}
+
+/* the fields of struct mallinfo are int and wrap beyond 2 GiB */
+#ifdef HAVE_MALLINFO2
+#define SYSINFO_HEAP_KB(value) ((size_t)(value) / 1024)
+#else
+#define SYSINFO_HEAP_KB(value) ((unsigned int)(value) / 1024)
+#endif
+
+static JSObjectRef sysinfo_make_heap(JSContextRef context)
+{
+	JSObjectRef object = JSObjectMake(context, NULL, NULL);
+#ifdef HAVE_MALLINFO2
+	struct mallinfo2 info = mallinfo2();
+#else
+	struct mallinfo info = mallinfo();
+#endif
+
+	/* mallinfo() reports bytes, everything else here is in kB */
+	javascript_object_set_property(context, object, "arena",
+		JSValueMakeNumber(context, SYSINFO_HEAP_KB(info.arena)),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "mmap",
+		JSValueMakeNumber(context, SYSINFO_HEAP_KB(info.hblkhd)),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "used",
+		JSValueMakeNumber(context, SYSINFO_HEAP_KB(info.uordblks)),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "free",
+		JSValueMakeNumber(context, SYSINFO_HEAP_KB(info.fordblks)),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "releasable",
+		JSValueMakeNumber(context, SYSINFO_HEAP_KB(info.keepcost)),
+		kJSPropertyAttributeReadOnly, NULL);
+
+	return object;
+}
+
+/*
+ * The default is meant to be polled: it costs a few small reads from /proc
+ * and doesn't walk the process tree. Passing true additionally reports the
+ * proportional set size of remote-control, the WebKit processes and the
+ * tasks, which is what matters when deciding whether to trim caches.
+ */
+static JSValueRef sysinfo_function_get_memory_stats(
+	JSContextRef context, JSObjectRef function, JSObjectRef object,
+	size_t argc, const JSValueRef argv[], JSValueRef *exception)
+{
+	struct sysinfo *inf = JSObjectGetPrivate(object);
+	struct sysinfo_memory self = { 0 }, browser = { 0 }, tasks = { 0 };
+	unsigned long total = 0, available = 0;
+	bool detailed = false;
+	JSObjectRef stats;
+	int err;
+
+	if (!inf) {
+		javascript_set_exception_text(context, exception,
+				JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	/* Usage: getMemoryStats([detailed]) */
+	switch (argc) {
+	case 1:
+		detailed = JSValueToBoolean(context, argv[0]);
+		break;
+	case 0:
+		break;
+	default:
+		javascript_set_exception_text(context, exception,
+				JS_ERR_INVALID_ARG_COUNT);
+		return NULL;
+	}
+
+	err = sysinfo_read_meminfo(&total, &available);
+	if (err < 0) {
+		javascript_set_exception_text(context, exception,
+			"failed to query memory stats: %s", g_strerror(-err));
+		return NULL;
+	}
+
+	if (detailed) {
+		sysinfo_read_rollup(getpid(), &self);
+		sysinfo_get_children_memory(inf, &browser, &tasks);
+	} else {
+		sysinfo_read_statm(getpid(), &self);
+	}
+
+	stats = JSObjectMake(context, NULL, NULL);
+	javascript_object_set_property(context, stats, "total",
+		JSValueMakeNumber(context, total),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, stats, "available",
+		JSValueMakeNumber(context, available),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, stats, "self",
+		sysinfo_make_memory(context, &self, detailed),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, stats, "heap",
+		sysinfo_make_heap(context),
+		kJSPropertyAttributeReadOnly, NULL);
+
+	if (detailed) {
+		javascript_object_set_property(context, stats, "browser",
+			sysinfo_make_memory(context, &browser, true),
+			kJSPropertyAttributeReadOnly, NULL);
+		javascript_object_set_property(context, stats, "tasks",
+			sysinfo_make_memory(context, &tasks, true),
+			kJSPropertyAttributeReadOnly, NULL);
+	}
+
+	return stats;
+}
+
+/*
+ * Drops what can be recreated on demand: the WebKit resource caches and the
+ * free memory the allocator still holds on to. Meant to be called by pages
+ * once getMemoryStats() reports memory running low, before the OOM killer
+ * picks a victim of its own.
+ */
+static JSValueRef sysinfo_function_trim_memory(
+	JSContextRef context, JSObjectRef function, JSObjectRef object,
+	size_t argc, const JSValueRef argv[], JSValueRef *exception)
+{
+	struct sysinfo *inf = JSObjectGetPrivate(object);
+
+	if (!inf) {
+		javascript_set_exception_text(context, exception,
+				JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	/* Usage: trimMemory() */
+	if (argc) {
+		javascript_set_exception_text(context, exception,
+				JS_ERR_INVALID_ARG_COUNT);
+		return NULL;
+	}
+
+#ifdef USE_WEBKIT2
+	webkit_web_context_clear_cache(webkit_web_context_get_default());
+#endif
+	malloc_trim(0);
+
+	return JSValueMakeUndefined(context);
+}
+
+static JSValueRef sysinfo_make_gpio_stats(JSContextRef context,
+	struct gpio_backend *backend, enum gpio gpio)
+{
+	struct gpio_stats stats;
+	JSObjectRef object;
+
+	if (gpio_backend_get_stats(backend, gpio, &stats) < 0)
+		return JSValueMakeNull(context);
+
+	object = JSObjectMake(context, NULL, NULL);
+	javascript_object_set_property(context, object, "events",
+		JSValueMakeNumber(context, stats.events),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "suppressed",
+		JSValueMakeNumber(context, stats.suppressed),
+		kJSPropertyAttributeReadOnly, NULL);
+
+	return object;
+}
+
+/*
+ * Returns the number of edges seen on the handset and smartcard lines and
+ * how many of them were dropped by the debouncing, or null for a line the
+ * GPIO backend doesn't keep counters for.
+ */
+static JSValueRef sysinfo_function_get_gpio_stats(
+	JSContextRef context, JSObjectRef function, JSObjectRef object,
+	size_t argc, const JSValueRef argv[], JSValueRef *exception)
+{
+	struct sysinfo *inf = JSObjectGetPrivate(object);
+	struct gpio_backend *backend;
+	JSObjectRef stats;
+
+	if (!inf) {
+		javascript_set_exception_text(context, exception,
+				JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	/* Usage: getGpioStats() */
+	if (argc) {
+		javascript_set_exception_text(context, exception,
+				JS_ERR_INVALID_ARG_COUNT);
+		return NULL;
+	}
+
+	backend = remote_control_get_gpio_backend(inf->rcd->rc);
+	if (!backend)
+		return JSValueMakeNull(context);
+
+	stats = JSObjectMake(context, NULL, NULL);
+	javascript_object_set_property(context, stats, "handset",
+		sysinfo_make_gpio_stats(context, backend, GPIO_HANDSET),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, stats, "smartcard",
+		sysinfo_make_gpio_stats(context, backend, GPIO_SMARTCARD),
+		kJSPropertyAttributeReadOnly, NULL);
+
+	return stats;
+}
+
+/*
+ * Counters for comparing what page loads cost: how long setting up the
+ * AvionicDesign object and its modules took (in milliseconds), how many
+ * descriptors the modules opened and how many are open now. The time of
+ * the navigation itself is reported by Browser.getTimeline().
+ */
+static JSValueRef sysinfo_function_get_script_stats(
+	JSContextRef context, JSObjectRef function, JSObjectRef object,
+	size_t argc, const JSValueRef argv[], JSValueRef *exception)
+{
+	struct javascript_stats stats;
+	JSObjectRef result;
+
+	/* Usage: getScriptStats() */
+	if (argc) {
+		javascript_set_exception_text(context, exception,
+				JS_ERR_INVALID_ARG_COUNT);
+		return NULL;
+	}
+
+	javascript_get_stats(&stats);
+
+	result = JSObjectMake(context, NULL, NULL);
+	javascript_object_set_property(context, result, "pages",
+		JSValueMakeNumber(context, stats.pages),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, result, "registerTime",
+		JSValueMakeNumber(context, stats.register_time / 1000.0),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, result, "modules",
+		JSValueMakeNumber(context, stats.modules),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, result, "createTime",
+		JSValueMakeNumber(context, stats.create_time / 1000.0),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, result, "moduleFds",
+		JSValueMakeNumber(context, stats.module_fds),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, result, "openFds",
+		JSValueMakeNumber(context, stats.open_fds),
+		kJSPropertyAttributeReadOnly, NULL);
+
+	return result;
+}
+
+/*
+ * How the requests to the cached origin were served since the start, or
+ * null if no cache is set up.
+ */
+static JSValueRef sysinfo_function_get_cache_stats(
+	JSContextRef context, JSObjectRef function, JSObjectRef object,
+	size_t argc, const JSValueRef argv[], JSValueRef *exception)
+{
+	struct sysinfo *inf = JSObjectGetPrivate(object);
+	struct webkit_cache_stats stats;
+	JSObjectRef result;
+
+	if (!inf) {
+		javascript_set_exception_text(context, exception,
+				JS_ERR_INVALID_OBJECT_TEXT);
+		return NULL;
+	}
+
+	/* Usage: getCacheStats() */
+	if (argc) {
+		javascript_set_exception_text(context, exception,
+				JS_ERR_INVALID_ARG_COUNT);
+		return NULL;
+	}
+
+	if (!inf->window || !remote_control_webkit_window_get_cache_stats(
+			inf->window, &stats))
+		return JSValueMakeNull(context);
+
+	result = JSObjectMake(context, NULL, NULL);
+	javascript_object_set_property(context, result, "requests",
+		JSValueMakeNumber(context, stats.requests),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, result, "hits",
+		JSValueMakeNumber(context, stats.hits),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, result, "revalidated",
+		JSValueMakeNumber(context, stats.revalidated),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, result, "stale",
+		JSValueMakeNumber(context, stats.stale),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, result, "misses",
+		JSValueMakeNumber(context, stats.misses),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, result, "errors",
+		JSValueMakeNumber(context, stats.errors),
+		kJSPropertyAttributeReadOnly, NULL);
+
+	return result;
+}
+
 static struct sysinfo *sysinfo_new(JSContextRef context,
 	struct javascript_userdata *data)
 {
@@ -440,6 +1006,7 @@ static struct sysinfo *sysinfo_new(JSContextRef context,
 		return NULL;
 	}
 	inf->rcd = data->rcd;
+	inf->window = data->window;
 
 	return inf;
 }
@@ -459,6 +1026,26 @@ static const JSStaticFunction sysinfo_functions[] = {
 		.name = "getFreeMem",
 		.callAsFunction = sysinfo_function_get_free_memory,
 		.attributes = kJSPropertyAttributeDontDelete,
+	},{
+		.name = "getMemoryStats",
+		.callAsFunction = sysinfo_function_get_memory_stats,
+		.attributes = kJSPropertyAttributeDontDelete,
+	},{
+		.name = "trimMemory",
+		.callAsFunction = sysinfo_function_trim_memory,
+		.attributes = kJSPropertyAttributeDontDelete,
+	},{
+		.name = "getGpioStats",
+		.callAsFunction = sysinfo_function_get_gpio_stats,
+		.attributes = kJSPropertyAttributeDontDelete,
+	},{
+		.name = "getScriptStats",
+		.callAsFunction = sysinfo_function_get_script_stats,
+		.attributes = kJSPropertyAttributeDontDelete,
+	},{
+		.name = "getCacheStats",
+		.callAsFunction = sysinfo_function_get_cache_stats,
+		.attributes = kJSPropertyAttributeDontDelete,
 	},{
 		.name = "localIP",
 		.callAsFunction = sysinfo_function_local_ip,
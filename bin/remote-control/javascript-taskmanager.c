@@ -163,13 +163,40 @@ static const JSStaticValue taskmanager_properties[] = {
 	{}
 };
 
+static JSValueRef taskmanager_make_usage(JSContextRef context,
+		const struct task_usage *usage)
+{
+	JSObjectRef object;
+
+	object = JSObjectMake(context, NULL, NULL);
+	if (!object)
+		return JSValueMakeNull(context);
+
+	/* times in seconds, peak RSS in kB */
+	javascript_object_set_property(context, object, "user",
+		JSValueMakeNumber(context, usage->utime / 1000000.0),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "system",
+		JSValueMakeNumber(context, usage->stime / 1000000.0),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "maxrss",
+		JSValueMakeNumber(context, usage->maxrss),
+		kJSPropertyAttributeReadOnly, NULL);
+	javascript_object_set_property(context, object, "launch",
+		JSValueMakeNumber(context, usage->launch / 1000000.0),
+		kJSPropertyAttributeReadOnly, NULL);
+
+	return object;
+}
+
 static void taskmanager_terminate_cb(int pid, void *data, int status)
 {
 	JSObjectRef object = data;
 	struct taskmanager *tm = JSObjectGetPrivate(object);
+	struct task_usage usage;
 
 	JSValueRef exception = NULL;
-	JSValueRef args[2];
+	JSValueRef args[3];
 
 	if (tm->callback == NULL)
 		return;
@@ -177,6 +204,11 @@ static void taskmanager_terminate_cb(int pid, void *data, int status)
 	args[0] = JSValueMakeNumber(tm->context, pid);
 	args[1] = JSValueMakeNumber(tm->context, status);
 
+	if (task_manager_get_usage(tm->rcd->rc, pid, &usage) == 0)
+		args[2] = taskmanager_make_usage(tm->context, &usage);
+	else
+		args[2] = JSValueMakeNull(tm->context);
+
 	(void)JSObjectCallAsFunction(tm->context, tm->callback,
 			object, G_N_ELEMENTS(args), args, &exception);
 	if (exception)
@@ -12,6 +12,7 @@
 
 #include <JavaScriptCore/JavaScript.h>
 #include <glib.h>
+#include <dirent.h>
 #include <errno.h>
 #include <math.h>
 #include <string.h>
@@ -27,6 +28,7 @@ extern struct javascript_module javascript_taskmanager;
 extern struct javascript_module javascript_audio;
 extern struct javascript_module javascript_audio_player;
 extern struct javascript_module javascript_backlight;
+extern struct javascript_module javascript_browser;
 extern struct javascript_module javascript_media_player;
 extern struct javascript_module javascript_medial;
 extern struct javascript_module javascript_modem;
@@ -55,6 +57,7 @@ static struct javascript_module *ad_modules[] = {
 	&javascript_audio,
 	&javascript_audio_player,
 	&javascript_backlight,
+	&javascript_browser,
 	&javascript_media_player,
 #ifdef ENABLE_JAVASCRIPT_MEDIAL
 	&javascript_medial,
@@ -572,45 +575,160 @@ cleanup:
 	return ret;
 }
 
-static int javascript_register_module(JSGlobalContextRef js,
-				JSObjectRef parent,
-				struct javascript_module *module,
-				struct javascript_userdata *data)
+/*
+ * Modules are only instantiated when a page first accesses them, which spares
+ * pages that use just a few of them from opening every device, watching udev
+ * and polling ttys on each load. Each page gets its own set of flags, so that
+ * a module is created at most once per page, successful or not.
+ */
+struct javascript_avionic_design {
+	struct javascript_userdata data;
+	bool created[G_N_ELEMENTS(ad_modules)];
+};
+
+static JSClassRef avionic_design_class;
+static struct javascript_stats javascript_stats;
+
+static int javascript_count_fds(void)
 {
-	JSObjectRef object;
+	struct dirent *entry;
+	int count = 0;
+	DIR *dir;
 
-	if (!module->create)
-		return 0;
+	dir = opendir("/proc/self/fd");
+	if (!dir)
+		return -errno;
 
-	object = module->create(js, module->class, data);
-	if (!object)
-		return -ENODEV;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] != '.')
+			count++;
+	}
 
-	return javascript_object_set_property(
-		js, parent, module->classdef->className, object, 0, NULL);
+	closedir(dir);
+
+	/* don't count the descriptor used for reading the directory */
+	return count - 1;
+}
+
+static int javascript_find_module(JSStringRef name)
+{
+	int i;
+
+	for (i = 0; ad_modules[i]; i++) {
+		if (ad_modules[i]->create && JSStringIsEqualToUTF8CString(name,
+				ad_modules[i]->classdef->className))
+			return i;
+	}
+
+	return -ENOENT;
 }
 
+static JSValueRef javascript_avionic_design_get(JSContextRef js,
+		JSObjectRef object, JSStringRef name, JSValueRef *exception)
+{
+	struct javascript_avionic_design *ad = JSObjectGetPrivate(object);
+	struct javascript_module *module;
+	JSObjectRef instance;
+	gint64 start, elapsed;
+	int index, fds;
+
+	if (!ad)
+		return NULL;
+
+	/* instantiated modules are regular properties of the object */
+	index = javascript_find_module(name);
+	if (index < 0 || ad->created[index])
+		return NULL;
+
+	module = ad_modules[index];
+	ad->created[index] = true;
+
+	fds = javascript_count_fds();
+	start = g_get_monotonic_time();
+
+	instance = module->create(js, module->class, &ad->data);
+
+	elapsed = g_get_monotonic_time() - start;
+	fds = javascript_count_fds() - fds;
+
+	if (!instance) {
+		g_warning("%s: failed to create %s object", __func__,
+			module->classdef->className);
+		return NULL;
+	}
+
+	javascript_stats.modules++;
+	javascript_stats.create_time += elapsed;
+	javascript_stats.module_fds += fds;
+
+	if (ad->data.window)
+		remote_control_webkit_window_add_javascript_time(
+			ad->data.window, elapsed);
+
+	g_debug("%s: created %s object in %" G_GINT64_FORMAT " us, %d fds",
+		__func__, module->classdef->className, elapsed, fds);
+
+	javascript_object_set_property(js, object, module->classdef->className,
+		instance, 0, NULL);
+
+	return instance;
+}
+
+static void javascript_avionic_design_get_names(JSContextRef js,
+		JSObjectRef object, JSPropertyNameAccumulatorRef names)
+{
+	struct javascript_avionic_design *ad = JSObjectGetPrivate(object);
+	JSStringRef name;
+	int i;
+
+	if (!ad)
+		return;
+
+	for (i = 0; ad_modules[i]; i++) {
+		if (!ad_modules[i]->create || ad->created[i])
+			continue;
+
+		name = JSStringCreateWithUTF8CString(
+				ad_modules[i]->classdef->className);
+		JSPropertyNameAccumulatorAddName(names, name);
+		JSStringRelease(name);
+	}
+}
+
+static void javascript_avionic_design_finalize(JSObjectRef object)
+{
+	struct javascript_avionic_design *ad = JSObjectGetPrivate(object);
+
+	g_free(ad);
+}
+
+static const JSClassDefinition avionic_design_classdef = {
+	.className = "AvionicDesign",
+	.getProperty = javascript_avionic_design_get,
+	.getPropertyNames = javascript_avionic_design_get_names,
+	.finalize = javascript_avionic_design_finalize,
+};
+
 static int javascript_register_avionic_design(JSGlobalContextRef js,
                                               JSObjectRef parent,
                                               const char *name,
 					      struct javascript_userdata *data)
 {
+	struct javascript_avionic_design *ad;
 	JSValueRef api_version;
 	JSObjectRef object;
-	int i, err;
+	int err;
 
-	object = JSObjectMake(js, NULL, NULL);
+	ad = g_new0(struct javascript_avionic_design, 1);
+	if (!ad)
+		return -ENOMEM;
 
-	for (i = 0; ad_modules[i]; i++) {
-		err = javascript_register_module(
-			js, object, ad_modules[i], data);
-		if (err) {
-			g_warning("%s: failed to register %s object: %s",
-				__func__, ad_modules[i]->classdef->className,
-				g_strerror(-err));
-			if (err != -ENODEV)
-				return err;
-		}
+	ad->data = *data;
+
+	object = JSObjectMake(js, avionic_design_class, ad);
+	if (!object) {
+		g_free(ad);
+		return -ENOMEM;
 	}
 
 	api_version = JSValueMakeNumber(js, JS_API_VERSION);
@@ -627,6 +745,7 @@ static int javascript_register_avionic_design(JSGlobalContextRef js,
 		js, parent, name, object, 0, NULL);
 }
 
+/* classes don't depend on the page, so they are created once per process */
 static int javascript_register_classes(void)
 {
 	int i;
@@ -640,50 +759,48 @@ static int javascript_register_classes(void)
 		}
 	}
 
-	return 0;
-}
-
-static void javascript_release_classes(void)
-{
-	int i;
+	avionic_design_class = JSClassCreate(&avionic_design_classdef);
+	if (!avionic_design_class)
+		return -ENOMEM;
 
-	for (i = 0; ad_modules[i]; i++) {
-		if (ad_modules[i]->class) {
-			JSClassRelease(ad_modules[i]->class);
-			ad_modules[i]->class = NULL;
-		}
-	}
+	return 0;
 }
 
 int javascript_register(JSGlobalContextRef context,
                         struct javascript_userdata *user_data)
 {
 	JSObjectRef object;
+	gint64 start, elapsed;
 	int err;
 
-	err = javascript_register_classes();
-	if (err < 0) {
-		g_debug("failed to register JavaScript classes: %s",
-				g_strerror(-err));
-		return err;
-	}
-
+	start = g_get_monotonic_time();
 	object = JSContextGetGlobalObject(context);
 
 	err = javascript_register_avionic_design(context, object,
 	                                         "AvionicDesign",
 	                                         user_data);
-	javascript_release_classes();
-
 	if (err < 0) {
 		g_debug("failed to register AvionicDesign object: %s",
 				g_strerror(-err));
 		return err;
 	}
 
+	elapsed = g_get_monotonic_time() - start;
+	javascript_stats.pages++;
+	javascript_stats.register_time += elapsed;
+
+	g_debug("registered AvionicDesign object in %" G_GINT64_FORMAT " us",
+		elapsed);
+
 	return 0;
 }
 
+void javascript_get_stats(struct javascript_stats *stats)
+{
+	*stats = javascript_stats;
+	stats->open_fds = javascript_count_fds();
+}
+
 int javascript_init(GKeyFile *config)
 {
 	int i, err;
@@ -700,5 +817,33 @@ int javascript_init(GKeyFile *config)
 		}
 	}
 
+	err = javascript_register_classes();
+	if (err < 0) {
+		g_debug("failed to register JavaScript classes: %s",
+				g_strerror(-err));
+		return err;
+	}
+
 	return 0;
 }
+
+/* called once all pages are gone, stops what the modules started in init */
+void javascript_exit(void)
+{
+	int i;
+
+	for (i = 0; ad_modules[i]; i++) {
+		if (ad_modules[i]->exit)
+			ad_modules[i]->exit();
+
+		if (ad_modules[i]->class) {
+			JSClassRelease(ad_modules[i]->class);
+			ad_modules[i]->class = NULL;
+		}
+	}
+
+	if (avionic_design_class) {
+		JSClassRelease(avionic_design_class);
+		avionic_design_class = NULL;
+	}
+}
@@ -35,6 +35,7 @@ struct javascript_userdata {
 struct javascript_module {
 	const JSClassDefinition	*classdef;
 	int (*init)(GKeyFile *config);
+	void (*exit)(void);
 	JSObjectRef (*create)(JSContextRef js, JSClassRef class,
 			struct javascript_userdata *data);
 
@@ -125,5 +126,21 @@ int javascript_register(JSGlobalContextRef js,
 			struct javascript_userdata *user_data);
 
 int javascript_init(GKeyFile *config);
+void javascript_exit(void);
+
+/*
+ * What setting up the JavaScript API costs, so that page loads can be
+ * compared on a target. The navigation itself is in the browser timeline.
+ */
+struct javascript_stats {
+	guint64 pages;		/* AvionicDesign objects registered */
+	gint64 register_time;	/* us spent registering them */
+	guint64 modules;	/* module objects created */
+	gint64 create_time;	/* us spent creating them */
+	gint64 module_fds;	/* descriptors opened by creating them */
+	int open_fds;		/* descriptors open right now */
+};
+
+void javascript_get_stats(struct javascript_stats *stats);
 
 #endif /* JAVASCRIPT_API_H */
@@ -0,0 +1,446 @@
+/*
+ * Copyright (C) 2017 Avionic Design GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <string.h>
+
+#include "remote-control-webkit-cache.h"
+
+/*
+ * A disk cache for the kiosk page. Only resources of the kiosk origin are
+ * stored, everything else is left to the network. Entries are kept by URL
+ * and revalidated with their ETag or Last-Modified validators, the least
+ * recently used ones are evicted once the size limit is reached.
+ *
+ * When a request to the origin fails at the transport level, the backend
+ * is considered down and requests are answered with stale entries until
+ * a probe of the origin succeeds again.
+ */
+
+G_DEFINE_TYPE(RemoteControlWebkitCache, remote_control_webkit_cache, SOUP_TYPE_CACHE);
+
+#define REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), REMOTE_CONTROL_TYPE_WEBKIT_CACHE, RemoteControlWebkitCachePrivate))
+
+/* seconds between two probes of the origin while it is unreachable */
+#define WEBKIT_CACHE_PROBE_INTERVAL 10
+
+enum {
+	WEBKIT_CACHE_QUEUED = 1 << 0,
+	WEBKIT_CACHE_STARTED = 1 << 1,
+	WEBKIT_CACHE_STALE = 1 << 2,
+	WEBKIT_CACHE_PROBE = 1 << 3,
+};
+
+struct _RemoteControlWebkitCachePrivate {
+	GURI *origin;
+	SoupSession *session;
+	gboolean offline;
+	guint probe;
+	SoupMessage *probe_msg;
+
+	struct webkit_cache_stats stats;
+};
+
+enum {
+	PROP_0,
+	PROP_OFFLINE,
+};
+
+static GQuark webkit_cache_quark;
+/* the cache a probe belongs to, cleared when the probe is cancelled */
+static GQuark webkit_cache_owner_quark;
+
+static guint webkit_cache_get_flags(SoupMessage *msg)
+{
+	return GPOINTER_TO_UINT(g_object_get_qdata(G_OBJECT(msg),
+			webkit_cache_quark));
+}
+
+static void webkit_cache_set_flags(SoupMessage *msg, guint flags)
+{
+	g_object_set_qdata(G_OBJECT(msg), webkit_cache_quark,
+			GUINT_TO_POINTER(flags));
+}
+
+static gboolean webkit_cache_same_origin(RemoteControlWebkitCachePrivate *priv,
+		SoupMessage *msg)
+{
+	gboolean ret = FALSE;
+	GURI *uri;
+	gchar *s;
+
+	s = soup_uri_to_string(soup_message_get_uri(msg), FALSE);
+	uri = g_uri_new(s);
+	g_free(s);
+
+	if (uri) {
+		ret = g_uri_same_origin(uri, priv->origin);
+		g_object_unref(uri);
+	}
+
+	return ret;
+}
+
+static void webkit_cache_probe_done(SoupSession *session, SoupMessage *msg,
+		gpointer user_data);
+
+static gboolean webkit_cache_probe(gpointer user_data)
+{
+	RemoteControlWebkitCache *self = user_data;
+	RemoteControlWebkitCachePrivate *priv;
+	SoupMessage *msg;
+	gchar *uri;
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(self);
+
+	if (priv->probe_msg || !priv->session)
+		return TRUE;
+
+	uri = g_uri_to_string(priv->origin);
+	msg = soup_message_new(SOUP_METHOD_HEAD, uri);
+	g_free(uri);
+
+	if (!msg)
+		return TRUE;
+
+	soup_message_headers_append(msg->request_headers, "Cache-Control",
+			"no-cache");
+	webkit_cache_set_flags(msg, WEBKIT_CACHE_PROBE);
+	g_object_set_qdata(G_OBJECT(msg), webkit_cache_owner_quark, self);
+
+	/* the session takes over the reference */
+	priv->probe_msg = msg;
+	soup_session_queue_message(priv->session, msg,
+			webkit_cache_probe_done, NULL);
+
+	return TRUE;
+}
+
+static void webkit_cache_set_offline(RemoteControlWebkitCache *self,
+		gboolean offline)
+{
+	RemoteControlWebkitCachePrivate *priv;
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(self);
+
+	if (priv->offline == offline)
+		return;
+
+	g_debug("%s(): backend %s", __func__,
+			offline ? "unreachable, serving stale entries" :
+			"reachable again");
+
+	priv->offline = offline;
+
+	if (offline) {
+		priv->probe = g_timeout_add_seconds(WEBKIT_CACHE_PROBE_INTERVAL,
+				webkit_cache_probe, self);
+	} else if (priv->probe) {
+		g_source_remove(priv->probe);
+		priv->probe = 0;
+	}
+
+	g_object_notify(G_OBJECT(self), "offline");
+}
+
+static void webkit_cache_probe_done(SoupSession *session, SoupMessage *msg,
+		gpointer user_data)
+{
+	RemoteControlWebkitCache *self;
+	RemoteControlWebkitCachePrivate *priv;
+
+	/* cancelled probes may complete after the cache is gone */
+	self = g_object_get_qdata(G_OBJECT(msg), webkit_cache_owner_quark);
+	if (!self)
+		return;
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(self);
+	priv->probe_msg = NULL;
+
+	/* any HTTP response means the backend is back */
+	if (!SOUP_STATUS_IS_TRANSPORT_ERROR(msg->status_code))
+		webkit_cache_set_offline(self, FALSE);
+}
+
+static void webkit_cache_request_queued(SoupSession *session,
+		SoupMessage *msg, gpointer user_data)
+{
+	RemoteControlWebkitCache *self = user_data;
+	RemoteControlWebkitCachePrivate *priv;
+	guint flags = WEBKIT_CACHE_QUEUED;
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(self);
+
+	if (webkit_cache_get_flags(msg) & WEBKIT_CACHE_PROBE)
+		return;
+
+	if (!webkit_cache_same_origin(priv, msg))
+		return;
+
+	/* accept entries of any age rather than failing the request */
+	if (priv->offline) {
+		soup_message_headers_append(msg->request_headers,
+				"Cache-Control", "max-stale");
+		flags |= WEBKIT_CACHE_STALE;
+	}
+
+	priv->stats.requests++;
+	webkit_cache_set_flags(msg, flags);
+}
+
+static void webkit_cache_request_started(SoupSession *session,
+		SoupMessage *msg, SoupSocket *socket, gpointer user_data)
+{
+	guint flags = webkit_cache_get_flags(msg);
+
+	if (flags & WEBKIT_CACHE_QUEUED)
+		webkit_cache_set_flags(msg, flags | WEBKIT_CACHE_STARTED);
+}
+
+static void webkit_cache_request_unqueued(SoupSession *session,
+		SoupMessage *msg, gpointer user_data)
+{
+	RemoteControlWebkitCache *self = user_data;
+	RemoteControlWebkitCachePrivate *priv;
+	guint flags = webkit_cache_get_flags(msg);
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(self);
+
+	if (!(flags & WEBKIT_CACHE_QUEUED))
+		return;
+
+	/* requests that never went out were answered by the cache */
+	if (!(flags & WEBKIT_CACHE_STARTED)) {
+		if (flags & WEBKIT_CACHE_STALE)
+			priv->stats.stale++;
+		else
+			priv->stats.hits++;
+	} else if (msg->status_code == SOUP_STATUS_NOT_MODIFIED) {
+		priv->stats.revalidated++;
+	} else if (SOUP_STATUS_IS_TRANSPORT_ERROR(msg->status_code)) {
+		priv->stats.errors++;
+
+		if (msg->status_code != SOUP_STATUS_CANCELLED)
+			webkit_cache_set_offline(self, TRUE);
+	} else {
+		priv->stats.misses++;
+	}
+
+	webkit_cache_set_flags(msg, 0);
+}
+
+static SoupCacheability webkit_cache_get_cacheability(SoupCache *cache,
+		SoupMessage *msg)
+{
+	RemoteControlWebkitCachePrivate *priv;
+	SoupCacheClass *parent;
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(cache);
+	parent = SOUP_CACHE_CLASS(remote_control_webkit_cache_parent_class);
+
+	if (!webkit_cache_same_origin(priv, msg))
+		return SOUP_CACHE_UNCACHEABLE;
+
+	return parent->get_cacheability(cache, msg);
+}
+
+static void webkit_cache_get_property(GObject *object, guint prop_id,
+		GValue *value, GParamSpec *pspec)
+{
+	RemoteControlWebkitCachePrivate *priv;
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(object);
+
+	switch (prop_id) {
+	case PROP_OFFLINE:
+		g_value_set_boolean(value, priv->offline);
+		break;
+
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void webkit_cache_dispose(GObject *object)
+{
+	RemoteControlWebkitCache *self = REMOTE_CONTROL_WEBKIT_CACHE(object);
+	RemoteControlWebkitCachePrivate *priv;
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(self);
+
+	remote_control_webkit_cache_detach(self);
+
+	if (priv->probe) {
+		g_source_remove(priv->probe);
+		priv->probe = 0;
+	}
+
+	G_OBJECT_CLASS(remote_control_webkit_cache_parent_class)->dispose(object);
+}
+
+static void webkit_cache_finalize(GObject *object)
+{
+	RemoteControlWebkitCachePrivate *priv;
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(object);
+
+	if (priv->origin)
+		g_object_unref(priv->origin);
+
+	G_OBJECT_CLASS(remote_control_webkit_cache_parent_class)->finalize(object);
+}
+
+static void remote_control_webkit_cache_class_init(RemoteControlWebkitCacheClass *klass)
+{
+	GObjectClass *object = G_OBJECT_CLASS(klass);
+	SoupCacheClass *cache = SOUP_CACHE_CLASS(klass);
+
+	g_type_class_add_private(klass, sizeof(RemoteControlWebkitCachePrivate));
+
+	object->get_property = webkit_cache_get_property;
+	object->dispose = webkit_cache_dispose;
+	object->finalize = webkit_cache_finalize;
+	cache->get_cacheability = webkit_cache_get_cacheability;
+
+	g_object_class_install_property(object, PROP_OFFLINE,
+			g_param_spec_boolean("offline", "backend offline",
+				"Whether stale entries are served because the backend is unreachable.",
+				FALSE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+	webkit_cache_quark = g_quark_from_static_string("webkit-cache");
+	webkit_cache_owner_quark = g_quark_from_static_string(
+			"webkit-cache-owner");
+}
+
+static void remote_control_webkit_cache_init(RemoteControlWebkitCache *self)
+{
+}
+
+RemoteControlWebkitCache *remote_control_webkit_cache_new(
+		const gchar *directory, GURI *origin, guint64 max_size)
+{
+	RemoteControlWebkitCachePrivate *priv;
+	RemoteControlWebkitCache *self;
+	gchar *name, *path;
+
+	g_return_val_if_fail(directory != NULL, NULL);
+	g_return_val_if_fail(origin != NULL, NULL);
+
+	/* one directory per origin, so a new kiosk URI starts out clean */
+	name = g_strdup_printf("%s-%s-%u", g_uri_get_scheme(origin),
+			g_uri_get_host(origin), g_uri_get_port(origin));
+	path = g_build_filename(directory, name, NULL);
+	g_free(name);
+
+	self = g_object_new(REMOTE_CONTROL_TYPE_WEBKIT_CACHE,
+			"cache-dir", path,
+			"cache-type", SOUP_CACHE_SINGLE_USER,
+			NULL);
+	g_free(path);
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(self);
+	priv->origin = g_object_ref(origin);
+
+	/* libsoup keeps the size in a guint */
+	if (max_size)
+		soup_cache_set_max_size(SOUP_CACHE(self),
+				MIN(max_size, G_MAXUINT));
+
+	soup_cache_load(SOUP_CACHE(self));
+
+	return self;
+}
+
+GURI *remote_control_webkit_cache_get_origin(RemoteControlWebkitCache *self)
+{
+	RemoteControlWebkitCachePrivate *priv;
+
+	g_return_val_if_fail(REMOTE_CONTROL_IS_WEBKIT_CACHE(self), NULL);
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(self);
+	return priv->origin;
+}
+
+void remote_control_webkit_cache_attach(RemoteControlWebkitCache *self,
+		SoupSession *session)
+{
+	RemoteControlWebkitCachePrivate *priv;
+
+	g_return_if_fail(REMOTE_CONTROL_IS_WEBKIT_CACHE(self));
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(self);
+
+	if (priv->session)
+		remote_control_webkit_cache_detach(self);
+
+	priv->session = g_object_ref(session);
+	soup_session_add_feature(session, SOUP_SESSION_FEATURE(self));
+
+	g_signal_connect(session, "request-queued",
+			G_CALLBACK(webkit_cache_request_queued), self);
+	g_signal_connect(session, "request-started",
+			G_CALLBACK(webkit_cache_request_started), self);
+	g_signal_connect(session, "request-unqueued",
+			G_CALLBACK(webkit_cache_request_unqueued), self);
+}
+
+void remote_control_webkit_cache_detach(RemoteControlWebkitCache *self)
+{
+	RemoteControlWebkitCachePrivate *priv;
+
+	g_return_if_fail(REMOTE_CONTROL_IS_WEBKIT_CACHE(self));
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(self);
+
+	if (!priv->session)
+		return;
+
+	if (priv->probe_msg) {
+		SoupMessage *msg = priv->probe_msg;
+
+		g_object_set_qdata(G_OBJECT(msg), webkit_cache_owner_quark,
+				NULL);
+		priv->probe_msg = NULL;
+
+		soup_session_cancel_message(priv->session, msg,
+				SOUP_STATUS_CANCELLED);
+	}
+
+	g_signal_handlers_disconnect_by_data(priv->session, self);
+	soup_session_remove_feature(priv->session, SOUP_SESSION_FEATURE(self));
+	soup_cache_dump(SOUP_CACHE(self));
+
+	g_object_unref(priv->session);
+	priv->session = NULL;
+}
+
+gboolean remote_control_webkit_cache_is_offline(RemoteControlWebkitCache *self)
+{
+	RemoteControlWebkitCachePrivate *priv;
+
+	g_return_val_if_fail(REMOTE_CONTROL_IS_WEBKIT_CACHE(self), FALSE);
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(self);
+	return priv->offline;
+}
+
+void remote_control_webkit_cache_get_stats(RemoteControlWebkitCache *self,
+		struct webkit_cache_stats *stats)
+{
+	RemoteControlWebkitCachePrivate *priv;
+
+	g_return_if_fail(REMOTE_CONTROL_IS_WEBKIT_CACHE(self));
+	g_return_if_fail(stats != NULL);
+
+	priv = REMOTE_CONTROL_WEBKIT_CACHE_GET_PRIVATE(self);
+	*stats = priv->stats;
+}
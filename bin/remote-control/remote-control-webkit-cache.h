@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2017 Avionic Design GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef REMOTE_CONTROL_WEBKIT_CACHE_H
+#define REMOTE_CONTROL_WEBKIT_CACHE_H 1
+
+#include <libsoup/soup.h>
+
+#include "guri.h"
+
+G_BEGIN_DECLS
+
+#define REMOTE_CONTROL_TYPE_WEBKIT_CACHE            (remote_control_webkit_cache_get_type())
+#define REMOTE_CONTROL_WEBKIT_CACHE(obj)            (G_TYPE_CHECK_INSTANCE_CAST((obj), REMOTE_CONTROL_TYPE_WEBKIT_CACHE, RemoteControlWebkitCache))
+#define REMOTE_CONTROL_IS_WEBKIT_CACHE(obj)         (G_TYPE_CHECK_INSTANCE_TYPE((obj), REMOTE_CONTROL_TYPE_WEBKIT_CACHE))
+#define REMOTE_CONTROL_WEBKIT_CACHE_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST((klass), REMOTE_CONTROL_TYPE_WEBKIT_CACHE, RemoteControlWebkitCacheClass))
+#define REMOTE_CONTROL_IS_WEBKIT_CACHE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass), REMOTE_CONTROL_TYPE_WEBKIT_CACHE))
+#define REMOTE_CONTROL_WEBKIT_CACHE_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS((obj), REMOTE_CONTROL_TYPE_WEBKIT_CACHE, RemoteControlWebkitCacheClass))
+
+typedef struct _RemoteControlWebkitCache        RemoteControlWebkitCache;
+typedef struct _RemoteControlWebkitCachePrivate RemoteControlWebkitCachePrivate;
+typedef struct _RemoteControlWebkitCacheClass   RemoteControlWebkitCacheClass;
+
+struct _RemoteControlWebkitCache {
+	SoupCache parent;
+};
+
+struct _RemoteControlWebkitCacheClass {
+	SoupCacheClass parent;
+};
+
+/* counts of the requests to the cached origin, by how they were served */
+struct webkit_cache_stats {
+	guint64 requests;
+	guint64 hits;		/* from the cache, without asking the backend */
+	guint64 revalidated;	/* from the cache, after a 304 from the backend */
+	guint64 stale;		/* from the cache, while the backend was down */
+	guint64 misses;		/* from the backend */
+	guint64 errors;		/* not at all */
+};
+
+GType remote_control_webkit_cache_get_type(void);
+
+RemoteControlWebkitCache *remote_control_webkit_cache_new(
+		const gchar *directory, GURI *origin, guint64 max_size);
+GURI *remote_control_webkit_cache_get_origin(RemoteControlWebkitCache *self);
+void remote_control_webkit_cache_attach(RemoteControlWebkitCache *self,
+		SoupSession *session);
+void remote_control_webkit_cache_detach(RemoteControlWebkitCache *self);
+gboolean remote_control_webkit_cache_is_offline(RemoteControlWebkitCache *self);
+void remote_control_webkit_cache_get_stats(RemoteControlWebkitCache *self,
+		struct webkit_cache_stats *stats);
+
+G_END_DECLS
+
+#endif /* REMOTE_CONTROL_WEBKIT_CACHE_H */
@@ -23,6 +23,7 @@
 #include <sys/wait.h>
 
 #include "remote-control-webkit-window.h"
+#include "remote-control-webkit-cache.h"
 #include "remote-control-data.h"
 #include "javascript.h"
 #include "utils.h"
@@ -45,8 +46,18 @@ struct _RemoteControlWebkitWindowPrivate {
 	WebKitWebView *webkit;
 	GMainLoop *loop;
 	GURI *uri;
+	gchar *cache_dir;
+	guint64 cache_size;
+#ifndef USE_WEBKIT2
+	RemoteControlWebkitCache *cache;
+#endif
 	gboolean hide_cursor;
 	gboolean check_origin;
+
+	/* the most recent page loads, indexed by sequence number */
+	struct webkit_timeline timeline[WEBKIT_TIMELINE_SIZE];
+	guint64 timeline_sequence;
+	gint64 timeline_start;
 	gboolean inspector;
 	/* used only when inspector enabled */
 #ifndef USE_WEBKIT2
@@ -107,6 +118,100 @@ static void webkit_cursor_hide(GtkWidget *widget, gboolean hide)
 
 static void remote_control_webkit_construct_view(RemoteControlWebkitWindow *self);
 
+static struct webkit_timeline *webkit_timeline_current(
+		RemoteControlWebkitWindowPrivate *priv)
+{
+	if (!priv->timeline_sequence)
+		return NULL;
+
+	return &priv->timeline[(priv->timeline_sequence - 1) %
+			WEBKIT_TIMELINE_SIZE];
+}
+
+static void webkit_timeline_start(RemoteControlWebkitWindowPrivate *priv)
+{
+	struct webkit_timeline *timeline;
+
+	timeline = &priv->timeline[priv->timeline_sequence %
+			WEBKIT_TIMELINE_SIZE];
+	g_free((gchar *)timeline->uri);
+
+	timeline->sequence = ++priv->timeline_sequence;
+	timeline->uri = NULL;
+	timeline->start = g_get_real_time();
+	timeline->first_byte = -1;
+	timeline->dom_loaded = -1;
+	timeline->finished = -1;
+	timeline->javascript = -1;
+	timeline->failed = FALSE;
+
+	priv->timeline_start = g_get_monotonic_time();
+}
+
+/* records the first time a milestone of the current page load is reached */
+static void webkit_timeline_mark(RemoteControlWebkitWindowPrivate *priv,
+		gsize offset)
+{
+	struct webkit_timeline *timeline = webkit_timeline_current(priv);
+	gint64 *milestone;
+
+	if (!timeline)
+		return;
+
+	milestone = G_STRUCT_MEMBER_P(timeline, offset);
+	if (*milestone < 0)
+		*milestone = g_get_monotonic_time() - priv->timeline_start;
+}
+
+static void webkit_timeline_commit(RemoteControlWebkitWindowPrivate *priv,
+		const gchar *uri)
+{
+	struct webkit_timeline *timeline = webkit_timeline_current(priv);
+
+	webkit_timeline_mark(priv,
+			G_STRUCT_OFFSET(struct webkit_timeline, first_byte));
+
+	if (timeline) {
+		g_free((gchar *)timeline->uri);
+		timeline->uri = g_strdup(uri);
+	}
+}
+
+static void webkit_timeline_finish(RemoteControlWebkitWindowPrivate *priv,
+		gboolean failed)
+{
+	struct webkit_timeline *timeline = webkit_timeline_current(priv);
+
+	webkit_timeline_mark(priv,
+			G_STRUCT_OFFSET(struct webkit_timeline, finished));
+
+	if (timeline && failed)
+		timeline->failed = TRUE;
+}
+
+static int webkit_register_javascript(RemoteControlWebkitWindow *window,
+		JSGlobalContextRef context)
+{
+	RemoteControlWebkitWindowPrivate *priv =
+	                REMOTE_CONTROL_WEBKIT_WINDOW_GET_PRIVATE(window);
+	struct webkit_timeline *timeline = webkit_timeline_current(priv);
+	struct javascript_userdata user;
+	gint64 start;
+	int err;
+
+	user.loop =  priv->loop;
+	user.rcd = priv->rcd;
+	user.window = window;
+
+	start = g_get_monotonic_time();
+	err = javascript_register(context, &user);
+
+	if (timeline)
+		timeline->javascript = g_get_monotonic_time() - start;
+
+	return err;
+}
+
 static void webkit_get_property(GObject *object, guint prop_id, GValue *value,
 		GParamSpec *pspec)
 {
@@ -184,10 +289,21 @@ static void webkit_finalize(GObject *object)
 {
 	RemoteControlWebkitWindow *window = REMOTE_CONTROL_WEBKIT_WINDOW(object);
 	RemoteControlWebkitWindowPrivate *priv;
+	guint i;
 
 	priv = REMOTE_CONTROL_WEBKIT_WINDOW_GET_PRIVATE(window);
+#ifndef USE_WEBKIT2
+	if (priv->cache) {
+		remote_control_webkit_cache_detach(priv->cache);
+		g_object_unref(priv->cache);
+	}
+#endif
+	g_free(priv->cache_dir);
 	g_object_unref(priv->uri);
 
+	for (i = 0; i < WEBKIT_TIMELINE_SIZE; i++)
+		g_free((gchar *)priv->timeline[i].uri);
+
 	G_OBJECT_CLASS(remote_control_webkit_window_parent_class)->finalize(object);
 }
 
@@ -200,26 +316,32 @@ static void webkit_on_load_changed(WebKitWebView *webkit,
 	                REMOTE_CONTROL_WEBKIT_WINDOW_GET_PRIVATE(window);
 
 	switch (load_event) {
+	case WEBKIT_LOAD_STARTED:
+		webkit_timeline_start(priv);
+		break;
+
 	case WEBKIT_LOAD_COMMITTED:
 	{
-		struct javascript_userdata user;
 		JSGlobalContextRef context;
 		int err;
 
-		user.loop =  priv->loop;
-		user.rcd = priv->rcd;
-		user.window = window;
+		webkit_timeline_commit(priv, webkit_web_view_get_uri(webkit));
 
 		context = webkit_web_view_get_javascript_global_context(webkit);
 		g_assert(context != NULL);
 
-		err = javascript_register(context, &user);
+		err = webkit_register_javascript(window, context);
 		if (err < 0) {
 			g_debug("failed to register JavaScript API: %s",
 					g_strerror(-err));
 		}
 		break;
 	}
+
+	case WEBKIT_LOAD_FINISHED:
+		webkit_timeline_finish(priv, FALSE);
+		break;
+
 	default:
 		break;
 	}
@@ -234,26 +356,57 @@ static void webkit_on_notify_load_status(WebKitWebView *webkit,
 	WebKitLoadStatus status;
 
 	status = webkit_web_view_get_load_status(webkit);
-	if (status == WEBKIT_LOAD_COMMITTED) {
+	if (status == WEBKIT_LOAD_PROVISIONAL) {
+		webkit_timeline_start(priv);
+	} else if (status == WEBKIT_LOAD_COMMITTED) {
 		WebKitWebFrame *frame = webkit_web_view_get_main_frame(webkit);
-		struct javascript_userdata user;
 		JSGlobalContextRef context;
 		int err;
 
-		user.loop =  priv->loop;
-		user.rcd = priv->rcd;
-		user.window = window;
+		webkit_timeline_commit(priv, webkit_web_view_get_uri(webkit));
 
 		context = webkit_web_frame_get_global_context(frame);
 		g_assert(context != NULL);
 
-		err = javascript_register(context, &user);
+		err = webkit_register_javascript(window, context);
 		if (err < 0) {
 			g_debug("failed to register JavaScript API: %s",
 					g_strerror(-err));
 		}
+	} else if (status == WEBKIT_LOAD_FAILED) {
+		webkit_timeline_finish(priv, TRUE);
+	} else if (status == WEBKIT_LOAD_FINISHED) {
+		webkit_timeline_finish(priv, FALSE);
+	}
+
+	if (status == WEBKIT_LOAD_FINISHED && priv->cache) {
+		struct webkit_cache_stats stats;
+
+		/* keep the index current in case we don't shut down cleanly */
+		soup_cache_dump(SOUP_CACHE(priv->cache));
+
+		remote_control_webkit_cache_get_stats(priv->cache, &stats);
+		g_debug("cache: %" G_GUINT64_FORMAT " requests, %"
+			G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT
+			" revalidated, %" G_GUINT64_FORMAT " stale, %"
+			G_GUINT64_FORMAT " misses, %" G_GUINT64_FORMAT
+			" errors", stats.requests, stats.hits,
+			stats.revalidated, stats.stale, stats.misses,
+			stats.errors);
 	}
 }
+
+static void webkit_on_document_load_finished(WebKitWebView *webkit,
+		WebKitWebFrame *frame, gpointer data)
+{
+	RemoteControlWebkitWindow *window = REMOTE_CONTROL_WEBKIT_WINDOW(data);
+	RemoteControlWebkitWindowPrivate *priv =
+	                REMOTE_CONTROL_WEBKIT_WINDOW_GET_PRIVATE(window);
+
+	if (frame == webkit_web_view_get_main_frame(webkit))
+		webkit_timeline_mark(priv, G_STRUCT_OFFSET(
+				struct webkit_timeline, dom_loaded));
+}
 #endif
 
 static void remote_control_webkit_window_class_init(RemoteControlWebkitWindowClass *klass)
@@ -372,6 +525,47 @@ static gboolean remote_control_webkit_reload(gpointer user_data)
 	return FALSE;
 }
 
+#ifndef USE_WEBKIT2
+static void webkit_cache_notify_offline(GObject *object, GParamSpec *pspec,
+		gpointer user_data)
+{
+	RemoteControlWebkitCache *cache = REMOTE_CONTROL_WEBKIT_CACHE(object);
+
+	/* the page may be made of stale entries, fetch it again */
+	if (!remote_control_webkit_cache_is_offline(cache))
+		remote_control_webkit_reload(user_data);
+}
+
+static void remote_control_webkit_update_cache(RemoteControlWebkitWindow *self)
+{
+	RemoteControlWebkitWindowPrivate *priv;
+	SoupSession *session = webkit_get_default_session();
+
+	priv = REMOTE_CONTROL_WEBKIT_WINDOW_GET_PRIVATE(self);
+
+	if (!priv->cache_dir || !priv->uri)
+		return;
+
+	if (priv->cache) {
+		GURI *origin = remote_control_webkit_cache_get_origin(
+				priv->cache);
+
+		if (g_uri_same_origin(origin, priv->uri))
+			return;
+
+		remote_control_webkit_cache_detach(priv->cache);
+		g_object_unref(priv->cache);
+	}
+
+	priv->cache = remote_control_webkit_cache_new(priv->cache_dir,
+			priv->uri, priv->cache_size);
+	remote_control_webkit_cache_attach(priv->cache, session);
+
+	g_signal_connect(priv->cache, "notify::offline",
+			G_CALLBACK(webkit_cache_notify_offline), self);
+}
+#endif
+
 #ifdef USE_WEBKIT2
 static gboolean webkit_handle_load_failed(WebKitWebView *webkit,
 	WebKitLoadEvent load_event, gchar *uri, GError *error,
@@ -383,6 +577,15 @@ static gboolean webkit_handle_load_error(WebKitWebView *webkit,
 #endif
 {
 	gboolean need_reload = FALSE;
+#ifdef USE_WEBKIT2
+	RemoteControlWebkitWindowPrivate *priv =
+	                REMOTE_CONTROL_WEBKIT_WINDOW_GET_PRIVATE(user_data);
+	struct webkit_timeline *timeline = webkit_timeline_current(priv);
+
+	/* the time is taken when WEBKIT_LOAD_FINISHED follows */
+	if (timeline)
+		timeline->failed = TRUE;
+#endif
 
 	g_debug("%s(): %s: %d: %s (%s)", __func__,
 			g_quark_to_string(error->domain),
@@ -552,6 +755,8 @@ static void remote_control_webkit_window_init(RemoteControlWebkitWindow *self)
 #else
 	g_signal_connect(GTK_WIDGET(priv->webkit), "notify::load-status",
 		G_CALLBACK(webkit_on_notify_load_status), self);
+	g_signal_connect(GTK_WIDGET(priv->webkit), "document-load-finished",
+		G_CALLBACK(webkit_on_document_load_finished), self);
 #endif
 
 #ifdef USE_WEBKIT2
@@ -616,6 +821,16 @@ gboolean remote_control_webkit_window_load(RemoteControlWebkitWindow *self,
 	RemoteControlWebkitWindowPrivate *priv;
 
 	priv = REMOTE_CONTROL_WEBKIT_WINDOW_GET_PRIVATE(self);
+
+	if (priv->uri)
+		g_object_unref(priv->uri);
+
+	priv->uri = g_uri_new(uri);
+
+#ifndef USE_WEBKIT2
+	remote_control_webkit_update_cache(self);
+#endif
+
 	webkit_web_view_load_uri(priv->webkit, uri);
 
 #ifndef USE_WEBKIT2
@@ -634,13 +849,63 @@ gboolean remote_control_webkit_window_load(RemoteControlWebkitWindow *self,
 	}
 #endif
 
-	if (priv->uri)
-		g_object_unref(priv->uri);
+	return TRUE;
+}
 
-	priv->uri = g_uri_new(uri);
+void remote_control_webkit_window_set_cache(RemoteControlWebkitWindow *self,
+		const gchar *directory, guint64 max_size)
+{
+	RemoteControlWebkitWindowPrivate *priv;
 
-	return TRUE;
+	priv = REMOTE_CONTROL_WEBKIT_WINDOW_GET_PRIVATE(self);
+
+#ifdef USE_WEBKIT2
+	g_warning("%s(): not supported with WebKit2", __func__);
+#else
+	g_free(priv->cache_dir);
+	priv->cache_dir = g_strdup(directory);
+	priv->cache_size = max_size;
 
+	remote_control_webkit_update_cache(self);
+#endif
+}
+
+gboolean remote_control_webkit_window_get_cache_stats(
+		RemoteControlWebkitWindow *self, struct webkit_cache_stats *stats)
+{
+	RemoteControlWebkitWindowPrivate *priv;
+
+	priv = REMOTE_CONTROL_WEBKIT_WINDOW_GET_PRIVATE(self);
+
+#ifndef USE_WEBKIT2
+	if (priv->cache) {
+		remote_control_webkit_cache_get_stats(priv->cache, stats);
+		return TRUE;
+	}
+#endif
+
+	return FALSE;
+}
+
+guint remote_control_webkit_window_get_timeline(RemoteControlWebkitWindow *self,
+		guint64 since, struct webkit_timeline *timeline, guint max)
+{
+	RemoteControlWebkitWindowPrivate *priv;
+	guint64 first, seq;
+	guint count = 0;
+
+	priv = REMOTE_CONTROL_WEBKIT_WINDOW_GET_PRIVATE(self);
+
+	first = priv->timeline_sequence > WEBKIT_TIMELINE_SIZE ?
+		priv->timeline_sequence - WEBKIT_TIMELINE_SIZE + 1 : 1;
+	if (since >= first)
+		first = since + 1;
+
+	for (seq = first; seq <= priv->timeline_sequence && count < max; seq++)
+		timeline[count++] = priv->timeline[(seq - 1) %
+				WEBKIT_TIMELINE_SIZE];
+
+	return count;
 }
 
 gboolean remote_control_webkit_window_reload(RemoteControlWebkitWindow *self)
@@ -652,3 +917,23 @@ gboolean remote_control_webkit_window_reload(RemoteControlWebkitWindow *self)
 
 	return TRUE;
 }
+
+/*
+ * AvionicDesign modules are created on first access, which may be long
+ * after the object itself was registered. Their cost is added to the
+ * JavaScript milestone of the current page load.
+ */
+void remote_control_webkit_window_add_javascript_time(
+		RemoteControlWebkitWindow *self, gint64 elapsed)
+{
+	RemoteControlWebkitWindowPrivate *priv;
+	struct webkit_timeline *timeline;
+
+	g_return_if_fail(REMOTE_CONTROL_IS_WEBKIT_WINDOW(self));
+
+	priv = REMOTE_CONTROL_WEBKIT_WINDOW_GET_PRIVATE(self);
+
+	timeline = webkit_timeline_current(priv);
+	if (timeline && timeline->javascript >= 0)
+		timeline->javascript += elapsed;
+}
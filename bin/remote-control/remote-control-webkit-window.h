@@ -12,6 +12,7 @@
 #include <gtk/gtk.h>
 
 #include "remote-control-data.h"
+#include "remote-control-webkit-cache.h"
 
 G_BEGIN_DECLS
 
@@ -34,6 +35,25 @@ struct _RemoteControlWebkitWindowClass {
 	GtkWindowClass parent;
 };
 
+/* the number of page loads kept in the timeline */
+#define WEBKIT_TIMELINE_SIZE 16
+
+/*
+ * Milestones of a page load, in microseconds since the navigation started,
+ * or -1 if the milestone wasn't reached (yet). The URI is owned by the
+ * window and only valid until the next navigation.
+ */
+struct webkit_timeline {
+	guint64 sequence;
+	const gchar *uri;
+	gint64 start;		/* wall-clock time */
+	gint64 first_byte;
+	gint64 dom_loaded;
+	gint64 finished;
+	gint64 javascript;	/* spent creating the JavaScript API and modules */
+	gboolean failed;
+};
+
 GType remote_control_webkit_window_get_type(void);
 
 GtkWidget *remote_control_webkit_window_new(GMainLoop *loop,
@@ -41,6 +61,15 @@ GtkWidget *remote_control_webkit_window_new(GMainLoop *loop,
 gboolean remote_control_webkit_window_load(RemoteControlWebkitWindow *self,
 		const gchar *uri);
 gboolean remote_control_webkit_window_reload(RemoteControlWebkitWindow *self);
+void remote_control_webkit_window_set_cache(RemoteControlWebkitWindow *self,
+		const gchar *directory, guint64 max_size);
+gboolean remote_control_webkit_window_get_cache_stats(
+		RemoteControlWebkitWindow *self, struct webkit_cache_stats *stats);
+/* copy up to max of the page loads newer than since, oldest first */
+guint remote_control_webkit_window_get_timeline(RemoteControlWebkitWindow *self,
+		guint64 since, struct webkit_timeline *timeline, guint max);
+void remote_control_webkit_window_add_javascript_time(
+		RemoteControlWebkitWindow *self, gint64 elapsed);
 
 G_END_DECLS
 
@@ -22,8 +22,6 @@
 #include <glib-unix.h>
 #include <gio/gio.h>
 
-#include <gudev/gudev.h>
-
 #include "remote-control-webkit-window.h"
 #include "remote-control-rdp-window.h"
 #include "remote-control.h"
@@ -108,11 +106,98 @@ static const gchar g_dbus_remote_control_xml[] =
 	"  </interface>"
 	"</node>";
 
+static void g_dbus_browser_method_call(GDBusConnection *connection,
+		const gchar *sender, const gchar *object,
+		const gchar *interface, const gchar *method,
+		GVariant *parameters, GDBusMethodInvocation *invocation,
+		gpointer user_data)
+{
+	RemoteControlWebkitWindow *window = user_data;
+	struct webkit_timeline timeline[WEBKIT_TIMELINE_SIZE];
+	GVariantBuilder builder;
+	guint64 since;
+	guint count, i;
+
+	if (g_strcmp0(method, "GetTimeline") != 0) {
+		g_dbus_method_invocation_return_error(invocation,
+				G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+				"unknown method %s", method);
+		return;
+	}
+
+	g_variant_get(parameters, "(t)", &since);
+
+	count = remote_control_webkit_window_get_timeline(window, since,
+			timeline, G_N_ELEMENTS(timeline));
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(tsxxxxxb)"));
+
+	for (i = 0; i < count; i++)
+		g_variant_builder_add(&builder, "(tsxxxxxb)",
+				timeline[i].sequence,
+				timeline[i].uri ? timeline[i].uri : "",
+				timeline[i].start, timeline[i].first_byte,
+				timeline[i].dom_loaded, timeline[i].finished,
+				timeline[i].javascript, timeline[i].failed);
+
+	g_dbus_method_invocation_return_value(invocation,
+			g_variant_new("(a(tsxxxxxb))", &builder));
+}
+
+static const GDBusInterfaceVTable g_dbus_browser_vtable = {
+	.method_call = g_dbus_browser_method_call,
+};
+
+/*
+ * GetTimeline() returns the page loads newer than the given sequence number
+ * as (sequence, uri, start, first byte, DOM content loaded, load finished,
+ * JavaScript API creation, failed). The start is wall-clock time, all other
+ * times are relative to it, in microseconds, and -1 if not reached.
+ */
+static const gchar g_dbus_browser_xml[] =
+	"<node>"
+	"  <interface name=\"RemoteControl.Browser\">"
+	"    <method name=\"GetTimeline\">"
+	"      <arg name=\"since\" type=\"t\" direction=\"in\"/>"
+	"      <arg name=\"timeline\" type=\"a(tsxxxxxb)\" direction=\"out\"/>"
+	"    </method>"
+	"  </interface>"
+	"</node>";
+
+static void g_dbus_register_browser(GDBusConnection *connection,
+		GtkWidget *window)
+{
+	GDBusInterfaceInfo *interface;
+	GDBusNodeInfo *node;
+	GError *error = NULL;
+	guint id;
+
+	node = g_dbus_node_info_new_for_xml(g_dbus_browser_xml, NULL);
+	interface = g_dbus_node_info_lookup_interface(node,
+			"RemoteControl.Browser");
+
+	id = g_dbus_connection_register_object(connection,
+			"/RemoteControl/Browser", interface,
+			&g_dbus_browser_vtable, window, NULL, &error);
+	if (!id) {
+		g_warning("failed to register browser object: %s",
+				error->message);
+		g_clear_error(&error);
+	}
+
+	g_dbus_node_info_unref(node);
+}
+
 static void g_dbus_bus_acquired(GDBusConnection *connection, const gchar *name,
 		gpointer user_data)
 {
 	g_debug("> %s(connection=%p, name=%s, user_data=%p)", __func__,
 			connection, name, user_data);
+
+	/* before the name is taken, so that clients never miss the object */
+	if (user_data && REMOTE_CONTROL_IS_WEBKIT_WINDOW(user_data))
+		g_dbus_register_browser(connection, user_data);
+
 	g_debug("< %s()", __func__);
 }
 
@@ -223,6 +308,17 @@ static gboolean setup_signal_handlers(GMainLoop *loop)
 	return TRUE;
 }
 
+static gboolean handle_trace_signal(gpointer user_data)
+{
+	int err;
+
+	err = trace_dump(NULL);
+	if (err < 0)
+		g_warning("failed to dump packet trace: %s", g_strerror(-err));
+
+	return TRUE;
+}
+
 static void on_window_destroy(GtkWidget *widget, gpointer user_data)
 {
 	GMainLoop *loop = user_data;
@@ -314,11 +410,26 @@ GtkWidget *create_browser_window(GKeyFile *conf, GMainLoop *loop,
 
 	if (uri) {
 		RemoteControlWebkitWindow *webkit;
+		gchar *cache_dir;
+		gint64 cache_size;
 
 		g_print("start with inspector: %s\n", inspector ? "enabled" : "disabled");
 		window = remote_control_webkit_window_new(loop, rcd, inspector);
 
 		webkit = REMOTE_CONTROL_WEBKIT_WINDOW(window);
+
+		cache_dir = g_key_file_get_string(conf, "browser",
+				"cache-directory", NULL);
+		if (cache_dir) {
+			/* in kB, so the size may well exceed a guint */
+			cache_size = g_key_file_get_int64(conf, "browser",
+					"cache-size", NULL);
+			remote_control_webkit_window_set_cache(webkit,
+					cache_dir,
+					(guint64)MAX(cache_size, 0) * 1024);
+			g_free(cache_dir);
+		}
+
 		remote_control_webkit_window_load(webkit, uri);
 
 		gtk_window_fullscreen(GTK_WINDOW(window));
@@ -570,31 +681,9 @@ static void stop_remote_control(struct remote_control_data *rcd)
 	g_free(rcd);
 }
 
-static void on_udev_event(GUdevClient *client, gchar *action,
-			  GUdevDevice *udevice, gpointer user_data)
-{
-	const char *caps = g_udev_device_get_property(udevice, "PRODUCT");
-	/* Because we only configure the system (linphone audio-settings, see
-	 * udev) to either usb-handset or classic handset on startup. We need
-	 * to restart remote-control whenever somebody connects the
-	 * usb-handset. */
-	if (caps == NULL || !g_str_has_prefix(caps, "8bb/29c6"))
-		return;
-	/* In real life it only makes sense to restart remote-control if a
-	 * device is added. On removal a device usually is no longer present
-	 * and can thus be ignored. Additionally a restart in progress from
-	 * removal could lead to missing subsequent add events if a headset
-	 * is changed fast enough. */
-	if (g_strcmp0(action, "add") == 0)
-		g_error("Handset %s detected, restarting", action);
-	else
-		g_critical("Handset %s detected", action);
-}
-
 int main(int argc, char *argv[])
 {
 	const gchar *default_config_file = SYSCONF_DIR "/remote-control.conf";
-	const gchar *const subsystems[] = { "usb/usb_interface", NULL };
 	gchar *config_file = NULL;
 	gboolean version = FALSE;
 	GOptionEntry entries[] = {
@@ -607,7 +696,6 @@ int main(int argc, char *argv[])
 	struct remote_control_data *rcd;
 	GMainContext *context = NULL;
 	struct watchdog *watchdog;
-	GUdevClient* udev_client;
 	GOptionContext *options;
 	GError *error = NULL;
 	GtkWidget *window;
@@ -721,11 +809,8 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-#ifdef ENABLE_DBUS
-	owner = g_bus_own_name(G_BUS_TYPE_SESSION, REMOTE_CONTROL_BUS_NAME,
-			G_BUS_NAME_OWNER_FLAGS_NONE, g_dbus_bus_acquired,
-			g_dbus_name_acquired, g_dbus_name_lost, NULL, NULL);
-#endif
+	/* dump the packet trace on demand */
+	g_unix_signal_add(SIGUSR1, handle_trace_signal, NULL);
 
 	rcd = start_remote_control(conf, &error);
 	if (!rcd) {
@@ -758,27 +843,32 @@ int main(int argc, char *argv[])
 				G_CALLBACK(on_window_destroy), loop);
 	}
 
+#ifdef ENABLE_DBUS
+	/*
+	 * The objects are registered once the main loop runs, which may be
+	 * after the window has been destroyed, so keep a reference to it.
+	 */
+	owner = g_bus_own_name(G_BUS_TYPE_SESSION, REMOTE_CONTROL_BUS_NAME,
+			G_BUS_NAME_OWNER_FLAGS_NONE, g_dbus_bus_acquired,
+			g_dbus_name_acquired, g_dbus_name_lost,
+			window ? g_object_ref(window) : NULL,
+			window ? g_object_unref : NULL);
+#endif
+
 	watchdog = watchdog_new(conf, NULL);
 	if (watchdog) {
 		g_debug("D-Bus Watchdog activated");
 		watchdog_attach(watchdog, context);
 	}
 
-	udev_client = g_udev_client_new(subsystems);
-	if (udev_client) {
-		g_signal_connect(udev_client, "uevent",
-				 G_CALLBACK(on_udev_event), NULL);
-	} else
-		g_warning("init: failed to create udev client");
-
 	g_main_loop_run(loop);
 
 	watchdog_unref(watchdog);
+	javascript_exit();
 	stop_remote_control(rcd);
 #ifdef ENABLE_DBUS
 	g_bus_unown_name(owner);
 #endif
-	g_object_unref(udev_client);
 	g_main_loop_unref(loop);
 	g_key_file_free(conf);
 	remote_control_log_exit();
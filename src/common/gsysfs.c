@@ -11,8 +11,10 @@
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "gsysfs.h"
 
@@ -200,3 +202,285 @@ gboolean g_sysfs_write_string(GUdevDevice *device, const gchar *property,
 
 	return TRUE;
 }
+
+/*
+ * Attributes that are accessed at a high rate, such as brightness during a
+ * fade or a GPIO value driving a LED pattern, are better kept open. The
+ * descriptor is opened on first use and reopened if the underlying device
+ * went away in the meantime.
+ */
+struct _GSysfsAttribute {
+	gchar *filename;
+	gint flags;
+	gint fd;
+};
+
+GSysfsAttribute *g_sysfs_attribute_new(GUdevDevice *device,
+				       const gchar *property, GError **error)
+{
+	GSysfsAttribute *attribute;
+	const gchar *path;
+
+	path = g_udev_device_get_sysfs_path(device);
+	if (!path) {
+		g_set_error(error, G_SYSFS_ERROR, G_SYSFS_ERROR_UNKNOWN,
+			    "sysfs path not available for `%s'",
+			    g_udev_device_get_name(device));
+		return NULL;
+	}
+
+	attribute = g_new0(GSysfsAttribute, 1);
+	attribute->filename = g_strdup_printf("%s/%s", path, property);
+	attribute->fd = -1;
+
+	return attribute;
+}
+
+GSysfsAttribute *g_sysfs_attribute_new_for_path(const gchar *filename)
+{
+	GSysfsAttribute *attribute;
+
+	attribute = g_new0(GSysfsAttribute, 1);
+	attribute->filename = g_strdup(filename);
+	attribute->fd = -1;
+
+	return attribute;
+}
+
+static void g_sysfs_attribute_close(GSysfsAttribute *attribute)
+{
+	if (attribute->fd >= 0)
+		close(attribute->fd);
+
+	attribute->fd = -1;
+}
+
+void g_sysfs_attribute_free(GSysfsAttribute *attribute)
+{
+	if (!attribute)
+		return;
+
+	g_sysfs_attribute_close(attribute);
+	g_free(attribute->filename);
+	g_free(attribute);
+}
+
+/*
+ * Read-write attributes are opened for both directions, attributes that
+ * don't permit this are opened for the requested access only.
+ */
+static gint g_sysfs_attribute_open(GSysfsAttribute *attribute, gint access,
+				   GError **error)
+{
+	if (attribute->fd >= 0) {
+		if (attribute->flags == O_RDWR || attribute->flags == access)
+			return attribute->fd;
+
+		g_sysfs_attribute_close(attribute);
+	}
+
+	attribute->flags = O_RDWR;
+	attribute->fd = open(attribute->filename, O_RDWR | O_CLOEXEC);
+	if (attribute->fd < 0 && errno == EACCES) {
+		attribute->flags = access;
+		attribute->fd = open(attribute->filename, access | O_CLOEXEC);
+	}
+
+	if (attribute->fd < 0)
+		g_set_error(error, G_SYSFS_ERROR, G_SYSFS_ERROR_ERRNO,
+			    "%s: %s", attribute->filename, g_strerror(errno));
+
+	return attribute->fd;
+}
+
+/* reads the whole attribute, reopening it once if the device went away */
+static gboolean g_sysfs_attribute_pread(GSysfsAttribute *attribute,
+					gchar *buf, gsize size, GError **error)
+{
+	gboolean retry = TRUE;
+	ssize_t len;
+	gint fd;
+
+	if (!attribute) {
+		g_set_error(error, G_SYSFS_ERROR, G_SYSFS_ERROR_DEVICE_NOT_FOUND,
+			    "attribute not available");
+		return FALSE;
+	}
+
+	do {
+		fd = g_sysfs_attribute_open(attribute, O_RDONLY, error);
+		if (fd < 0)
+			return FALSE;
+
+		len = pread(fd, buf, size - 1, 0);
+		if (len < 0 && errno == ENODEV && retry) {
+			g_sysfs_attribute_close(attribute);
+			retry = FALSE;
+			continue;
+		}
+
+		break;
+	} while (TRUE);
+
+	if (len < 0) {
+		g_set_error(error, G_SYSFS_ERROR, G_SYSFS_ERROR_ERRNO,
+			    "%s", g_strerror(errno));
+		return FALSE;
+	}
+
+	buf[len] = '\0';
+	return TRUE;
+}
+
+static gboolean g_sysfs_attribute_pwrite(GSysfsAttribute *attribute,
+					 const gchar *buf, gsize len,
+					 GError **error)
+{
+	gboolean retry = TRUE;
+	ssize_t err;
+	gint fd;
+
+	if (!attribute) {
+		g_set_error(error, G_SYSFS_ERROR, G_SYSFS_ERROR_DEVICE_NOT_FOUND,
+			    "attribute not available");
+		return FALSE;
+	}
+
+	do {
+		fd = g_sysfs_attribute_open(attribute, O_WRONLY, error);
+		if (fd < 0)
+			return FALSE;
+
+		err = pwrite(fd, buf, len, 0);
+		if (err < 0 && errno == ENODEV && retry) {
+			g_sysfs_attribute_close(attribute);
+			retry = FALSE;
+			continue;
+		}
+
+		break;
+	} while (TRUE);
+
+	if (err < 0) {
+		g_set_error(error, G_SYSFS_ERROR, G_SYSFS_ERROR_ERRNO,
+			    "%s", g_strerror(errno));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* parses an optionally signed decimal number, like the kernel prints them */
+static gboolean g_sysfs_attribute_parse(GSysfsAttribute *attribute,
+					const gchar *buf, gboolean negative_ok,
+					guint *magnitude, gboolean *negative,
+					GError **error)
+{
+	const gchar *ptr = buf;
+	guint result = 0;
+
+	while (g_ascii_isspace(*ptr))
+		ptr++;
+
+	*negative = FALSE;
+
+	if (negative_ok && *ptr == '-') {
+		*negative = TRUE;
+		ptr++;
+	}
+
+	if (!g_ascii_isdigit(*ptr)) {
+		g_set_error(error, G_SYSFS_ERROR, G_SYSFS_ERROR_PARSE,
+			    "cannot parse `%s'", attribute->filename);
+		return FALSE;
+	}
+
+	while (g_ascii_isdigit(*ptr))
+		result = result * 10 + (*ptr++ - '0');
+
+	*magnitude = result;
+	return TRUE;
+}
+
+/* formats backwards from the end of the buffer, returns the start */
+static gchar *g_sysfs_attribute_format(gchar *end, guint magnitude,
+				       gboolean negative)
+{
+	gchar *ptr = end;
+
+	do {
+		*--ptr = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude);
+
+	if (negative)
+		*--ptr = '-';
+
+	return ptr;
+}
+
+gboolean g_sysfs_attribute_read_uint(GSysfsAttribute *attribute, guint *value,
+				     GError **error)
+{
+	gboolean negative;
+	gchar buf[32];
+
+	g_return_val_if_fail(value != NULL, FALSE);
+
+	if (!g_sysfs_attribute_pread(attribute, buf, sizeof(buf), error))
+		return FALSE;
+
+	return g_sysfs_attribute_parse(attribute, buf, FALSE, value,
+				       &negative, error);
+}
+
+gboolean g_sysfs_attribute_write_uint(GSysfsAttribute *attribute, guint value,
+				      GError **error)
+{
+	gchar buf[16], *ptr;
+
+	ptr = g_sysfs_attribute_format(buf + sizeof(buf), value, FALSE);
+
+	return g_sysfs_attribute_pwrite(attribute, ptr,
+					buf + sizeof(buf) - ptr, error);
+}
+
+gboolean g_sysfs_attribute_read_int(GSysfsAttribute *attribute, gint *value,
+				    GError **error)
+{
+	gboolean negative;
+	guint magnitude;
+	gchar buf[32];
+
+	g_return_val_if_fail(value != NULL, FALSE);
+
+	if (!g_sysfs_attribute_pread(attribute, buf, sizeof(buf), error))
+		return FALSE;
+
+	if (!g_sysfs_attribute_parse(attribute, buf, TRUE, &magnitude,
+				     &negative, error))
+		return FALSE;
+
+	if (magnitude > (negative ? (guint)G_MAXINT + 1 : (guint)G_MAXINT)) {
+		g_set_error(error, G_SYSFS_ERROR, G_SYSFS_ERROR_INVALID_VALUE,
+			    "value of `%s' out of range", attribute->filename);
+		return FALSE;
+	}
+
+	*value = negative ? (gint)(0 - magnitude) : (gint)magnitude;
+	return TRUE;
+}
+
+gboolean g_sysfs_attribute_write_int(GSysfsAttribute *attribute, gint value,
+				     GError **error)
+{
+	gchar buf[16], *ptr;
+
+	/* the magnitude of G_MININT doesn't fit into a gint */
+	ptr = g_sysfs_attribute_format(buf + sizeof(buf),
+			value < 0 ? 0u - (guint)value : (guint)value,
+			value < 0);
+
+	return g_sysfs_attribute_pwrite(attribute, ptr,
+					buf + sizeof(buf) - ptr, error);
+}
@@ -37,6 +37,22 @@ gchar *g_sysfs_read_string(GUdevDevice *device, const gchar *property,
 gboolean g_sysfs_write_string(GUdevDevice *device, const gchar *property,
 			      const gchar *string, GError **error);
 
+typedef struct _GSysfsAttribute GSysfsAttribute;
+
+GSysfsAttribute *g_sysfs_attribute_new(GUdevDevice *device,
+				       const gchar *property, GError **error);
+GSysfsAttribute *g_sysfs_attribute_new_for_path(const gchar *filename);
+void g_sysfs_attribute_free(GSysfsAttribute *attribute);
+
+gboolean g_sysfs_attribute_read_uint(GSysfsAttribute *attribute, guint *value,
+				     GError **error);
+gboolean g_sysfs_attribute_write_uint(GSysfsAttribute *attribute, guint value,
+				      GError **error);
+gboolean g_sysfs_attribute_read_int(GSysfsAttribute *attribute, gint *value,
+				    GError **error);
+gboolean g_sysfs_attribute_write_int(GSysfsAttribute *attribute, gint value,
+				     GError **error);
+
 G_END_DECLS
 
 #endif
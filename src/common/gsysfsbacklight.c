@@ -23,6 +23,9 @@
 typedef struct {
 	GUdevDevice *device;
 	guint max_brightness;
+
+	GSysfsAttribute *brightness;
+	GSysfsAttribute *bl_power;
 } GSysfsBacklightPrivate;
 
 #define G_SYSFS_BACKLIGHT_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), G_SYSFS_TYPE_BACKLIGHT, GSysfsBacklightPrivate))
@@ -43,9 +46,13 @@ static void g_sysfs_backlight_set_device(GSysfsBacklight *self,
 	guint value = 0;
 
 	g_clear_object(&priv->device);
+	g_sysfs_attribute_free(priv->brightness);
+	g_sysfs_attribute_free(priv->bl_power);
 
 	priv->max_brightness = 0;
 	priv->device = device;
+	priv->brightness = g_sysfs_attribute_new(device, "brightness", NULL);
+	priv->bl_power = g_sysfs_attribute_new(device, "bl_power", NULL);
 
 	if (!g_sysfs_read_uint(device, "max_brightness", &value, &error)) {
 		pr_debug("failed to read `max_brightness' property: %s",
@@ -96,6 +103,8 @@ static void g_sysfs_backlight_finalize(GObject *object)
 {
 	GSysfsBacklightPrivate *priv = G_SYSFS_BACKLIGHT_GET_PRIVATE(object);
 
+	g_sysfs_attribute_free(priv->brightness);
+	g_sysfs_attribute_free(priv->bl_power);
 	g_object_unref(priv->device);
 }
 
@@ -183,7 +192,7 @@ guint g_sysfs_backlight_get_brightness(GSysfsBacklight *self, GError **error)
 	GSysfsBacklightPrivate *priv = G_SYSFS_BACKLIGHT_GET_PRIVATE(self);
 	guint value;
 
-	if (!g_sysfs_read_uint(priv->device, "brightness", &value, error))
+	if (!g_sysfs_attribute_read_uint(priv->brightness, &value, error))
 		return 0;
 
 	return value;
@@ -194,7 +203,7 @@ gboolean g_sysfs_backlight_set_brightness(GSysfsBacklight *self, guint value,
 {
 	GSysfsBacklightPrivate *priv = G_SYSFS_BACKLIGHT_GET_PRIVATE(self);
 
-	return g_sysfs_write_uint(priv->device, "brightness", value, error);
+	return g_sysfs_attribute_write_uint(priv->brightness, value, error);
 }
 
 gboolean g_sysfs_backlight_enable(GSysfsBacklight *self, GError **error)
@@ -202,7 +211,7 @@ gboolean g_sysfs_backlight_enable(GSysfsBacklight *self, GError **error)
 	GSysfsBacklightPrivate *priv = G_SYSFS_BACKLIGHT_GET_PRIVATE(self);
 	guint value = FB_BLANK_UNBLANK;
 
-	return g_sysfs_write_uint(priv->device, "bl_power", value, error);
+	return g_sysfs_attribute_write_uint(priv->bl_power, value, error);
 }
 
 gboolean g_sysfs_backlight_disable(GSysfsBacklight *self, GError **error)
@@ -210,7 +219,7 @@ gboolean g_sysfs_backlight_disable(GSysfsBacklight *self, GError **error)
 	GSysfsBacklightPrivate *priv = G_SYSFS_BACKLIGHT_GET_PRIVATE(self);
 	guint value = FB_BLANK_POWERDOWN;
 
-	return g_sysfs_write_uint(priv->device, "bl_power", value, error);
+	return g_sysfs_attribute_write_uint(priv->bl_power, value, error);
 }
 
 gboolean g_sysfs_backlight_is_enabled(GSysfsBacklight *self, GError **error)
@@ -218,7 +227,7 @@ gboolean g_sysfs_backlight_is_enabled(GSysfsBacklight *self, GError **error)
 	GSysfsBacklightPrivate *priv = G_SYSFS_BACKLIGHT_GET_PRIVATE(self);
 	guint value;
 
-	if (!g_sysfs_read_uint(priv->device, "bl_power", &value, error))
+	if (!g_sysfs_attribute_read_uint(priv->bl_power, &value, error))
 		return FALSE;
 
 	return value == FB_BLANK_UNBLANK;
@@ -22,6 +22,7 @@
 typedef struct {
 	GUdevDevice *device;
 	guint pin;
+	GSysfsAttribute *value;
 } GSysfsGpioPrivate;
 
 #define G_SYSFS_GPIO_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), G_SYSFS_TYPE_GPIO, GSysfsGpioPrivate))
@@ -99,14 +100,14 @@ static gboolean gpio_get_level(GSysfsGpio *gpio, guint *level, GError **errorp)
 {
 	GSysfsGpioPrivate *priv = G_SYSFS_GPIO_GET_PRIVATE(gpio);
 
-	return g_sysfs_read_uint(priv->device, "value", level, errorp);
+	return g_sysfs_attribute_read_uint(priv->value, level, errorp);
 }
 
 static gboolean gpio_set_level(GSysfsGpio *gpio, guint level, GError **errorp)
 {
 	GSysfsGpioPrivate *priv = G_SYSFS_GPIO_GET_PRIVATE(gpio);
 
-	return g_sysfs_write_uint(priv->device, "value", level, errorp);
+	return g_sysfs_attribute_write_uint(priv->value, level, errorp);
 }
 
 static void g_sysfs_gpio_get_property(GObject *object, guint prop_id,
@@ -169,7 +170,10 @@ static void g_sysfs_gpio_set_property(GObject *object, guint prop_id,
 
 	case PROP_DEVICE:
 		g_clear_object(&priv->device);
+		g_sysfs_attribute_free(priv->value);
 		priv->device = g_value_dup_object(value);
+		priv->value = g_sysfs_attribute_new(priv->device, "value",
+						    NULL);
 		break;
 
 	case PROP_DIRECTION:
@@ -206,6 +210,8 @@ static void g_sysfs_gpio_finalize(GObject *object)
 	GUdevDevice *subsys;
 	GUdevClient *udev;
 
+	g_sysfs_attribute_free(priv->value);
+
 	udev = g_udev_client_new(subsystems);
 	if (!udev) {
 		pr_debug("Udev not found");
@@ -498,17 +504,14 @@ freev:
 
 gboolean g_sysfs_gpio_set_value(GSysfsGpio *gpio, guint value, GError **errorp)
 {
-	GSysfsGpioPrivate *priv = G_SYSFS_GPIO_GET_PRIVATE(gpio);
-
-	return g_sysfs_write_uint(priv->device, "value", value, errorp);
+	return gpio_set_level(gpio, value, errorp);
 }
 
 guint g_sysfs_gpio_get_value(GSysfsGpio *gpio, GError **errorp)
 {
-	GSysfsGpioPrivate *priv = G_SYSFS_GPIO_GET_PRIVATE(gpio);
 	guint value;
 
-	if (!g_sysfs_read_uint(priv->device, "value", &value, errorp))
+	if (!gpio_get_level(gpio, &value, errorp))
 		return 0;
 
 	return value;
@@ -14,11 +14,227 @@
 
 #include "remote-control.h"
 
-struct app_watchdog {
+/*
+ * Pings are sent from a separate thread so that a slow watchdog daemon
+ * cannot stall the caller. Only one ping is in flight at any time and
+ * triggers arriving in the meantime are merged into a single ping that is
+ * sent as soon as the current one completes.
+ */
+struct app_watchdog_channel {
 	DBusWatchdog *dbus_watchdog;
+	const gchar *name;
+	gboolean pending;
+	gint64 pending_since;
+	gint64 last_trigger;
+	gboolean failing;
+
+	struct app_watchdog_stats stats;
+	guint64 latency_sum;
+};
+
+struct app_watchdog {
+	struct app_watchdog_channel channels[APP_WATCHDOG_CHANNEL_MAX];
 	guint interval;
+
+	GSource *heartbeat;
+
+	GThread *thread;
+	GMutex lock;
+	GCond cond;
+	struct app_watchdog_channel *busy;
+	gboolean done;
+};
+
+static const gchar *const channel_names[APP_WATCHDOG_CHANNEL_MAX] = {
+	[APP_WATCHDOG_CHANNEL_SCRIPT] = "app-watchdog",
+	[APP_WATCHDOG_CHANNEL_MAIN_LOOP] = "main-loop",
 };
 
+static struct app_watchdog_channel *app_watchdog_next(
+		struct app_watchdog *watchdog)
+{
+	guint i;
+
+	for (i = 0; i < APP_WATCHDOG_CHANNEL_MAX; i++) {
+		struct app_watchdog_channel *channel = &watchdog->channels[i];
+
+		if (channel->pending && channel->dbus_watchdog)
+			return channel;
+	}
+
+	return NULL;
+}
+
+static gpointer app_watchdog_thread(gpointer data)
+{
+	struct app_watchdog *watchdog = data;
+	struct app_watchdog_channel *channel;
+	DBusWatchdog *dbus_watchdog;
+	gboolean success;
+	gint64 since;
+	guint64 latency;
+
+	g_mutex_lock(&watchdog->lock);
+
+	while (!watchdog->done) {
+		channel = app_watchdog_next(watchdog);
+		if (!channel) {
+			g_cond_wait(&watchdog->cond, &watchdog->lock);
+			continue;
+		}
+
+		dbus_watchdog = channel->dbus_watchdog;
+		since = channel->pending_since;
+		channel->pending = FALSE;
+		watchdog->busy = channel;
+
+		g_mutex_unlock(&watchdog->lock);
+
+		success = dbus_watchdog_ping(dbus_watchdog, NULL,
+				channel->name);
+
+		g_mutex_lock(&watchdog->lock);
+
+		watchdog->busy = NULL;
+		latency = g_get_monotonic_time() - since;
+
+		if (success) {
+			if (channel->failing)
+				g_debug("app-watchdog: %s: ping recovered",
+					channel->name);
+
+			channel->stats.pings++;
+			channel->latency_sum += latency;
+			channel->stats.latency_avg = channel->latency_sum /
+				channel->stats.pings;
+			if (latency > channel->stats.latency_max)
+				channel->stats.latency_max = latency;
+		} else {
+			if (!channel->failing)
+				g_warning("app-watchdog: %s: ping failed",
+					channel->name);
+
+			channel->stats.failures++;
+		}
+
+		channel->failing = !success;
+
+		/* app_watchdog_stop() may be waiting for the ping to finish */
+		g_cond_broadcast(&watchdog->cond);
+	}
+
+	g_mutex_unlock(&watchdog->lock);
+
+	return NULL;
+}
+
+static void app_watchdog_channel_stop(struct app_watchdog *watchdog,
+		enum app_watchdog_channel_id id)
+{
+	struct app_watchdog_channel *channel = &watchdog->channels[id];
+	DBusWatchdog *dbus_watchdog;
+
+	g_mutex_lock(&watchdog->lock);
+
+	while (watchdog->busy == channel)
+		g_cond_wait(&watchdog->cond, &watchdog->lock);
+
+	dbus_watchdog = channel->dbus_watchdog;
+	channel->dbus_watchdog = NULL;
+	channel->pending = FALSE;
+
+	g_mutex_unlock(&watchdog->lock);
+
+	if (dbus_watchdog) {
+		dbus_watchdog_stop(dbus_watchdog, NULL);
+		dbus_watchdog_unref(dbus_watchdog);
+	}
+}
+
+static int app_watchdog_channel_start(struct app_watchdog *watchdog,
+		enum app_watchdog_channel_id id, guint interval)
+{
+	struct app_watchdog_channel *channel = &watchdog->channels[id];
+	DBusWatchdog *dbus_watchdog;
+
+	/* restarting with a new interval replaces the previous watchdog */
+	app_watchdog_channel_stop(watchdog, id);
+
+	dbus_watchdog = dbus_watchdog_new(interval * 1000, NULL);
+	if (!dbus_watchdog)
+		return -ENODEV;
+
+	g_mutex_lock(&watchdog->lock);
+	channel->dbus_watchdog = dbus_watchdog;
+	channel->last_trigger = 0;
+	g_mutex_unlock(&watchdog->lock);
+
+	return 0;
+}
+
+static int app_watchdog_channel_trigger(struct app_watchdog *watchdog,
+		enum app_watchdog_channel_id id)
+{
+	struct app_watchdog_channel *channel = &watchdog->channels[id];
+	gint64 now = g_get_monotonic_time();
+	int ret = 0;
+
+	g_mutex_lock(&watchdog->lock);
+
+	if (!channel->dbus_watchdog) {
+		ret = -ENODEV;
+		goto unlock;
+	}
+
+	if (channel->last_trigger &&
+	    now - channel->last_trigger > channel->stats.gap_max)
+		channel->stats.gap_max = now - channel->last_trigger;
+
+	channel->last_trigger = now;
+	channel->stats.triggers++;
+
+	if (channel->pending) {
+		channel->stats.coalesced++;
+		goto unlock;
+	}
+
+	channel->pending = TRUE;
+	channel->pending_since = now;
+	g_cond_signal(&watchdog->cond);
+
+unlock:
+	g_mutex_unlock(&watchdog->lock);
+	return ret;
+}
+
+static gboolean app_watchdog_heartbeat(gpointer data)
+{
+	struct app_watchdog *watchdog = data;
+
+	app_watchdog_channel_trigger(watchdog, APP_WATCHDOG_CHANNEL_MAIN_LOOP);
+
+	return TRUE;
+}
+
+static int app_watchdog_start_heartbeat(struct app_watchdog *watchdog,
+		guint interval)
+{
+	int err;
+
+	err = app_watchdog_channel_start(watchdog,
+			APP_WATCHDOG_CHANNEL_MAIN_LOOP, interval);
+	if (err < 0)
+		return err;
+
+	/* ping three times per period, like the standalone watchdog does */
+	watchdog->heartbeat = g_timeout_source_new(interval * 1000 / 3);
+	g_source_set_callback(watchdog->heartbeat, app_watchdog_heartbeat,
+			watchdog, NULL);
+	g_source_attach(watchdog->heartbeat, NULL);
+
+	return 0;
+}
+
 int app_watchdog_start(struct app_watchdog *watchdog, int interval)
 {
 	if (watchdog == NULL)
@@ -31,12 +247,8 @@ int app_watchdog_start(struct app_watchdog *watchdog, int interval)
 	if (watchdog->interval <= 0)
 		return -EINVAL;
 
-	watchdog->dbus_watchdog = dbus_watchdog_new(watchdog->interval * 1000,
-			NULL);
-	if (!watchdog->dbus_watchdog)
-		return -ENODEV;
-
-	return 0;
+	return app_watchdog_channel_start(watchdog,
+			APP_WATCHDOG_CHANNEL_SCRIPT, watchdog->interval);
 }
 
 int app_watchdog_stop(struct app_watchdog *watchdog)
@@ -44,12 +256,7 @@ int app_watchdog_stop(struct app_watchdog *watchdog)
 	if (watchdog == NULL)
 		return -EINVAL;
 
-	if (watchdog->dbus_watchdog != NULL) {
-		dbus_watchdog_stop(watchdog->dbus_watchdog, NULL);
-		dbus_watchdog_unref(watchdog->dbus_watchdog);
-	}
-
-	watchdog->dbus_watchdog = NULL;
+	app_watchdog_channel_stop(watchdog, APP_WATCHDOG_CHANNEL_SCRIPT);
 
 	return 0;
 }
@@ -59,11 +266,21 @@ int app_watchdog_trigger(struct app_watchdog *watchdog)
 	if (watchdog == NULL)
 		return -EINVAL;
 
-	if (watchdog->dbus_watchdog == NULL)
-		return -ENODEV;
+	return app_watchdog_channel_trigger(watchdog,
+			APP_WATCHDOG_CHANNEL_SCRIPT);
+}
 
-	if (!dbus_watchdog_ping(watchdog->dbus_watchdog, NULL, "app-watchdog"))
-		return -ENODEV;
+int app_watchdog_get_stats(struct app_watchdog *watchdog,
+		enum app_watchdog_channel_id id,
+		struct app_watchdog_stats *stats)
+{
+	if (!watchdog || id >= APP_WATCHDOG_CHANNEL_MAX || !stats)
+		return -EINVAL;
+
+	g_mutex_lock(&watchdog->lock);
+	*stats = watchdog->channels[id].stats;
+	stats->running = watchdog->channels[id].dbus_watchdog != NULL;
+	g_mutex_unlock(&watchdog->lock);
 
 	return 0;
 }
@@ -72,11 +289,21 @@ int app_watchdog_create(struct app_watchdog **watchdogp, GKeyFile *config)
 {
 	struct app_watchdog *watchdog;
 	int interval;
+	guint i;
 
 	watchdog = g_new0(struct app_watchdog, 1);
 	if (!watchdog)
 		return -ENOMEM;
 
+	for (i = 0; i < APP_WATCHDOG_CHANNEL_MAX; i++)
+		watchdog->channels[i].name = channel_names[i];
+
+	g_mutex_init(&watchdog->lock);
+	g_cond_init(&watchdog->cond);
+
+	watchdog->thread = g_thread_new("app-watchdog", app_watchdog_thread,
+			watchdog);
+
 	interval = g_key_file_get_integer(config, "js-watchdog", "timeout",
 			NULL);
 	if (interval > 0) {
@@ -86,6 +313,15 @@ int app_watchdog_create(struct app_watchdog **watchdogp, GKeyFile *config)
 			g_warning("%s: Could not autostart watchdog", __func__);
 	}
 
+	interval = g_key_file_get_integer(config, "js-watchdog", "heartbeat",
+			NULL);
+	if (interval > 0) {
+		g_debug("%s: Main loop heartbeat with interval %d", __func__,
+				interval);
+		if (app_watchdog_start_heartbeat(watchdog, interval) != 0)
+			g_warning("%s: Could not start heartbeat", __func__);
+	}
+
 	*watchdogp = watchdog;
 	return 0;
 }
@@ -95,6 +331,22 @@ int app_watchdog_free(struct app_watchdog *watchdog)
 	if (!watchdog)
 		return -EINVAL;
 
+	if (watchdog->heartbeat) {
+		g_source_destroy(watchdog->heartbeat);
+		g_source_unref(watchdog->heartbeat);
+		app_watchdog_channel_stop(watchdog,
+				APP_WATCHDOG_CHANNEL_MAIN_LOOP);
+	}
+
+	g_mutex_lock(&watchdog->lock);
+	watchdog->done = TRUE;
+	g_cond_signal(&watchdog->cond);
+	g_mutex_unlock(&watchdog->lock);
+
+	g_thread_join(watchdog->thread);
+
+	g_cond_clear(&watchdog->cond);
+	g_mutex_clear(&watchdog->lock);
 	g_free(watchdog);
 
 	return 0;
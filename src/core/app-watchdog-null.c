@@ -31,6 +31,13 @@ int app_watchdog_trigger(struct app_watchdog *watchdog)
 	return -ENOSYS;
 }
 
+int app_watchdog_get_stats(struct app_watchdog *watchdog,
+		enum app_watchdog_channel_id id,
+		struct app_watchdog_stats *stats)
+{
+	return -ENOSYS;
+}
+
 int app_watchdog_create(struct app_watchdog **watchdogp, GKeyFile *config)
 {
 	return 0;
@@ -16,17 +16,59 @@
 
 #include "remote-control.h"
 
-#include "find-device.h"
-
 #define AUDIO_ALSA_DEBUG 0
-#define AUDIO_USE_DEVICE_PREFIX "BurrBrown from Texas Instruments "
 #define AUDIO_USB_DEVICE_NAME "USB AUDIO  CODEC"
-#define AUDIO_USB_DEVICE_FULL_NAME AUDIO_USE_DEVICE_PREFIX AUDIO_USB_DEVICE_NAME
+
+#define AUDIO_NUM_STATES (AUDIO_STATE_LINEIN_HEADSET + 1)
+/* volume changes are written to the hardware at most once per period */
+#define AUDIO_VOLUME_PERIOD 20
+
+static const char *soundcard_control_names[] = {
+	"Master",
+	"Speaker",
+	"Line Out",
+	"Headphone",
+	"PCM",
+};
+
+struct soundcard_control {
+	snd_mixer_elem_t *elem;
+	long min;
+	long max;
+
+	/* raw volume waiting to be written */
+	long pending;
+	gboolean dirty;
+};
 
 struct soundcard {
 	gchar *name;
 	int index;
 	snd_mixer_t *mixer;
+	GPollFD *fds;
+	unsigned int num_fds;
+
+	struct soundcard_control controls[G_N_ELEMENTS(soundcard_control_names)];
+};
+
+/* a single UCM command */
+struct ucm_step {
+	gchar *identifier;
+	const char *value;
+};
+
+/* the commands needed to get from one state to another */
+struct ucm_transition {
+	struct ucm_step steps[2];
+	unsigned int num_steps;
+};
+
+/* voip devices of a state, looked up once */
+struct ucm_voip {
+	gboolean valid;
+	gchar *playback;
+	gchar *capture;
+	float gain;
 };
 
 struct audio {
@@ -34,10 +76,28 @@ struct audio {
 	snd_use_case_mgr_t *ucm;
 	enum audio_state state;
 
+	struct ucm_transition transitions[AUDIO_NUM_STATES][AUDIO_NUM_STATES];
+	struct ucm_voip voip[AUDIO_NUM_STATES];
+
 	gint index;
 	GList *cards;
 
 	gboolean usb_handset;
+
+	/* the volume control of each state, NULL if there is none */
+	struct soundcard_control *volume[AUDIO_NUM_STATES];
+	GSource *source;
+	gint64 last_write;
+	gboolean dirty;
+};
+
+/*
+ * Keeps the mixers of all cards in sync with external changes and writes
+ * coalesced volume changes.
+ */
+struct audio_source {
+	GSource source;
+	struct audio *audio;
 };
 
 int audio_get_state(struct audio *audio, enum audio_state *statep);
@@ -151,11 +211,11 @@ static const struct ucm_state ucm_states[] = {
 	},
 };
 
-static const char *audio_state_to_control(struct audio *audio)
+static const char *audio_state_to_control(enum audio_state state)
 {
 	const char *control = NULL;
 
-	switch (audio->state) {
+	switch (state) {
 	case AUDIO_STATE_HIFI_PLAYBACK_SPEAKER:
 	case AUDIO_STATE_VOICECALL_SPEAKER:
 	case AUDIO_STATE_VOICECALL_IP_SPEAKER:
@@ -181,8 +241,139 @@ static const char *audio_state_to_control(struct audio *audio)
 	return control;
 }
 
-static void soundcard_mixer_close(struct soundcard *card);
-static int soundcard_mixer_open(struct soundcard *card);
+static void ucm_transition_add(struct ucm_transition *transition,
+			       gchar *identifier, const char *value)
+{
+	struct ucm_step *step = &transition->steps[transition->num_steps++];
+
+	step->identifier = identifier;
+	step->value = value;
+}
+
+/*
+ * Changing the verb disables all devices of the previous verb, so there is
+ * no need to do that explicitly. Within the same verb, the device is
+ * switched, which lets UCM run a transition sequence if there is one.
+ */
+static void audio_build_transitions(struct audio *audio)
+{
+	unsigned int from, to;
+
+	for (from = 0; from < AUDIO_NUM_STATES; from++) {
+		const struct ucm_state *f = &ucm_states[from];
+
+		for (to = 0; to < AUDIO_NUM_STATES; to++) {
+			struct ucm_transition *t = &audio->transitions[from][to];
+			const struct ucm_state *s = &ucm_states[to];
+			gboolean f_none, s_none;
+
+			if (from == to)
+				continue;
+
+			f_none = strcmp(f->device, SND_USE_CASE_DEV_NONE) == 0;
+			s_none = strcmp(s->device, SND_USE_CASE_DEV_NONE) == 0;
+
+			if (strcmp(f->verb, s->verb) != 0) {
+				ucm_transition_add(t, g_strdup("_verb"),
+						   s->verb);
+				if (!s_none)
+					ucm_transition_add(t,
+						g_strdup("_enadev"),
+						s->device);
+			} else if (strcmp(f->device, s->device) != 0) {
+				if (!f_none && !s_none) {
+					ucm_transition_add(t, g_strdup_printf(
+						"_swdev/%s", f->device),
+						s->device);
+				} else if (!f_none) {
+					ucm_transition_add(t,
+						g_strdup("_disdev"),
+						f->device);
+				} else {
+					ucm_transition_add(t,
+						g_strdup("_enadev"),
+						s->device);
+				}
+			}
+		}
+	}
+}
+
+static void audio_free_transitions(struct audio *audio)
+{
+	unsigned int from, to, i;
+
+	for (from = 0; from < AUDIO_NUM_STATES; from++) {
+		for (to = 0; to < AUDIO_NUM_STATES; to++) {
+			struct ucm_transition *t = &audio->transitions[from][to];
+
+			for (i = 0; i < t->num_steps; i++)
+				g_free(t->steps[i].identifier);
+		}
+	}
+}
+
+/*
+ * Looks up a value for the given device and verb, which does not need to
+ * be the current one, falling back to the value of the verb.
+ */
+static gchar *audio_ucm_get(struct audio *audio, const char *name,
+			    const struct ucm_state *s)
+{
+	char identifier[128];
+	const char *value;
+
+	snprintf(identifier, sizeof(identifier), "%s/%s/%s", name, s->device,
+		 s->verb);
+	if (!snd_use_case_get(audio->ucm, identifier, &value))
+		return (gchar *)value;
+
+	snprintf(identifier, sizeof(identifier), "%s//%s", name, s->verb);
+	if (!snd_use_case_get(audio->ucm, identifier, &value))
+		return (gchar *)value;
+
+	return NULL;
+}
+
+static struct ucm_voip *audio_get_voip(struct audio *audio,
+				       enum audio_state state)
+{
+	const struct ucm_state *s = &ucm_states[state];
+	struct ucm_voip *voip = &audio->voip[state];
+	gchar *gain;
+
+	if (voip->valid)
+		return voip;
+
+	voip->valid = TRUE;
+
+	if (strcmp(s->verb, SND_USE_CASE_VERB_IP_VOICECALL) ||
+	    !strcmp(s->device, SND_USE_CASE_DEV_NONE))
+		return voip;
+
+	voip->playback = audio_ucm_get(audio, "PlaybackPCM", s);
+	voip->capture = audio_ucm_get(audio, "CapturePCM", s);
+
+	gain = audio_ucm_get(audio, "CaptureGain", s);
+	if (gain) {
+		voip->gain = atof(gain);
+		free(gain);
+	}
+
+	return voip;
+}
+
+/* drops the looked up devices, they are looked up again on next use */
+static void audio_free_voip(struct audio *audio)
+{
+	unsigned int i;
+
+	for (i = 0; i < AUDIO_NUM_STATES; i++) {
+		free(audio->voip[i].playback);
+		free(audio->voip[i].capture);
+		memset(&audio->voip[i], 0, sizeof(audio->voip[i]));
+	}
+}
 
 static inline snd_mixer_elem_t* soundcard_get_control(struct soundcard *card,
 						      const char *control)
@@ -196,65 +387,63 @@ static inline snd_mixer_elem_t* soundcard_get_control(struct soundcard *card,
 	return snd_mixer_find_selem(card->mixer, sid);
 }
 
-static int soundcard_control_set_volume(struct soundcard *card,
-					const char *control, long volume)
+static struct soundcard_control *soundcard_find_control(struct soundcard *card,
+							const char *name)
 {
-	long min = 0, max = 0, vol;
-	snd_mixer_elem_t* elem;
-	int err;
-
-	err = soundcard_mixer_open(card);
-	if (err < 0)
-		return err;
+	unsigned int i;
 
-	elem = soundcard_get_control(card, control);
-	if (!elem) {
-		soundcard_mixer_close(card);
-		return -ENODEV;
+	for (i = 0; i < G_N_ELEMENTS(soundcard_control_names); i++) {
+		if (strcmp(soundcard_control_names[i], name) == 0)
+			return card->controls[i].elem ? &card->controls[i] : NULL;
 	}
 
-	err = snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
-	if (err < 0)
-		return err;
+	return NULL;
+}
 
-	vol = ((volume * (max - min)) / 255) + min;
+static int soundcard_control_write(struct soundcard_control *ctl)
+{
+	int err;
+
+	ctl->dirty = FALSE;
 
-	err = snd_mixer_selem_set_playback_volume_all(elem, vol);
+	err = snd_mixer_selem_set_playback_volume_all(ctl->elem, ctl->pending);
 	if (err < 0)
 		return err;
 
-	snd_mixer_selem_set_playback_switch_all(elem, vol > 0);
-
-	soundcard_mixer_close(card);
+	snd_mixer_selem_set_playback_switch_all(ctl->elem, ctl->pending > 0);
 	return 0;
 }
 
-static int soundcard_control_get_volume(struct soundcard *card,
-					const char *control, long *volumep)
+static void soundcard_control_set_volume(struct soundcard_control *ctl,
+					 long volume)
 {
-	snd_mixer_elem_t* elem;
-	long min, max;
-	long volume;
-	int err;
+	ctl->pending = ((volume * (ctl->max - ctl->min)) / 255) + ctl->min;
+	ctl->dirty = TRUE;
+}
 
-	err = soundcard_mixer_open(card);
-	if (err < 0)
-		return err;
+/*
+ * The element values are kept up to date by the mixer events, so this does
+ * not touch the hardware. Volume not yet written is reported as is.
+ */
+static int soundcard_control_get_volume(struct soundcard_control *ctl,
+					long *volumep)
+{
+	long volume = ctl->pending;
+	int err;
 
-	elem = soundcard_get_control(card, control);
-	if (!elem) {
-		soundcard_mixer_close(card);
-		return -ENODEV;
+	if (!ctl->dirty) {
+		/* since we set both, we can query only one side */
+		err = snd_mixer_selem_get_playback_volume(ctl->elem,
+				SND_MIXER_SCHN_FRONT_LEFT, &volume);
+		if (err < 0)
+			return err;
 	}
 
-	snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
-	/* since we set both, we can query only one side */
-	err = snd_mixer_selem_get_playback_volume(elem, SND_MIXER_SCHN_FRONT_LEFT, &volume);
-	volume = ((volume + min) * 255) / (max - min);
-	*volumep = volume;
+	if (ctl->max <= ctl->min)
+		return -ERANGE;
 
-	soundcard_mixer_close(card);
-	return err;
+	*volumep = ((volume - ctl->min) * 255) / (ctl->max - ctl->min);
+	return 0;
 }
 
 static void soundcard_mixer_close(struct soundcard *card)
@@ -264,12 +453,38 @@ static void soundcard_mixer_close(struct soundcard *card)
 	if (!card || !card->mixer)
 		return;
 
+	g_free(card->fds);
+	card->fds = NULL;
+	card->num_fds = 0;
+	memset(card->controls, 0, sizeof(card->controls));
+
 	snprintf(device, sizeof(device), "hw:%d", card->index);
 	snd_mixer_detach(card->mixer, device);
 	snd_mixer_close(card->mixer);
 	card->mixer = NULL;
 }
 
+static void soundcard_mixer_resolve(struct soundcard *card)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(soundcard_control_names); i++) {
+		struct soundcard_control *ctl = &card->controls[i];
+		snd_mixer_elem_t *elem;
+
+		elem = soundcard_get_control(card, soundcard_control_names[i]);
+		if (!elem || !snd_mixer_selem_has_playback_volume(elem))
+			continue;
+
+		if (snd_mixer_selem_get_playback_volume_range(elem, &ctl->min,
+				&ctl->max) < 0)
+			continue;
+
+		ctl->elem = elem;
+	}
+}
+
+/* the mixer stays open for the lifetime of the card */
 static int soundcard_mixer_open(struct soundcard *card)
 {
 	char device[16];
@@ -293,8 +508,25 @@ static int soundcard_mixer_open(struct soundcard *card)
 	if (err < 0)
 		goto detach;
 
+	err = snd_mixer_poll_descriptors_count(card->mixer);
+	if (err < 0)
+		goto detach;
+
+	card->num_fds = err;
+	card->fds = g_new0(GPollFD, card->num_fds);
+
+	err = snd_mixer_poll_descriptors(card->mixer,
+			(struct pollfd *)card->fds, card->num_fds);
+	if (err < 0)
+		goto free;
+
+	soundcard_mixer_resolve(card);
 	return 0;
 
+free:
+	g_free(card->fds);
+	card->fds = NULL;
+	card->num_fds = 0;
 detach:
 	snd_mixer_detach(card->mixer, device);
 close:
@@ -421,12 +653,224 @@ static int audio_find_cards(struct audio *audio)
 	return g_list_length(audio->cards) > 0 ? 0 : -ENODEV;
 }
 
+static gboolean audio_is_handset_state(enum audio_state state)
+{
+	if (state == AUDIO_STATE_VOICECALL_HANDSET ||
+	    state == AUDIO_STATE_VOICECALL_IP_HANDSET)
+		return true;
+	return false;
+}
+
+/*
+ * Looks up the volume control of each state once, instead of on every
+ * volume change.
+ */
+static void audio_resolve_controls(struct audio *audio)
+{
+	struct soundcard *card, *usb = NULL;
+	unsigned int state;
+
+	card = g_list_nth(audio->cards, audio->index)->data;
+
+	/*
+	 * When USB handset is used, we have a second soundcard, so we need
+	 * to change the control we would use. This solution is kind of a of
+	 * hack but i have no better idea how to solve this issue right now.
+	 */
+	if (audio->usb_handset)
+		usb = audio_get_card_by_name(audio, AUDIO_USB_DEVICE_NAME);
+
+	for (state = 0; state < AUDIO_NUM_STATES; state++) {
+		const char *control = audio_state_to_control(state);
+		struct soundcard *target = card;
+
+		if (usb && audio_is_handset_state(state)) {
+			target = usb;
+			control = "PCM";
+		}
+
+		audio->volume[state] = soundcard_find_control(target, control);
+		if (!audio->volume[state])
+			g_debug("audio-alsa-ucm: no control %s on %s for "
+				"state %u", control, target->name, state);
+	}
+}
+
+static int audio_flush_volume(struct audio *audio)
+{
+	int ret = 0;
+	GList *node;
+	guint i;
+
+	for (node = audio->cards; node; node = node->next) {
+		struct soundcard *card = node->data;
+
+		for (i = 0; i < G_N_ELEMENTS(card->controls); i++) {
+			struct soundcard_control *ctl = &card->controls[i];
+			int err;
+
+			if (!ctl->dirty)
+				continue;
+
+			err = soundcard_control_write(ctl);
+			if (err < 0) {
+				g_warning("audio-alsa-ucm: failed to set "
+					  "volume: %s", snd_strerror(err));
+				ret = err;
+			}
+		}
+	}
+
+	audio->last_write = g_get_monotonic_time();
+	audio->dirty = FALSE;
+
+	return ret;
+}
+
+static gint64 audio_flush_deadline(struct audio *audio)
+{
+	return audio->last_write + AUDIO_VOLUME_PERIOD * 1000;
+}
+
+static gboolean audio_source_prepare(GSource *source, gint *timeout)
+{
+	struct audio *audio = ((struct audio_source *)source)->audio;
+	gint64 remaining;
+
+	if (timeout)
+		*timeout = -1;
+
+	if (!audio->dirty)
+		return FALSE;
+
+	remaining = audio_flush_deadline(audio) - g_get_monotonic_time();
+	if (remaining <= 0)
+		return TRUE;
+
+	if (timeout)
+		*timeout = (remaining + 999) / 1000;
+
+	return FALSE;
+}
+
+static gboolean audio_source_check(GSource *source)
+{
+	struct audio *audio = ((struct audio_source *)source)->audio;
+	unsigned int i;
+	GList *node;
+
+	for (node = audio->cards; node; node = node->next) {
+		struct soundcard *card = node->data;
+
+		for (i = 0; i < card->num_fds; i++)
+			if (card->fds[i].revents)
+				return TRUE;
+	}
+
+	return audio->dirty &&
+		audio_flush_deadline(audio) <= g_get_monotonic_time();
+}
+
+static gboolean audio_source_dispatch(GSource *source, GSourceFunc callback,
+				      gpointer user_data)
+{
+	struct audio *audio = ((struct audio_source *)source)->audio;
+	unsigned int i;
+	GList *node;
+
+	/* pick up changes made by others, e.g. alsamixer */
+	for (node = audio->cards; node; node = node->next) {
+		struct soundcard *card = node->data;
+
+		for (i = 0; i < card->num_fds; i++) {
+			if (card->fds[i].revents) {
+				snd_mixer_handle_events(card->mixer);
+				break;
+			}
+		}
+	}
+
+	if (audio->dirty &&
+	    audio_flush_deadline(audio) <= g_get_monotonic_time())
+		audio_flush_volume(audio);
+
+	return TRUE;
+}
+
+static GSourceFuncs audio_source_funcs = {
+	.prepare = audio_source_prepare,
+	.check = audio_source_check,
+	.dispatch = audio_source_dispatch,
+};
+
+static void audio_attach_mixers(struct audio *audio)
+{
+	unsigned int i;
+	GList *node;
+	int err;
+
+	for (node = audio->cards; node; node = node->next) {
+		struct soundcard *card = node->data;
+
+		err = soundcard_mixer_open(card);
+		if (err < 0) {
+			g_debug("audio-alsa-ucm: failed to open mixer of %s: %s",
+				card->name, snd_strerror(err));
+			continue;
+		}
+
+		for (i = 0; i < card->num_fds; i++)
+			g_source_add_poll(audio->source, &card->fds[i]);
+	}
+
+	audio->usb_handset = audio_get_card_by_name(audio,
+			AUDIO_USB_DEVICE_NAME) != NULL;
+	if (audio->usb_handset)
+		g_debug("audio-alsa-ucm: found usb handset");
+
+	audio_resolve_controls(audio);
+}
+
+static void audio_detach_mixers(struct audio *audio)
+{
+	unsigned int i;
+	GList *node;
+
+	for (node = audio->cards; node; node = node->next) {
+		struct soundcard *card = node->data;
+
+		for (i = 0; i < card->num_fds; i++)
+			g_source_remove_poll(audio->source, &card->fds[i]);
+	}
+
+	memset(audio->volume, 0, sizeof(audio->volume));
+	audio->usb_handset = false;
+}
+
+static int audio_open_mixers(struct audio *audio)
+{
+	struct audio_source *source;
+
+	source = (struct audio_source *)g_source_new(&audio_source_funcs,
+						     sizeof(*source));
+	if (!source)
+		return -ENOMEM;
+
+	source->audio = audio;
+	audio->source = &source->source;
+
+	audio_attach_mixers(audio);
+	g_source_attach(audio->source, NULL);
+
+	return 0;
+}
+
 int audio_create(struct audio **audiop, struct remote_control *rc,
 		 GKeyFile *config)
 {
 	struct soundcard *card;
 	struct audio *audio;
-	int err, ret;
+	int err;
 
 	audio = g_new0(struct audio, 1);
 	if (!audio)
@@ -466,12 +910,13 @@ int audio_create(struct audio **audiop, struct remote_control *rc,
 	if (AUDIO_ALSA_DEBUG)
 		alsa_ucm_dump_verbs(audio);
 
-	ret = find_input_devices(AUDIO_USB_DEVICE_FULL_NAME, NULL, NULL);
-	if (ret > 0) {
-		g_debug("audio-alsa-ucm: found usb handset");
-		audio->usb_handset = true;
-	} else
-		audio->usb_handset = false;
+	audio_build_transitions(audio);
+
+	err = audio_open_mixers(audio);
+	if (err < 0) {
+		audio_free(audio);
+		return err;
+	}
 
 	*audiop = audio;
 	return 0;
@@ -484,6 +929,14 @@ int audio_free(struct audio *audio)
 	if (!audio)
 		return -EINVAL;
 
+	if (audio->source) {
+		if (audio->dirty)
+			audio_flush_volume(audio);
+
+		g_source_destroy(audio->source);
+		g_source_unref(audio->source);
+	}
+
 	if (audio->ucm) {
 		err = snd_use_case_mgr_reset(audio->ucm);
 		if (err < 0) {
@@ -499,194 +952,174 @@ int audio_free(struct audio *audio)
 	}
 
 	g_list_free_full(audio->cards, (GDestroyNotify)soundcard_free);
+	audio_free_transitions(audio);
+	audio_free_voip(audio);
 
 	g_free(audio);
 	return 0;
 }
 
-static void audio_update_voip(struct audio *audio, const struct ucm_state *s)
+static void audio_update_voip(struct audio *audio, enum audio_state state)
 {
 	struct voip *voip = remote_control_get_voip(audio->rc);
-	char identifier[128];
+	struct ucm_voip *config;
 	char card[128];
-	char *name;
 
-	if (!voip || strcmp(s->verb, SND_USE_CASE_VERB_IP_VOICECALL) ||
-			!strcmp(s->device, SND_USE_CASE_DEV_NONE))
+	if (!voip)
 		return;
 
-	snprintf(identifier, sizeof(identifier), "PlaybackPCM/%s", s->device);
-	if (!snd_use_case_get(audio->ucm, identifier, (const char **)&name) ||
-			!snd_use_case_get(audio->ucm, "PlaybackPCM",
-					(const char **)&name)) {
-		snprintf(card, sizeof(card), "ALSA: %s", name);
-		voip_set_playback(voip, card);
-		g_free(name);
-	}
+	config = audio_get_voip(audio, state);
 
-	snprintf(identifier, sizeof(identifier), "CapturePCM/%s", s->device);
-	if (!snd_use_case_get(audio->ucm, identifier, (const char **)&name) ||
-			!snd_use_case_get(audio->ucm, "CapturePCM",
-					(const char **)&name)) {
-		snprintf(card, sizeof(card), "ALSA: %s", name);
+	/* calls on the handset follow the USB handset while it is plugged */
+	if (audio->usb_handset && audio_is_handset_state(state)) {
+		snprintf(card, sizeof(card), "ALSA: %s", AUDIO_USB_DEVICE_NAME);
+		voip_set_playback(voip, card);
 		voip_set_capture(voip, card);
-		g_free(name);
+	} else {
+		if (config->playback) {
+			snprintf(card, sizeof(card), "ALSA: %s",
+				 config->playback);
+			voip_set_playback(voip, card);
+		}
+
+		if (config->capture) {
+			snprintf(card, sizeof(card), "ALSA: %s",
+				 config->capture);
+			voip_set_capture(voip, card);
+		}
 	}
-	snprintf(identifier, sizeof(identifier), "CaptureGain/%s", s->device);
-	if (!snd_use_case_get(audio->ucm, identifier, (const char **)&name) ||
-			!snd_use_case_get(audio->ucm, "CaptureGain",
-					(const char **)&name)) {
-		float gain = atof(name);
-		if (gain != 0.0)
-			voip_set_capture_gain(voip, gain);
-		g_free(name);
+
+	if (config->gain != 0.0)
+		voip_set_capture_gain(voip, config->gain);
+}
+
+/*
+ * After a transition failed half way the routing matches neither state,
+ * so fall back to the inactive verb, which doesn't route anything.
+ */
+static void audio_reset_state(struct audio *audio)
+{
+	int err;
+
+	err = snd_use_case_set(audio->ucm, "_verb",
+			       ucm_states[AUDIO_STATE_INACTIVE].verb);
+	if (err < 0) {
+		g_warning("audio-alsa-ucm: failed to set %s: %s",
+			  ucm_states[AUDIO_STATE_INACTIVE].verb,
+			  snd_strerror(err));
+
+		err = snd_use_case_mgr_reset(audio->ucm);
+		if (err < 0)
+			g_warning("audio-alsa-ucm: failed to reset: %s",
+				  snd_strerror(err));
 	}
+
+	audio->state = AUDIO_STATE_INACTIVE;
 }
 
 int audio_set_state(struct audio *audio, enum audio_state state)
 {
-	const struct ucm_state *s;
-	enum audio_state prev_state;
+	const struct ucm_transition *transition;
+	unsigned int i;
 	int err;
 
 	if (!audio || (state < 0) || (state >= G_N_ELEMENTS(ucm_states)))
 		return -EINVAL;
 
-	s = &ucm_states[state];
 	g_debug("audio-alsa-ucm: set state to %d", state);
 
-	/* FIXME: we wan't to change this in favor of a more generic API
-	 *        that would allow the frontend to enable and disable devices
-	 *        explicitly. */
-	/* first disable the previous state */
-	if (audio_get_state (audio, &prev_state) == 0 &&
-	    strcmp(ucm_states[prev_state].device, SND_USE_CASE_DEV_NONE) != 0) {
-		err = snd_use_case_set(audio->ucm, "_disdev",
-				       ucm_states[prev_state].device);
-		if (err < 0) {
-			g_warning("audio-alsa-ucm: failed to disable device %s: %s",
-				  ucm_states[prev_state].device, snd_strerror(err));
-		}
-	}
+	if (state == audio->state)
+		return 0;
 
-	g_debug("audio-alsa-ucm: set verb %s", s->verb);
-	err = snd_use_case_set(audio->ucm, "_verb", s->verb);
-	if (err < 0) {
-		g_warning("audio-alsa-ucm: failed to set use-case %s: %s",
-			  s->verb, snd_strerror(err));
-		return err;
-	}
+	transition = &audio->transitions[audio->state][state];
+
+	for (i = 0; i < transition->num_steps; i++) {
+		const struct ucm_step *step = &transition->steps[i];
+
+		g_debug("audio-alsa-ucm: set %s %s", step->identifier,
+			step->value);
 
-	if (strcmp(s->device, SND_USE_CASE_DEV_NONE) != 0) {
-		err = snd_use_case_set(audio->ucm, "_enadev", s->device);
+		err = snd_use_case_set(audio->ucm, step->identifier,
+				       step->value);
 		if (err < 0) {
-			g_warning("audio-alsa-ucm: failed to enable device %s: %s",
-				  s->device, snd_strerror(err));
+			g_warning("audio-alsa-ucm: failed to set %s %s: %s",
+				  step->identifier, step->value,
+				  snd_strerror(err));
+			audio_reset_state(audio);
 			return err;
 		}
 	}
 
 	audio->state = state;
 
-	audio_update_voip(audio, s);
+	audio_update_voip(audio, state);
 
 	return 0;
 }
 
-int audio_get_state(struct audio *audio, enum audio_state *statep)
+/*
+ * Called ahead of audio_set_state(), e.g. when the phone rings, so that the
+ * UCM lookups are done and voip already opens the right devices when the
+ * call is accepted. The current routing is not touched.
+ */
+int audio_prepare_state(struct audio *audio, enum audio_state state)
 {
-	if (!audio || !statep)
+	if (!audio || (state < 0) || (state >= G_N_ELEMENTS(ucm_states)))
 		return -EINVAL;
 
-	*statep = audio->state;
+	audio_update_voip(audio, state);
+
 	return 0;
 }
 
-static gboolean audio_is_handset_selected(struct audio *audio)
+int audio_get_state(struct audio *audio, enum audio_state *statep)
 {
-	if (audio->state == AUDIO_STATE_VOICECALL_HANDSET ||
-	    audio->state == AUDIO_STATE_VOICECALL_IP_HANDSET)
-		return true;
-	return false;
+	if (!audio || !statep)
+		return -EINVAL;
+
+	*statep = audio->state;
+	return 0;
 }
 
+/*
+ * Volume sliders send lots of changes in a short time. The first change is
+ * written right away, later ones within the same period only update the
+ * pending value, which is written once the period is over.
+ */
 int audio_set_volume(struct audio *audio, uint8_t volume)
 {
-	struct soundcard *card;
-	const char *control;
-
-	control = audio_state_to_control(audio);
-	if (!control)
-		return -EBADFD;
+	struct soundcard_control *ctl;
 
-	card = g_list_nth(audio->cards, audio->index)->data;
-	if (!card)
-		return -EBADFD;
+	if (!audio)
+		return -EINVAL;
 
-	/*
-	 * When USB handset is used, we have a second soundcard, so we need
-	 * to change the control we would use. This solution is kind of a of
-	 * hack but i have no better idea how to solve this issue right now.
-	 */
-	if (audio->usb_handset && audio_is_handset_selected(audio) &&
-	    g_list_length(audio->cards) > 1) {
-		struct soundcard *usb;
+	ctl = audio->volume[audio->state];
+	if (!ctl)
+		return -ENODEV;
 
-		usb = audio_get_card_by_name(audio, AUDIO_USB_DEVICE_NAME);
-		if (!usb) {
-			g_warning("audio-alsa-ucm: usb handset not found");
-			return -ENODEV;
-		}
+	soundcard_control_set_volume(ctl, volume);
+	audio->dirty = TRUE;
 
-		card = usb;
-		control = "PCM";
-		g_debug("   overriding handset: card=%s control=%s",
-			card->name, control);
-	}
+	if (audio_flush_deadline(audio) <= g_get_monotonic_time())
+		return audio_flush_volume(audio);
 
-	return soundcard_control_set_volume(card, control, volume);
+	return 0;
 }
 
 int audio_get_volume(struct audio *audio, uint8_t *volumep)
 {
-	struct soundcard *card;
-	const char *control;
+	struct soundcard_control *ctl;
 	long volume = 0;
 	int ret;
 
-	if (!volumep)
+	if (!audio || !volumep)
 		return -EINVAL;
 
-	control = audio_state_to_control(audio);
-	if (!control)
-		return -EBADFD;
-
-	card = g_list_nth(audio->cards, audio->index)->data;
-	if (!card)
-		return -EBADFD;
-
-	/*
-	 * When USB handset is used, we have a second soundcard, so we need
-	 * to change the control we would use. This solution is kind of a of
-	 * hack but i have no better idea how to solve this issue right now.
-	 */
-	if (audio->usb_handset && audio_is_handset_selected(audio) &&
-	    g_list_length(audio->cards) > 1) {
-		struct soundcard *usb;
-
-		usb = audio_get_card_by_name(audio, AUDIO_USB_DEVICE_NAME);
-		if (!usb) {
-			g_warning("audio-alsa-ucm: usb handset not found");
-			return -ENODEV;
-		}
-
-		card = usb;
-		control = "PCM";
-		g_debug("   overriding handset: card=%s control=%s",
-			card->name, control);
-	}
+	ctl = audio->volume[audio->state];
+	if (!ctl)
+		return -ENODEV;
 
-	ret = soundcard_control_get_volume(card, control, &volume);
+	ret = soundcard_control_get_volume(ctl, &volume);
 	if (ret < 0)
 		return ret;
 
@@ -703,3 +1136,36 @@ int audio_get_speakers_enable(struct audio *audio, bool *enablep)
 {
 	return -ENOSYS;
 }
+
+/*
+ * Called when a sound card comes or goes, e.g. the USB handset. The UCM
+ * card stays, so only the mixers are reopened and the volume controls and
+ * voip devices of the current state are looked up again.
+ */
+int audio_reload_cards(struct audio *audio)
+{
+	int err;
+
+	if (!audio)
+		return -EINVAL;
+
+	if (audio->dirty)
+		audio_flush_volume(audio);
+
+	audio_detach_mixers(audio);
+	g_list_free_full(audio->cards, (GDestroyNotify)soundcard_free);
+	audio->cards = NULL;
+
+	err = audio_find_cards(audio);
+	if (err < 0) {
+		g_warning("audio-alsa-ucm: No card found, %d", err);
+		return err;
+	}
+
+	audio_attach_mixers(audio);
+
+	audio_free_voip(audio);
+	audio_update_voip(audio, audio->state);
+
+	return 0;
+}
@@ -34,6 +34,11 @@ int audio_get_state(struct audio *audio, enum audio_state *statep)
 	return -ENOSYS;
 }
 
+int audio_prepare_state(struct audio *audio, enum audio_state state)
+{
+	return -ENOSYS;
+}
+
 int audio_set_volume(struct audio *audio, uint8_t volume)
 {
 	return -ENOSYS;
@@ -53,3 +58,8 @@ int audio_get_speakers_enable(struct audio *audio, bool *enablep)
 {
 	return -ENOSYS;
 }
+
+int audio_reload_cards(struct audio *audio)
+{
+	return -ENOSYS;
+}
@@ -308,6 +308,11 @@ int audio_get_state(struct audio *self, enum audio_state *statep)
 	return -EINVAL;
 }
 
+int audio_prepare_state(struct audio *self, enum audio_state state)
+{
+	return -ENOSYS;
+}
+
 int audio_set_volume(struct audio *self, uint8_t volume)
 {
 	pa_volume_t cor = (PA_VOLUME_NORM / 255) * volume;
@@ -355,3 +360,9 @@ int audio_get_speakers_enable(struct audio *self, bool *enablep)
 {
 	return -ENOSYS;
 }
+
+/* PulseAudio keeps track of hot-plugged cards on its own */
+int audio_reload_cards(struct audio *self)
+{
+	return 0;
+}
@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2017 Avionic Design GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <glib.h>
+
+#include "remote-control.h"
+
+/* time between two steps of a fade, in microseconds */
+#define BACKLIGHT_FADE_INTERVAL	(16 * G_TIME_SPAN_MILLISECOND)
+
+/*
+ * Fades run in a thread of their own, so that a slow backlight device
+ * doesn't hold up the main loop. The thread only writes a new value when
+ * the brightness level actually changes, so slow fades cost few writes.
+ */
+struct backlight_fader {
+	struct backlight *backlight;
+	struct event_manager *events;
+
+	GThread *thread;
+	GMutex lock;
+	GCond cond;
+	gboolean done;
+
+	/* the fade requested last, picked up by the thread */
+	gboolean pending;
+	unsigned int target;
+	gint64 duration;
+	enum backlight_curve curve;
+
+	/* the fade in progress */
+	gboolean active;
+	gboolean writing;
+	int current;
+};
+
+/* CIE 1931 lightness, 0-100, for a relative luminance of 0-1 */
+static double cie_luminance(double lightness)
+{
+	double t;
+
+	if (lightness <= 8.0)
+		return lightness / 903.3;
+
+	t = (lightness + 16.0) / 116.0;
+
+	return t * t * t;
+}
+
+/* the inverse is only needed at the ends of a fade, so bisect */
+static double cie_lightness(double luminance)
+{
+	double low = 0.0, high = 100.0;
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		double mid = (low + high) / 2.0;
+
+		if (cie_luminance(mid) < luminance)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	return (low + high) / 2.0;
+}
+
+static unsigned int backlight_fade_level(enum backlight_curve curve,
+		unsigned int from, unsigned int to, double progress)
+{
+	double start, end, value;
+
+	if (curve == BACKLIGHT_CURVE_SMOOTH)
+		progress = progress * progress * (3.0 - 2.0 * progress);
+
+	if (curve == BACKLIGHT_CURVE_LINEAR) {
+		value = from + ((double)to - from) * progress;
+	} else {
+		/* equal steps in perceived brightness */
+		start = cie_lightness((double)from / BACKLIGHT_MAX);
+		end = cie_lightness((double)to / BACKLIGHT_MAX);
+		value = cie_luminance(start + (end - start) * progress) *
+			BACKLIGHT_MAX;
+	}
+
+	return CLAMP((int)(value + 0.5), BACKLIGHT_MIN, BACKLIGHT_MAX);
+}
+
+static void backlight_fade_report(struct backlight_fader *fader,
+		enum event_backlight_state state, int brightness)
+{
+	struct event event;
+	int err;
+
+	memset(&event, 0, sizeof(event));
+	event.source = EVENT_SOURCE_BACKLIGHT;
+	event.backlight.state = state;
+	event.backlight.brightness = MAX(brightness, 0);
+
+	err = event_manager_report(fader->events, &event);
+	if (err < 0)
+		g_debug("backlight: failed to report event: %s",
+			g_strerror(-err));
+}
+
+/* called with the lock held, drops it while talking to the device */
+static int backlight_fade_write(struct backlight_fader *fader,
+		unsigned int level)
+{
+	int err;
+
+	if (level == fader->current)
+		return 0;
+
+	fader->writing = TRUE;
+	g_mutex_unlock(&fader->lock);
+
+	err = backlight_set(fader->backlight, level);
+
+	g_mutex_lock(&fader->lock);
+	fader->writing = FALSE;
+	g_cond_broadcast(&fader->cond);
+
+	if (err < 0)
+		return err;
+
+	fader->current = level;
+	return 0;
+}
+
+static gpointer backlight_fade_thread(gpointer data)
+{
+	struct backlight_fader *fader = data;
+	enum backlight_curve curve = BACKLIGHT_CURVE_LINEAR;
+	unsigned int from = 0, to = 0;
+	gint64 start = 0, end = 0;
+	int err;
+
+	g_mutex_lock(&fader->lock);
+
+	while (!fader->done) {
+		gint64 now = g_get_monotonic_time();
+
+		if (fader->pending) {
+			/* a new fade takes over where the previous one is */
+			if (fader->active)
+				backlight_fade_report(fader,
+					EVENT_BACKLIGHT_STATE_FADE_CANCELLED,
+					fader->current);
+
+			if (!fader->active || fader->current < 0) {
+				int level;
+
+				fader->writing = TRUE;
+				g_mutex_unlock(&fader->lock);
+
+				level = backlight_get(fader->backlight);
+
+				g_mutex_lock(&fader->lock);
+				fader->writing = FALSE;
+				fader->current = level;
+				g_cond_broadcast(&fader->cond);
+			}
+
+			from = fader->current < 0 ? BACKLIGHT_MAX :
+				fader->current;
+			to = fader->target;
+			curve = fader->curve;
+			start = now;
+			end = now + fader->duration;
+
+			fader->pending = FALSE;
+			fader->active = TRUE;
+		}
+
+		if (!fader->active) {
+			g_cond_wait(&fader->cond, &fader->lock);
+			continue;
+		}
+
+		if (now >= end) {
+			err = backlight_fade_write(fader, to);
+			if (err < 0)
+				g_warning("backlight: failed to set brightness: %s",
+					g_strerror(-err));
+
+			/* cancelled or replaced while writing */
+			if (!fader->active || fader->pending)
+				continue;
+
+			fader->active = FALSE;
+			backlight_fade_report(fader,
+				EVENT_BACKLIGHT_STATE_FADE_DONE, fader->current);
+			continue;
+		}
+
+		err = backlight_fade_write(fader, backlight_fade_level(curve,
+				from, to, (double)(now - start) / (end - start)));
+		if (err < 0) {
+			g_warning("backlight: fade aborted: %s",
+				g_strerror(-err));
+			fader->active = FALSE;
+			backlight_fade_report(fader,
+				EVENT_BACKLIGHT_STATE_FADE_CANCELLED,
+				fader->current);
+			continue;
+		}
+
+		g_cond_wait_until(&fader->cond, &fader->lock,
+			MIN(now + BACKLIGHT_FADE_INTERVAL, end));
+	}
+
+	g_mutex_unlock(&fader->lock);
+
+	return NULL;
+}
+
+int backlight_fader_create(struct backlight_fader **faderp,
+		struct backlight *backlight, struct event_manager *events)
+{
+	struct backlight_fader *fader;
+
+	if (!faderp)
+		return -EINVAL;
+
+	fader = g_new0(struct backlight_fader, 1);
+	if (!fader)
+		return -ENOMEM;
+
+	fader->backlight = backlight;
+	fader->events = events;
+	fader->current = -1;
+
+	g_mutex_init(&fader->lock);
+	g_cond_init(&fader->cond);
+
+	fader->thread = g_thread_new("backlight-fade", backlight_fade_thread,
+			fader);
+
+	*faderp = fader;
+	return 0;
+}
+
+int backlight_fader_free(struct backlight_fader *fader)
+{
+	if (!fader)
+		return -EINVAL;
+
+	g_mutex_lock(&fader->lock);
+	fader->done = TRUE;
+	g_cond_signal(&fader->cond);
+	g_mutex_unlock(&fader->lock);
+
+	g_thread_join(fader->thread);
+
+	g_cond_clear(&fader->cond);
+	g_mutex_clear(&fader->lock);
+	g_free(fader);
+
+	return 0;
+}
+
+int backlight_fade(struct backlight_fader *fader, unsigned int brightness,
+		unsigned int duration, enum backlight_curve curve)
+{
+	if (!fader || brightness > BACKLIGHT_MAX ||
+	    curve >= BACKLIGHT_CURVE_MAX)
+		return -EINVAL;
+
+	if (!fader->backlight)
+		return -ENODEV;
+
+	g_mutex_lock(&fader->lock);
+
+	fader->target = brightness;
+	fader->duration = (gint64)duration * G_TIME_SPAN_MILLISECOND;
+	fader->curve = curve;
+	fader->pending = TRUE;
+	g_cond_signal(&fader->cond);
+
+	g_mutex_unlock(&fader->lock);
+
+	return 0;
+}
+
+int backlight_fade_cancel(struct backlight_fader *fader)
+{
+	gboolean cancelled;
+	int current;
+
+	if (!fader)
+		return -EINVAL;
+
+	g_mutex_lock(&fader->lock);
+
+	cancelled = fader->active || fader->pending;
+	fader->active = FALSE;
+	fader->pending = FALSE;
+
+	/* the caller is about to access the device itself */
+	while (fader->writing)
+		g_cond_wait(&fader->cond, &fader->lock);
+
+	current = fader->current;
+	fader->current = -1;
+
+	g_mutex_unlock(&fader->lock);
+
+	if (cancelled)
+		backlight_fade_report(fader,
+			EVENT_BACKLIGHT_STATE_FADE_CANCELLED, current);
+
+	return cancelled ? 1 : 0;
+}
+
+int backlight_fade_get_brightness(struct backlight_fader *fader)
+{
+	int ret;
+
+	if (!fader)
+		return -EINVAL;
+
+	g_mutex_lock(&fader->lock);
+	ret = (fader->active || fader->pending) ? fader->current : -ENODATA;
+	g_mutex_unlock(&fader->lock);
+
+	return ret < 0 ? -ENODATA : ret;
+}
@@ -12,32 +12,212 @@
 #endif
 
 #include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <X11/X.h>
 #include <X11/Xlib.h>
-#include <poll.h>
+#ifdef HAVE_XI2
+#include <X11/extensions/XInput2.h>
+#include <X11/extensions/Xfixes.h>
+#endif
 
 #include "remote-control.h"
 
-#define CURSOR_MOVEMENT_SLEEP 100000
-
 struct cursor_movement {
 	GThread *thread;
-	int timeout;
+	int wakeup;
+	gint timeout;
 };
 
-static void cursor_motion_wait_for_motion(struct cursor_movement *priv,
-		Display *dpy)
+#ifdef HAVE_XI2
+
+/*
+ * Raw events are delivered to every client that selects them on the root
+ * window, so the pointer never needs to be grabbed and nothing is taken
+ * away from the application that is actually being used.
+ */
+static int cursor_movement_select_events(Display *dpy, Window root,
+		int *opcode)
+{
+	unsigned char bits[XIMaskLen(XI_LASTEVENT)] = { 0 };
+	int event, error, major = 2, minor = 0;
+	XIEventMask mask;
+
+	if (!XQueryExtension(dpy, "XInputExtension", opcode, &event, &error))
+		return -ENOSYS;
+
+	if (XIQueryVersion(dpy, &major, &minor) != Success)
+		return -ENOSYS;
+
+	if (!XFixesQueryExtension(dpy, &event, &error))
+		return -ENOSYS;
+
+	XISetMask(bits, XI_RawMotion);
+	XISetMask(bits, XI_RawButtonPress);
+#ifdef XI_RawTouchBegin
+	XISetMask(bits, XI_RawTouchBegin);
+#endif
+
+	mask.deviceid = XIAllMasterDevices;
+	mask.mask_len = sizeof(bits);
+	mask.mask = bits;
+
+	XISelectEvents(dpy, root, &mask, 1);
+
+	return 0;
+}
+
+static void cursor_movement_arm(int fd, gint64 deadline)
+{
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+	its.it_value.tv_sec = deadline / G_USEC_PER_SEC;
+	its.it_value.tv_nsec = (deadline % G_USEC_PER_SEC) * 1000;
+
+	timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* returns TRUE if any pointer activity was seen */
+static gboolean cursor_movement_drain(Display *dpy, int opcode)
+{
+	gboolean motion = FALSE;
+	XEvent event;
+
+	while (XPending(dpy)) {
+		XNextEvent(dpy, &event);
+
+		if (event.xcookie.type == GenericEvent &&
+		    event.xcookie.extension == opcode)
+			motion = TRUE;
+	}
+
+	return motion;
+}
+
+/*
+ * The cursor is hidden until the pointer is used, and hidden again once it
+ * has been left alone for the timeout. The thread only wakes up for pointer
+ * events and for the one deadline, which is pushed back lazily: when the
+ * timer fires before the pointer has been idle long enough, it is rearmed
+ * for the remaining time instead of on every motion event.
+ */
+static gpointer cursor_movement_thread(gpointer user_data)
 {
-	int xfd = ConnectionNumber(dpy);
+	struct cursor_movement *priv = user_data;
+	gboolean hidden = FALSE, armed = FALSE;
+	gint64 last = 0;
+	struct pollfd fds[3];
+	int opcode, timer;
+	Display *dpy;
+	Window root;
+
+	dpy = XOpenDisplay(NULL);
+	if (!dpy)
+		return NULL;
 
-	while (priv->timeout) {
-		struct pollfd fds[1];
+	root = DefaultRootWindow(dpy);
+
+	if (cursor_movement_select_events(dpy, root, &opcode) < 0) {
+		g_warning("cursor-movement: XInput 2 or XFixes not available");
+		XCloseDisplay(dpy);
+		return NULL;
+	}
+
+	timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timer < 0) {
+		g_warning("cursor-movement: failed to create timer: %s",
+			g_strerror(errno));
+		XCloseDisplay(dpy);
+		return NULL;
+	}
+
+	XFixesHideCursor(dpy, root);
+	XFlush(dpy);
+	hidden = TRUE;
+
+	fds[0].fd = ConnectionNumber(dpy);
+	fds[0].events = POLLIN;
+	fds[1].fd = timer;
+	fds[1].events = POLLIN;
+	fds[2].fd = priv->wakeup;
+	fds[2].events = POLLIN;
+
+	while (g_atomic_int_get(&priv->timeout)) {
+		gint64 timeout, now;
+		uint64_t expirations;
 		int err;
 
-		fds[0].fd = xfd;
-		fds[0].events = POLLIN;
+		/* events may already be queued by Xlib */
+		err = XPending(dpy) ? 0 : poll(fds, G_N_ELEMENTS(fds), -1);
+		if (err < 0 && errno != EINTR)
+			break;
+
+		if (err > 0 && fds[2].revents)
+			break;
+
+		timeout = g_atomic_int_get(&priv->timeout) * 1000LL;
+		now = g_get_monotonic_time();
+
+		if (cursor_movement_drain(dpy, opcode)) {
+			last = now;
+
+			if (hidden) {
+				XFixesShowCursor(dpy, root);
+				XFlush(dpy);
+				hidden = FALSE;
+			}
+
+			if (!armed) {
+				cursor_movement_arm(timer, last + timeout);
+				armed = TRUE;
+			}
+		}
+
+		if (err > 0 && fds[1].revents) {
+			if (read(timer, &expirations, sizeof(expirations)) < 0)
+				continue;
+
+			if (now >= last + timeout) {
+				XFixesHideCursor(dpy, root);
+				XFlush(dpy);
+				hidden = TRUE;
+				armed = FALSE;
+			} else {
+				cursor_movement_arm(timer, last + timeout);
+			}
+		}
+	}
+
+	if (hidden)
+		XFixesShowCursor(dpy, root);
 
-		err = poll(fds, 1, CURSOR_MOVEMENT_SLEEP / 1000);
+	close(timer);
+	XCloseDisplay(dpy);
+	return NULL;
+}
+
+#else /* HAVE_XI2 */
+
+#define CURSOR_MOVEMENT_SLEEP 100000
+
+/*
+ * Without XInput 2 and XFixes the pointer is grabbed with an empty cursor
+ * until it is moved, and the cursor stays visible for the timeout.
+ */
+static void cursor_motion_wait_for_motion(struct cursor_movement *priv,
+		Display *dpy)
+{
+	struct pollfd fds[2];
+	int err;
+
+	fds[0].fd = ConnectionNumber(dpy);
+	fds[0].events = POLLIN;
+	fds[1].fd = priv->wakeup;
+	fds[1].events = POLLIN;
+
+	while (g_atomic_int_get(&priv->timeout)) {
+		err = poll(fds, G_N_ELEMENTS(fds), CURSOR_MOVEMENT_SLEEP / 1000);
 		if (err < 0 || fds[0].revents & POLLIN || XPending(dpy))
 			return;
 	}
@@ -45,7 +225,7 @@ static void cursor_motion_wait_for_motion(struct cursor_movement *priv,
 
 static gpointer cursor_movement_thread(gpointer user_data)
 {
-	struct cursor_movement *priv = (struct cursor_movement *)user_data;
+	struct cursor_movement *priv = user_data;
 	Display *dpy = XOpenDisplay(NULL);
 	const char data[] = { 0 };
 	Cursor emptyCursor = 0;
@@ -61,7 +241,7 @@ static gpointer cursor_movement_thread(gpointer user_data)
 	emptyCursor = XCreatePixmapCursor(dpy, pixmap, pixmap, &color, &color,
 			0, 0);
 
-	while (priv->timeout) {
+	while (g_atomic_int_get(&priv->timeout)) {
 		const unsigned int mask = PointerMotionMask | ButtonPressMask;
 		gint64 start;
 		XEvent event;
@@ -81,10 +261,11 @@ static gpointer cursor_movement_thread(gpointer user_data)
 
 		XAllowEvents(dpy, ReplayPointer, CurrentTime);
 		XUngrabPointer(dpy, CurrentTime);
-		while (priv->timeout && XPending(dpy))
+		while (g_atomic_int_get(&priv->timeout) && XPending(dpy))
 			XMaskEvent(dpy, mask, &event);
 		start = g_get_monotonic_time();
-		while (start + 1000LL * priv->timeout > g_get_monotonic_time())
+		while (start + 1000LL * g_atomic_int_get(&priv->timeout) >
+				g_get_monotonic_time())
 			usleep(CURSOR_MOVEMENT_SLEEP);
 	}
 
@@ -96,12 +277,25 @@ static gpointer cursor_movement_thread(gpointer user_data)
 	return NULL;
 }
 
+#endif /* HAVE_XI2 */
+
 int cursor_movement_create(struct cursor_movement **cursor_movement)
 {
+	struct cursor_movement *priv;
+
 	if (!cursor_movement)
 		return -EINVAL;
 
-	*cursor_movement = g_new0(struct cursor_movement, 1);
+	priv = g_new0(struct cursor_movement, 1);
+
+	priv->wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (priv->wakeup < 0) {
+		int err = -errno;
+		g_free(priv);
+		return err;
+	}
+
+	*cursor_movement = priv;
 
 	return 0;
 }
@@ -112,6 +306,7 @@ int cursor_movement_free(struct cursor_movement *cursor_movement)
 		return -EINVAL;
 
 	cursor_movement_set_timeout(cursor_movement, 0);
+	close(cursor_movement->wakeup);
 	g_free(cursor_movement);
 
 	return 0;
@@ -119,14 +314,18 @@ int cursor_movement_free(struct cursor_movement *cursor_movement)
 
 int cursor_movement_set_timeout(struct cursor_movement *cursor_movement, int timeout)
 {
+	eventfd_t value;
+
 	if (!cursor_movement)
 		return -EINVAL;
 
-	cursor_movement->timeout = timeout;
-	if (!cursor_movement->timeout && cursor_movement->thread) {
+	g_atomic_int_set(&cursor_movement->timeout, timeout);
+	if (!timeout && cursor_movement->thread) {
+		eventfd_write(cursor_movement->wakeup, 1);
 		g_thread_join(cursor_movement->thread);
+		eventfd_read(cursor_movement->wakeup, &value);
 		cursor_movement->thread = NULL;
-	} else if (cursor_movement->timeout && !cursor_movement->thread) {
+	} else if (timeout && !cursor_movement->thread) {
 		cursor_movement->thread = g_thread_new("cursor_movement_thread",
 				cursor_movement_thread, cursor_movement);
 		if (!cursor_movement->thread)
@@ -140,5 +339,5 @@ int cursor_movement_get_timeout(struct cursor_movement *cursor_movement)
 	if (!cursor_movement)
 		return -EINVAL;
 
-	return cursor_movement->timeout;
+	return g_atomic_int_get(&cursor_movement->timeout);
 }
@@ -0,0 +1,722 @@
+/*
+ * Copyright (C) 2017 Avionic Design GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <linux/input.h>
+
+#include <glib.h>
+
+#include "remote-control.h"
+#include "find-device.h"
+
+#define EVDEV_BATCH	64
+
+#define BITS_PER_LONG	(sizeof(long) * 8)
+#define NBITS(x)	(((x) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define TEST_BIT(bit, array) \
+	((array[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+/*
+ * Each event device is opened once, no matter how many users are
+ * interested in it. Its capabilities are read when it is opened, so that
+ * filtering doesn't need any further ioctl()s.
+ */
+struct evdev_device {
+	GPollFD poll;
+	gchar *devnode;
+	gchar *name;
+
+	unsigned long evbits[NBITS(EV_CNT)];
+	unsigned long keybits[NBITS(KEY_CNT)];
+	unsigned long swbits[NBITS(SW_CNT)];
+	unsigned long ledbits[NBITS(LED_CNT)];
+
+	unsigned int grabs;
+};
+
+struct evdev_subscription {
+	struct evdev_filter filter;
+	gchar *device;
+	gboolean removed;
+};
+
+struct evdev {
+	GSource source;
+	GList *devices;
+	GList *subscriptions;
+	GUdevClient *udev;
+	/* subscriptions may not be freed while callbacks are pending */
+	unsigned int busy;
+};
+
+/*
+ * Process wide, like the input devices themselves. The lock protects the
+ * lists, which may be modified from any thread. Callbacks are run without
+ * it, always from the default main context.
+ */
+static struct evdev *evdev = NULL;
+static GMutex evdev_lock;
+
+static gboolean evdev_matches(struct evdev_subscription *sub,
+		struct evdev_device *device)
+{
+	unsigned int type;
+
+	if (sub->removed)
+		return FALSE;
+
+	if (g_strcmp0(sub->device, device->name) != 0 &&
+	    g_strcmp0(sub->device, device->devnode) != 0)
+		return FALSE;
+
+	if (!sub->filter.types)
+		return TRUE;
+
+	for (type = 0; type < EV_CNT; type++)
+		if ((sub->filter.types & (1UL << type)) &&
+		    TEST_BIT(type, device->evbits))
+			return TRUE;
+
+	return FALSE;
+}
+
+static gboolean evdev_is_wanted(struct evdev_device *device)
+{
+	GList *node;
+
+	for (node = evdev->subscriptions; node; node = node->next)
+		if (evdev_matches(node->data, device))
+			return TRUE;
+
+	return FALSE;
+}
+
+static void evdev_grab(struct evdev_device *device, gboolean grab)
+{
+	if (grab && device->grabs++ > 0)
+		return;
+
+	if (!grab && (device->grabs == 0 || --device->grabs > 0))
+		return;
+
+	if (ioctl(device->poll.fd, EVIOCGRAB, grab ? 1 : 0) < 0)
+		g_warning("evdev: failed to %s %s: %s",
+			grab ? "grab" : "release", device->devnode,
+			g_strerror(errno));
+}
+
+static void evdev_device_free(struct evdev_device *device)
+{
+	close(device->poll.fd);
+	g_free(device->devnode);
+	g_free(device->name);
+	g_free(device);
+}
+
+/* drop subscriptions and devices let go of while callbacks were run */
+static void evdev_purge(void)
+{
+	GList *node, *next;
+
+	for (node = evdev->subscriptions; node; node = next) {
+		struct evdev_subscription *sub = node->data;
+
+		next = node->next;
+
+		if (sub->removed) {
+			evdev->subscriptions = g_list_delete_link(
+				evdev->subscriptions, node);
+			g_free(sub->device);
+			g_free(sub);
+		}
+	}
+
+	for (node = evdev->devices; node; node = next) {
+		struct evdev_device *device = node->data;
+
+		next = node->next;
+
+		if (!evdev_is_wanted(device)) {
+			g_source_remove_poll(&evdev->source, &device->poll);
+			evdev->devices = g_list_delete_link(evdev->devices,
+				node);
+			evdev_device_free(device);
+		}
+	}
+}
+
+/* called with the lock held, ends a section started by evdev_collect() */
+static void evdev_release(void)
+{
+	if (--evdev->busy == 0)
+		evdev_purge();
+}
+
+/*
+ * Presence callbacks are run without the lock, so collect them first. The
+ * subscriptions collected stay allocated until evdev_notify() is done.
+ */
+static GList *evdev_collect(struct evdev_device *device)
+{
+	GList *subs = NULL;
+	GList *node;
+
+	for (node = evdev->subscriptions; node; node = node->next) {
+		struct evdev_subscription *sub = node->data;
+
+		if (sub->filter.presence && evdev_matches(sub, device))
+			subs = g_list_prepend(subs, sub);
+	}
+
+	evdev->busy++;
+
+	return g_list_reverse(subs);
+}
+
+static void evdev_notify(GList *subs, struct evdev_device *device,
+		bool present)
+{
+	GList *node;
+
+	for (node = subs; node; node = node->next) {
+		struct evdev_subscription *sub = node->data;
+		gboolean removed;
+
+		/* an earlier callback may have unsubscribed this one */
+		g_mutex_lock(&evdev_lock);
+		removed = sub->removed;
+		g_mutex_unlock(&evdev_lock);
+
+		if (!removed)
+			sub->filter.presence(sub->filter.data, device,
+				present);
+	}
+
+	g_list_free(subs);
+
+	g_mutex_lock(&evdev_lock);
+	evdev_release();
+	g_mutex_unlock(&evdev_lock);
+}
+
+/* called with the lock held, returns it released */
+static void evdev_remove_device(struct evdev_device *device)
+{
+	GList *subs, *node;
+
+	g_debug("evdev: %s removed", device->devnode);
+
+	g_source_remove_poll(&evdev->source, &device->poll);
+	evdev->devices = g_list_remove(evdev->devices, device);
+	subs = evdev_collect(device);
+
+	for (node = evdev->subscriptions; node; node = node->next) {
+		struct evdev_subscription *sub = node->data;
+
+		if (sub->filter.grab && evdev_matches(sub, device))
+			evdev_grab(device, FALSE);
+	}
+
+	g_mutex_unlock(&evdev_lock);
+
+	evdev_notify(subs, device, false);
+	evdev_device_free(device);
+}
+
+/* called with the lock held, returns it released */
+static int evdev_open_device(const gchar *devnode)
+{
+	struct evdev_device *device;
+	char name[256] = "";
+	GList *subs, *node;
+	int fd;
+
+	for (node = evdev->devices; node; node = node->next) {
+		device = node->data;
+
+		if (g_strcmp0(device->devnode, devnode) == 0) {
+			g_mutex_unlock(&evdev_lock);
+			return 0;
+		}
+	}
+
+	/* LEDs are set by writing to the device */
+	fd = open(devnode, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+		fd = open(devnode, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		int err = -errno;
+		g_mutex_unlock(&evdev_lock);
+		return err;
+	}
+
+	device = g_new0(struct evdev_device, 1);
+	device->poll.fd = fd;
+	device->poll.events = G_IO_IN | G_IO_HUP | G_IO_ERR;
+	device->devnode = g_strdup(devnode);
+
+	ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name);
+	device->name = g_strdup(name);
+
+	ioctl(fd, EVIOCGBIT(0, sizeof(device->evbits)), device->evbits);
+	ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(device->keybits)),
+		device->keybits);
+	ioctl(fd, EVIOCGBIT(EV_SW, sizeof(device->swbits)), device->swbits);
+	ioctl(fd, EVIOCGBIT(EV_LED, sizeof(device->ledbits)),
+		device->ledbits);
+
+	g_debug("evdev: %s (%s) added", devnode, device->name);
+
+	evdev->devices = g_list_append(evdev->devices, device);
+	g_source_add_poll(&evdev->source, &device->poll);
+
+	for (node = evdev->subscriptions; node; node = node->next) {
+		struct evdev_subscription *sub = node->data;
+
+		if (sub->filter.grab && evdev_matches(sub, device))
+			evdev_grab(device, TRUE);
+	}
+
+	subs = evdev_collect(device);
+	g_mutex_unlock(&evdev_lock);
+
+	evdev_notify(subs, device, true);
+
+	return 0;
+}
+
+static void evdev_deliver(struct evdev_device *device,
+		const struct input_event *events, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		GList *node;
+
+		for (node = evdev->subscriptions; node; node = node->next) {
+			struct evdev_subscription *sub = node->data;
+
+			if (!sub->filter.event || !evdev_matches(sub, device))
+				continue;
+
+			if (sub->filter.types &&
+			    !(sub->filter.types & (1UL << events[i].type)))
+				continue;
+
+			/* only this thread removes list entries */
+			g_mutex_unlock(&evdev_lock);
+			sub->filter.event(sub->filter.data, device, &events[i]);
+			g_mutex_lock(&evdev_lock);
+		}
+	}
+}
+
+static gboolean evdev_source_prepare(GSource *source, gint *timeout)
+{
+	if (timeout)
+		*timeout = -1;
+
+	return FALSE;
+}
+
+static gboolean evdev_source_check(GSource *source)
+{
+	struct evdev *evdev = (struct evdev *)source;
+	gboolean ret = FALSE;
+	GList *node;
+
+	g_mutex_lock(&evdev_lock);
+
+	for (node = evdev->devices; node; node = node->next) {
+		struct evdev_device *device = node->data;
+
+		if (device->poll.revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) {
+			ret = TRUE;
+			break;
+		}
+	}
+
+	g_mutex_unlock(&evdev_lock);
+
+	return ret;
+}
+
+static gboolean evdev_source_dispatch(GSource *source, GSourceFunc callback,
+		gpointer user_data)
+{
+	struct input_event events[EVDEV_BATCH];
+	GList *node, *next;
+
+	g_mutex_lock(&evdev_lock);
+	evdev->busy++;
+
+	for (node = evdev->devices; node; node = next) {
+		struct evdev_device *device = node->data;
+		gboolean gone = FALSE;
+		ssize_t num;
+
+		next = node->next;
+
+		if (device->poll.revents & G_IO_IN) {
+			/* one read() returns as many events as are queued */
+			num = read(device->poll.fd, events, sizeof(events));
+			if (num < 0) {
+				if (errno == ENODEV)
+					gone = TRUE;
+				else if (errno != EAGAIN && errno != EINTR)
+					g_debug("evdev: read(): %s",
+						g_strerror(errno));
+			} else {
+				evdev_deliver(device, events,
+					num / sizeof(events[0]));
+			}
+		} else if (device->poll.revents & (G_IO_HUP | G_IO_ERR)) {
+			gone = TRUE;
+		}
+
+		device->poll.revents = 0;
+
+		if (gone) {
+			evdev_remove_device(device);
+			g_mutex_lock(&evdev_lock);
+		}
+	}
+
+	evdev_release();
+
+	g_mutex_unlock(&evdev_lock);
+
+	if (callback)
+		return callback(user_data);
+
+	return TRUE;
+}
+
+static GSourceFuncs evdev_source_funcs = {
+	.prepare = evdev_source_prepare,
+	.check = evdev_source_check,
+	.dispatch = evdev_source_dispatch,
+};
+
+static void evdev_uevent(GUdevClient *client, const gchar *action,
+		GUdevDevice *udevice, gpointer user_data)
+{
+	const gchar *devnode = g_udev_device_get_device_file(udevice);
+	GUdevDevice *parent;
+	const gchar *name;
+	GList *node;
+	int err;
+
+	if (!devnode || !g_str_has_prefix(g_udev_device_get_name(udevice),
+			"event"))
+		return;
+
+	if (g_strcmp0(action, "remove") == 0) {
+		g_mutex_lock(&evdev_lock);
+
+		for (node = evdev->devices; node; node = node->next) {
+			struct evdev_device *device = node->data;
+
+			if (g_strcmp0(device->devnode, devnode) == 0) {
+				evdev_remove_device(device);
+				return;
+			}
+		}
+
+		g_mutex_unlock(&evdev_lock);
+		return;
+	}
+
+	if (g_strcmp0(action, "add") != 0)
+		return;
+
+	/* the name is an attribute of the input device, not the event node */
+	parent = g_udev_device_get_parent(udevice);
+	if (!parent)
+		return;
+
+	name = g_udev_device_get_sysfs_attr(parent, "name");
+
+	g_mutex_lock(&evdev_lock);
+
+	for (node = evdev->subscriptions; node; node = node->next) {
+		struct evdev_subscription *sub = node->data;
+
+		if (!sub->removed && (g_strcmp0(sub->device, name) == 0 ||
+				g_strcmp0(sub->device, devnode) == 0))
+			break;
+	}
+
+	if (node) {
+		err = evdev_open_device(devnode);
+		if (err < 0)
+			g_warning("evdev: failed to open %s: %s", devnode,
+				g_strerror(-err));
+	} else {
+		g_mutex_unlock(&evdev_lock);
+	}
+
+	g_object_unref(parent);
+}
+
+/* called with the lock held */
+static int evdev_setup(void)
+{
+	const gchar *const subsystems[] = { "input", NULL };
+	GSource *source;
+
+	if (evdev)
+		return 0;
+
+	source = g_source_new(&evdev_source_funcs, sizeof(*evdev));
+	if (!source)
+		return -ENOMEM;
+
+	evdev = (struct evdev *)source;
+
+	/* watch before looking, so that no device can slip through */
+	evdev->udev = g_udev_client_new(subsystems);
+	if (evdev->udev)
+		g_signal_connect(evdev->udev, "uevent",
+				 G_CALLBACK(evdev_uevent), NULL);
+	else
+		g_warning("evdev: failed to create udev client");
+
+	g_source_attach(source, NULL);
+
+	return 0;
+}
+
+static int evdev_found(gpointer user, const gchar *filename,
+		const gchar *name, const int vendorId, const int productId)
+{
+	int err;
+
+	g_mutex_lock(&evdev_lock);
+
+	err = evdev_open_device(filename);
+	if (err < 0)
+		g_warning("evdev: failed to open %s: %s", filename,
+			g_strerror(-err));
+
+	return 0;
+}
+
+int evdev_subscribe(const struct evdev_filter *filter,
+		struct evdev_subscription **subp)
+{
+	struct evdev_subscription *sub;
+	GList *present = NULL;
+	GList *node;
+	int err;
+
+	if (!filter || !filter->device || !subp)
+		return -EINVAL;
+
+	g_mutex_lock(&evdev_lock);
+
+	err = evdev_setup();
+	if (err < 0) {
+		g_mutex_unlock(&evdev_lock);
+		return err;
+	}
+
+	sub = g_new0(struct evdev_subscription, 1);
+	sub->filter = *filter;
+	sub->device = g_strdup(filter->device);
+	sub->filter.device = sub->device;
+
+	evdev->subscriptions = g_list_append(evdev->subscriptions, sub);
+
+	/* devices already opened for someone else */
+	for (node = evdev->devices; node; node = node->next) {
+		struct evdev_device *device = node->data;
+
+		if (!evdev_matches(sub, device))
+			continue;
+
+		if (sub->filter.grab)
+			evdev_grab(device, TRUE);
+
+		present = g_list_append(present, device);
+	}
+
+	evdev->busy++;
+	g_mutex_unlock(&evdev_lock);
+
+	for (node = present; node; node = node->next)
+		if (sub->filter.presence)
+			sub->filter.presence(sub->filter.data, node->data,
+				true);
+
+	g_list_free(present);
+
+	if (g_str_has_prefix(sub->device, "/dev/")) {
+		g_mutex_lock(&evdev_lock);
+		err = evdev_open_device(sub->device);
+		if (err < 0 && err != -ENOENT)
+			g_warning("evdev: failed to open %s: %s", sub->device,
+				g_strerror(-err));
+	} else {
+		find_input_devices(sub->device, evdev_found, NULL);
+	}
+
+	g_mutex_lock(&evdev_lock);
+	evdev_release();
+	g_mutex_unlock(&evdev_lock);
+
+	*subp = sub;
+	return 0;
+}
+
+void evdev_unsubscribe(struct evdev_subscription *sub)
+{
+	GList *node;
+
+	if (!sub)
+		return;
+
+	g_mutex_lock(&evdev_lock);
+
+	if (sub->filter.grab) {
+		for (node = evdev->devices; node; node = node->next)
+			if (evdev_matches(sub, node->data))
+				evdev_grab(node->data, FALSE);
+	}
+
+	sub->removed = TRUE;
+
+	/* a dispatch or notification might be iterating over it */
+	if (!evdev->busy)
+		evdev_purge();
+
+	g_mutex_unlock(&evdev_lock);
+}
+
+const char *evdev_device_get_name(struct evdev_device *device)
+{
+	return device ? device->name : NULL;
+}
+
+const char *evdev_device_get_node(struct evdev_device *device)
+{
+	return device ? device->devnode : NULL;
+}
+
+bool evdev_device_has_code(struct evdev_device *device, unsigned int type,
+		unsigned int code)
+{
+	if (!device || type >= EV_CNT || !TEST_BIT(type, device->evbits))
+		return false;
+
+	switch (type) {
+	case EV_KEY:
+		return code < KEY_CNT && TEST_BIT(code, device->keybits);
+
+	case EV_SW:
+		return code < SW_CNT && TEST_BIT(code, device->swbits);
+
+	case EV_LED:
+		return code < LED_CNT && TEST_BIT(code, device->ledbits);
+	}
+
+	return true;
+}
+
+int evdev_device_get_switch(struct evdev_device *device, unsigned int code)
+{
+	unsigned long state[NBITS(SW_CNT)] = { 0 };
+
+	if (!evdev_device_has_code(device, EV_SW, code))
+		return -ENOENT;
+
+	if (ioctl(device->poll.fd, EVIOCGSW(sizeof(state)), state) < 0)
+		return -errno;
+
+	return TEST_BIT(code, state);
+}
+
+/* called with the lock held */
+static struct evdev_device *evdev_find_led(const char *name,
+		unsigned int code)
+{
+	GList *node;
+
+	if (!evdev)
+		return NULL;
+
+	for (node = evdev->devices; node; node = node->next) {
+		struct evdev_device *device = node->data;
+
+		if (g_strcmp0(name, device->name) != 0 &&
+		    g_strcmp0(name, device->devnode) != 0)
+			continue;
+
+		if (evdev_device_has_code(device, EV_LED, code))
+			return device;
+	}
+
+	return NULL;
+}
+
+int evdev_set_led(const char *name, unsigned int code, bool on)
+{
+	struct input_event event = {};
+	struct evdev_device *device;
+	int ret = 0;
+
+	g_mutex_lock(&evdev_lock);
+
+	device = evdev_find_led(name, code);
+	if (!device) {
+		ret = -ENODEV;
+		goto unlock;
+	}
+
+	event.type = EV_LED;
+	event.code = code;
+	event.value = on;
+
+	if (write(device->poll.fd, &event, sizeof(event)) < 0)
+		ret = -errno;
+
+unlock:
+	g_mutex_unlock(&evdev_lock);
+	return ret;
+}
+
+int evdev_get_led(const char *name, unsigned int code)
+{
+	unsigned long state[NBITS(LED_CNT)] = { 0 };
+	struct evdev_device *device;
+	int ret;
+
+	g_mutex_lock(&evdev_lock);
+
+	device = evdev_find_led(name, code);
+	if (!device) {
+		ret = -ENODEV;
+		goto unlock;
+	}
+
+	if (ioctl(device->poll.fd, EVIOCGLED(sizeof(state)), state) < 0)
+		ret = -errno;
+	else
+		ret = TEST_BIT(code, state);
+
+unlock:
+	g_mutex_unlock(&evdev_lock);
+	return ret;
+}
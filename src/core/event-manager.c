@@ -14,26 +14,130 @@
 
 #include "remote-control.h"
 
+#define EVENT_QUEUE_SIZE_DEFAULT 64
+#define EVENT_HANDSET_QUEUE_SIZE 32
+#define EVENT_HISTORY_SIZE 256
+
+/*
+ * Events are reported from worker threads as well as from the main
+ * context. The lock protects the source states and the subscriber list,
+ * and therefore also serializes the producers of every subscriber ring.
+ */
 struct event_manager {
+	GMutex lock;
+
 	enum event_voip_state voip_state;
 	enum event_smartcard_state smartcard_state;
 	enum event_hook_state hook_state;
 	enum event_modem_state modem_state;
+	enum event_usb_handset_state usb_handset_state;
+	struct event_backlight backlight;
+
+	struct event_handset handset_events[EVENT_HANDSET_QUEUE_SIZE];
+	guint handset_head;
+	guint handset_count;
 
-	GQueue *handset_events;
-	GList *callbacks;
+	/* the most recent events, indexed by sequence number */
+	struct event_record history[EVENT_HISTORY_SIZE];
+	uint64_t sequence;
+
+	GList *subscriptions;
+	gint dropped;
 };
 
-struct event_callback {
-	event_manager_event_cb func_cb;
+/*
+ * Every subscriber has its own single-producer, single-consumer ring. The
+ * producer side runs with the manager lock held, the consumer side is the
+ * dispatch of the subscription source in the subscriber's main context,
+ * so neither needs a lock or an allocation per event.
+ */
+struct event_subscription {
+	GSource source;
+
+	unsigned int sources;
+	event_manager_deliver_cb callback;
 	void *data;
-	void *owner;
+
+	struct event_record *ring;
+	guint mask;
+	gint head;
+	gint tail;
+	gint dropped;
+};
+
+static gboolean event_subscription_pending(struct event_subscription *sub)
+{
+	return g_atomic_int_get(&sub->head) != g_atomic_int_get(&sub->tail);
+}
+
+static gboolean event_subscription_prepare(GSource *source, gint *timeout)
+{
+	if (timeout)
+		*timeout = -1;
+
+	return event_subscription_pending((struct event_subscription *)source);
+}
+
+static gboolean event_subscription_check(GSource *source)
+{
+	return event_subscription_pending((struct event_subscription *)source);
+}
+
+static gboolean event_subscription_dispatch(GSource *source,
+		GSourceFunc callback, gpointer user_data)
+{
+	struct event_subscription *sub = (struct event_subscription *)source;
+	guint tail = g_atomic_int_get(&sub->tail);
+	guint head = g_atomic_int_get(&sub->head);
+	struct event_record record;
+
+	/* a callback may unsubscribe, which destroys the source */
+	while (tail != head && !g_source_is_destroyed(source)) {
+		record = sub->ring[tail & sub->mask];
+		g_atomic_int_set(&sub->tail, ++tail);
+
+		sub->callback(sub->data, &record);
+	}
+
+	return TRUE;
+}
+
+static void event_subscription_finalize(GSource *source)
+{
+	struct event_subscription *sub = (struct event_subscription *)source;
+
+	g_free(sub->ring);
+}
+
+static GSourceFuncs event_subscription_funcs = {
+	.prepare = event_subscription_prepare,
+	.check = event_subscription_check,
+	.dispatch = event_subscription_dispatch,
+	.finalize = event_subscription_finalize,
 };
 
+/* called with the manager lock held */
+static void event_subscription_push(struct event_manager *manager,
+		struct event_subscription *sub, const struct event_record *record)
+{
+	guint head = sub->head;
+	guint tail = g_atomic_int_get(&sub->tail);
+
+	if (head - tail > sub->mask) {
+		g_atomic_int_inc(&sub->dropped);
+		g_atomic_int_inc(&manager->dropped);
+		return;
+	}
+
+	sub->ring[head & sub->mask] = *record;
+	g_atomic_int_set(&sub->head, head + 1);
+
+	g_main_context_wakeup(g_source_get_context(&sub->source));
+}
+
 int event_manager_create(struct event_manager **managerp)
 {
 	struct event_manager *manager;
-	int err = 0;
 
 	if (!managerp)
 		return -EINVAL;
@@ -42,59 +146,119 @@ int event_manager_create(struct event_manager **managerp)
 	if (!manager)
 		return -ENOMEM;
 
+	g_mutex_init(&manager->lock);
+
 	manager->voip_state = EVENT_VOIP_STATE_IDLE;
 	manager->smartcard_state = EVENT_SMARTCARD_STATE_REMOVED;
 	manager->hook_state = EVENT_HOOK_STATE_ON;
 	manager->modem_state = EVENT_MODEM_STATE_DISCONNECTED;
-
-	manager->handset_events = g_queue_new();
-	if (!manager->handset_events) {
-		err = -ENOMEM;
-		goto free;
-	}
+	manager->usb_handset_state = EVENT_USB_HANDSET_STATE_DISCONNECTED;
 
 	*managerp = manager;
 	return 0;
-
-free:
-	g_queue_free(manager->handset_events);
-	g_free(manager);
-	return err;
 }
 
 int event_manager_free(struct event_manager *manager)
 {
+	GList *node;
+
 	if (!manager)
 		return -EINVAL;
 
-	g_list_free_full(manager->callbacks, g_free);
-	g_queue_free(manager->handset_events);
+	for (node = manager->subscriptions; node; node = node->next) {
+		g_source_destroy(node->data);
+		g_source_unref(node->data);
+	}
+
+	g_list_free(manager->subscriptions);
+	g_mutex_clear(&manager->lock);
 	g_free(manager);
 	return 0;
 }
 
+int event_manager_subscribe(struct event_manager *manager,
+		unsigned int sources, unsigned int queue_size,
+		GMainContext *context, event_manager_deliver_cb callback,
+		void *data, struct event_subscription **subscriptionp)
+{
+	struct event_subscription *sub;
+	guint size = 1;
+
+	g_return_val_if_fail(manager != NULL, -EINVAL);
+	g_return_val_if_fail(callback != NULL, -EINVAL);
+	g_return_val_if_fail(subscriptionp != NULL, -EINVAL);
+
+	if (!queue_size)
+		queue_size = EVENT_QUEUE_SIZE_DEFAULT;
+
+	/* the ring indices are masked, so round up to a power of two */
+	while (size < queue_size)
+		size <<= 1;
+
+	sub = (struct event_subscription *)g_source_new(
+			&event_subscription_funcs, sizeof(*sub));
+	if (!sub)
+		return -ENOMEM;
+
+	sub->sources = sources;
+	sub->callback = callback;
+	sub->data = data;
+	sub->ring = g_new0(struct event_record, size);
+	sub->mask = size - 1;
+
+	g_source_attach(&sub->source, context);
+
+	g_mutex_lock(&manager->lock);
+	manager->subscriptions = g_list_prepend(manager->subscriptions, sub);
+	g_mutex_unlock(&manager->lock);
+
+	*subscriptionp = sub;
+	return 0;
+}
+
+void event_manager_unsubscribe(struct event_manager *manager,
+		struct event_subscription *subscription)
+{
+	if (!manager || !subscription)
+		return;
+
+	g_mutex_lock(&manager->lock);
+	manager->subscriptions = g_list_remove(manager->subscriptions,
+			subscription);
+	g_mutex_unlock(&manager->lock);
+
+	g_source_destroy(&subscription->source);
+	g_source_unref(&subscription->source);
+}
+
+unsigned long event_subscription_get_dropped(
+		struct event_subscription *subscription)
+{
+	return subscription ? g_atomic_int_get(&subscription->dropped) : 0;
+}
+
+unsigned long event_manager_get_dropped(struct event_manager *manager)
+{
+	return manager ? g_atomic_int_get(&manager->dropped) : 0;
+}
+
 int event_manager_report(struct event_manager *manager, struct event *event)
 {
-	gpointer item;
+	struct event_record *record;
+	guint slot;
 	int ret = 0;
-	GList *cb;
+	GList *node;
 
 	if (!manager || !event)
 		return -EINVAL;
 
-	for (cb = manager->callbacks; cb != NULL; cb = cb->next) {
-		struct event_callback *ecb = cb->data;
-
-		if (!ecb)
-			continue;
-
-		ret = ecb->func_cb(ecb->data, event);
-		if (ret) {
-			g_debug("%s: callback failed: %s", __func__,
-				strerror(-ret));
-		}
+	if (event->source >= EVENT_SOURCE_MAX) {
+		g_debug("Unknown event: %d", event->source);
+		return -ENXIO;
 	}
 
+	g_mutex_lock(&manager->lock);
+
 	switch (event->source) {
 	case EVENT_SOURCE_MODEM:
 		manager->modem_state = event->modem.state;
@@ -105,45 +269,109 @@ int event_manager_report(struct event_manager *manager, struct event *event)
 		break;
 
 	case EVENT_SOURCE_SMARTCARD:
-		g_debug("SMARTCARD: %d -> %d (%d)", manager->smartcard_state,
-				event->smartcard.state, ret);
+		g_debug("SMARTCARD: %d -> %d", manager->smartcard_state,
+				event->smartcard.state);
 		manager->smartcard_state = event->smartcard.state;
 		break;
 
 	case EVENT_SOURCE_HOOK:
-		g_debug("HOOK: %d -> %d (%d)", manager->hook_state,
-				event->hook.state, ret);
+		g_debug("HOOK: %d -> %d", manager->hook_state,
+				event->hook.state);
 		manager->hook_state = event->hook.state;
 		break;
 
 	case EVENT_SOURCE_HANDSET:
-		item = g_new(struct event_handset, 1);
-		if (!item) {
-			ret = -ENOMEM;
+		if (manager->handset_count == EVENT_HANDSET_QUEUE_SIZE) {
+			g_atomic_int_inc(&manager->dropped);
+			ret = -ENOSPC;
 			break;
 		}
 
-		memcpy(item, &event->handset, sizeof(event->handset));
-		g_queue_push_tail(manager->handset_events, item);
+		slot = (manager->handset_head + manager->handset_count) %
+			EVENT_HANDSET_QUEUE_SIZE;
+		manager->handset_events[slot] = event->handset;
+		manager->handset_count++;
+		break;
+
+	case EVENT_SOURCE_USB_HANDSET:
+		g_debug("USB HANDSET: %d -> %d", manager->usb_handset_state,
+				event->usb_handset.state);
+		manager->usb_handset_state = event->usb_handset.state;
+		break;
+
+	case EVENT_SOURCE_BACKLIGHT:
+		manager->backlight = event->backlight;
 		break;
 
 	default:
-		g_debug("Unknown event: %d (%d)", event->source, ret);
-		ret = -ENXIO;
 		break;
 	}
 
+	record = &manager->history[manager->sequence % EVENT_HISTORY_SIZE];
+	record->sequence = ++manager->sequence;
+	record->timestamp = g_get_real_time();
+	record->event = *event;
+
+	for (node = manager->subscriptions; node; node = node->next) {
+		struct event_subscription *sub = node->data;
+
+		if (sub->sources & EVENT_SOURCE_MASK(event->source))
+			event_subscription_push(manager, sub, record);
+	}
+
+	g_mutex_unlock(&manager->lock);
+
 	return ret;
 }
 
+uint64_t event_manager_get_sequence(struct event_manager *manager)
+{
+	uint64_t sequence;
+
+	if (!manager)
+		return 0;
+
+	g_mutex_lock(&manager->lock);
+	sequence = manager->sequence;
+	g_mutex_unlock(&manager->lock);
+
+	return sequence;
+}
+
+int event_manager_get_history(struct event_manager *manager, uint64_t since,
+		struct event_record *records, unsigned int max)
+{
+	uint64_t first, sequence;
+	unsigned int count = 0;
+
+	if (!manager || (!records && max))
+		return -EINVAL;
+
+	g_mutex_lock(&manager->lock);
+
+	/* events older than the history are lost, start with the oldest */
+	first = manager->sequence > EVENT_HISTORY_SIZE ?
+		manager->sequence - EVENT_HISTORY_SIZE + 1 : 1;
+	sequence = MAX(since + 1, first);
+
+	for (; sequence <= manager->sequence && count < max; sequence++)
+		records[count++] = manager->history[(sequence - 1) %
+			EVENT_HISTORY_SIZE];
+
+	g_mutex_unlock(&manager->lock);
+
+	return count;
+}
+
 int event_manager_get_source_state(struct event_manager *manager, struct event *event)
 {
-	gpointer item;
 	int err = 0;
 
 	if (!manager || !event)
 		return -EINVAL;
 
+	g_mutex_lock(&manager->lock);
+
 	switch (event->source) {
 	case EVENT_SOURCE_MODEM:
 		event->modem.state = manager->modem_state;
@@ -162,65 +390,31 @@ int event_manager_get_source_state(struct event_manager *manager, struct event *
 		break;
 
 	case EVENT_SOURCE_HANDSET:
-		item = g_queue_pop_head(manager->handset_events);
-		if (item) {
-			memcpy(&event->handset, item, sizeof(event->handset));
-			g_free(item);
+		if (manager->handset_count) {
+			event->handset = manager->handset_events[
+				manager->handset_head];
+			manager->handset_head = (manager->handset_head + 1) %
+				EVENT_HANDSET_QUEUE_SIZE;
+			manager->handset_count--;
 		} else {
 			err = -ENODATA;
 		}
 		break;
 
-	default:
-		err = -ENOSYS;
+	case EVENT_SOURCE_USB_HANDSET:
+		event->usb_handset.state = manager->usb_handset_state;
 		break;
-	}
-
-	return err;
-}
 
-int event_manager_set_event_cb(struct event_manager *manager,
-		event_manager_event_cb callback, void *data, void *owner_ref)
-{
-	struct event_callback *ecb;
-	GList *cb;
-
-	g_return_val_if_fail(manager != NULL, -EINVAL);
+	case EVENT_SOURCE_BACKLIGHT:
+		event->backlight = manager->backlight;
+		break;
 
-	for (cb = manager->callbacks; cb != NULL; cb = cb->next) {
-		ecb = cb->data;
-		if (ecb && ecb->owner == owner_ref) {
-			manager->callbacks = g_list_remove(manager->callbacks,
-				ecb);
-			g_free(ecb);
-		}
+	default:
+		err = -ENOSYS;
+		break;
 	}
 
-	ecb = g_new0(struct event_callback, 1);
-
-	ecb->owner = owner_ref;
-	ecb->data = data;
-	ecb->func_cb = callback;
-
-	manager->callbacks = g_list_insert(manager->callbacks, ecb, 0);
-
-	return 0;
-}
-
-void *event_manager_get_event_cb_owner(struct event_manager *manager,
-		event_manager_event_cb callback)
-{
-	struct event_callback *ecb;
-	GList *cb;
-
-	if (!manager)
-		return NULL;
-
-	for (cb = manager->callbacks; cb != NULL; cb = cb->next) {
-		ecb = cb->data;
-		if (ecb && ecb->func_cb == callback)
-			return ecb->owner;
-	}
+	g_mutex_unlock(&manager->lock);
 
-	return NULL;
+	return err;
 }
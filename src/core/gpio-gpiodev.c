@@ -17,28 +17,65 @@
 
 #include "remote-control.h"
 
-static struct gpio_map {
-	unsigned int offset;
+#define GPIO_EVENT_BATCH 16
+#define GPIO_DEBOUNCE_DEFAULT 20 /* ms */
+
+static const char GPIO_GROUP[] = "gpio";
+
+static const struct gpio_map {
 	enum gpio gpio;
+	const char *name;
+	unsigned int offset;
 } gpio_list[] = {
-	{ 0, GPIO_HANDSET },
-	{ 2, GPIO_SMARTCARD },
+	{ GPIO_HANDSET, "handset", 0 },
+	{ GPIO_SMARTCARD, "smartcard", 2 },
 };
 
 static const unsigned int gpios[] = { 34, 35, 36 };
 
+struct gpio_line {
+	unsigned int offset;
+	gint64 debounce; /* us */
+
+	int value; /* last reported value, -1 if none yet */
+	int pending; /* value waiting for the line to settle, -1 if none */
+	gint64 deadline;
+
+	struct gpio_stats stats;
+};
+
 struct gpio_backend {
 	GSource source;
 	GPollFD fd;
 
+	struct gpio_line lines[GPIO_NUM];
+	gint64 deadline; /* earliest pending deadline, -1 if none */
+	GMutex stats_lock; /* the stats are read from other threads */
+
+	gint *exposed_gpios;
+	gsize num_exposed;
+
 	struct event_manager *events;
 };
 
 static gboolean gpio_source_prepare(GSource *source, gint *timeout)
 {
+	struct gpio_backend *backend = (struct gpio_backend *)source;
+	gint64 now;
+
 	if (timeout)
 		*timeout = -1;
 
+	if (backend->deadline < 0)
+		return FALSE;
+
+	now = g_source_get_time(source);
+	if (now >= backend->deadline)
+		return TRUE;
+
+	if (timeout)
+		*timeout = (backend->deadline - now + 999) / 1000;
+
 	return FALSE;
 }
 
@@ -49,35 +86,42 @@ static gboolean gpio_source_check(GSource *source)
 	if (backend->fd.revents & G_IO_IN)
 		return TRUE;
 
+	if (backend->deadline >= 0 &&
+	    g_source_get_time(source) >= backend->deadline)
+		return TRUE;
+
 	return FALSE;
 }
 
-static gboolean gpio_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+static struct gpio_line *gpio_backend_find_line(struct gpio_backend *backend,
+		unsigned int offset, enum gpio *type)
 {
-	struct gpio_backend *backend = (struct gpio_backend *)source;
-	enum gpio type = GPIO_UNKNOWN;
-	struct gpio_event data;
-	struct event event;
 	guint i;
-	int err;
-
-	err = read(backend->fd.fd, &data, sizeof(data));
-	if (err < 0) {
-		g_warning("gpiodev: read(): %s", strerror(errno));
-		return TRUE;
-	}
 
 	for (i = 0; i < G_N_ELEMENTS(gpio_list); i++) {
-		if (data.gpio == gpio_list[i].offset) {
-			type = gpio_list[i].gpio;
-			break;
+		enum gpio gpio = gpio_list[i].gpio;
+
+		if (backend->lines[gpio].offset == offset) {
+			*type = gpio;
+			return &backend->lines[gpio];
 		}
 	}
 
+	return NULL;
+}
+
+static void gpio_report(struct gpio_backend *backend, enum gpio type,
+		int value)
+{
+	struct event event;
+	int err;
+
+	memset(&event, 0, sizeof(event));
+
 	switch (type) {
 	case GPIO_HANDSET:
 		event.source = EVENT_SOURCE_HOOK;
-		if (data.value)
+		if (value)
 			event.hook.state = EVENT_HOOK_STATE_OFF;
 		else
 			event.hook.state = EVENT_HOOK_STATE_ON;
@@ -85,22 +129,146 @@ static gboolean gpio_source_dispatch(GSource *source, GSourceFunc callback, gpoi
 
 	case GPIO_SMARTCARD:
 		event.source = EVENT_SOURCE_SMARTCARD;
-		if (data.value)
+		if (value)
 			event.smartcard.state = EVENT_SMARTCARD_STATE_REMOVED;
 		else
 			event.smartcard.state = EVENT_SMARTCARD_STATE_INSERTED;
 		break;
 
 	default:
-		g_debug("gpiodev: unknown GPIO %u transitioned to %u",
-				data.gpio, data.value);
-		break;
+		return;
 	}
 
 	err = event_manager_report(backend->events, &event);
 	if (err < 0)
 		g_debug("gpiodev: failed to report event: %s",
 			g_strerror(-err));
+}
+
+/*
+ * Edges arriving within the debounce interval of the previous one only
+ * replace the pending value of the line and restart the interval. Once the
+ * line has settled, the pending value is reported if it differs from the
+ * one that was reported last.
+ */
+static void gpio_line_edge(struct gpio_backend *backend, enum gpio type,
+		struct gpio_line *line, int value, gint64 timestamp)
+{
+	g_mutex_lock(&backend->stats_lock);
+	line->stats.events++;
+	if (line->debounce && line->pending >= 0)
+		line->stats.suppressed++;
+	g_mutex_unlock(&backend->stats_lock);
+
+	if (line->debounce == 0) {
+		line->value = value;
+		gpio_report(backend, type, value);
+		return;
+	}
+
+	line->pending = value;
+	line->deadline = timestamp + line->debounce;
+}
+
+static gint64 gpio_backend_flush(struct gpio_backend *backend, gint64 now)
+{
+	gint64 ready = -1;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS(gpio_list); i++) {
+		enum gpio type = gpio_list[i].gpio;
+		struct gpio_line *line = &backend->lines[type];
+
+		if (line->pending < 0)
+			continue;
+
+		if (line->deadline > now) {
+			if (ready < 0 || line->deadline < ready)
+				ready = line->deadline;
+
+			continue;
+		}
+
+		if (line->pending != line->value) {
+			line->value = line->pending;
+			gpio_report(backend, type, line->value);
+		} else {
+			g_mutex_lock(&backend->stats_lock);
+			line->stats.suppressed++;
+			g_mutex_unlock(&backend->stats_lock);
+		}
+
+		line->pending = -1;
+	}
+
+	return ready;
+}
+
+/*
+ * Edges are debounced by the time they occurred at, rather than by the time
+ * the main loop got around to reading them, where the driver provides it.
+ * Both are on the monotonic clock.
+ */
+static gint64 gpio_event_get_timestamp(const struct gpio_event *event,
+		gint64 now)
+{
+#ifdef HAVE_STRUCT_GPIO_EVENT_TIMESTAMP_NS
+	if (event->timestamp_ns)
+		return event->timestamp_ns / 1000;
+#endif
+
+	return now;
+}
+
+static void gpio_backend_read_events(struct gpio_backend *backend)
+{
+	struct gpio_event data[GPIO_EVENT_BATCH];
+	ssize_t num, i;
+	gint64 now;
+
+	/* drain everything that is pending, the descriptor is non-blocking */
+	do {
+		num = read(backend->fd.fd, data, sizeof(data));
+		if (num < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				g_warning("gpiodev: read(): %s",
+					strerror(errno));
+
+			break;
+		}
+
+		now = g_get_monotonic_time();
+		num /= sizeof(data[0]);
+
+		for (i = 0; i < num; i++) {
+			struct gpio_line *line;
+			enum gpio type;
+
+			line = gpio_backend_find_line(backend, data[i].gpio,
+					&type);
+			if (!line) {
+				g_debug("gpiodev: unknown GPIO %u transitioned "
+					"to %u", data[i].gpio, data[i].value);
+				continue;
+			}
+
+			gpio_line_edge(backend, type, line, !!data[i].value,
+					gpio_event_get_timestamp(&data[i], now));
+		}
+	} while (num == G_N_ELEMENTS(data));
+}
+
+static gboolean gpio_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+	struct gpio_backend *backend = (struct gpio_backend *)source;
+	gint64 now = g_source_get_time(source);
+
+	if (backend->fd.revents & G_IO_IN)
+		gpio_backend_read_events(backend);
+
+	/* the events may have been read after the source time was taken */
+	now = MAX(now, g_get_monotonic_time());
+	backend->deadline = gpio_backend_flush(backend, now);
 
 	if (callback)
 		return callback(user_data);
@@ -114,6 +282,9 @@ static void gpio_source_finalize(GSource *source)
 
 	if (backend->fd.fd >= 0)
 		close(backend->fd.fd);
+
+	g_mutex_clear(&backend->stats_lock);
+	g_free(backend->exposed_gpios);
 }
 
 static GSourceFuncs gpio_source_funcs = {
@@ -123,6 +294,57 @@ static GSourceFuncs gpio_source_funcs = {
 	.finalize = gpio_source_finalize,
 };
 
+static void gpio_load_config(struct gpio_backend *backend, GKeyFile *config)
+{
+	gint debounce = GPIO_DEBOUNCE_DEFAULT;
+	GError *error = NULL;
+	gchar *key;
+	guint i;
+
+	if (g_key_file_has_key(config, GPIO_GROUP, "debounce", NULL))
+		debounce = g_key_file_get_integer(config, GPIO_GROUP,
+				"debounce", NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(gpio_list); i++) {
+		struct gpio_line *line = &backend->lines[gpio_list[i].gpio];
+		gint value;
+
+		line->offset = gpio_list[i].offset;
+		line->debounce = MAX(debounce, 0) * 1000;
+		line->value = -1;
+		line->pending = -1;
+
+		value = g_key_file_get_integer(config, GPIO_GROUP,
+				gpio_list[i].name, &error);
+		if (!error)
+			line->offset = value;
+		else
+			g_clear_error(&error);
+
+		key = g_strdup_printf("%s-debounce", gpio_list[i].name);
+		value = g_key_file_get_integer(config, GPIO_GROUP, key, &error);
+		if (!error)
+			line->debounce = MAX(value, 0) * 1000;
+		else
+			g_clear_error(&error);
+		g_free(key);
+
+		g_debug("gpiodev: %s on line %u, debounce %" G_GINT64_FORMAT
+			" ms", gpio_list[i].name, line->offset,
+			line->debounce / 1000);
+	}
+
+	backend->exposed_gpios = g_key_file_get_integer_list(config, GPIO_GROUP,
+			"expose", &backend->num_exposed, NULL);
+	if (!backend->exposed_gpios) {
+		backend->num_exposed = G_N_ELEMENTS(gpios);
+		backend->exposed_gpios = g_new(gint, backend->num_exposed);
+
+		for (i = 0; i < backend->num_exposed; i++)
+			backend->exposed_gpios[i] = gpios[i];
+	}
+}
+
 int gpio_backend_create(struct gpio_backend **backendp, struct event_manager *events,
 		     GKeyFile *config)
 {
@@ -139,8 +361,11 @@ int gpio_backend_create(struct gpio_backend **backendp, struct event_manager *ev
 
 	backend = (struct gpio_backend *)source;
 	backend->events = events;
+	backend->deadline = -1;
+	g_mutex_init(&backend->stats_lock);
+	gpio_load_config(backend, config);
 
-	backend->fd.fd = open("/dev/gpio-0", O_RDWR);
+	backend->fd.fd = open("/dev/gpio-0", O_RDWR | O_NONBLOCK);
 	if (backend->fd.fd < 0) {
 		err = -errno;
 		goto free;
@@ -149,7 +374,7 @@ int gpio_backend_create(struct gpio_backend **backendp, struct event_manager *ev
 	for (i = 0; i < G_N_ELEMENTS(gpio_list); i++) {
 		struct gpio_event enable;
 
-		enable.gpio = gpio_list[i].offset;
+		enable.gpio = backend->lines[gpio_list[i].gpio].offset;
 		enable.value = 1;
 
 		err = ioctl(backend->fd.fd, GPIO_IOC_ENABLE_IRQ, &enable);
@@ -167,6 +392,7 @@ int gpio_backend_create(struct gpio_backend **backendp, struct event_manager *ev
 
 close:
 	close(backend->fd.fd);
+	backend->fd.fd = -1;
 free:
 	g_source_unref(source);
 	return err;
@@ -184,16 +410,30 @@ GSource *gpio_backend_get_source(struct gpio_backend *backend)
 
 int gpio_backend_get_num_gpios(struct gpio_backend *backend)
 {
-	return backend ? G_N_ELEMENTS(gpios) : -EINVAL;
+	return backend ? backend->num_exposed : -EINVAL;
+}
+
+int gpio_backend_get_stats(struct gpio_backend *backend, enum gpio gpio,
+		struct gpio_stats *stats)
+{
+	g_return_val_if_fail(backend != NULL, -EINVAL);
+	g_return_val_if_fail(gpio > GPIO_UNKNOWN && gpio < GPIO_NUM, -EINVAL);
+	g_return_val_if_fail(stats != NULL, -EINVAL);
+
+	g_mutex_lock(&backend->stats_lock);
+	*stats = backend->lines[gpio].stats;
+	g_mutex_unlock(&backend->stats_lock);
+
+	return 0;
 }
 
 int gpio_backend_direction_input(struct gpio_backend *backend, unsigned int gpio)
 {
 	int err;
 
-	g_return_val_if_fail(gpio < G_N_ELEMENTS(gpios), -EINVAL);
+	g_return_val_if_fail(gpio < backend->num_exposed, -EINVAL);
 
-	err = ioctl(backend->fd.fd, GPIO_IOC_SET_INPUT, gpios[gpio]);
+	err = ioctl(backend->fd.fd, GPIO_IOC_SET_INPUT, backend->exposed_gpios[gpio]);
 	if (err < 0)
 		return -errno;
 
@@ -206,9 +446,9 @@ int gpio_backend_direction_output(struct gpio_backend *backend, unsigned int gpi
 	struct gpio_event pin;
 	int err;
 
-	g_return_val_if_fail(gpio < G_N_ELEMENTS(gpios), -EINVAL);
+	g_return_val_if_fail(gpio < backend->num_exposed, -EINVAL);
 
-	pin.gpio = gpios[gpio];
+	pin.gpio = backend->exposed_gpios[gpio];
 	pin.value = !!value;
 
 	err = ioctl(backend->fd.fd, GPIO_IOC_SET_OUTPUT, &pin);
@@ -223,9 +463,9 @@ int gpio_backend_set_value(struct gpio_backend *backend, unsigned int gpio, int
 	struct gpio_event pin;
 	int err;
 
-	g_return_val_if_fail(gpio < G_N_ELEMENTS(gpios), -EINVAL);
+	g_return_val_if_fail(gpio < backend->num_exposed, -EINVAL);
 
-	pin.gpio = gpios[gpio];
+	pin.gpio = backend->exposed_gpios[gpio];
 	pin.value = !!value;
 
 	err = ioctl(backend->fd.fd, GPIO_IOC_SET_VALUE, &pin);
@@ -239,11 +479,31 @@ int gpio_backend_get_value(struct gpio_backend *backend, unsigned int gpio)
 {
 	int err;
 
-	g_return_val_if_fail(gpio < G_N_ELEMENTS(gpios), -EINVAL);
+	g_return_val_if_fail(gpio < backend->num_exposed, -EINVAL);
 
-	err = ioctl(backend->fd.fd, GPIO_IOC_GET_VALUE, gpios[gpio]);
+	err = ioctl(backend->fd.fd, GPIO_IOC_GET_VALUE, backend->exposed_gpios[gpio]);
 	if (err < 0)
 		return -errno;
 
 	return !!err;
 }
+
+int gpio_backend_get_values(struct gpio_backend *backend,
+		const unsigned int *gpios, int *values, unsigned int num)
+{
+	unsigned int i;
+	int err;
+
+	g_return_val_if_fail(backend != NULL, -EINVAL);
+	g_return_val_if_fail(gpios != NULL && values != NULL, -EINVAL);
+
+	for (i = 0; i < num; i++) {
+		err = gpio_backend_get_value(backend, gpios[i]);
+		if (err < 0)
+			return err;
+
+		values[i] = err;
+	}
+
+	return 0;
+}
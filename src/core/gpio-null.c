@@ -53,3 +53,15 @@ int gpio_backend_get_value(struct gpio_backend *backend, unsigned int gpio)
 {
 	return -ENOSYS;
 }
+
+int gpio_backend_get_values(struct gpio_backend *backend,
+		const unsigned int *gpios, int *values, unsigned int num)
+{
+	return -ENOSYS;
+}
+
+int gpio_backend_get_stats(struct gpio_backend *backend, enum gpio gpio,
+		struct gpio_stats *stats)
+{
+	return -ENOSYS;
+}
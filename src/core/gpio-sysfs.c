@@ -15,11 +15,13 @@
 #include <glib.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <gpio.h>
 
 #include "remote-control.h"
 
 #include "find-device.h"
+#include "gsysfs.h"
 
 #define USB_HANDSET_NAME "BurrBrown from Texas Instruments USB AUDIO  CODEC"
 
@@ -45,6 +47,7 @@ struct gpio_backend {
 
 
 	gint *exposed_gpios;
+	GSysfsAttribute **exposed_values;
 	gsize num_exposed;
 
 	struct event_manager *events;
@@ -88,11 +91,7 @@ static int gpio_handle_irq(struct gpio_backend *backend, guint gpio,
 	if (!poll)
 		return -EINVAL;
 
-	err = lseek(poll->fd, 0, SEEK_SET);
-	if (err < 0)
-		return -errno;
-
-	err = read(poll->fd, &value, sizeof(value));
+	err = pread(poll->fd, &value, sizeof(value), 0);
 	if (err < 0)
 		return -errno;
 
@@ -159,6 +158,9 @@ static void gpio_source_finalize(GSource *source)
 	int err;
 
 	for (i = 0; i < backend->num_exposed; i++) {
+		if (backend->exposed_values)
+			g_sysfs_attribute_free(backend->exposed_values[i]);
+
 		err = gpio_free(backend->chip, backend->exposed_gpios[i]);
 		if (err < 0) {
 			g_debug("gpio-sysfs: %s failed: %s", "gpio_free()",
@@ -173,6 +175,7 @@ static void gpio_source_finalize(GSource *source)
 	}
 
 	gpio_chip_close(backend->chip);
+	g_free(backend->exposed_values);
 	g_free(backend->exposed_gpios);
 	g_free(backend->label);
 }
@@ -273,11 +276,42 @@ free:
 
 }
 
+/*
+ * Exposed GPIOs are accessed through their value attributes, which are kept
+ * open for the lifetime of the backend so that reading or writing a value
+ * does not require a lookup and open() each time.
+ */
+static GSysfsAttribute *gpio_open_value(const char *syspath, guint gpio,
+		GError **error)
+{
+	GSysfsAttribute *attribute;
+	gchar *filename;
+	gboolean found;
+	guint base;
+
+	filename = g_strdup_printf("%s/base", syspath);
+	attribute = g_sysfs_attribute_new_for_path(filename);
+	found = g_sysfs_attribute_read_uint(attribute, &base, error);
+	g_sysfs_attribute_free(attribute);
+	g_free(filename);
+
+	if (!found)
+		return NULL;
+
+	filename = g_strdup_printf(SYSFS_GPIO_PATH "/gpio%u/value",
+			base + gpio);
+	attribute = g_sysfs_attribute_new_for_path(filename);
+	g_free(filename);
+
+	return attribute;
+}
+
 int gpio_backend_create(struct gpio_backend **backendp, struct event_manager *events,
                      GKeyFile *config)
 {
 	guint active_mask = (guint)-1;
 	struct gpio_backend *backend;
+	GError *error = NULL;
 	GSource *source;
 	char *syspath;
 	int err;
@@ -310,7 +344,6 @@ int gpio_backend_create(struct gpio_backend **backendp, struct event_manager *ev
 		g_warning("gpio-sysfs: %s(%s) failed: %s",
 				"gpio_backend_open", syspath, g_strerror(-err));
 	}
-	free(syspath);
 
 	/* remove the hook from active mask when usb handset is available */
 	if (find_input_devices(USB_HANDSET_NAME, NULL, NULL)) {
@@ -332,14 +365,28 @@ int gpio_backend_create(struct gpio_backend **backendp, struct event_manager *ev
 		}
 	}
 
+	backend->exposed_values = g_new0(GSysfsAttribute *,
+			backend->num_exposed);
+
 	for (i = 0; i < backend->num_exposed; i++) {
 		err = gpio_request(backend->chip, backend->exposed_gpios[i]);
 		if ((err < 0) && (err != -EBUSY)) {
 			g_debug("gpio-sysfs: %s failed: %s", "gpio_request",
 					g_strerror(-err));
 		}
+
+		backend->exposed_values[i] = gpio_open_value(syspath,
+				backend->exposed_gpios[i], &error);
+		if (!backend->exposed_values[i]) {
+			g_debug("gpio-sysfs: failed to open value of GPIO %d: "
+					"%s", backend->exposed_gpios[i],
+					error->message);
+			g_clear_error(&error);
+		}
 	}
 
+	free(syspath);
+
 	*backendp = backend;
 	return 0;
 
@@ -395,11 +442,22 @@ int gpio_backend_direction_output(struct gpio_backend *backend, unsigned int gpi
 
 int gpio_backend_set_value(struct gpio_backend *backend, unsigned int gpio, int value)
 {
+	GError *error = NULL;
 	int err;
 
 	g_return_val_if_fail(backend != NULL, -EINVAL);
 	g_return_val_if_fail(gpio < backend->num_exposed, -EINVAL);
 
+	if (backend->exposed_values[gpio]) {
+		if (g_sysfs_attribute_write_uint(backend->exposed_values[gpio],
+				!!value, &error))
+			return 0;
+
+		/* try again through the chip */
+		g_debug("gpio-sysfs: %s", error->message);
+		g_error_free(error);
+	}
+
 	err = gpio_set_value(backend->chip, backend->exposed_gpios[gpio], value);
 	if (err < 0)
 		return err;
@@ -409,14 +467,76 @@ int gpio_backend_set_value(struct gpio_backend *backend, unsigned int gpio, int
 
 int gpio_backend_get_value(struct gpio_backend *backend, unsigned int gpio)
 {
+	GError *error = NULL;
+	guint value;
 	int err;
 
 	g_return_val_if_fail(backend != NULL, -EINVAL);
 	g_return_val_if_fail(gpio < backend->num_exposed, -EINVAL);
 
+	if (backend->exposed_values[gpio]) {
+		if (g_sysfs_attribute_read_uint(backend->exposed_values[gpio],
+				&value, &error))
+			return value != 0;
+
+		g_debug("gpio-sysfs: %s", error->message);
+		g_error_free(error);
+	}
+
 	err = gpio_get_value(backend->chip, backend->exposed_gpios[gpio]);
 	if (err < 0)
 		return err;
 
 	return !!err;
 }
+
+/*
+ * Reads the values of several exposed GPIOs, each with a single pread() on
+ * its cached value attribute. GPIOs whose attribute can't be read are
+ * queried through libgpio instead.
+ */
+int gpio_backend_get_values(struct gpio_backend *backend,
+		const unsigned int *gpios, int *values, unsigned int num)
+{
+	GError *error = NULL;
+	unsigned int i;
+	guint value;
+	int err;
+
+	g_return_val_if_fail(backend != NULL, -EINVAL);
+	g_return_val_if_fail(gpios != NULL && values != NULL, -EINVAL);
+
+	for (i = 0; i < num; i++)
+		if (gpios[i] >= backend->num_exposed)
+			return -EINVAL;
+
+	for (i = 0; i < num; i++) {
+		GSysfsAttribute *attribute = backend->exposed_values[gpios[i]];
+
+		if (attribute) {
+			if (g_sysfs_attribute_read_uint(attribute, &value,
+					&error)) {
+				values[i] = value != 0;
+				continue;
+			}
+
+			g_debug("gpio-sysfs: %s", error->message);
+			g_clear_error(&error);
+		}
+
+		err = gpio_get_value(backend->chip,
+				backend->exposed_gpios[gpios[i]]);
+		if (err < 0)
+			return err;
+
+		values[i] = !!err;
+	}
+
+	return 0;
+}
+
+int gpio_backend_get_stats(struct gpio_backend *backend, enum gpio gpio,
+		struct gpio_stats *stats)
+{
+	return -ENOSYS;
+}
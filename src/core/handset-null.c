@@ -22,6 +22,11 @@ int handset_free(struct handset *handset)
 	return 0;
 }
 
+GSource *handset_get_source(struct handset *handset)
+{
+	return NULL;
+}
+
 int handset_display_clear(struct handset *handset)
 {
 	return 0;
@@ -14,13 +14,44 @@
 
 #include "remote-control.h"
 
+/* upper bound of events handled per dispatch, so others get a turn */
+#define HANDSET_EVENT_BATCH 16
+
+enum handset_op_type {
+	HANDSET_OP_CLEAR,
+	HANDSET_OP_ICON,
+	HANDSET_OP_TEXT,
+};
+
+/* display update queued until the next handset_display_sync() */
+struct handset_op {
+	enum handset_op_type type;
+	unsigned int x;
+	unsigned int y;
+	unsigned int id;
+	gchar *text;
+	bool show;
+};
+
+struct handset_source {
+	GSource source;
+	struct handset *handset;
+	GPollFD poll;
+};
+
 struct handset {
 	struct ptip_client *client;
 	struct remote_control *rc;
-	GThread *thread;
-	gboolean done;
+	GSource *source;
+	GQueue ops;
 };
 
+static void handset_op_free(struct handset_op *op)
+{
+	g_free(op->text);
+	g_free(op);
+}
+
 static int handset_handle_event(struct handset *handset)
 {
 	struct ptip_event *event = NULL;
@@ -62,52 +93,100 @@ static int handset_handle_event(struct handset *handset)
 	return 0;
 }
 
-static gpointer handset_thread(gpointer data)
+static gboolean handset_source_prepare(GSource *source, gint *timeout)
 {
-	struct handset *handset = data;
+	if (timeout)
+		*timeout = -1;
 
-	while (!handset->done) {
-		struct ptip_connection *events = NULL;
-		GPollFD fds[1];
-		gint err;
+	return FALSE;
+}
+
+static gboolean handset_source_check(GSource *source)
+{
+	struct handset_source *hs = (struct handset_source *)source;
 
-		err = ptip_client_get_events(handset->client, &events);
+	if (hs->poll.revents & (G_IO_IN | G_IO_HUP | G_IO_ERR))
+		return TRUE;
+
+	return FALSE;
+}
+
+static gboolean handset_source_dispatch(GSource *source,
+		GSourceFunc callback, gpointer user_data)
+{
+	struct handset_source *hs = (struct handset_source *)source;
+	unsigned int count = 0;
+	int err;
+
+	if (hs->poll.revents & (G_IO_HUP | G_IO_ERR)) {
+		g_warning("%s(): event channel closed", __func__);
+		goto remove;
+	}
+
+	/* drain whatever has queued up, without going through the loop */
+	do {
+		err = handset_handle_event(hs->handset);
 		if (err < 0) {
-			g_warning("%s(): ptip_client_get_events(): %s",
+			g_warning("%s(): handset_handle_event(): %s",
 					__func__, g_strerror(-err));
-			break;
+			goto remove;
 		}
 
-		err = ptip_connection_get_fd(events, &fds[0].fd);
-		if (err < 0) {
-			g_warning("%s(): ptip_connection_get_fd(): %s",
-					__func__, g_strerror(-err));
+		hs->poll.revents = 0;
+
+		if (++count >= HANDSET_EVENT_BATCH)
 			break;
-		}
+	} while (g_poll(&hs->poll, 1, 0) > 0 &&
+		 (hs->poll.revents & G_IO_IN));
 
-		fds[0].events = G_IO_IN;
+	return TRUE;
 
-		err = g_poll(fds, G_N_ELEMENTS(fds), 250);
-		if (err <= 0) {
-			if ((err == 0) || (errno == EINTR))
-				continue;
+remove:
+	g_source_remove_poll(source, &hs->poll);
+	return TRUE;
+}
 
-			g_warning("%s(): g_poll(): %s", __func__,
-					g_strerror(errno));
-			break;
-		}
+static GSourceFuncs handset_source_funcs = {
+	.prepare = handset_source_prepare,
+	.check = handset_source_check,
+	.dispatch = handset_source_dispatch,
+};
 
-		if (fds[0].revents & G_IO_IN) {
-			err = handset_handle_event(handset);
-			if (err < 0) {
-				g_warning("%s(): handset_handle_event(): %s",
-						__func__, g_strerror(-err));
-				break;
-			}
-		}
+static int handset_source_new(struct handset *handset)
+{
+	struct ptip_connection *events = NULL;
+	struct handset_source *hs;
+	GSource *source;
+	int err;
+
+	/* the event channel is set up once, not on every wakeup */
+	err = ptip_client_get_events(handset->client, &events);
+	if (err < 0) {
+		g_warning("%s(): ptip_client_get_events(): %s", __func__,
+				g_strerror(-err));
+		return err;
 	}
 
-	return NULL;
+	source = g_source_new(&handset_source_funcs, sizeof(*hs));
+	if (!source)
+		return -ENOMEM;
+
+	hs = (struct handset_source *)source;
+	hs->handset = handset;
+
+	err = ptip_connection_get_fd(events, &hs->poll.fd);
+	if (err < 0) {
+		g_warning("%s(): ptip_connection_get_fd(): %s", __func__,
+				g_strerror(-err));
+		g_source_unref(source);
+		return err;
+	}
+
+	hs->poll.events = G_IO_IN | G_IO_HUP | G_IO_ERR;
+	g_source_add_poll(source, &hs->poll);
+
+	handset->source = source;
+	return 0;
 }
 
 int handset_create(struct handset **handsetp, struct remote_control *rc)
@@ -119,6 +198,8 @@ int handset_create(struct handset **handsetp, struct remote_control *rc)
 	if (!handset)
 		return -ENOMEM;
 
+	g_queue_init(&handset->ops);
+
 	err = ptip_client_create(&handset->client, "ptip");
 	if (err < 0) {
 		g_debug("PT-IP: connection failed: %s", g_strerror(-err));
@@ -129,19 +210,12 @@ int handset_create(struct handset **handsetp, struct remote_control *rc)
 	g_debug("PT-IP: connection established");
 
 	handset->rc = rc;
-	handset->done = FALSE;
-
-#if !GLIB_CHECK_VERSION(2, 31, 0)
-	handset->thread = g_thread_create(handset_thread, handset, TRUE,
-			NULL);
-#else
-	handset->thread = g_thread_new("handset-ptip", handset_thread,
-			handset);
-#endif
-	if (!handset->thread) {
+
+	err = handset_source_new(handset);
+	if (err < 0) {
 		ptip_client_free(handset->client);
 		g_free(handset);
-		return -ENOMEM;
+		return err;
 	}
 
 out:
@@ -154,42 +228,140 @@ int handset_free(struct handset *handset)
 	if (!handset)
 		return -EINVAL;
 
-	if (handset->thread) {
-		handset->done = TRUE;
-		g_thread_join(handset->thread);
+	if (handset->source) {
+		g_source_destroy(handset->source);
+		g_source_unref(handset->source);
 	}
 
+	g_queue_foreach(&handset->ops, (GFunc)handset_op_free, NULL);
+	g_queue_clear(&handset->ops);
+
 	ptip_client_free(handset->client);
 	g_free(handset);
 	return 0;
 }
 
+GSource *handset_get_source(struct handset *handset)
+{
+	if (!handset || !handset->source)
+		return NULL;
+
+	return g_source_ref(handset->source);
+}
+
+/*
+ * Drop queued updates that a new one supersedes: everything for a clear,
+ * the same icon or the same text at the same position otherwise.
+ */
+static void handset_queue_op(struct handset *handset, struct handset_op *op)
+{
+	GList *node = handset->ops.head;
+
+	while (node) {
+		struct handset_op *queued = node->data;
+		GList *next = node->next;
+		bool drop;
+
+		switch (op->type) {
+		case HANDSET_OP_CLEAR:
+			drop = true;
+			break;
+
+		case HANDSET_OP_ICON:
+			drop = queued->type == HANDSET_OP_ICON &&
+				queued->id == op->id;
+			break;
+
+		case HANDSET_OP_TEXT:
+			drop = queued->type == HANDSET_OP_TEXT &&
+				queued->x == op->x && queued->y == op->y &&
+				g_strcmp0(queued->text, op->text) == 0;
+			break;
+
+		default:
+			drop = false;
+			break;
+		}
+
+		if (drop) {
+			g_queue_delete_link(&handset->ops, node);
+			handset_op_free(queued);
+		}
+
+		node = next;
+	}
+
+	g_queue_push_tail(&handset->ops, op);
+}
+
+static int handset_send_op(struct handset *handset,
+		const struct handset_op *op)
+{
+	switch (op->type) {
+	case HANDSET_OP_CLEAR:
+		return ptip_client_display_clear(handset->client);
+
+	case HANDSET_OP_ICON:
+		if (op->show)
+			return ptip_client_icon_show(handset->client, op->id);
+
+		return ptip_client_icon_hide(handset->client, op->id);
+
+	case HANDSET_OP_TEXT:
+		if (op->show)
+			return ptip_client_text_show(handset->client, op->x,
+					op->y, op->text);
+
+		return ptip_client_text_hide(handset->client, op->x, op->y,
+				op->text);
+	}
+
+	return -EINVAL;
+}
+
 int handset_display_clear(struct handset *handset)
 {
-	int err;
+	struct handset_op *op;
 
 	if (!handset || !handset->client)
 		return handset ? -ENODEV : -EINVAL;
 
-	err = ptip_client_display_clear(handset->client);
-	if (err < 0)
-		return err;
+	op = g_new0(struct handset_op, 1);
+	if (!op)
+		return -ENOMEM;
+
+	op->type = HANDSET_OP_CLEAR;
+	handset_queue_op(handset, op);
 
 	return 0;
 }
 
+/*
+ * Sends all display updates queued since the last call in one go, so that
+ * a refresh of the display results in a single burst followed by a flush.
+ */
 int handset_display_sync(struct handset *handset)
 {
+	struct handset_op *op;
+	int ret = 0;
 	int err;
 
 	if (!handset || !handset->client)
 		return handset ? -ENODEV : -EINVAL;
 
+	while ((op = g_queue_pop_head(&handset->ops)) != NULL) {
+		err = handset_send_op(handset, op);
+		if (err < 0 && ret == 0)
+			ret = err;
+
+		handset_op_free(op);
+	}
+
 	err = ptip_client_display_flush(handset->client);
 	if (err < 0)
 		return err;
 
-	return 0;
+	return ret;
 }
 
 int handset_display_set_brightness(struct handset *handset,
@@ -224,18 +396,19 @@ int handset_keypad_set_brightness(struct handset *handset,
 
 int handset_icon_show(struct handset *handset, unsigned int id, bool show)
 {
-	int err;
+	struct handset_op *op;
 
 	if (!handset || !handset->client)
 		return handset ? -ENODEV : -EINVAL;
 
-	if (show)
-		err = ptip_client_icon_show(handset->client, id);
-	else
-		err = ptip_client_icon_hide(handset->client, id);
+	op = g_new0(struct handset_op, 1);
+	if (!op)
+		return -ENOMEM;
 
-	if (err < 0)
-		return err;
+	op->type = HANDSET_OP_ICON;
+	op->id = id;
+	op->show = show;
+	handset_queue_op(handset, op);
 
 	return 0;
 }
@@ -243,18 +416,21 @@ int handset_icon_show(struct handset *handset, unsigned int id, bool show)
 int handset_text_show(struct handset *handset, unsigned int x, unsigned int y,
 		const char *text, bool show)
 {
-	int err;
+	struct handset_op *op;
 
 	if (!handset || !handset->client)
 		return handset ? -ENODEV : -EINVAL;
 
-	if (show)
-		err = ptip_client_text_show(handset->client, x, y, text);
-	else
-		err = ptip_client_text_hide(handset->client, x, y, text);
+	op = g_new0(struct handset_op, 1);
+	if (!op)
+		return -ENOMEM;
 
-	if (err < 0)
-		return err;
+	op->type = HANDSET_OP_TEXT;
+	op->x = x;
+	op->y = y;
+	op->text = g_strdup(text);
+	op->show = show;
+	handset_queue_op(handset, op);
 
 	return 0;
 }
@@ -12,68 +12,54 @@
 
 #include <lldpctl.h>
 #include <ctype.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <glib.h>
 
 #include "remote-control.h"
 
+#define LLDP_RECONNECT_TIMEOUT 5000
+
+/*
+ * Neighbor information as seen after the last change reported by lldpd.
+ * Snapshots are never modified once published.
+ */
+struct lldp_snapshot {
+	GHashTable *info;
+	char *frame;
+	ssize_t len;
+};
+
 struct lldp_monitor {
+	/* used for queries, only valid in the monitor thread */
 	lldpctl_conn_t *conn;
+	gchar *transport;
 	gchar *iface;
-};
-
-int lldp_monitor_free(struct lldp_monitor *monitor)
-{
-	if (!monitor)
-		return -EINVAL;
 
-	lldpctl_release(monitor->conn);
-	g_free(monitor->iface);
+	/* lldpd is watched and queried from a separate thread */
+	GThread *thread;
+	int wakeup;
+	gint done;
+	gboolean changed;
 
-	g_free(monitor);
+	GMutex lock;
+	struct lldp_snapshot *pending;
+	guint publish_id;
 
-	return 0;
-}
+	/* only accessed from the main loop */
+	struct lldp_snapshot *snapshot;
+	lldp_monitor_changed_cb changed_cb;
+	void *changed_data;
+};
 
-int lldp_monitor_create(struct lldp_monitor **monitorp, GKeyFile *config)
-{
+/* a connection to lldpd, whose I/O is interrupted by the wakeup eventfd */
+struct lldp_watch {
 	struct lldp_monitor *monitor;
-	gchar *value;
-
-	if (!monitorp)
-		return -EINVAL;
-
-	monitor = g_new0(struct lldp_monitor, 1);
-	if (!monitor)
-		return -ENOMEM;
-
-	value = g_key_file_get_string(config, "lldp", "transport", NULL);
-	if (value) {
-		monitor->conn = lldpctl_new_name(value, NULL, NULL, NULL);
-		g_debug("lldp: requested transport %s", value);
-		g_free(value);
-	} else {
-		monitor->conn = lldpctl_new(NULL, NULL, NULL);
-	}
-	if (!monitor->conn) {
-		lldp_monitor_free(monitor);
-		return -ENODEV;
-	}
-
-	value = g_key_file_get_string(config, "lldp", "interface", NULL);
-	if (value) {
-		g_debug("lldp: requested interface %s", value);
-		monitor->iface = value;
-	}
-
-	*monitorp = monitor;
-
-	return 0;
-}
-
-GSource *lldp_monitor_get_source(struct lldp_monitor *monitor)
-{
-	return NULL;
-}
+	int fd;
+};
 
 static int lldp_write_tlv(char *data, int type, const void *mem, size_t size,
 		int sub)
@@ -237,43 +223,6 @@ static void lldp_monitor_dump_info(struct lldp_monitor *monitor)
 }
 #endif
 
-ssize_t lldp_monitor_read(struct lldp_monitor *monitor, void *buffer,
-		size_t size)
-{
-	lldpctl_atom_t *neighbors = NULL;
-	lldpctl_atom_t *neighbor = NULL;
-	char *data = NULL;
-	ssize_t ret = 0;
-
-#ifdef DEBUG_INFO
-	lldp_monitor_dump_info(monitor);
-#endif
-
-	if (!monitor || !buffer || !size)
-		return -EINVAL;
-
-	neighbors = lldp_monitor_get_neighbors(monitor);
-	if (neighbors)
-		neighbor = lldpctl_atom_iter_value(neighbors,
-				lldpctl_atom_iter(neighbors));
-	if (neighbor)
-		data = lldp_write_neighbor(neighbor, &ret);
-
-	if (ret > size)
-		ret = size;
-	if (ret > 0)
-		memcpy(buffer, data, ret);
-
-	if (neighbor)
-		lldpctl_atom_dec_ref(neighbor);
-	if (neighbors)
-		lldpctl_atom_dec_ref(neighbors);
-
-	free(data);
-
-	return ret;
-}
-
 #define G_HASH_TABLE_ADD_STR(c,p,d,n,k,v) { \
 	const char *s = lldpctl_atom_get_str(n, v); \
 	if (lldpctl_last_error(c) == LLDPCTL_NO_ERROR && s) \
@@ -518,25 +467,386 @@ static void lldp_add_neighbor(GHashTable *data, lldpctl_conn_t *conn,
 	g_free(prefix);
 }
 
-int lldp_monitor_read_info(struct lldp_monitor *monitor, GHashTable **data)
+static void lldp_snapshot_free(struct lldp_snapshot *snapshot)
+{
+	if (!snapshot)
+		return;
+
+	g_hash_table_unref(snapshot->info);
+	free(snapshot->frame);
+	g_free(snapshot);
+}
+
+static struct lldp_snapshot *lldp_monitor_query(struct lldp_monitor *monitor)
 {
-	lldpctl_atom_t *neighbors = NULL;
-	lldpctl_atom_t *neighbor = NULL;
+	struct lldp_snapshot *snapshot;
+	lldpctl_atom_t *neighbors;
+	lldpctl_atom_t *neighbor;
 	lldpctl_atom_iter_t *iter;
 	int i = 0;
 
-	if (!monitor || !data)
-		return -EINVAL;
-
-	*data = g_hash_table_new_full(NULL, NULL, g_free, g_free);
-	if (!*data)
-		return -ENOMEM;
+	snapshot = g_new0(struct lldp_snapshot, 1);
+	snapshot->info = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
 
 	neighbors = lldp_monitor_get_neighbors(monitor);
+	if (!neighbors)
+		return snapshot;
+
 	LLDPCTR_ATOM_LIST_FOR_EACH(neighbors, iter, neighbor) {
-		lldp_add_neighbor(*data, monitor->conn, neighbor, i++);
+		if (i == 0)
+			snapshot->frame = lldp_write_neighbor(neighbor,
+					&snapshot->len);
+
+		lldp_add_neighbor(snapshot->info, monitor->conn, neighbor,
+				i++);
 	}
 	lldpctl_atom_dec_ref(neighbors);
 
+	return snapshot;
+}
+
+static gboolean lldp_monitor_publish(gpointer data)
+{
+	struct lldp_monitor *monitor = data;
+	struct lldp_snapshot *snapshot;
+
+	g_mutex_lock(&monitor->lock);
+	snapshot = monitor->pending;
+	monitor->pending = NULL;
+	monitor->publish_id = 0;
+	g_mutex_unlock(&monitor->lock);
+
+	lldp_snapshot_free(monitor->snapshot);
+	monitor->snapshot = snapshot;
+
+	if (monitor->changed_cb)
+		monitor->changed_cb(monitor->changed_data);
+
+	return FALSE;
+}
+
+/*
+ * Queries the full neighbor list and hands it to the main loop. Several
+ * refreshes before the main loop gets to run collapse into one.
+ */
+static void lldp_monitor_refresh(struct lldp_monitor *monitor)
+{
+	struct lldp_snapshot *snapshot, *old;
+
+	snapshot = lldp_monitor_query(monitor);
+
+	/* the query was cut short, don't publish what it got */
+	if (g_atomic_int_get(&monitor->done)) {
+		lldp_snapshot_free(snapshot);
+		return;
+	}
+
+	g_mutex_lock(&monitor->lock);
+	old = monitor->pending;
+	monitor->pending = snapshot;
+	if (!monitor->publish_id)
+		monitor->publish_id = g_idle_add(lldp_monitor_publish,
+				monitor);
+	g_mutex_unlock(&monitor->lock);
+
+	lldp_snapshot_free(old);
+}
+
+static void lldp_monitor_changed(lldpctl_conn_t *conn, lldpctl_change_t type,
+		lldpctl_atom_t *interface, lldpctl_atom_t *neighbor, void *data)
+{
+	struct lldp_monitor *monitor = data;
+	const char *name;
+
+	name = lldpctl_atom_get_str(interface, lldpctl_k_interface_name);
+	if (monitor->iface && g_strcmp0(monitor->iface, name))
+		return;
+
+	monitor->changed = TRUE;
+}
+
+/* returns a negative value if the monitor is being stopped */
+static int lldp_monitor_wait(struct lldp_monitor *monitor, int fd,
+		short events, int timeout)
+{
+	struct pollfd fds[2];
+	int err;
+
+	fds[0].fd = monitor->wakeup;
+	fds[0].events = POLLIN;
+	fds[1].fd = fd;
+	fds[1].events = events;
+
+	do {
+		err = poll(fds, fd < 0 ? 1 : 2, timeout);
+	} while (err < 0 && errno == EINTR);
+
+	if (err < 0 || fds[0].revents)
+		return -ECANCELED;
+
+	return 0;
+}
+
+static ssize_t lldp_watch_send(lldpctl_conn_t *conn, const uint8_t *data,
+		size_t length, void *user_data)
+{
+	struct lldp_watch *watch = user_data;
+	ssize_t err;
+
+	if (lldp_monitor_wait(watch->monitor, watch->fd, POLLOUT, -1) < 0)
+		return LLDPCTL_ERR_CALLBACK_FAILED;
+
+	err = write(watch->fd, data, length);
+	if (err < 0)
+		return LLDPCTL_ERR_CALLBACK_FAILED;
+
+	return err;
+}
+
+static ssize_t lldp_watch_recv(lldpctl_conn_t *conn, const uint8_t *data,
+		size_t length, void *user_data)
+{
+	struct lldp_watch *watch = user_data;
+	ssize_t err;
+
+	if (lldp_monitor_wait(watch->monitor, watch->fd, POLLIN, -1) < 0)
+		return LLDPCTL_ERR_CALLBACK_FAILED;
+
+	err = read(watch->fd, (uint8_t *)data, length);
+	if (err < 0)
+		return LLDPCTL_ERR_CALLBACK_FAILED;
+
+	if (err == 0)
+		return LLDPCTL_ERR_EOF;
+
+	return err;
+}
+
+static int lldp_watch_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	g_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		int err = -errno;
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+static gpointer lldp_monitor_thread(gpointer data)
+{
+	struct lldp_monitor *monitor = data;
+	struct lldp_watch watch = { .monitor = monitor };
+	struct lldp_watch query = { .monitor = monitor };
+	const char *path = monitor->transport;
+	lldpctl_conn_t *conn;
+
+	if (!path)
+		path = lldpctl_get_default_transport();
+
+	while (!g_atomic_int_get(&monitor->done)) {
+		watch.fd = lldp_watch_connect(path);
+		if (watch.fd < 0) {
+			g_debug("lldp: failed to connect to %s: %s", path,
+				g_strerror(-watch.fd));
+			lldp_monitor_wait(monitor, -1, 0,
+					LLDP_RECONNECT_TIMEOUT);
+			continue;
+		}
+
+		/*
+		 * A connection in watch mode can't be used for queries, so
+		 * they get one of their own. It goes through the same
+		 * callbacks, so that stopping the monitor doesn't have to
+		 * wait for a query to complete either.
+		 */
+		query.fd = lldp_watch_connect(path);
+		if (query.fd < 0) {
+			g_debug("lldp: failed to connect to %s: %s", path,
+				g_strerror(-query.fd));
+			close(watch.fd);
+			lldp_monitor_wait(monitor, -1, 0,
+					LLDP_RECONNECT_TIMEOUT);
+			continue;
+		}
+
+		monitor->conn = lldpctl_new_name(path, lldp_watch_send,
+				lldp_watch_recv, &query);
+		conn = lldpctl_new_name(path, lldp_watch_send,
+				lldp_watch_recv, &watch);
+		if (conn && monitor->conn &&
+		    lldpctl_watch_callback(conn, lldp_monitor_changed,
+				monitor) == LLDPCTL_NO_ERROR) {
+			/* covers anything that changed while disconnected */
+			lldp_monitor_refresh(monitor);
+
+			while (lldpctl_watch(conn) == LLDPCTL_NO_ERROR) {
+				if (!monitor->changed)
+					continue;
+
+				monitor->changed = FALSE;
+				lldp_monitor_refresh(monitor);
+			}
+		}
+
+		if (conn)
+			lldpctl_release(conn);
+
+		if (monitor->conn) {
+			lldpctl_release(monitor->conn);
+			monitor->conn = NULL;
+		}
+
+		close(query.fd);
+		close(watch.fd);
+
+		if (!g_atomic_int_get(&monitor->done)) {
+			g_debug("lldp: lost connection to lldpd");
+			lldp_monitor_wait(monitor, -1, 0,
+					LLDP_RECONNECT_TIMEOUT);
+		}
+	}
+
+	return NULL;
+}
+
+int lldp_monitor_free(struct lldp_monitor *monitor)
+{
+	if (!monitor)
+		return -EINVAL;
+
+	if (monitor->thread) {
+		g_atomic_int_set(&monitor->done, TRUE);
+		eventfd_write(monitor->wakeup, 1);
+		g_thread_join(monitor->thread);
+	}
+
+	if (monitor->publish_id)
+		g_source_remove(monitor->publish_id);
+
+	lldp_snapshot_free(monitor->pending);
+	lldp_snapshot_free(monitor->snapshot);
+
+	if (monitor->wakeup >= 0)
+		close(monitor->wakeup);
+
+	g_mutex_clear(&monitor->lock);
+
+	g_free(monitor->transport);
+	g_free(monitor->iface);
+
+	g_free(monitor);
+
+	return 0;
+}
+
+int lldp_monitor_create(struct lldp_monitor **monitorp, GKeyFile *config)
+{
+	struct lldp_monitor *monitor;
+	gchar *value;
+
+	if (!monitorp)
+		return -EINVAL;
+
+	monitor = g_new0(struct lldp_monitor, 1);
+	if (!monitor)
+		return -ENOMEM;
+
+	g_mutex_init(&monitor->lock);
+	monitor->wakeup = -1;
+
+	value = g_key_file_get_string(config, "lldp", "transport", NULL);
+	if (value) {
+		g_debug("lldp: requested transport %s", value);
+		monitor->transport = value;
+	}
+
+	value = g_key_file_get_string(config, "lldp", "interface", NULL);
+	if (value) {
+		g_debug("lldp: requested interface %s", value);
+		monitor->iface = value;
+	}
+
+	monitor->wakeup = eventfd(0, EFD_CLOEXEC);
+	if (monitor->wakeup < 0) {
+		int err = -errno;
+		lldp_monitor_free(monitor);
+		return err;
+	}
+
+	monitor->thread = g_thread_new("lldp-monitor", lldp_monitor_thread,
+			monitor);
+
+	*monitorp = monitor;
+
+	return 0;
+}
+
+GSource *lldp_monitor_get_source(struct lldp_monitor *monitor)
+{
+	return NULL;
+}
+
+int lldp_monitor_set_changed_cb(struct lldp_monitor *monitor,
+		lldp_monitor_changed_cb callback, void *data)
+{
+	if (!monitor)
+		return -EINVAL;
+
+	monitor->changed_cb = callback;
+	monitor->changed_data = data;
+
+	return 0;
+}
+
+void *lldp_monitor_get_changed_cb_data(struct lldp_monitor *monitor)
+{
+	return monitor ? monitor->changed_data : NULL;
+}
+
+ssize_t lldp_monitor_read(struct lldp_monitor *monitor, void *buffer,
+		size_t size)
+{
+	struct lldp_snapshot *snapshot;
+	ssize_t ret = 0;
+
+#ifdef DEBUG_INFO
+	lldp_monitor_dump_info(monitor);
+#endif
+
+	if (!monitor || !buffer || !size)
+		return -EINVAL;
+
+	snapshot = monitor->snapshot;
+	if (snapshot && snapshot->frame) {
+		ret = MIN((size_t)snapshot->len, size);
+		memcpy(buffer, snapshot->frame, ret);
+	}
+
+	return ret;
+}
+
+int lldp_monitor_read_info(struct lldp_monitor *monitor, GHashTable **data)
+{
+	if (!monitor || !data)
+		return -EINVAL;
+
+	if (monitor->snapshot)
+		*data = g_hash_table_ref(monitor->snapshot->info);
+	else
+		*data = g_hash_table_new(g_str_hash, g_str_equal);
+
 	return 0;
 }
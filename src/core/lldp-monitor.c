@@ -21,6 +21,7 @@
 #include <net/if.h>
 #endif
 #include <linux/if_packet.h>
+#include <linux/filter.h>
 
 #include <netlink/netlink.h>
 #include <netlink/route/link.h>
@@ -46,6 +47,67 @@ extern char *if_indextoname (unsigned int __ifindex, char *__ifname) __THROW;
 static const uint8_t LLDP_MULTICAST_ADDR[] = { 0x01, 0x80, 0xc2, 0x00, 0x00, 0x0e };
 static const uint16_t ETH_P_LLDP = 0x88cc;
 
+#define LLDP_MAX_NEIGHBORS 8
+#define LLDP_MAX_VLANS 8
+
+#define LLDP_TLV_END			0
+#define LLDP_TLV_CHASSIS_ID		1
+#define LLDP_TLV_PORT_ID		2
+#define LLDP_TLV_TTL			3
+#define LLDP_TLV_PORT_DESCR		4
+#define LLDP_TLV_SYSTEM_NAME		5
+#define LLDP_TLV_SYSTEM_DESCR		6
+#define LLDP_TLV_SYSTEM_CAP		7
+#define LLDP_TLV_MGMT_ADDR		8
+#define LLDP_TLV_ORG_SPECIFIC		127
+
+#define LLDP_CHASSIS_ID_MAC		4
+#define LLDP_CHASSIS_ID_NETWORK		5
+#define LLDP_PORT_ID_MAC		3
+#define LLDP_PORT_ID_NETWORK		4
+
+#define LLDP_ADDR_FAMILY_IPV4		1
+#define LLDP_ADDR_FAMILY_IPV6		2
+
+#define LLDP_DOT1_PVID			1
+#define LLDP_DOT1_VLAN_NAME		3
+
+static const uint8_t LLDP_OUI_DOT1[] = { 0x00, 0x80, 0xc2 };
+
+struct lldp_vlan {
+	guint16 id;
+	gchar *name;
+};
+
+/*
+ * Everything JavaScript asks for, parsed once when the frame arrives. The
+ * neighbor is identified by its chassis and port ID (the MSAP identifier)
+ * and forgotten when its TTL runs out.
+ */
+struct lldp_neighbor {
+	guint8 chassis_id_subtype;
+	gchar *chassis_id;
+	guint8 port_id_subtype;
+	gchar *port_id;
+	gchar *port_descr;
+	gchar *system_name;
+	gchar *system_descr;
+	gboolean has_cap;
+	guint16 cap_available;
+	guint16 cap_enabled;
+	gchar *mgmt_ip;
+	guint16 pvid;
+	struct lldp_vlan vlans[LLDP_MAX_VLANS];
+	guint num_vlans;
+
+	guint16 ttl;
+	gint64 created;
+	gint64 expires;
+
+	void *data;
+	size_t len;
+};
+
 struct lldp_monitor {
 	GSource source;
 
@@ -54,13 +116,410 @@ struct lldp_monitor {
 	GPollFD fd;
 
 	void *data;
-	size_t len;
+
+	/*
+	 * Ordered by first appearance, the most recent frame is latest. Only
+	 * changed from the dispatch, so the lock is needed there and by the
+	 * readers on other threads, but not for reading in the source itself.
+	 */
+	GMutex lock;
+	GList *neighbors;
+	struct lldp_neighbor *latest;
+
+	/* set and run in the default main context, see lldp_monitor_notify() */
+	lldp_monitor_changed_cb changed_cb;
+	void *changed_data;
+	gint notify_pending;
 };
 
+static void lldp_neighbor_clear(struct lldp_neighbor *neighbor)
+{
+	guint i;
+
+	g_free(neighbor->chassis_id);
+	g_free(neighbor->port_id);
+	g_free(neighbor->port_descr);
+	g_free(neighbor->system_name);
+	g_free(neighbor->system_descr);
+	g_free(neighbor->mgmt_ip);
+
+	for (i = 0; i < neighbor->num_vlans; i++)
+		g_free(neighbor->vlans[i].name);
+
+	g_free(neighbor->data);
+	memset(neighbor, 0, sizeof(*neighbor));
+}
+
+static void lldp_neighbor_free(struct lldp_neighbor *neighbor)
+{
+	lldp_neighbor_clear(neighbor);
+	g_free(neighbor);
+}
+
+static gchar *lldp_format_hex(const guint8 *data, size_t len)
+{
+	GString *str = g_string_sized_new(len * 3);
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		g_string_append_printf(str, "%s%02x", i ? ":" : "", data[i]);
+
+	return g_string_free(str, FALSE);
+}
+
+static gchar *lldp_format_address(const guint8 *data, size_t len)
+{
+	char buf[INET6_ADDRSTRLEN];
+
+	if (len == 5 && data[0] == LLDP_ADDR_FAMILY_IPV4)
+		return g_strdup(inet_ntop(AF_INET, data + 1, buf, sizeof(buf)));
+
+	if (len == 17 && data[0] == LLDP_ADDR_FAMILY_IPV6)
+		return g_strdup(inet_ntop(AF_INET6, data + 1, buf, sizeof(buf)));
+
+	return NULL;
+}
+
+static gchar *lldp_format_string(const guint8 *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (!isprint(data[i]))
+			return lldp_format_hex(data, len);
+
+	return g_strndup((const gchar *)data, len);
+}
+
+/* chassis and port IDs, formatted the same way lldpctl does */
+static gchar *lldp_format_id(const guint8 *data, size_t len, guint8 mac,
+		guint8 network)
+{
+	gchar *ret = NULL;
+
+	if (len < 2)
+		return NULL;
+
+	if (data[0] == mac && len == 1 + ETH_ALEN)
+		ret = lldp_format_hex(data + 1, ETH_ALEN);
+	else if (data[0] == network)
+		ret = lldp_format_address(data + 1, len - 1);
+
+	return ret ? ret : lldp_format_string(data + 1, len - 1);
+}
+
+static void lldp_parse_org_specific(struct lldp_neighbor *neighbor,
+		const guint8 *data, size_t len)
+{
+	struct lldp_vlan *vlan;
+	size_t name_len;
+
+	if (len < 4 || memcmp(data, LLDP_OUI_DOT1, sizeof(LLDP_OUI_DOT1)))
+		return;
+
+	switch (data[3]) {
+	case LLDP_DOT1_PVID:
+		if (len >= 6)
+			neighbor->pvid = (data[4] << 8) | data[5];
+		break;
+
+	case LLDP_DOT1_VLAN_NAME:
+		if (len < 7 || neighbor->num_vlans >= LLDP_MAX_VLANS)
+			break;
+
+		name_len = MIN(data[6], len - 7);
+		vlan = &neighbor->vlans[neighbor->num_vlans++];
+		vlan->id = (data[4] << 8) | data[5];
+		vlan->name = g_strndup((const gchar *)&data[7], name_len);
+		break;
+	}
+}
+
+/*
+ * Walks the TLVs of an LLDPDU once and fills in the neighbor. Returns
+ * -EBADMSG if the mandatory chassis ID, port ID and TTL TLVs are missing.
+ */
+static int lldp_neighbor_parse(struct lldp_neighbor *neighbor,
+		const guint8 *frame, size_t size)
+{
+	const guint8 *data = frame + ETH_HLEN;
+	const guint8 *end = frame + size;
+	gboolean has_ttl = FALSE;
+
+	if (size < ETH_HLEN)
+		return -EBADMSG;
+
+	while (data + 2 <= end) {
+		guint type = data[0] >> 1;
+		size_t len = ((data[0] & 1) << 8) | data[1];
+
+		data += 2;
+		if (data + len > end)
+			return -EBADMSG;
+
+		switch (type) {
+		case LLDP_TLV_END:
+			data = end;
+			continue;
+
+		case LLDP_TLV_CHASSIS_ID:
+			if (neighbor->chassis_id || len < 2)
+				return -EBADMSG;
+
+			neighbor->chassis_id_subtype = data[0];
+			neighbor->chassis_id = lldp_format_id(data, len,
+					LLDP_CHASSIS_ID_MAC,
+					LLDP_CHASSIS_ID_NETWORK);
+			break;
+
+		case LLDP_TLV_PORT_ID:
+			if (neighbor->port_id || len < 2)
+				return -EBADMSG;
+
+			neighbor->port_id_subtype = data[0];
+			neighbor->port_id = lldp_format_id(data, len,
+					LLDP_PORT_ID_MAC, LLDP_PORT_ID_NETWORK);
+			break;
+
+		case LLDP_TLV_TTL:
+			if (len < 2)
+				return -EBADMSG;
+
+			neighbor->ttl = (data[0] << 8) | data[1];
+			has_ttl = TRUE;
+			break;
+
+		case LLDP_TLV_PORT_DESCR:
+			if (!neighbor->port_descr)
+				neighbor->port_descr = g_strndup(
+						(const gchar *)data, len);
+			break;
+
+		case LLDP_TLV_SYSTEM_NAME:
+			if (!neighbor->system_name)
+				neighbor->system_name = g_strndup(
+						(const gchar *)data, len);
+			break;
+
+		case LLDP_TLV_SYSTEM_DESCR:
+			if (!neighbor->system_descr)
+				neighbor->system_descr = g_strndup(
+						(const gchar *)data, len);
+			break;
+
+		case LLDP_TLV_SYSTEM_CAP:
+			if (len < 4)
+				break;
+
+			neighbor->has_cap = TRUE;
+			neighbor->cap_available = (data[0] << 8) | data[1];
+			neighbor->cap_enabled = (data[2] << 8) | data[3];
+			break;
+
+		case LLDP_TLV_MGMT_ADDR:
+			/* address string length includes the family */
+			if (neighbor->mgmt_ip || len < 1 || data[0] + 1 > len)
+				break;
+
+			neighbor->mgmt_ip = lldp_format_address(data + 1,
+					data[0]);
+			break;
+
+		case LLDP_TLV_ORG_SPECIFIC:
+			lldp_parse_org_specific(neighbor, data, len);
+			break;
+
+		default:
+			break;
+		}
+
+		data += len;
+	}
+
+	if (!neighbor->chassis_id || !neighbor->port_id || !has_ttl)
+		return -EBADMSG;
+
+	return 0;
+}
+
+static void lldp_monitor_remove_neighbor(struct lldp_monitor *monitor,
+		GList *node)
+{
+	struct lldp_neighbor *neighbor = node->data;
+
+	g_debug("lldp: neighbor %s/%s removed", neighbor->chassis_id,
+		neighbor->port_id);
+
+	if (monitor->latest == neighbor)
+		monitor->latest = NULL;
+
+	monitor->neighbors = g_list_delete_link(monitor->neighbors, node);
+	lldp_neighbor_free(neighbor);
+}
+
+static gboolean lldp_monitor_notify_idle(gpointer data)
+{
+	struct lldp_monitor *monitor = data;
+
+	g_atomic_int_set(&monitor->notify_pending, 0);
+
+	if (!g_source_is_destroyed(&monitor->source) && monitor->changed_cb)
+		monitor->changed_cb(monitor->changed_data);
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * The monitor is dispatched in the remote-control thread, but the changed
+ * callback calls into JavaScript, so it is run from the default main
+ * context instead. Changes that come in while a notification is pending
+ * are covered by it.
+ */
+static void lldp_monitor_notify(struct lldp_monitor *monitor)
+{
+	if (!g_atomic_int_compare_and_exchange(&monitor->notify_pending, 0, 1))
+		return;
+
+	g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, lldp_monitor_notify_idle,
+			g_source_ref(&monitor->source),
+			(GDestroyNotify)g_source_unref);
+}
+
+static gint64 lldp_monitor_next_expiry(struct lldp_monitor *monitor)
+{
+	gint64 expires = G_MAXINT64;
+	GList *node;
+
+	for (node = monitor->neighbors; node; node = node->next) {
+		struct lldp_neighbor *neighbor = node->data;
+
+		expires = MIN(expires, neighbor->expires);
+	}
+
+	return expires;
+}
+
+static gboolean lldp_monitor_expire(struct lldp_monitor *monitor)
+{
+	gint64 now = g_get_monotonic_time();
+	GList *node = monitor->neighbors;
+	gboolean changed = FALSE;
+
+	while (node) {
+		struct lldp_neighbor *neighbor = node->data;
+		GList *next = node->next;
+
+		if (neighbor->expires <= now) {
+			lldp_monitor_remove_neighbor(monitor, node);
+			changed = TRUE;
+		}
+
+		node = next;
+	}
+
+	return changed;
+}
+
+static GList *lldp_monitor_find_neighbor(struct lldp_monitor *monitor,
+		const struct lldp_neighbor *key)
+{
+	GList *node;
+
+	for (node = monitor->neighbors; node; node = node->next) {
+		struct lldp_neighbor *neighbor = node->data;
+
+		if (neighbor->chassis_id_subtype == key->chassis_id_subtype &&
+		    neighbor->port_id_subtype == key->port_id_subtype &&
+		    g_str_equal(neighbor->chassis_id, key->chassis_id) &&
+		    g_str_equal(neighbor->port_id, key->port_id))
+			return node;
+	}
+
+	return NULL;
+}
+
+/* returns TRUE if the set of neighbors or their information changed */
+static gboolean lldp_monitor_update(struct lldp_monitor *monitor,
+		const void *frame, size_t len)
+{
+	struct lldp_neighbor update, *neighbor;
+	gint64 now = g_get_monotonic_time();
+	gboolean changed = TRUE;
+	GList *node;
+	int err;
+
+	memset(&update, 0, sizeof(update));
+
+	err = lldp_neighbor_parse(&update, frame, len);
+	if (err < 0) {
+		g_debug("lldp: dropping malformed frame");
+		lldp_neighbor_clear(&update);
+		return FALSE;
+	}
+
+	node = lldp_monitor_find_neighbor(monitor, &update);
+
+	/* a TTL of zero announces that the neighbor is shutting down */
+	if (update.ttl == 0) {
+		if (node)
+			lldp_monitor_remove_neighbor(monitor, node);
+
+		lldp_neighbor_clear(&update);
+		return node != NULL;
+	}
+
+	if (node) {
+		neighbor = node->data;
+		update.created = neighbor->created;
+
+		/* periodic retransmissions usually don't change anything */
+		changed = neighbor->len != len ||
+			memcmp(neighbor->data, frame, len);
+		lldp_neighbor_clear(neighbor);
+	} else {
+		if (g_list_length(monitor->neighbors) >= LLDP_MAX_NEIGHBORS) {
+			g_debug("lldp: too many neighbors, ignoring %s/%s",
+				update.chassis_id, update.port_id);
+			lldp_neighbor_clear(&update);
+			return FALSE;
+		}
+
+		neighbor = g_new0(struct lldp_neighbor, 1);
+		monitor->neighbors = g_list_append(monitor->neighbors,
+				neighbor);
+		update.created = now;
+
+		g_debug("lldp: neighbor %s/%s added", update.chassis_id,
+			update.port_id);
+	}
+
+	update.expires = now + update.ttl * G_USEC_PER_SEC;
+	update.data = g_memdup(frame, len);
+	update.len = len;
+
+	*neighbor = update;
+	monitor->latest = neighbor;
+
+	return changed;
+}
+
+/* wake up in time to forget neighbors whose TTL has run out */
 static gboolean lldp_monitor_source_prepare(GSource *source, gint *timeout)
 {
-	if (timeout)
-		*timeout = -1;
+	struct lldp_monitor *monitor = (struct lldp_monitor *)source;
+	gint64 expires = lldp_monitor_next_expiry(monitor);
+	gint64 now = g_get_monotonic_time();
+
+	if (expires <= now)
+		return TRUE;
+
+	if (timeout) {
+		if (expires == G_MAXINT64)
+			*timeout = -1;
+		else
+			*timeout = MIN((expires - now + 999) / 1000,
+					G_MAXINT);
+	}
 
 	return FALSE;
 }
@@ -72,23 +531,39 @@ static gboolean lldp_monitor_source_check(GSource *source)
 	if (monitor->fd.revents & G_IO_IN)
 		return TRUE;
 
-	return FALSE;
+	return lldp_monitor_next_expiry(monitor) <= g_get_monotonic_time();
 }
 
 static gboolean lldp_monitor_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
 {
 	struct lldp_monitor *monitor = (struct lldp_monitor *)source;
+	gboolean changed;
 	ssize_t err;
 
-	err = recv(monitor->sockfd, monitor->data, LLDP_MAX_SIZE, 0);
-	if (err <= 0) {
-		g_log(G_LOG_DOMAIN, G_LOG_LEVEL_ERROR, "failed to receive "
-				"LLDP frame: %s", strerror(errno));
-		monitor->len = 0;
-	} else {
-		monitor->len = err;
+	g_mutex_lock(&monitor->lock);
+	changed = lldp_monitor_expire(monitor);
+	g_mutex_unlock(&monitor->lock);
+
+	if (monitor->fd.revents & G_IO_IN) {
+		err = recv(monitor->sockfd, monitor->data, LLDP_MAX_SIZE, 0);
+		if (err <= 0) {
+			g_log(G_LOG_DOMAIN, G_LOG_LEVEL_ERROR, "failed to "
+					"receive LLDP frame: %s",
+					strerror(errno));
+		} else {
+			trace_record(TRACE_SOURCE_LLDP, TRACE_DIRECTION_IN,
+					monitor->data, err);
+
+			g_mutex_lock(&monitor->lock);
+			if (lldp_monitor_update(monitor, monitor->data, err))
+				changed = TRUE;
+			g_mutex_unlock(&monitor->lock);
+		}
 	}
 
+	if (changed)
+		lldp_monitor_notify(monitor);
+
 	return TRUE;
 }
 
@@ -116,6 +591,9 @@ static void lldp_monitor_source_finalize(GSource *source)
 		close(monitor->sockfd);
 	}
 
+	g_list_free_full(monitor->neighbors,
+			(GDestroyNotify)lldp_neighbor_free);
+	g_mutex_clear(&monitor->lock);
 	g_free(monitor->data);
 }
 
@@ -126,6 +604,40 @@ static GSourceFuncs lldp_monitor_source_funcs = {
 	.finalize = lldp_monitor_source_finalize,
 };
 
+/*
+ * Let the kernel drop everything but LLDP frames received on the monitored
+ * interface, so that no other traffic is ever copied to userspace.
+ */
+static int lldp_monitor_attach_filter(struct lldp_monitor *monitor)
+{
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_LLDP, 0, 3),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, monitor->ifindex, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, LLDP_MAX_SIZE),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog filter = {
+		.len = G_N_ELEMENTS(code),
+		.filter = code,
+	};
+	ssize_t err;
+
+	err = setsockopt(monitor->sockfd, SOL_SOCKET, SO_ATTACH_FILTER,
+			&filter, sizeof(filter));
+	if (err < 0)
+		return -errno;
+
+	/* frames queued before the filter was attached bypassed it */
+	do {
+		err = recv(monitor->sockfd, monitor->data, LLDP_MAX_SIZE,
+				MSG_DONTWAIT);
+	} while (err >= 0);
+
+	return 0;
+}
+
 int lldp_monitor_create(struct lldp_monitor **monitorp, GKeyFile *config)
 {
 	struct lldp_monitor *monitor;
@@ -144,6 +656,7 @@ int lldp_monitor_create(struct lldp_monitor **monitorp, GKeyFile *config)
 		return -ENOMEM;
 
 	monitor = (struct lldp_monitor *)source;
+	g_mutex_init(&monitor->lock);
 
 	monitor->data = g_malloc0(LLDP_MAX_SIZE);
 	if (!monitor->data) {
@@ -177,6 +690,10 @@ int lldp_monitor_create(struct lldp_monitor **monitorp, GKeyFile *config)
 
 	monitor->sockfd = err;
 
+	err = lldp_monitor_attach_filter(monitor);
+	if (err < 0)
+		goto close;
+
 	memset(&sa, 0, sizeof(sa));
 	sa.sll_family = AF_PACKET;
 	sa.sll_protocol = htons(ETH_P_LLDP);
@@ -232,21 +749,124 @@ GSource *lldp_monitor_get_source(struct lldp_monitor *monitor)
 ssize_t lldp_monitor_read(struct lldp_monitor *monitor, void *buffer,
 		size_t size)
 {
+	struct lldp_neighbor *latest;
 	ssize_t ret = 0;
 
 	if (!monitor || !buffer || !size)
 		return -EINVAL;
 
-	if (monitor->len) {
-		size_t len = min(size, monitor->len);
-		memcpy(buffer, monitor->data, len);
+	/* expired neighbors are only removed from the main loop */
+	g_mutex_lock(&monitor->lock);
+
+	latest = monitor->latest;
+	if (latest && latest->expires > g_get_monotonic_time()) {
+		size_t len = min(size, latest->len);
+		memcpy(buffer, latest->data, len);
 		ret = len;
 	}
 
+	g_mutex_unlock(&monitor->lock);
+
 	return ret;
 }
 
+#define LLDP_INFO_ADD(d,p,k,f,...) \
+	g_hash_table_insert(d, g_strdup_printf("%s%s", p, k), \
+			g_strdup_printf(f, __VA_ARGS__))
+
+#define LLDP_INFO_ADD_STR(d,p,k,v) { \
+	if (v) \
+		LLDP_INFO_ADD(d, p, k, "%s", v); \
+}
+
+/* uses the same keys as the lldpctl backend */
+static void lldp_add_neighbor(GHashTable *data,
+		const struct lldp_neighbor *neighbor, int index, gint64 now)
+{
+	gchar *prefix = g_strdup_printf("neighbor%d.", index);
+	guint i;
+
+	LLDP_INFO_ADD(data, prefix, "port.age", "%" G_GINT64_FORMAT,
+		(now - neighbor->created) / G_USEC_PER_SEC);
+	LLDP_INFO_ADD(data, prefix, "port.ttl", "%u", neighbor->ttl);
+	LLDP_INFO_ADD(data, prefix, "port.id_subtype_num", "%u",
+		neighbor->port_id_subtype);
+	LLDP_INFO_ADD_STR(data, prefix, "port.id", neighbor->port_id);
+	LLDP_INFO_ADD_STR(data, prefix, "port.descr", neighbor->port_descr);
+
+	if (neighbor->pvid)
+		LLDP_INFO_ADD(data, prefix, "port.pvid", "%u", neighbor->pvid);
+
+	for (i = 0; i < neighbor->num_vlans; i++) {
+		gchar *sub_prefix = g_strdup_printf("%sport.vlan%u.", prefix,
+				i);
+
+		LLDP_INFO_ADD(data, sub_prefix, "id", "%u",
+			neighbor->vlans[i].id);
+		LLDP_INFO_ADD_STR(data, sub_prefix, "name",
+			neighbor->vlans[i].name);
+		g_free(sub_prefix);
+	}
+
+	LLDP_INFO_ADD(data, prefix, "chassis.id_subtype_num", "%u",
+		neighbor->chassis_id_subtype);
+	LLDP_INFO_ADD_STR(data, prefix, "chassis.id", neighbor->chassis_id);
+	LLDP_INFO_ADD_STR(data, prefix, "chassis.name", neighbor->system_name);
+	LLDP_INFO_ADD_STR(data, prefix, "chassis.descr",
+		neighbor->system_descr);
+
+	if (neighbor->has_cap) {
+		LLDP_INFO_ADD(data, prefix, "chassis.cap.available", "%u",
+			neighbor->cap_available);
+		LLDP_INFO_ADD(data, prefix, "chassis.cap.enabled", "%u",
+			neighbor->cap_enabled);
+	}
+
+	LLDP_INFO_ADD_STR(data, prefix, "chassis.mgmt0.ip", neighbor->mgmt_ip);
+
+	g_free(prefix);
+}
+
 int lldp_monitor_read_info(struct lldp_monitor *monitor, GHashTable **data)
 {
-	return -ENOSYS;
+	gint64 now = g_get_monotonic_time();
+	GList *node;
+	int i = 0;
+
+	if (!monitor || !data)
+		return -EINVAL;
+
+	*data = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	if (!*data)
+		return -ENOMEM;
+
+	g_mutex_lock(&monitor->lock);
+
+	for (node = monitor->neighbors; node; node = node->next) {
+		struct lldp_neighbor *neighbor = node->data;
+
+		if (neighbor->expires > now)
+			lldp_add_neighbor(*data, neighbor, i++, now);
+	}
+
+	g_mutex_unlock(&monitor->lock);
+
+	return 0;
+}
+
+int lldp_monitor_set_changed_cb(struct lldp_monitor *monitor,
+		lldp_monitor_changed_cb callback, void *data)
+{
+	if (!monitor)
+		return -EINVAL;
+
+	monitor->changed_cb = callback;
+	monitor->changed_data = data;
+
+	return 0;
+}
+
+void *lldp_monitor_get_changed_cb_data(struct lldp_monitor *monitor)
+{
+	return monitor ? monitor->changed_data : NULL;
 }
@@ -20,6 +20,7 @@ struct remote_control {
 	struct gpio_backend *gpio;
 	struct audio *audio;
 	struct backlight *backlight;
+	struct backlight_fader *fader;
 	struct cursor_movement *cursor_movement;
 	struct media_player *player;
 	struct sound_manager *sound;
@@ -31,6 +32,7 @@ struct remote_control {
 	struct lldp_monitor *lldp;
 	struct task_manager *task_manager;
 	struct handset *handset;
+	struct usb_handset *usb_handset;
 	struct app_watchdog *watchdog;
 
 	GSource *source;
@@ -87,6 +89,12 @@ int remote_control_create(struct remote_control **rcp, GKeyFile *config)
 		return -ENOMEM;
 	}
 
+	err = trace_init(config);
+	if (err < 0) {
+		g_critical("trace_init(): %s", strerror(-err));
+		return err;
+	}
+
 	err = lldp_monitor_create(&rc->lldp, config);
 	if (err < 0) {
 		g_critical("lldp_monitor_create(): %s", strerror(-err));
@@ -111,6 +119,13 @@ int remote_control_create(struct remote_control **rcp, GKeyFile *config)
 		return err;
 	}
 
+	err = backlight_fader_create(&rc->fader, rc->backlight,
+			rc->event_manager);
+	if (err < 0) {
+		g_critical("backlight_fader_create(): %s", strerror(-err));
+		return err;
+	}
+
 	err = cursor_movement_create(&rc->cursor_movement);
 	if (err < 0) {
 		g_critical("cursor_movement_create(): %s", strerror(-err));
@@ -183,6 +198,12 @@ int remote_control_create(struct remote_control **rcp, GKeyFile *config)
 		return err;
 	}
 
+	source = handset_get_source(rc->handset);
+	if (source) {
+		g_source_add_child_source(rc->source, source);
+		g_source_unref(source);
+	}
+
 	err = mixer_create(&rc->mixer);
 	if (err < 0) {
 		g_critical("mixer_create(): %s", strerror(-err));
@@ -207,7 +228,7 @@ int remote_control_create(struct remote_control **rcp, GKeyFile *config)
 		g_source_unref(source);
 	}
 
-	err = usb_handset_create(rc);
+	err = usb_handset_create(&rc->usb_handset, rc);
 	if (err < 0) {
 		g_critical("usb_handset_create(): %s", strerror(-err));
 		return err;
@@ -233,6 +254,7 @@ int remote_control_free(struct remote_control *rc)
 	if (!rc)
 		return -EINVAL;
 
+	usb_handset_free(rc->usb_handset);
 	handset_free(rc->handset);
 	task_manager_free(rc->task_manager);
 	net_udp_free(rc->net_udp);
@@ -241,12 +263,14 @@ int remote_control_free(struct remote_control *rc)
 	sound_manager_free(rc->sound);
 	media_player_free(rc->player);
 	cursor_movement_free(rc->cursor_movement);
+	backlight_fader_free(rc->fader);
 	backlight_free(rc->backlight);
 	audio_free(rc->audio);
 	app_watchdog_free(rc->watchdog);
 	gpio_backend_free(rc->gpio);
 	event_manager_free(rc->event_manager);
 	lldp_monitor_free(rc->lldp);
+	trace_exit();
 	g_free(rc);
 
 	return 0;
@@ -267,6 +291,11 @@ struct backlight *remote_control_get_backlight(struct remote_control *rc)
 	return rc ? rc->backlight : NULL;
 }
 
+struct backlight_fader *remote_control_get_backlight_fader(struct remote_control *rc)
+{
+	return rc ? rc->fader : NULL;
+}
+
 struct cursor_movement *remote_control_get_cursor_movement(struct remote_control *rc)
 {
 	return rc ? rc->cursor_movement : NULL;
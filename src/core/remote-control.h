@@ -29,6 +29,8 @@ enum event_source {
 	EVENT_SOURCE_SMARTCARD,
 	EVENT_SOURCE_HOOK,
 	EVENT_SOURCE_HANDSET,
+	EVENT_SOURCE_USB_HANDSET,
+	EVENT_SOURCE_BACKLIGHT,
 	EVENT_SOURCE_MAX,
 };
 
@@ -89,6 +91,25 @@ struct event_handset {
 	bool pressed;
 };
 
+enum event_usb_handset_state {
+	EVENT_USB_HANDSET_STATE_DISCONNECTED,
+	EVENT_USB_HANDSET_STATE_CONNECTED,
+};
+
+struct event_usb_handset {
+	enum event_usb_handset_state state;
+};
+
+enum event_backlight_state {
+	EVENT_BACKLIGHT_STATE_FADE_DONE,
+	EVENT_BACKLIGHT_STATE_FADE_CANCELLED,
+};
+
+struct event_backlight {
+	enum event_backlight_state state;
+	unsigned int brightness;
+};
+
 struct event {
 	enum event_source source;
 
@@ -99,23 +120,51 @@ struct event {
 		struct event_smartcard smartcard;
 		struct event_hook hook;
 		struct event_handset handset;
+		struct event_usb_handset usb_handset;
+		struct event_backlight backlight;
 	};
 };
 
-struct event_manager;
+/* events are numbered from 1, in the order they were reported */
+struct event_record {
+	uint64_t sequence;
+	int64_t timestamp;	/* wall-clock time in microseconds */
+	struct event event;
+};
 
-typedef int (* event_manager_event_cb)( void *data, struct event *event);
+struct event_manager;
 
 int event_manager_create(struct event_manager **managerp);
 int event_manager_free(struct event_manager *manager);
 int event_manager_report(struct event_manager *manager, struct event *event);
 int event_manager_get_source_state(struct event_manager *manager, struct event *event);
-/* The owner_ref identifier is used to identify the instance setting the callback.
- * Blame Bert and Julian for this construct ;) */
-int event_manager_set_event_cb(struct event_manager *manager,
-		event_manager_event_cb callback, void *data, void *owner_ref);
-void *event_manager_get_event_cb_owner(struct event_manager *manager,
-	event_manager_event_cb callback);
+uint64_t event_manager_get_sequence(struct event_manager *manager);
+/* copy up to max of the recorded events newer than since, oldest first */
+int event_manager_get_history(struct event_manager *manager, uint64_t since,
+		struct event_record *records, unsigned int max);
+
+/*
+ * Subscribers get events of the selected sources delivered into their own
+ * main context. Events are queued in a bounded ring per subscriber and
+ * dropped, and counted, if the subscriber doesn't keep up.
+ */
+#define EVENT_SOURCE_MASK(source)	(1u << (source))
+#define EVENT_SOURCE_MASK_ALL		(EVENT_SOURCE_MASK(EVENT_SOURCE_MAX) - 1)
+
+struct event_subscription;
+
+typedef void (*event_manager_deliver_cb)(void *data,
+		const struct event_record *record);
+
+int event_manager_subscribe(struct event_manager *manager,
+		unsigned int sources, unsigned int queue_size,
+		GMainContext *context, event_manager_deliver_cb callback,
+		void *data, struct event_subscription **subscriptionp);
+void event_manager_unsubscribe(struct event_manager *manager,
+		struct event_subscription *subscription);
+unsigned long event_subscription_get_dropped(
+		struct event_subscription *subscription);
+unsigned long event_manager_get_dropped(struct event_manager *manager);
 
 /**
  * audio state
@@ -140,10 +189,13 @@ int audio_create(struct audio **audiop, struct remote_control *rc, GKeyFile *con
 int audio_free(struct audio *audio);
 int audio_set_state(struct audio *audio, enum audio_state state);
 int audio_get_state(struct audio *audio, enum audio_state *statep);
+int audio_prepare_state(struct audio *audio, enum audio_state state);
 int audio_set_volume(struct audio *audio, uint8_t volume);
 int audio_get_volume(struct audio *audio, uint8_t *volumep);
 int audio_set_speakers_enable(struct audio *audio, bool enable);
 int audio_get_speakers_enable(struct audio *audio, bool *enablep);
+/* pick up sound cards that were plugged in or removed since */
+int audio_reload_cards(struct audio *audio);
 
 /**
  * backlight
@@ -160,6 +212,30 @@ int backlight_is_enabled(struct backlight *backlight);
 int backlight_set(struct backlight *backlight, unsigned int brightness);
 int backlight_get(struct backlight *backlight);
 
+/*
+ * Fades are carried out by a thread of their own and reported through the
+ * event manager when they complete or are cancelled. Starting a new fade
+ * takes over from the current level of a running one.
+ */
+enum backlight_curve {
+	BACKLIGHT_CURVE_LINEAR,
+	BACKLIGHT_CURVE_PERCEPTUAL,
+	BACKLIGHT_CURVE_SMOOTH,
+	BACKLIGHT_CURVE_MAX,
+};
+
+struct backlight_fader;
+
+int backlight_fader_create(struct backlight_fader **faderp,
+		struct backlight *backlight, struct event_manager *events);
+int backlight_fader_free(struct backlight_fader *fader);
+int backlight_fade(struct backlight_fader *fader, unsigned int brightness,
+		unsigned int duration, enum backlight_curve curve);
+/* returns 1 if a fade was cancelled, no fade step is in flight on return */
+int backlight_fade_cancel(struct backlight_fader *fader);
+/* the current level of a running fade, -ENODATA if there is none */
+int backlight_fade_get_brightness(struct backlight_fader *fader);
+
 /**
  * cursor movement
  */
@@ -427,12 +503,18 @@ int net_udp_set_recv_cb(struct net_udp_channel *chan, net_udp_recv_cb cb,
 
 struct lldp_monitor;
 
+typedef void (*lldp_monitor_changed_cb)(void *data);
+
 int lldp_monitor_create(struct lldp_monitor **monitorp, GKeyFile *config);
 int lldp_monitor_free(struct lldp_monitor *monitor);
 GSource *lldp_monitor_get_source(struct lldp_monitor *monitor);
 ssize_t lldp_monitor_read(struct lldp_monitor *monitor, void *buffer,
 		size_t size);
 int lldp_monitor_read_info(struct lldp_monitor *monitor, GHashTable **data);
+/* called from the main loop whenever the set of neighbors changes */
+int lldp_monitor_set_changed_cb(struct lldp_monitor *monitor,
+		lldp_monitor_changed_cb callback, void *data);
+void *lldp_monitor_get_changed_cb_data(struct lldp_monitor *monitor);
 
 /**
  * task manager
@@ -440,11 +522,25 @@ int lldp_monitor_read_info(struct lldp_monitor *monitor, GHashTable **data);
 typedef void(*task_terminate_cb)(int, void*, int);
 struct task_manager;
 
+/*
+ * resource usage of a task, the launch time is available while the task is
+ * running, everything else only from within its terminate callback
+ */
+struct task_usage {
+	uint64_t utime;		/* user CPU time in microseconds */
+	uint64_t stime;		/* system CPU time in microseconds */
+	long maxrss;		/* peak resident set size in kB */
+	uint64_t launch;	/* time taken to start the task in microseconds */
+};
+
 int task_manager_create(struct task_manager **managerp);
 int task_manager_free(struct task_manager *manager);
 int32_t task_manager_exec(void *priv, const char *command_line,
 		task_terminate_cb terminate_cb, void *callback_data);
 int32_t task_manager_kill(void *priv, int32_t pid, int32_t sig);
+int task_manager_get_usage(void *priv, int32_t pid, struct task_usage *usage);
+/* real PIDs of the running tasks, returns the number of PIDs stored */
+int task_manager_get_real_pids(void *priv, int32_t *pids, size_t max);
 
 /**
  * tuner
@@ -464,7 +560,12 @@ struct handset;
 
 int handset_create(struct handset **handsetp, struct remote_control *rc);
 int handset_free(struct handset *handset);
+GSource *handset_get_source(struct handset *handset);
 
+/*
+ * Display updates are queued and only sent to the handset by
+ * handset_display_sync(), which should be called once per refresh.
+ */
 int handset_display_clear(struct handset *handset);
 int handset_display_sync(struct handset *handset);
 int handset_display_set_brightness(struct handset *handset,
@@ -487,6 +588,11 @@ enum gpio {
 
 struct gpio_backend;
 
+struct gpio_stats {
+	unsigned long events;		/* edges seen on the line */
+	unsigned long suppressed;	/* edges dropped as bounces */
+};
+
 int gpio_backend_create(struct gpio_backend **backendp, struct event_manager *events,
 		GKeyFile *config);
 int gpio_backend_free(struct gpio_backend *backend);
@@ -497,17 +603,97 @@ int gpio_backend_direction_output(struct gpio_backend *backend, unsigned int gpi
 		int value);
 int gpio_backend_set_value(struct gpio_backend *backend, unsigned int gpio, int value);
 int gpio_backend_get_value(struct gpio_backend *backend, unsigned int gpio);
+int gpio_backend_get_values(struct gpio_backend *backend,
+		const unsigned int *gpios, int *values, unsigned int num);
+int gpio_backend_get_stats(struct gpio_backend *backend, enum gpio gpio,
+		struct gpio_stats *stats);
 
 /**
  * Application Watchdog
  */
 struct app_watchdog;
 
+enum app_watchdog_channel_id {
+	APP_WATCHDOG_CHANNEL_SCRIPT,	/* triggered by the user interface */
+	APP_WATCHDOG_CHANNEL_MAIN_LOOP,	/* triggered by the main loop itself */
+	APP_WATCHDOG_CHANNEL_MAX,
+};
+
+struct app_watchdog_stats {
+	bool running;
+	unsigned long triggers;
+	unsigned long coalesced;	/* triggers merged into a queued ping */
+	unsigned long pings;
+	unsigned long failures;
+	/* all times in microseconds */
+	uint64_t latency_avg;		/* from trigger to ping completion */
+	uint64_t latency_max;
+	uint64_t gap_max;		/* longest time between two triggers */
+};
+
 int app_watchdog_create(struct app_watchdog **watchdogp, GKeyFile *config);
 int app_watchdog_free(struct app_watchdog *watchdog);
 int app_watchdog_start(struct app_watchdog *watchdog, int interval);
 int app_watchdog_stop(struct app_watchdog *watchdog);
 int app_watchdog_trigger(struct app_watchdog *watchdog);
+int app_watchdog_get_stats(struct app_watchdog *watchdog,
+		enum app_watchdog_channel_id id,
+		struct app_watchdog_stats *stats);
+
+/**
+ * evdev input devices, shared by all users within the process
+ */
+struct input_event;
+struct evdev_device;
+struct evdev_subscription;
+
+typedef void (*evdev_event_cb)(void *data, struct evdev_device *device,
+		const struct input_event *event);
+typedef void (*evdev_presence_cb)(void *data, struct evdev_device *device,
+		bool present);
+
+struct evdev_filter {
+	const char *device;	/* device name or node */
+	unsigned long types;	/* mask of (1 << EV_*), 0 for all */
+	bool grab;		/* exclusive access while subscribed */
+	evdev_event_cb event;
+	evdev_presence_cb presence;
+	void *data;
+};
+
+int evdev_subscribe(const struct evdev_filter *filter,
+		struct evdev_subscription **subp);
+void evdev_unsubscribe(struct evdev_subscription *sub);
+const char *evdev_device_get_name(struct evdev_device *device);
+const char *evdev_device_get_node(struct evdev_device *device);
+bool evdev_device_has_code(struct evdev_device *device, unsigned int type,
+		unsigned int code);
+int evdev_device_get_switch(struct evdev_device *device, unsigned int code);
+int evdev_set_led(const char *device, unsigned int code, bool on);
+int evdev_get_led(const char *device, unsigned int code);
+
+/**
+ * packet trace
+ */
+enum trace_source {
+	TRACE_SOURCE_MEDIAL,
+	TRACE_SOURCE_LCD,
+	TRACE_SOURCE_IRKEY,
+	TRACE_SOURCE_SMARTCARD,
+	TRACE_SOURCE_LLDP,
+	TRACE_SOURCE_MAX,
+};
+
+enum trace_direction {
+	TRACE_DIRECTION_IN,
+	TRACE_DIRECTION_OUT,
+};
+
+int trace_init(GKeyFile *config);
+void trace_exit(void);
+void trace_record(enum trace_source source, enum trace_direction direction,
+		const void *data, size_t size);
+int trace_dump(const char *filename);
 
 /**
  * remote control
@@ -519,6 +705,7 @@ int remote_control_free(struct remote_control *rc);
 struct event_manager *remote_control_get_event_manager(struct remote_control *rc);
 struct audio* remote_control_get_audio(struct remote_control *rc);
 struct backlight *remote_control_get_backlight(struct remote_control *rc);
+struct backlight_fader *remote_control_get_backlight_fader(struct remote_control *rc);
 struct cursor_movement *remote_control_get_cursor_movement(struct remote_control *rc);
 struct media_player *remote_control_get_media_player(struct remote_control *rc);
 struct sound_manager *remote_control_get_sound_manager(struct remote_control *rc);
@@ -537,7 +724,11 @@ struct app_watchdog *remote_control_get_watchdog(struct remote_control *rc);
 /**
  * USB Handset
  */
-int usb_handset_create(struct remote_control *rc);
+struct usb_handset;
+
+int usb_handset_create(struct usb_handset **handsetp,
+		struct remote_control *rc);
+int usb_handset_free(struct usb_handset *handset);
 
 /**
  * utilities
@@ -21,7 +21,6 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <ctype.h>
 
 #include "remote-control.h"
 #include "glogging.h"
@@ -67,40 +66,6 @@ struct smartcard {
 	ssize_t atr_len;
 };
 
-static void hexdump(char *msg, uint8_t *buf, size_t len)
-{
-	const size_t rowsize = 16;
-	const uint8_t *ptr = buf;
-	FILE *fp = stdout;
-	size_t i, j;
-
-	fprintf(fp, "%s\n", msg);
-	for (j = 0; j < len; j += rowsize) {
-
-		for (i = 0; i < rowsize; i++) {
-			if ((j + i) < len)
-				fprintf(fp, "%s%02x", i ? " " : "", ptr[j + i]);
-			else
-				fprintf(fp, "%s  ", i ? " " : "");
-		}
-
-		fprintf(fp, " | ");
-
-		for (i = 0; i < rowsize; i++) {
-			if ((j + i) < len) {
-				if (isprint(ptr[j + i]))
-					fprintf(fp, "%c", ptr[j + i]);
-				else
-					fprintf(fp, ".");
-			} else {
-				fprintf(fp, " ");
-			}
-		}
-
-		fprintf(fp, " |\n");
-	}
-}
-
 static uint8_t *sc_payload(uint8_t *buf)
 {
 	return buf + ALPAR_HEADER_LEN;
@@ -308,6 +273,8 @@ static int sc_receive(int fd, uint8_t *buf, int *payload_len, int max_wait)
 	if (pos < 0)
 		return pos;
 
+	trace_record(TRACE_SOURCE_SMARTCARD, TRACE_DIRECTION_IN, buf, len);
+
 	if (sc_lrc(buf, len))
 		return -EBADMSG;
 
@@ -330,6 +297,8 @@ static int sc_transmit(int fd, uint8_t cmd, uint8_t *buf, int payload_len)
 	buf[payload_len + 4] = sc_lrc(buf, payload_len + 4);
 
 	ret = write(fd, buf, payload_len + 5);
+	trace_record(TRACE_SOURCE_SMARTCARD, TRACE_DIRECTION_OUT, buf,
+			payload_len + 5);
 
 	return ret == payload_len + 5 ? 0 : ret < 0 ? ret : -EIO;
 }
@@ -338,6 +307,9 @@ static int sc_wake_up(int fd)
 {
 	uint8_t buf[] = { 0xAA };
 
+	trace_record(TRACE_SOURCE_SMARTCARD, TRACE_DIRECTION_OUT, buf,
+			sizeof(buf));
+
 	return write(fd, buf, sizeof(buf));
 }
 
@@ -416,8 +388,6 @@ static void nxp_check_card(struct smartcard *smartcard, gboolean inserted)
 				smartcard->rcv_len);
 		smartcard->atr_len = smartcard->rcv_len;
 
-		hexdump("ATR", smartcard->atr_buffer, smartcard->atr_len);
-
 		ret = nxp_command(smartcard, NXP_GET_CARD_PARAM,
 				buf, 0);
 		if (ret > 2) {
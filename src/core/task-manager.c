@@ -10,25 +10,86 @@
 #  include "config.h"
 #endif
 
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 #include "remote-control.h"
 
 #include "gtkosk-dbus.h"
 
 #define TASK_MANAGER_PID_MIN 2
+#define TASK_MANAGER_ARGV_CACHE_SIZE 16
+
+/* how long children get to exit on shutdown, before and after SIGKILL */
+#define TASK_MANAGER_KILL_TIMEOUT (2 * G_USEC_PER_SEC)
+#define TASK_MANAGER_KILL_POLL (10 * G_TIME_SPAN_MILLISECOND)
 
 struct task {
 	task_terminate_cb callback;
 	void *callback_data;
 	GPid real_pid;
 	int32_t pid;
+
+	struct task_usage usage;
+	bool killed;
 };
 
 struct task_manager {
 	int32_t last_pid;
 	GtkOskControl *osk;
-	GList *tasks;
+
+	/* the environment only depends on our own, so build it once */
+	gchar **envp;
+	/* parsed command-lines, most applications are started repeatedly */
+	GHashTable *argv_cache;
+
+	/* tasks indexed by virtual and by real PID, the former owns them */
+	GHashTable *tasks;
+	GHashTable *real_pids;
+
+	/* reap threads that haven't been joined yet */
+	GList *reapers;
+};
+
+/*
+ * GLib's child watch reaps with waitpid() and thereby loses the resource
+ * usage of the child, so each task gets a thread blocking in wait4() that
+ * hands the result back to the default main context.
+ */
+enum task_reap_state {
+	TASK_REAP_RUNNING,
+	TASK_REAP_EXITED,
+	/* given up on at shutdown, the thread frees itself */
+	TASK_REAP_DETACHED,
+};
+
+struct task_reap {
+	struct task_manager *manager;
+	GThread *thread;
+	GSource *source;
+	GPid pid;
+	int status;
+	struct rusage usage;
+	gint state;
 };
 
+static void task_reap_free(struct task_reap *reap)
+{
+	g_thread_join(reap->thread);
+
+	if (reap->source) {
+		g_source_destroy(reap->source);
+		g_source_unref(reap->source);
+	}
+
+	g_free(reap);
+}
+
 static void task_free(gpointer data)
 {
 	struct task *task = data;
@@ -37,64 +98,180 @@ static void task_free(gpointer data)
 	g_free(task);
 }
 
-static void child_watch(GPid pid, gint status, gpointer data)
+static uint64_t timeval_to_us(const struct timeval *tv)
 {
-	struct task_manager *manager = data;
-	GList *tasks = manager->tasks;
-	GList *node;
+	return (uint64_t)tv->tv_sec * G_USEC_PER_SEC + tv->tv_usec;
+}
 
-	for (node = g_list_first(tasks); node; node = g_list_next(node)) {
-		struct task *task = node->data;
-
-		if (task->real_pid == pid) {
-			g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "child %d/%d "
-					"exited with status %d", task->pid,
-					task->real_pid, status);
-			manager->tasks = g_list_delete_link(tasks, node);
-			if (task->callback)
-				task->callback(task->pid, task->callback_data,
-						status);
-			task_free(task);
-			break;
-		}
+static gboolean task_reaped(gpointer data)
+{
+	struct task_reap *reap = data;
+	struct task_manager *manager = reap->manager;
+	struct task *task;
+
+	manager->reapers = g_list_remove(manager->reapers, reap);
+
+	task = g_hash_table_lookup(manager->real_pids,
+			GINT_TO_POINTER(reap->pid));
+	if (!task)
+		goto out;
+
+	task->usage.utime = timeval_to_us(&reap->usage.ru_utime);
+	task->usage.stime = timeval_to_us(&reap->usage.ru_stime);
+	task->usage.maxrss = reap->usage.ru_maxrss;
+
+	g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "child %d/%d exited with "
+			"status %d (user %" G_GUINT64_FORMAT " us, system %"
+			G_GUINT64_FORMAT " us, max. RSS %ld kB)", task->pid,
+			task->real_pid, reap->status, task->usage.utime,
+			task->usage.stime, task->usage.maxrss);
+
+	/* the task stays in the table so the callback can query its usage */
+	if (task->callback && !task->killed)
+		task->callback(task->pid, task->callback_data, reap->status);
+
+	g_hash_table_remove(manager->real_pids, GINT_TO_POINTER(reap->pid));
+	g_hash_table_remove(manager->tasks, GINT_TO_POINTER(task->pid));
+
+out:
+	/* the thread has nothing left to do but return */
+	task_reap_free(reap);
+	return FALSE;
+}
+
+static gpointer task_reap_thread(gpointer data)
+{
+	struct task_reap *reap = data;
+	GSource *source;
+	pid_t ret;
+
+	do {
+		ret = wait4(reap->pid, &reap->status, 0, &reap->usage);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		g_warning("failed to wait for child %d: %s", reap->pid,
+				g_strerror(errno));
+		memset(&reap->usage, 0, sizeof(reap->usage));
+		reap->status = -1;
 	}
+
+	if (!g_atomic_int_compare_and_exchange(&reap->state,
+			TASK_REAP_RUNNING, TASK_REAP_EXITED)) {
+		g_free(reap);
+		return NULL;
+	}
+
+	/* published before attaching, the callback may run right away */
+	source = g_idle_source_new();
+	g_source_set_callback(source, task_reaped, reap, NULL);
+	reap->source = source;
+	g_source_attach(source, NULL);
+
+	return NULL;
 }
 
-static void check_pid(gpointer data, gpointer user_data)
+static int task_watch(struct task_manager *manager, struct task *task)
 {
-	struct task *task = data;
-	int32_t *pid = user_data;
+	struct task_reap *reap;
+	GThread *thread;
+
+	reap = g_new0(struct task_reap, 1);
+	if (!reap)
+		return -ENOMEM;
 
-	if (task->pid == *pid)
-		(*pid)++;
+	reap->manager = manager;
+	reap->pid = task->real_pid;
+
+	thread = g_thread_new("task-reap", task_reap_thread, reap);
+	if (!thread) {
+		g_free(reap);
+		return -ENOMEM;
+	}
+
+	reap->thread = thread;
+	manager->reapers = g_list_prepend(manager->reapers, reap);
+
+	return 0;
 }
 
+/*
+ * Virtual PIDs are handed out in ascending order, so a PID is only skipped
+ * if it is still in use after the counter wrapped around.
+ */
 static int32_t task_manager_get_next_pid(struct task_manager *manager)
 {
-	int32_t pid = manager->last_pid + 1;
+	int32_t pid = manager->last_pid;
 
-	while (TRUE) {
-		if (pid < TASK_MANAGER_PID_MIN)
+	do {
+		if (pid < TASK_MANAGER_PID_MIN || pid == G_MAXINT32)
 			pid = TASK_MANAGER_PID_MIN;
+		else
+			pid++;
+	} while (g_hash_table_contains(manager->tasks, GINT_TO_POINTER(pid)));
 
-		g_list_foreach(manager->tasks, check_pid, &pid);
+	return pid;
+}
+
+static int create_environment(gchar ***envpp)
+{
+	static const struct {
+		const gchar *name;
+		const gchar *def;
+	} environment[] = {
+		{ "DISPLAY", ":0" },
+		{ "HOME", "/tmp" },
+		{ "http_proxy", NULL },
+		{ "DBUS_SESSION_BUS_ADDRESS", NULL}
+	};
+	gchar **envp;
+	int i,j;
+
+	if (!envpp || *envpp != NULL)
+		return -EINVAL;
+
+	envp = g_new0(gchar *, G_N_ELEMENTS(environment) + 1);
+	if (!envp)
+		return -ENOMEM;
+
+	for (j = 0, i = 0; i < G_N_ELEMENTS(environment); i++) {
+		const char *env = g_getenv(environment[i].name);
+		/* skip this one, if we have no value and no default has
+		 * been specified. */
+		if (!env && environment[i].def == NULL)
+			continue;
 
-		if (pid == (manager->last_pid + 1))
-			break;
+		envp[j++] = g_strdup_printf("%s=%s", environment[i].name,
+					    env ?: environment[i].def);
 	}
 
-	return pid;
+	envp[j] = NULL;
+	*envpp = envp;
+
+	return j;
 }
 
 int task_manager_create(struct task_manager **managerp)
 {
 	struct task_manager *manager;
+	int err;
 
 	manager = g_new0(struct task_manager, 1);
 	if (!manager)
 		return -ENOMEM;
 
+	err = create_environment(&manager->envp);
+	if (err < 0) {
+		g_free(manager);
+		return err;
+	}
+
 	manager->last_pid = TASK_MANAGER_PID_MIN - 1;
+	manager->tasks = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+			NULL, task_free);
+	manager->real_pids = g_hash_table_new(g_direct_hash, g_direct_equal);
+	manager->argv_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, (GDestroyNotify)g_strfreev);
 	manager->osk = gtk_osk_control_proxy_new_for_bus_sync(
 			G_BUS_TYPE_SESSION, G_DBUS_PROXY_FLAGS_NONE,
 			"com.avionicdesign.gtkosk.control",
@@ -105,78 +282,237 @@ int task_manager_create(struct task_manager **managerp)
 	return 0;
 }
 
+/* returns TRUE if all children were reaped within the timeout */
+static gboolean task_manager_wait_reapers(struct task_manager *manager,
+		gint64 timeout)
+{
+	gint64 deadline = g_get_monotonic_time() + timeout;
+	GList *node;
+
+	while (TRUE) {
+		for (node = manager->reapers; node; node = node->next) {
+			struct task_reap *reap = node->data;
+
+			if (g_atomic_int_get(&reap->state) ==
+					TASK_REAP_RUNNING)
+				break;
+		}
+
+		if (!node)
+			return TRUE;
+
+		if (g_get_monotonic_time() >= deadline)
+			return FALSE;
+
+		g_usleep(TASK_MANAGER_KILL_POLL);
+	}
+}
+
+static void task_manager_release_reaper(gpointer data)
+{
+	struct task_reap *reap = data;
+
+	if (g_atomic_int_compare_and_exchange(&reap->state, TASK_REAP_RUNNING,
+			TASK_REAP_DETACHED)) {
+		g_warning("child %d did not exit, not waiting for it",
+				reap->pid);
+		g_thread_unref(reap->thread);
+		return;
+	}
+
+	task_reap_free(reap);
+}
+
 int task_manager_free(struct task_manager *manager)
 {
+	GHashTableIter iter;
+	gpointer value;
 	int32_t ret = 0;
-	GList *node;
 
 	if (!manager)
 		return -EINVAL;
 
-	/* kill all child tasks */
-	for (node = g_list_first(manager->tasks); node; node = g_list_next(node)) {
-		struct task *task = node->data;
+	/*
+	 * Kill all child tasks, including those sent some other signal by
+	 * task_manager_kill() before. Stopped children need to be continued
+	 * to act on the signal.
+	 */
+	g_hash_table_iter_init(&iter, manager->tasks);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct task *task = value;
+
 		ret = kill(task->real_pid, SIGTERM);
 		if (ret != 0) {
 			g_warning("Could not kill task %d (%s)", task->real_pid,
 					strerror(errno));
+			continue;
 		}
+
+		kill(task->real_pid, SIGCONT);
+	}
+
+	/*
+	 * The main loop has already terminated at this point, so results
+	 * still pending in the default main context are never dispatched.
+	 * Wait for the children to exit and drop the results instead, but
+	 * don't let a child that ignores SIGTERM hold up the shutdown.
+	 */
+	if (!task_manager_wait_reapers(manager, TASK_MANAGER_KILL_TIMEOUT)) {
+		GList *node;
+
+		for (node = manager->reapers; node; node = node->next) {
+			struct task_reap *reap = node->data;
+
+			if (g_atomic_int_get(&reap->state) !=
+					TASK_REAP_RUNNING)
+				continue;
+
+			g_warning("child %d ignored SIGTERM, sending SIGKILL",
+					reap->pid);
+			kill(reap->pid, SIGKILL);
+		}
+
+		task_manager_wait_reapers(manager, TASK_MANAGER_KILL_TIMEOUT);
 	}
 
-	g_list_free_full(manager->tasks, task_free);
+	g_list_free_full(manager->reapers, task_manager_release_reaper);
+
+	g_hash_table_destroy(manager->real_pids);
+	g_hash_table_destroy(manager->tasks);
+	g_hash_table_destroy(manager->argv_cache);
+	g_strfreev(manager->envp);
 	g_object_unref(manager->osk);
 	g_free(manager);
 	return 0;
 }
 
-static int create_environment(gchar ***envpp)
+static gchar **task_manager_parse_argv(struct task_manager *manager,
+		const char *command_line)
 {
-	static const struct {
-		const gchar *name;
-		const gchar *def;
-	} environment[] = {
-		{ "DISPLAY", ":0" },
-		{ "HOME", "/tmp" },
-		{ "http_proxy", NULL },
-		{ "DBUS_SESSION_BUS_ADDRESS", NULL}
-	};
-	gchar **envp;
-	int i,j;
+	GError *error = NULL;
+	gchar **argv;
 
-	if (!envpp || *envpp != NULL)
-		return -EINVAL;
+	argv = g_hash_table_lookup(manager->argv_cache, command_line);
+	if (argv)
+		return argv;
 
-	envp = g_new0(gchar *, G_N_ELEMENTS(environment) + 1);
-	if (!envp)
-		return -ENOMEM;
+	if (!g_shell_parse_argv(command_line, NULL, &argv, &error)) {
+		g_log(G_LOG_DOMAIN, G_LOG_LEVEL_ERROR, "failed to parse "
+				"command-line: %s",
+				error ? error->message : "(unknown error)");
+		g_error_free(error);
+		return NULL;
+	}
 
-	for (j = 0, i = 0; i < G_N_ELEMENTS(environment); i++) {
-		const char *env = g_getenv(environment[i].name);
-		/* skip this one, if we have no value and no default has
-		 * been specified. */
-		if (!env && environment[i].def == NULL)
-			continue;
+	if (g_hash_table_size(manager->argv_cache) >=
+			TASK_MANAGER_ARGV_CACHE_SIZE)
+		g_hash_table_remove_all(manager->argv_cache);
 
-		envp[j++] = g_strdup_printf("%s=%s", environment[i].name,
-					    env ?: environment[i].def);
+	g_hash_table_insert(manager->argv_cache, g_strdup(command_line), argv);
+	return argv;
+}
+
+#ifndef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+/*
+ * Without closefrom, close every descriptor that is open now. Close actions
+ * for descriptors that are closed by the time the child runs are ignored.
+ */
+static int task_spawn_close_fds(posix_spawn_file_actions_t *actions)
+{
+	struct dirent *entry;
+	struct rlimit limit;
+	int fd, max, err;
+	DIR *dir;
+
+	dir = opendir("/proc/self/fd");
+	if (dir) {
+		while ((entry = readdir(dir)) != NULL) {
+			fd = atoi(entry->d_name);
+			if (fd <= STDERR_FILENO || fd == dirfd(dir))
+				continue;
+
+			err = posix_spawn_file_actions_addclose(actions, fd);
+			if (err) {
+				closedir(dir);
+				return -err;
+			}
+		}
+
+		closedir(dir);
+		return 0;
 	}
 
-	envp[j] = NULL;
-	*envpp = envp;
+	/* no procfs, go through all descriptors that could be open */
+	if (getrlimit(RLIMIT_NOFILE, &limit) < 0 ||
+	    limit.rlim_cur == RLIM_INFINITY)
+		max = sysconf(_SC_OPEN_MAX);
+	else
+		max = limit.rlim_cur;
+
+	for (fd = STDERR_FILENO + 1; fd < max; fd++) {
+		err = posix_spawn_file_actions_addclose(actions, fd);
+		if (err)
+			return -err;
+	}
 
-	return j;
+	return 0;
+}
+#endif
+
+/*
+ * g_spawn_async() forks the complete process, so the cost of starting a
+ * child grows with the page tables of the parent, which include all of
+ * WebKit. posix_spawn() shares the address space with the child until it
+ * calls exec(), which keeps the launch time constant.
+ */
+static int task_spawn(gchar **argv, gchar **envp, GPid *pid)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	int err;
+
+	err = posix_spawnattr_init(&attr);
+	if (err)
+		return -err;
+
+	err = posix_spawn_file_actions_init(&actions);
+	if (err) {
+		posix_spawnattr_destroy(&attr);
+		return -err;
+	}
+
+	/* don't pass on signal dispositions or masks of the main loop */
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	sigfillset(&mask);
+	posix_spawnattr_setsigdefault(&attr, &mask);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+			POSIX_SPAWN_SETSIGDEF);
+
+	/* like g_spawn_async(), don't leak descriptors into the child */
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+	err = posix_spawn_file_actions_addclosefrom_np(&actions,
+			STDERR_FILENO + 1);
+#else
+	err = -task_spawn_close_fds(&actions);
+#endif
+	if (!err)
+		err = posix_spawn(pid, argv[0], &actions, &attr, argv, envp);
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	return -err;
 }
 
 int32_t task_manager_exec(void *priv, const char *command_line,
 		task_terminate_cb terminate_cb, void *callback_data)
 {
 	struct task_manager *manager = remote_control_get_task_manager(priv);
-	GError *error = NULL;
-	gchar **argv = NULL;
-	gchar **envp = NULL;
 	struct task *task;
 	int32_t ret = 0;
-	gint argc = 0;
+	gchar **argv;
+	gint64 start;
 
 	g_return_val_if_fail(command_line != NULL, -EINVAL);
 
@@ -188,69 +524,100 @@ int32_t task_manager_exec(void *priv, const char *command_line,
 	task->callback_data = callback_data;
 	task->pid = task_manager_get_next_pid(manager);
 
-	ret = create_environment(&envp);
-	if (ret < 0)
-		g_log(G_LOG_DOMAIN, G_LOG_LEVEL_ERROR, "failed to prepare "
-				"environment: %s", g_strerror(-ret));
-
-	if (!g_shell_parse_argv(command_line, &argc, &argv, &error)) {
-		g_log(G_LOG_DOMAIN, G_LOG_LEVEL_ERROR, "failed to parse "
-				"command-line: %s",
-				error ? error->message : "(unknown error)");
-		g_error_free(error);
+	argv = task_manager_parse_argv(manager, command_line);
+	if (!argv) {
 		ret = -EACCES;
 		goto free;
 	}
 
-	if (!g_spawn_async(NULL, argv, envp, G_SPAWN_DO_NOT_REAP_CHILD, NULL,
-				NULL, &task->real_pid, &error)) {
+	start = g_get_monotonic_time();
+
+	ret = task_spawn(argv, manager->envp, &task->real_pid);
+	if (ret < 0) {
 		g_log(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, "failed to execute "
-				"child process: %s",
-				error ? error->message : "(unknown error)");
-		g_error_free(error);
+				"child process: %s", g_strerror(-ret));
 		ret = -EACCES;
 		goto free;
 	}
 
-	g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "running \"%s\" (PID: %d/%d)",
-			command_line, task->pid, task->real_pid);
-	g_child_watch_add(task->real_pid, child_watch, manager);
-	manager->tasks = g_list_append(manager->tasks, task);
+	task->usage.launch = g_get_monotonic_time() - start;
+
+	g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "running \"%s\" (PID: %d/%d, "
+			"launched in %" G_GUINT64_FORMAT " us)", command_line,
+			task->pid, task->real_pid, task->usage.launch);
+
+	ret = task_watch(manager, task);
+	if (ret < 0)
+		g_warning("failed to watch child %d: %s", task->real_pid,
+				g_strerror(-ret));
+
+	g_hash_table_insert(manager->tasks, GINT_TO_POINTER(task->pid), task);
+	g_hash_table_insert(manager->real_pids,
+			GINT_TO_POINTER(task->real_pid), task);
 	manager->last_pid = task->pid;
 
-	ret = task->pid;
-	goto out;
+	return task->pid;
 
 free:
 	g_free(task);
-out:
-	g_strfreev(envp);
-	g_strfreev(argv);
 	return ret;
 }
 
 int32_t task_manager_kill(void *priv, int32_t pid, int32_t sig)
 {
 	struct task_manager *manager = remote_control_get_task_manager(priv);
-	GList *tasks = manager->tasks;
 	int32_t ret = -ESRCH;
-	GList *node;
+	struct task *task;
 
-	for (node = g_list_first(tasks); node; node = g_list_next(node)) {
-		struct task *task = node->data;
-
-		if (task->pid == pid) {
-			manager->tasks = g_list_delete_link(tasks, node);
-			ret = kill(task->real_pid, sig);
-			g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "child %d/%d "
-					"killed with signal %d (%d)",
-					task->pid, task->real_pid, sig, ret);
-			task_free(task);
-			break;
-		}
+	/*
+	 * Killed tasks are kept around until they have been reaped, so that
+	 * neither their virtual nor their real PID can be reused too early.
+	 * The terminate callback is not run for them.
+	 */
+	task = g_hash_table_lookup(manager->tasks, GINT_TO_POINTER(pid));
+	if (task && !task->killed) {
+		task->killed = true;
+		ret = kill(task->real_pid, sig);
+		g_log(G_LOG_DOMAIN, G_LOG_LEVEL_INFO, "child %d/%d "
+				"killed with signal %d (%d)",
+				task->pid, task->real_pid, sig, ret);
 	}
+
 	if (manager->osk) /* Make sure osk is not active */
 		gtk_osk_control_set_visible(manager->osk, FALSE);
 
 	return ret;
 }
+
+int task_manager_get_usage(void *priv, int32_t pid, struct task_usage *usage)
+{
+	struct task_manager *manager = remote_control_get_task_manager(priv);
+	struct task *task;
+
+	if (!manager || !usage)
+		return -EINVAL;
+
+	task = g_hash_table_lookup(manager->tasks, GINT_TO_POINTER(pid));
+	if (!task)
+		return -ESRCH;
+
+	*usage = task->usage;
+	return 0;
+}
+
+int task_manager_get_real_pids(void *priv, int32_t *pids, size_t max)
+{
+	struct task_manager *manager = remote_control_get_task_manager(priv);
+	GHashTableIter iter;
+	gpointer key;
+	size_t count = 0;
+
+	if (!manager || (!pids && max))
+		return -EINVAL;
+
+	g_hash_table_iter_init(&iter, manager->real_pids);
+	while (count < max && g_hash_table_iter_next(&iter, &key, NULL))
+		pids[count++] = GPOINTER_TO_INT(key);
+
+	return count;
+}
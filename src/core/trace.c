@@ -0,0 +1,396 @@
+/*
+ * Copyright (C) 2017 Avionic Design GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <glib.h>
+
+#include "remote-control.h"
+
+#define TRACE_DEFAULT_FRAMES	64
+#define TRACE_DEFAULT_SNAPLEN	256
+#define TRACE_DEFAULT_FILE	"/tmp/remote-control-trace.pcapng"
+
+/*
+ * pcapng block types and link types, see
+ * https://github.com/pcapng/pcapng for the format specification.
+ */
+#define PCAPNG_BLOCK_SHB	0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB	0x00000001
+#define PCAPNG_BLOCK_EPB	0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC	0x1a2b3c4d
+
+#define PCAPNG_OPT_ENDOFOPT	0
+#define PCAPNG_OPT_IF_NAME	2
+#define PCAPNG_OPT_EPB_FLAGS	2
+
+#define PCAPNG_EPB_FLAG_INBOUND		0x1
+#define PCAPNG_EPB_FLAG_OUTBOUND	0x2
+
+#define LINKTYPE_ETHERNET	1
+#define LINKTYPE_USER0		147
+
+struct trace_frame {
+	gint64 timestamp;
+	guint32 length;
+	guint16 caplen;
+	guint8 direction;
+};
+
+struct trace_ring {
+	GMutex lock;
+	struct trace_frame *frames;
+	guint8 *data;
+	guint head;
+	guint count;
+};
+
+struct trace {
+	struct trace_ring rings[TRACE_SOURCE_MAX];
+	guint num_frames;
+	guint snaplen;
+	gchar *filename;
+};
+
+static const struct {
+	const gchar *name;
+	guint16 linktype;
+} trace_sources[TRACE_SOURCE_MAX] = {
+	[TRACE_SOURCE_MEDIAL] = { "medial", LINKTYPE_USER0 + 0 },
+	[TRACE_SOURCE_LCD] = { "lcd", LINKTYPE_USER0 + 1 },
+	[TRACE_SOURCE_IRKEY] = { "irkey", LINKTYPE_USER0 + 2 },
+	[TRACE_SOURCE_SMARTCARD] = { "smartcard", LINKTYPE_USER0 + 3 },
+	[TRACE_SOURCE_LLDP] = { "lldp", LINKTYPE_ETHERNET },
+};
+
+/*
+ * Process wide, so that callers don't need to carry a handle around. The
+ * lock keeps the trace from going away while frames are recorded or
+ * dumped, the ring locks serialize access to the rings themselves.
+ */
+static struct trace *trace = NULL;
+static GRWLock trace_lock;
+
+int trace_init(GKeyFile *config)
+{
+	struct trace *t;
+	gint value;
+	guint i;
+
+	g_rw_lock_reader_lock(&trace_lock);
+	t = trace;
+	g_rw_lock_reader_unlock(&trace_lock);
+
+	if (t)
+		return -EBUSY;
+
+	t = g_new0(struct trace, 1);
+	if (!t)
+		return -ENOMEM;
+
+	t->num_frames = TRACE_DEFAULT_FRAMES;
+	t->snaplen = TRACE_DEFAULT_SNAPLEN;
+
+	if (g_key_file_has_key(config, "trace", "frames", NULL)) {
+		value = g_key_file_get_integer(config, "trace", "frames", NULL);
+		t->num_frames = MAX(value, 0);
+	}
+
+	value = g_key_file_get_integer(config, "trace", "snaplen", NULL);
+	if (value > 0)
+		t->snaplen = MIN(value, G_MAXUINT16);
+
+	t->filename = g_key_file_get_string(config, "trace", "file", NULL);
+	if (!t->filename)
+		t->filename = g_strdup(TRACE_DEFAULT_FILE);
+
+	if (t->num_frames == 0) {
+		g_debug("trace: disabled");
+		g_free(t->filename);
+		g_free(t);
+		return 0;
+	}
+
+	for (i = 0; i < TRACE_SOURCE_MAX; i++) {
+		struct trace_ring *ring = &t->rings[i];
+
+		g_mutex_init(&ring->lock);
+		ring->frames = g_new0(struct trace_frame, t->num_frames);
+		ring->data = g_malloc0(t->num_frames * t->snaplen);
+	}
+
+	g_debug("trace: %u frames of %u bytes per source", t->num_frames,
+		t->snaplen);
+
+	g_rw_lock_writer_lock(&trace_lock);
+	trace = t;
+	g_rw_lock_writer_unlock(&trace_lock);
+
+	return 0;
+}
+
+void trace_exit(void)
+{
+	struct trace *t;
+	guint i;
+
+	/* waits for writers still recording, later ones see no trace */
+	g_rw_lock_writer_lock(&trace_lock);
+	t = trace;
+	trace = NULL;
+	g_rw_lock_writer_unlock(&trace_lock);
+
+	if (!t)
+		return;
+
+	for (i = 0; i < TRACE_SOURCE_MAX; i++) {
+		struct trace_ring *ring = &t->rings[i];
+
+		g_mutex_clear(&ring->lock);
+		g_free(ring->frames);
+		g_free(ring->data);
+	}
+
+	g_free(t->filename);
+	g_free(t);
+}
+
+/*
+ * Called on the hot path of the protocol implementations, so nothing but a
+ * copy of the raw frame is done here. Formatting is left to whoever reads
+ * the dump.
+ */
+void trace_record(enum trace_source source, enum trace_direction direction,
+		const void *data, size_t size)
+{
+	struct trace_frame *frame;
+	struct trace_ring *ring;
+	size_t caplen;
+
+	if (source >= TRACE_SOURCE_MAX || !data || !size)
+		return;
+
+	g_rw_lock_reader_lock(&trace_lock);
+
+	if (!trace) {
+		g_rw_lock_reader_unlock(&trace_lock);
+		return;
+	}
+
+	caplen = MIN(size, trace->snaplen);
+	ring = &trace->rings[source];
+
+	g_mutex_lock(&ring->lock);
+
+	/* taken with the lock held, so that each ring is in time order */
+	frame = &ring->frames[ring->head];
+	frame->timestamp = g_get_real_time();
+	frame->length = size;
+	frame->caplen = caplen;
+	frame->direction = direction;
+	memcpy(ring->data + ring->head * trace->snaplen, data, caplen);
+
+	ring->head = (ring->head + 1) % trace->num_frames;
+	if (ring->count < trace->num_frames)
+		ring->count++;
+
+	g_mutex_unlock(&ring->lock);
+	g_rw_lock_reader_unlock(&trace_lock);
+}
+
+static void pcapng_append_u16(GByteArray *buffer, guint16 value)
+{
+	g_byte_array_append(buffer, (const guint8 *)&value, sizeof(value));
+}
+
+static void pcapng_append_u32(GByteArray *buffer, guint32 value)
+{
+	g_byte_array_append(buffer, (const guint8 *)&value, sizeof(value));
+}
+
+static void pcapng_append_padded(GByteArray *buffer, const void *data,
+		gsize size)
+{
+	static const guint8 padding[3] = { 0 };
+
+	g_byte_array_append(buffer, data, size);
+	if (size % 4)
+		g_byte_array_append(buffer, padding, 4 - (size % 4));
+}
+
+/* block length is known only at the end, so patch it in afterwards */
+static void pcapng_finish_block(GByteArray *buffer, guint start)
+{
+	guint32 length = buffer->len - start + sizeof(guint32);
+
+	memcpy(buffer->data + start + sizeof(guint32), &length,
+		sizeof(length));
+	pcapng_append_u32(buffer, length);
+}
+
+static guint pcapng_start_block(GByteArray *buffer, guint32 type)
+{
+	guint start = buffer->len;
+
+	pcapng_append_u32(buffer, type);
+	pcapng_append_u32(buffer, 0);
+
+	return start;
+}
+
+static void pcapng_append_shb(GByteArray *buffer)
+{
+	guint start = pcapng_start_block(buffer, PCAPNG_BLOCK_SHB);
+
+	pcapng_append_u32(buffer, PCAPNG_BYTE_ORDER_MAGIC);
+	pcapng_append_u16(buffer, 1);
+	pcapng_append_u16(buffer, 0);
+	/* section length unknown */
+	pcapng_append_u32(buffer, 0xffffffff);
+	pcapng_append_u32(buffer, 0xffffffff);
+	pcapng_finish_block(buffer, start);
+}
+
+static void pcapng_append_idb(GByteArray *buffer, enum trace_source source,
+		guint snaplen)
+{
+	const gchar *name = trace_sources[source].name;
+	guint start = pcapng_start_block(buffer, PCAPNG_BLOCK_IDB);
+
+	pcapng_append_u16(buffer, trace_sources[source].linktype);
+	pcapng_append_u16(buffer, 0);
+	pcapng_append_u32(buffer, snaplen);
+	pcapng_append_u16(buffer, PCAPNG_OPT_IF_NAME);
+	pcapng_append_u16(buffer, strlen(name));
+	pcapng_append_padded(buffer, name, strlen(name));
+	pcapng_append_u16(buffer, PCAPNG_OPT_ENDOFOPT);
+	pcapng_append_u16(buffer, 0);
+	pcapng_finish_block(buffer, start);
+}
+
+static void pcapng_append_epb(GByteArray *buffer, guint32 interface,
+		const struct trace_frame *frame, const guint8 *data)
+{
+	guint start = pcapng_start_block(buffer, PCAPNG_BLOCK_EPB);
+	guint32 flags;
+
+	/* timestamps are in microseconds, the pcapng default resolution */
+	pcapng_append_u32(buffer, interface);
+	pcapng_append_u32(buffer, (guint64)frame->timestamp >> 32);
+	pcapng_append_u32(buffer, (guint64)frame->timestamp & 0xffffffff);
+	pcapng_append_u32(buffer, frame->caplen);
+	pcapng_append_u32(buffer, frame->length);
+	pcapng_append_padded(buffer, data, frame->caplen);
+
+	if (frame->direction == TRACE_DIRECTION_OUT)
+		flags = PCAPNG_EPB_FLAG_OUTBOUND;
+	else
+		flags = PCAPNG_EPB_FLAG_INBOUND;
+
+	pcapng_append_u16(buffer, PCAPNG_OPT_EPB_FLAGS);
+	pcapng_append_u16(buffer, sizeof(flags));
+	pcapng_append_u32(buffer, flags);
+	pcapng_append_u16(buffer, PCAPNG_OPT_ENDOFOPT);
+	pcapng_append_u16(buffer, 0);
+	pcapng_finish_block(buffer, start);
+}
+
+/*
+ * Each ring is in time order already, so the frames of all sources are
+ * merged by timestamp. The rings are locked in ascending order, while
+ * trace_record() only ever holds one of them.
+ */
+static void trace_append_frames(GByteArray *buffer, struct trace *t)
+{
+	guint slot[TRACE_SOURCE_MAX], left[TRACE_SOURCE_MAX];
+	guint i, next;
+
+	for (i = 0; i < TRACE_SOURCE_MAX; i++) {
+		struct trace_ring *ring = &t->rings[i];
+
+		g_mutex_lock(&ring->lock);
+
+		slot[i] = (ring->head + t->num_frames - ring->count) %
+			t->num_frames;
+		left[i] = ring->count;
+	}
+
+	while (TRUE) {
+		next = TRACE_SOURCE_MAX;
+
+		for (i = 0; i < TRACE_SOURCE_MAX; i++) {
+			if (!left[i])
+				continue;
+
+			if (next == TRACE_SOURCE_MAX ||
+			    t->rings[i].frames[slot[i]].timestamp <
+			    t->rings[next].frames[slot[next]].timestamp)
+				next = i;
+		}
+
+		if (next == TRACE_SOURCE_MAX)
+			break;
+
+		pcapng_append_epb(buffer, next,
+			&t->rings[next].frames[slot[next]],
+			t->rings[next].data + slot[next] * t->snaplen);
+
+		slot[next] = (slot[next] + 1) % t->num_frames;
+		left[next]--;
+	}
+
+	for (i = TRACE_SOURCE_MAX; i > 0; i--)
+		g_mutex_unlock(&t->rings[i - 1].lock);
+}
+
+int trace_dump(const char *filename)
+{
+	GError *error = NULL;
+	GByteArray *buffer;
+	gchar *path;
+	gboolean ret;
+	guint i;
+
+	g_rw_lock_reader_lock(&trace_lock);
+
+	if (!trace) {
+		g_rw_lock_reader_unlock(&trace_lock);
+		return -ENODEV;
+	}
+
+	path = g_strdup(filename ? filename : trace->filename);
+
+	buffer = g_byte_array_new();
+	pcapng_append_shb(buffer);
+
+	/* one interface per source, the interface ID is the source */
+	for (i = 0; i < TRACE_SOURCE_MAX; i++)
+		pcapng_append_idb(buffer, i, trace->snaplen);
+
+	trace_append_frames(buffer, trace);
+
+	g_rw_lock_reader_unlock(&trace_lock);
+
+	ret = g_file_set_contents(path, (const gchar *)buffer->data,
+			buffer->len, &error);
+	g_byte_array_free(buffer, TRUE);
+
+	if (!ret) {
+		g_warning("trace: failed to write %s: %s", path,
+			error->message);
+		g_error_free(error);
+		g_free(path);
+		return -EIO;
+	}
+
+	g_debug("trace: dumped to %s", path);
+	g_free(path);
+	return 0;
+}
@@ -10,26 +10,29 @@
 #  include "config.h"
 #endif
 
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-
 #include <glib.h>
+#include <gudev/gudev.h>
 
 #include "remote-control.h"
 
-#include "find-device.h"
-
 #include <linux/input.h>
 
+#define USB_HANDSET_NAME "BurrBrown from Texas Instruments USB AUDIO  CODEC"
+
+/*
+ * The handset may be plugged in and out at any time. Its input devices are
+ * followed by the evdev layer, and whenever a sound card comes or goes the
+ * audio routing is updated, so that the handset is usable without a restart.
+ */
 struct usb_handset {
-	GSource source;
-	GList *devices;
+	struct evdev_subscription *input;
+	unsigned int num_devices;
 	struct event_manager *events;
+	struct remote_control *rc;
+	GUdevClient *udev;
 };
 
-static int event_is_hook(struct input_event *event)
+static int event_is_hook(const struct input_event *event)
 {
 	if (event->type == EV_KEY && event->code == KEY_MUTE)
 		return 1;
@@ -40,7 +43,8 @@ static int event_is_hook(struct input_event *event)
 	return 0;
 }
 
-static int usb_handset_report(struct usb_handset *input, struct input_event *in_event)
+static int usb_handset_report(struct usb_handset *input,
+		const struct input_event *in_event)
 {
 	struct event event;
 	ssize_t err;
@@ -63,149 +67,139 @@ static int usb_handset_report(struct usb_handset *input, struct input_event *in_
 	return 0;
 }
 
-static gboolean usb_handset_prepare(GSource *source, gint *timeout)
+static void usb_handset_report_connection(struct usb_handset *input,
+		enum event_usb_handset_state state)
 {
-	if (timeout)
-		*timeout = -1;
+	struct event event;
+	int err;
 
-	return FALSE;
+	memset(&event, 0, sizeof(event));
+	event.source = EVENT_SOURCE_USB_HANDSET;
+	event.usb_handset.state = state;
+
+	err = event_manager_report(input->events, &event);
+	if (err < 0)
+		g_debug("usb-handset: failed to report event: %s",
+			g_strerror(-err));
 }
 
-static gboolean usb_handset_check(GSource *source)
+static void usb_handset_event(void *data, struct evdev_device *device,
+		const struct input_event *event)
 {
-	struct usb_handset *input = (struct usb_handset *)source;
-	GList *node;
-
-	for (node = g_list_first(input->devices); node; node = node->next) {
-		GPollFD *poll = node->data;
+	struct usb_handset *input = data;
+	int err;
 
-		if (poll->revents & G_IO_IN)
-			return TRUE;
-	}
-
-	return FALSE;
+	err = usb_handset_report(input, event);
+	if (err < 0)
+		g_debug("usb-handset: input_report(): %s", g_strerror(-err));
 }
 
-static gboolean usb_handset_dispatch(GSource *source, GSourceFunc callback,
-		gpointer user_data)
+static void usb_handset_presence(void *data, struct evdev_device *device,
+		bool present)
 {
-	struct usb_handset *input = (struct usb_handset *)source;
-	GList *node = g_list_first(input->devices);
-
-	while (node != NULL) {
-		GPollFD *poll = node->data;
-		GList *next = node->next;
-		struct input_event event;
-		ssize_t err;
-
-		if (poll->revents & G_IO_IN) {
-			err = read(poll->fd, &event, sizeof(event));
-			if (err < 0) {
-				int e = errno;
-				g_debug("usb-handset: read(): %s", g_strerror(e));
-				if (e == ENODEV) {
-					g_source_remove_poll(source, poll);
-					input->devices = g_list_delete_link(
-							input->devices, node);
-				}
-			} else {
-				err = usb_handset_report(input, &event);
-				if (err < 0) {
-					g_debug("usb-handset: input_report(): %s",
-							g_strerror(-err));
-				}
-			}
-		}
-		node = next;
+	struct usb_handset *input = data;
+
+	g_debug("usb-handset: %s %s", evdev_device_get_node(device),
+		present ? "added" : "removed");
+
+	if (present) {
+		if (input->num_devices++ == 0)
+			usb_handset_report_connection(input,
+				EVENT_USB_HANDSET_STATE_CONNECTED);
+	} else if (input->num_devices > 0) {
+		if (--input->num_devices == 0)
+			usb_handset_report_connection(input,
+				EVENT_USB_HANDSET_STATE_DISCONNECTED);
 	}
-
-	if (callback)
-		return callback(user_data);
-
-	return TRUE;
 }
 
-static void free_poll(gpointer data)
+static void usb_handset_uevent(GUdevClient *client, const gchar *action,
+		GUdevDevice *udevice, gpointer user_data)
 {
-	GPollFD *poll = data;
-	close(poll->fd);
-	g_free(poll);
-}
+	struct usb_handset *input = user_data;
+	int err;
 
-static void usb_handset_finalize(GSource *source)
-{
-	struct usb_handset *input = (struct usb_handset *)source;
+	/* every card has exactly one control device */
+	if (g_strcmp0(action, "add") != 0 && g_strcmp0(action, "remove") != 0)
+		return;
 
-	g_list_free_full(input->devices, free_poll);
-}
+	if (!g_str_has_prefix(g_udev_device_get_name(udevice), "controlC"))
+		return;
 
-static GSourceFuncs input_source_funcs = {
-	.prepare = usb_handset_prepare,
-	.check = usb_handset_check,
-	.dispatch = usb_handset_dispatch,
-	.finalize = usb_handset_finalize,
-};
+	g_debug("usb-handset: sound card %s %s",
+		g_udev_device_get_name(udevice), action);
 
-static int usb_handset_add_device(gpointer user, const gchar *filename,
-		const char *name, const int productId, const int vendorId)
-{
-	struct usb_handset *input = user;
-	GPollFD *poll;
-	int fd;
+	err = audio_reload_cards(remote_control_get_audio(input->rc));
+	if (err < 0 && err != -ENOSYS)
+		g_warning("usb-handset: failed to reload sound cards: %s",
+			  g_strerror(-err));
+}
 
-	g_return_val_if_fail(input != NULL, -EINVAL);
-	g_return_val_if_fail(filename != NULL, -EINVAL);
+int usb_handset_create(struct usb_handset **handsetp,
+		struct remote_control *rc)
+{
+	const gchar *const subsystems[] = { "sound", NULL };
+	struct evdev_filter filter = {
+		.device = USB_HANDSET_NAME,
+		.types = (1UL << EV_KEY) | (1UL << EV_SW),
+		.event = usb_handset_event,
+		.presence = usb_handset_presence,
+	};
+	struct usb_handset *input;
+	int err;
 
-	fd = open(filename, O_RDONLY);
-	if (fd < 0)
-		return -errno;
+	if (!handsetp)
+		return -EINVAL;
 
-	poll = g_new0(GPollFD, 1);
-	if (!poll) {
-		close(fd);
+	input = g_new0(struct usb_handset, 1);
+	if (!input)
 		return -ENOMEM;
-	}
 
-	poll->events = G_IO_IN | G_IO_HUP | G_IO_ERR;
-	poll->fd = fd;
+	input->events = remote_control_get_event_manager(rc);
+	input->rc = rc;
+
+	input->udev = g_udev_client_new(subsystems);
+	if (input->udev)
+		g_signal_connect(input->udev, "uevent",
+				 G_CALLBACK(usb_handset_uevent), input);
+	else
+		g_warning("usb-handset: failed to create udev client");
+
+	filter.data = input;
 
-	input->devices = g_list_append(input->devices, poll);
-	g_source_add_poll((GSource *)input, poll);
+	err = evdev_subscribe(&filter, &input->input);
+	if (err < 0)
+		g_warning("usb-handset: failed to watch input devices: %s",
+			  g_strerror(-err));
 
+	*handsetp = input;
 	return 0;
 }
 
-static GSource *usb_handset_new(struct remote_control *rc)
+static gboolean usb_handset_release(gpointer data)
 {
-	struct usb_handset *input;
-	GSource *source;
+	struct usb_handset *input = data;
 
-	source = g_source_new(&input_source_funcs, sizeof(*input));
-	if (!source) {
-		g_debug("usb-handset: failed to allocate memory");
-		return NULL;
-	}
+	evdev_unsubscribe(input->input);
 
-	input = (struct usb_handset *)source;
-	input->events = remote_control_get_event_manager(rc);
-	input->devices = NULL;
-
-	find_input_devices("BurrBrown from Texas Instruments USB AUDIO  CODEC",
-			   usb_handset_add_device, input);
+	if (input->udev) {
+		g_signal_handlers_disconnect_by_data(input->udev, input);
+		g_object_unref(input->udev);
+	}
 
-	return source;
+	g_free(input);
+	return FALSE;
 }
 
-int usb_handset_create(struct remote_control *rc)
+/*
+ * The evdev callbacks run from the default main context, which may be in
+ * the middle of one right now, so the handset is released from there.
+ */
+int usb_handset_free(struct usb_handset *input)
 {
-	GSource *source;
-
-	source = usb_handset_new(rc);
-	if (!source)
-		return -ENOMEM;
-
-	g_source_attach(source, NULL);
-	g_source_unref(source);
+	if (!input)
+		return -EINVAL;
 
+	g_main_context_invoke(NULL, usb_handset_release, input);
 	return 0;
 }
@@ -719,11 +719,29 @@ int voip_dial(struct voip *voip, uint8_t dtmf)
 	return 0;
 }
 
+/*
+ * linphone only knows the sound cards present when it was started, so a
+ * card that has been plugged in since, like the USB handset, is looked for
+ * again before giving up on it.
+ */
+static void voip_find_sound_device(struct voip *voip, const char *card_name)
+{
+	if (linphone_core_sound_device_can_playback(voip->core, card_name) ||
+	    linphone_core_sound_device_can_capture(voip->core, card_name))
+		return;
+
+	g_debug("voip-linphone: %s unknown, reloading sound devices",
+		card_name);
+	linphone_core_reload_sound_devices(voip->core);
+}
+
 int voip_set_playback(struct voip *voip, const char *card_name)
 {
 	if (!voip)
 		return -EINVAL;
 
+	voip_find_sound_device(voip, card_name);
+
 	int err = linphone_core_set_playback_device(voip->core, card_name);
 	if (err < 0)
 		g_warning("voip-linphone: failed to set playback device");
@@ -737,6 +755,8 @@ int voip_set_capture(struct voip *voip, const char *card_name)
 	if (!voip)
 		return -EINVAL;
 
+	voip_find_sound_device(voip, card_name);
+
 	int err = linphone_core_set_capture_device(voip->core, card_name);
 	if (err < 0)
 		g_warning("voip-linphone: failed to set capture device");
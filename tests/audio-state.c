@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2017 Avionic Design GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "remote-control.h"
+
+#define DEFAULT_ITERATIONS 20
+
+static const char *state_names[] = {
+	[AUDIO_STATE_INACTIVE] = "idle",
+	[AUDIO_STATE_HIFI_PLAYBACK_SPEAKER] = "hifi-speaker",
+	[AUDIO_STATE_HIFI_PLAYBACK_HEADSET] = "hifi-headset",
+	[AUDIO_STATE_VOICECALL_HANDSET] = "call-handset",
+	[AUDIO_STATE_VOICECALL_HEADSET] = "call-headset",
+	[AUDIO_STATE_VOICECALL_SPEAKER] = "call-speaker",
+	[AUDIO_STATE_VOICECALL_IP_HANDSET] = "voip-handset",
+	[AUDIO_STATE_VOICECALL_IP_HEADSET] = "voip-headset",
+	[AUDIO_STATE_VOICECALL_IP_SPEAKER] = "voip-speaker",
+	[AUDIO_STATE_LINEIN_SPEAKER] = "linein-speaker",
+	[AUDIO_STATE_LINEIN_HEADSET] = "linein-headset",
+};
+
+/* ringing, picking up the handset, going hands-free and hanging up */
+static const enum audio_state default_states[] = {
+	AUDIO_STATE_HIFI_PLAYBACK_SPEAKER,
+	AUDIO_STATE_VOICECALL_IP_HANDSET,
+	AUDIO_STATE_VOICECALL_IP_SPEAKER,
+	AUDIO_STATE_HIFI_PLAYBACK_SPEAKER,
+	AUDIO_STATE_INACTIVE,
+};
+
+struct transition {
+	enum audio_state from;
+	enum audio_state to;
+	gint64 min;
+	gint64 max;
+	gint64 total;
+};
+
+static int parse_state(const char *name, enum audio_state *statep)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(state_names); i++) {
+		if (strcmp(state_names[i], name) == 0) {
+			*statep = i;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * Measures the latency of audio_set_state(), e.g.:
+ *
+ *   audio-state 20 hifi-speaker voip-handset idle
+ *
+ * cycles through the given states, or a typical call if none are given.
+ */
+int main(int argc, char *argv[])
+{
+	guint iterations = DEFAULT_ITERATIONS;
+	enum audio_state *states;
+	struct transition *transitions;
+	struct audio *audio = NULL;
+	GKeyFile *config;
+	guint num, i, j;
+	int err;
+
+	if (argc > 1)
+		iterations = strtoul(argv[1], NULL, 0);
+
+	if (argc > 2) {
+		num = argc - 2;
+		states = g_new(enum audio_state, num);
+
+		for (i = 0; i < num; i++) {
+			if (parse_state(argv[i + 2], &states[i]) < 0) {
+				g_printerr("unknown state: %s\n", argv[i + 2]);
+				return 1;
+			}
+		}
+	} else {
+		num = G_N_ELEMENTS(default_states);
+		states = g_memdup(default_states, sizeof(default_states));
+	}
+
+	config = g_key_file_new();
+
+	err = audio_create(&audio, NULL, config);
+	if (err < 0) {
+		g_printerr("audio_create(): %s\n", g_strerror(-err));
+		return 1;
+	}
+
+	transitions = g_new0(struct transition, num);
+
+	for (i = 0; i < num; i++) {
+		transitions[i].from = states[(i + num - 1) % num];
+		transitions[i].to = states[i];
+		transitions[i].min = G_MAXINT64;
+	}
+
+	/* start from the last state, so that the first switch is a real one */
+	audio_set_state(audio, states[num - 1]);
+
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < num; j++) {
+			struct transition *t = &transitions[j];
+			gint64 start, elapsed;
+
+			start = g_get_monotonic_time();
+			err = audio_set_state(audio, t->to);
+			elapsed = g_get_monotonic_time() - start;
+
+			if (err < 0) {
+				g_printerr("audio_set_state(%s): %s\n",
+					   state_names[t->to],
+					   g_strerror(-err));
+				audio_free(audio);
+				return 1;
+			}
+
+			t->min = MIN(t->min, elapsed);
+			t->max = MAX(t->max, elapsed);
+			t->total += elapsed;
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		struct transition *t = &transitions[i];
+
+		g_print("%-14s -> %-14s min %6" G_GINT64_FORMAT " us, avg %6"
+			G_GINT64_FORMAT " us, max %6" G_GINT64_FORMAT " us\n",
+			state_names[t->from], state_names[t->to], t->min,
+			t->total / MAX(iterations, 1), t->max);
+	}
+
+	audio_free(audio);
+	g_key_file_free(config);
+	g_free(transitions);
+	g_free(states);
+
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2017 Avionic Design GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include "gsysfs.h"
+
+#define DEFAULT_ITERATIONS 100000
+
+/*
+ * Writes the same attribute the way g_sysfs_write_uint() does, which opens
+ * and closes the file for every value.
+ */
+static gboolean write_fopen(const gchar *filename, guint value)
+{
+	FILE *fp;
+	int err;
+
+	fp = fopen(filename, "w");
+	if (!fp)
+		return FALSE;
+
+	err = fprintf(fp, "%u", value);
+	fclose(fp);
+
+	return err > 0;
+}
+
+static void report(const gchar *name, guint iterations, gint64 elapsed)
+{
+	g_print("%-10s %u writes in %" G_GINT64_FORMAT " us, %.0f writes/s\n",
+		name, iterations, elapsed, iterations * 1000000.0 /
+		MAX(elapsed, 1));
+}
+
+/*
+ * Microbenchmark for sysfs attribute writes, e.g.:
+ *
+ *   sysfs-attribute /sys/class/backlight/backlight.0/brightness 100000 255
+ *
+ * alternates between 0 and the given maximum value.
+ */
+int main(int argc, char *argv[])
+{
+	guint iterations = DEFAULT_ITERATIONS;
+	GSysfsAttribute *attribute;
+	GError *error = NULL;
+	guint max = 1, i;
+	gint64 start;
+
+	if (argc < 2) {
+		g_printerr("usage: %s filename [iterations] [max]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc > 2)
+		iterations = strtoul(argv[2], NULL, 0);
+
+	if (argc > 3)
+		max = strtoul(argv[3], NULL, 0);
+
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < iterations; i++) {
+		if (!write_fopen(argv[1], (i & 1) ? max : 0)) {
+			g_printerr("fopen: write failed\n");
+			return 1;
+		}
+	}
+
+	report("fopen", iterations, g_get_monotonic_time() - start);
+
+	attribute = g_sysfs_attribute_new_for_path(argv[1]);
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < iterations; i++) {
+		if (!g_sysfs_attribute_write_uint(attribute, (i & 1) ? max : 0,
+						  &error)) {
+			g_printerr("attribute: %s\n", error->message);
+			g_error_free(error);
+			g_sysfs_attribute_free(attribute);
+			return 1;
+		}
+	}
+
+	report("attribute", iterations, g_get_monotonic_time() - start);
+	g_sysfs_attribute_free(attribute);
+
+	return 0;
+}